@@ -0,0 +1,503 @@
+// Benchmarks for the solver.
+//
+// Micro-benchmarks time the operations the solver does most often, and
+// macro-benchmarks solve the canned act 1 fights with the starting deck of
+// each character.  Only the fights which solve in seconds run unless
+// --macro=all is given.  Each result is printed as one JSON line:
+//
+// {"name": "micro/node_play_card", "time_s": 0.5, "ops": 1234567, "ns_per_op": 405.0, "peak_rss_kb": 5120}
+// {"name": "macro/ironclad/cultist", "time_s": 0.35, "nodes": 91234, "nodes_per_s": 260668, "final_hp": 66.96875, "death_chance": 0, "peak_rss_kb": 65536}
+//
+// Results saved with --output can be given as --baseline to a later run,
+// which then reports each benchmark which got slower by more than
+// --max_regression (as a fraction) and each fight whose final HP changed,
+// and exits with status 1 if there were any.
+//
+// Example usage:
+//   bench_the_spire --output=baseline.jsonl
+//   bench_the_spire --baseline=baseline.jsonl
+//   bench_the_spire --filter=macro/ironclad --max_regression=0.2
+//   bench_the_spire --filter=micro --micro_time=2
+//   bench_the_spire --macro=all --filter=macro/silent
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+#ifdef __linux__
+#include <malloc.h>
+#endif
+
+#include "defines.h"
+#include "presets.hpp"
+#include "node.hpp"
+#include "fight.hpp"
+#include "tree.hpp"
+#include "jobs.hpp"
+
+// result of a benchmark
+struct BenchResult {
+    // name, such as "micro/node_play_card" or "macro/ironclad/cultist"
+    std::string name;
+    // true for a fight solve
+    bool macro = false;
+    // wall clock time
+    double time_s = 0.0;
+    // number of operations timed (micro) or nodes created (macro)
+    uint64_t count = 0;
+    // expected final hp (macro)
+    double final_hp = 0.0;
+    // chance of dying (macro)
+    double death_chance = 0.0;
+    // peak resident set size while running, in kB (or 0 if unknown)
+    uint64_t peak_rss_kb = 0;
+    // time spent in each phase of the solve (macro, with USE_PROFILER)
+    ProfileCounters profile;
+    // return the value compared against the baseline (lower is better)
+    double GetCost() const {
+        return macro ? time_s : time_s * 1e9 / count;
+    }
+    // return the result as a JSON line
+    std::string ToJson() const {
+        char buffer[256];
+        std::string line = "{\"name\": " + ToJsonString(name) + ", ";
+        if (macro) {
+            snprintf(buffer, sizeof(buffer),
+                "\"time_s\": %.6g, \"nodes\": %llu, \"nodes_per_s\": %.6g, "
+                "\"final_hp\": %.10g, \"death_chance\": %.10g, ",
+                time_s, (unsigned long long) count, count / time_s,
+                final_hp, death_chance);
+        } else {
+            snprintf(buffer, sizeof(buffer),
+                "\"time_s\": %.6g, \"ops\": %llu, \"ns_per_op\": %.6g, ",
+                time_s, (unsigned long long) count, GetCost());
+        }
+        line += buffer;
+        if (!profile.IsEmpty()) {
+            line += "\"profile\": {";
+            for (int i = 0; i < kProfileFinal; ++i) {
+                snprintf(buffer, sizeof(buffer), "%s\"%s\": %.4f",
+                    i == 0 ? "" : ", ",
+                    profile_phase_name[i],
+                    profile.GetFraction((ProfilePhaseEnum) i));
+                line += buffer;
+            }
+            line += "}, ";
+        }
+        snprintf(buffer, sizeof(buffer), "\"peak_rss_kb\": %llu}",
+            (unsigned long long) peak_rss_kb);
+        return line + buffer;
+    }
+};
+
+// minimum time to spend on each micro-benchmark
+double micro_time_s = 0.5;
+
+// only run benchmarks whose name contains this
+std::string bench_filter;
+
+// true to solve every fight for every character instead of the quick ones
+// (the others take from minutes to hours each)
+bool run_all_fights = false;
+
+// macro-benchmarks run unless run_all_fights is set
+std::vector<std::string> quick_fight_names = {
+    "macro/ironclad/cultist",
+    "macro/ironclad/two_louses",
+    "macro/ironclad/blue_slaver",
+    "macro/ironclad/gremlin_nob",
+};
+
+// file to write results to (if any)
+std::string output_filename;
+
+// file with results to compare against (if any)
+std::string baseline_filename;
+
+// slowdown, as a fraction, above which a benchmark counts as a regression
+double max_regression = 0.10;
+
+// written to by micro-benchmarks so their work isn't optimized away
+volatile uint64_t bench_sink = 0;
+
+// reset the peak resident set size, if supported
+// (only Linux can reset it, otherwise the peak is over the whole process)
+void ResetPeakRSS() {
+#ifdef __linux__
+    // (return memory freed by earlier benchmarks, so it isn't counted)
+    malloc_trim(0);
+    FILE * file = fopen("/proc/self/clear_refs", "w");
+    if (file != nullptr) {
+        fputs("5", file);
+        fclose(file);
+    }
+#endif
+}
+
+// return the peak resident set size in kB, or 0 if unknown
+uint64_t GetPeakRSS() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize / 1024;
+#else
+#ifdef __linux__
+    // (VmHWM is reset by ResetPeakRSS, unlike ru_maxrss)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmHWM:", 0) == 0) {
+            return strtoull(line.c_str() + 6, nullptr, 10);
+        }
+    }
+#endif
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+// return the name in lowercase with spaces replaced by underscores
+std::string GetBenchName(const std::string & name) {
+    std::string result;
+    for (auto c : name) {
+        result += c == ' ' ? '_' : (char) tolower(c);
+    }
+    return result;
+}
+
+// return true if the benchmark with the given name should run
+bool IsSelected(const std::string & name) {
+    return name.find(bench_filter) != std::string::npos;
+}
+
+// time an operation by calling it repeatedly for at least micro_time_s
+template <class Operation>
+BenchResult RunMicroBenchmark(const std::string & name, Operation operation) {
+    BenchResult result;
+    result.name = name;
+    ResetPeakRSS();
+    // (the first calls fill caches, as they would early in a solve)
+    for (int i = 0; i < 16; ++i) {
+        operation();
+    }
+    const auto start = std::chrono::steady_clock::now();
+    uint64_t batch = 1;
+    while (true) {
+        for (uint64_t i = 0; i < batch; ++i) {
+            operation();
+        }
+        result.count += batch;
+        result.time_s = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        if (result.time_s >= micro_time_s) {
+            break;
+        }
+        if (batch < 1024) {
+            batch *= 2;
+        }
+    }
+    result.peak_rss_kb = GetPeakRSS();
+    return result;
+}
+
+// return an ironclad node at the start of its first turn against a jaw worm
+// (the hand is 3 strikes, a defend and bash)
+Node GetBenchNode() {
+    Node node;
+    node.hp = 72;
+    node.max_hp = 80;
+    node.relics = {0};
+    node.InitializeStartingNode();
+    node.PopPendingAction();
+    node.PopPendingAction();
+    node.draw_pile.RemoveCard(card_strike, 3);
+    node.draw_pile.RemoveCard(card_defend, 1);
+    node.draw_pile.RemoveCard(card_bash, 1);
+    node.hand.AddCard(card_strike, 3);
+    node.hand.AddCard(card_defend, 1);
+    node.hand.AddCard(card_bash, 1);
+    node.turn = 1;
+    node.energy = 3;
+    node.monster[0] = base_mob_jaw_worm;
+    node.monster[0].last_intent[0] = 0;
+    return node;
+}
+
+// run the micro-benchmarks
+void RunMicroBenchmarks(std::vector<BenchResult> & result) {
+    NodeShared::deck = deck_map["starting_ironclad_cursed"];
+    const Node base_node = GetBenchNode();
+    const CardCollectionPtr deck = NodeShared::deck;
+    auto run = [&](const std::string & name, auto operation) {
+        if (IsSelected(name)) {
+            result.push_back(RunMicroBenchmark(name, operation));
+            printf("%s\n", result.back().ToJson().c_str());
+            fflush(stdout);
+        }
+    };
+    // (links between collections are cached, so these measure the lookup
+    // the solver does for almost every card moved)
+    run("micro/card_collection_add_card", [&]() {
+        CardCollectionPtr collection = deck;
+        collection.AddCard(card_strike);
+        bench_sink = bench_sink + collection.Count();
+    });
+    run("micro/card_collection_remove_card", [&]() {
+        CardCollectionPtr collection = deck;
+        collection.RemoveCard(card_strike);
+        bench_sink = bench_sink + collection.Count();
+    });
+    // (selections are cached per collection as well)
+    run("micro/card_collection_select", [&]() {
+        bench_sink = bench_sink + deck.Select(5)->size();
+    });
+    // (includes copying the node, as the solver does for each child)
+    run("micro/node_play_card", [&]() {
+        Node node = base_node;
+        node.hand.RemoveCard(card_bash);
+        node.PlayCard(card_bash.GetIndex(), 0);
+        bench_sink = bench_sink + node.energy;
+    });
+    run("micro/node_end_turn", [&]() {
+        Node node = base_node;
+        node.EndTurn();
+        bench_sink = bench_sink + node.hp;
+    });
+    run("micro/node_is_worse_or_equal", [&]() {
+        Node node = base_node;
+        node.hp -= 1;
+        bench_sink = bench_sink + node.IsWorseOrEqual(base_node);
+    });
+    // (includes creating and deleting the children)
+    run("micro/tree_find_player_choices", [&]() {
+        Node node = base_node;
+        TreeStruct tree(node);
+        tree.quiet = true;
+        tree.FindPlayerChoices(node);
+        bench_sink = bench_sink + node.child.size();
+    });
+    NodeShared::deck.Clear();
+}
+
+// solve a fight with the starting deck of a character
+BenchResult RunMacroBenchmark(
+        const std::string & name,
+        const CharacterType & character,
+        FightEnum fight_type) {
+    BenchResult result;
+    result.name = name;
+    result.macro = true;
+    ResetPeakRSS();
+    {
+        // (each fight is solved in its own context so memory doesn't grow
+        // from fight to fight)
+        SolverContext context;
+        SolverContextScope scope(context);
+        NodeShared::deck.Clear();
+        NodeShared::deck.AddDeck(deck_map[character.deck]);
+        Node top_node;
+        top_node.max_hp = character.max_hp;
+        top_node.hp = top_node.max_hp * 9 / 10;
+        top_node.relics = {0};
+        for (auto & item : relic_map) {
+            if (GetBenchName(item.first) == character.relics) {
+                top_node.relics += item.second;
+            }
+        }
+        top_node.InitializeStartingNode();
+        TreeStruct tree(top_node);
+        tree.fight_type = fight_type;
+        tree.quiet = true;
+        const auto start = std::chrono::steady_clock::now();
+        tree.ExpandFight();
+        result.time_s = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        result.count = tree.created_node_count + tree.reused_node_count;
+        result.final_hp = tree.final_hp;
+        result.death_chance = tree.death_chance;
+        result.profile = tree.profile;
+    }
+    NodeShared::deck.Clear();
+    result.peak_rss_kb = GetPeakRSS();
+    return result;
+}
+
+// run the macro-benchmarks
+void RunMacroBenchmarks(std::vector<BenchResult> & result) {
+    const FightEnum fight[] = {
+        kFightAct1EasyCultist,
+        kFightAct1EasyJawWorm,
+        kFightAct1EasyLouses,
+        kFightAct1BlueSlaver,
+        kFightAct1EliteGremlinNob,
+        kFightAct1EliteLagavulin,
+    };
+    for (auto & item : character_map) {
+#ifndef USE_ORBS
+        // (orbs aren't simulated, so defect fights can't be solved)
+        if (item.first == "defect") {
+            continue;
+        }
+#endif
+        for (auto fight_type : fight) {
+            const std::string name = "macro/" + item.first + "/" +
+                GetBenchName(fight_map[fight_type].name);
+            if (!IsSelected(name)) {
+                continue;
+            }
+            if (!run_all_fights &&
+                    std::find(
+                        quick_fight_names.begin(),
+                        quick_fight_names.end(),
+                        name) == quick_fight_names.end()) {
+                continue;
+            }
+            result.push_back(RunMacroBenchmark(name, item.second, fight_type));
+            printf("%s\n", result.back().ToJson().c_str());
+            fflush(stdout);
+        }
+    }
+}
+
+// compare results against a baseline file, return the number of problems
+int CompareToBaseline(const std::vector<BenchResult> & result, std::string filename) {
+    std::ifstream file(filename);
+    if (!file.good()) {
+        printf("ERROR: could not open %s\n", filename.c_str());
+        exit(1);
+    }
+    std::map<std::string, JsonObject> baseline;
+    std::string line;
+    while (std::getline(file, line)) {
+        JsonObject object;
+        if (line.empty() || !ParseJsonObject(line, object) ||
+                object.find("name") == object.end()) {
+            continue;
+        }
+        baseline[object["name"]] = object;
+    }
+    int problem_count = 0;
+    printf("\nComparison to %s:\n", filename.c_str());
+    for (const auto & this_result : result) {
+        auto it = baseline.find(this_result.name);
+        if (it == baseline.end()) {
+            printf("%-40s (not in baseline)\n", this_result.name.c_str());
+            continue;
+        }
+        const JsonObject & object = it->second;
+        const char * key = this_result.macro ? "time_s" : "ns_per_op";
+        if (object.find(key) == object.end()) {
+            printf("%-40s (no %s in baseline)\n", this_result.name.c_str(), key);
+            continue;
+        }
+        const double old_cost = atof(object.at(key).c_str());
+        const double new_cost = this_result.GetCost();
+        const double change = old_cost > 0.0 ? new_cost / old_cost - 1.0 : 0.0;
+        const bool regressed = change > max_regression;
+        printf("%-40s %10.4g -> %10.4g %s (%+.1f%%)%s\n",
+            this_result.name.c_str(), old_cost, new_cost,
+            this_result.macro ? "s " : "ns", change * 100.0,
+            regressed ? "  REGRESSION" : "");
+        if (regressed) {
+            ++problem_count;
+        }
+        // (a solve is deterministic, so any change in the result is a bug)
+        if (this_result.macro && object.find("final_hp") != object.end()) {
+            const double old_hp = atof(object.at("final_hp").c_str());
+            if (std::fabs(old_hp - this_result.final_hp) > 1e-6) {
+                printf("%-40s final HP changed from %.10g to %.10g  MISMATCH\n",
+                    this_result.name.c_str(), old_hp, this_result.final_hp);
+                ++problem_count;
+            }
+        }
+    }
+    return problem_count;
+}
+
+// process a command line argument, return true if successful
+bool ProcessArgument(const std::string & argument) {
+    if (argument.rfind("--", 0) != 0 || argument.find('=') == std::string::npos) {
+        return false;
+    }
+    const std::string name = argument.substr(2, argument.find('=') - 2);
+    const std::string value = argument.substr(argument.find('=') + 1);
+    if (name == "filter") {
+        bench_filter = value;
+    } else if (name == "output") {
+        output_filename = value;
+    } else if (name == "baseline") {
+        baseline_filename = value;
+    } else if (name == "max_regression") {
+        max_regression = atof(value.c_str());
+    } else if (name == "macro") {
+        if (value == "quick") {
+            run_all_fights = false;
+        } else if (value == "all") {
+            run_all_fights = true;
+        } else {
+            return false;
+        }
+    } else if (name == "micro_time") {
+        micro_time_s = atof(value.c_str());
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// entry point
+int main(int argc, char ** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (!ProcessArgument(argv[i])) {
+            printf("ERROR: could not process argument %s\n", argv[i]);
+            exit(1);
+        }
+    }
+    PopulateDecks();
+    std::vector<BenchResult> result;
+    RunMicroBenchmarks(result);
+    RunMacroBenchmarks(result);
+    if (result.empty()) {
+        printf("ERROR: no benchmarks match \"%s\"\n", bench_filter.c_str());
+        exit(1);
+    }
+    if (!output_filename.empty()) {
+        FILE * file = fopen(output_filename.c_str(), "w");
+        if (file == nullptr) {
+            printf("ERROR: could not open %s\n", output_filename.c_str());
+            exit(1);
+        }
+        for (const auto & this_result : result) {
+            fprintf(file, "%s\n", this_result.ToJson().c_str());
+        }
+        fclose(file);
+    }
+    if (!baseline_filename.empty() &&
+            CompareToBaseline(result, baseline_filename) > 0) {
+        exit(1);
+    }
+    return 0;
+}
@@ -115,6 +115,13 @@ enum ActionType : uint8_t {
     kUpgradeAllCardsInHand,
     // if the target is poisoned, do the next action (else skip it)
     kActionIfPoisoned,
+    // set block to a given amount
+    // first argument is block amount
+    kActionSetBlock,
+    // set a buff/debuff to a given amount
+    // first argument is buff type
+    // second argument is buff amount
+    kActionSetBuff,
 };
 
 // An action is a single event caused by a card such as damage, or a buff
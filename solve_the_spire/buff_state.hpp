@@ -67,6 +67,32 @@ const BuffType ambiguous_buffs[] = {
     kBuffCombustHpLoss,
 };
 
+// name of each buff/debuff (in BuffType order)
+const char * const buff_name[kBuffFinal] = {
+    "strength",
+    "dexterity",
+    "weak",
+    "frail",
+    "vulnerable",
+    "ritual",
+    "thorns",
+    "enrage",
+    "metallicize",
+    "curl_up",
+    "regenerate",
+    "strength_down",
+    "poison",
+    "rage",
+    "barricade",
+    "berserk",
+    "brutality",
+    "demon_form",
+    "noxious_fumes",
+    "no_draw",
+    "combust_hp_loss",
+    "combust_damage",
+};
+
 // number of stacks of each buff/debuff
 struct BuffState {
     int16_t value[kBuffFinal];
@@ -2,40 +2,257 @@
 
 #include <set>
 #include <vector>
+#include <mutex>
+#include <atomic>
 
 #include "defines.h"
 #include "cards.hpp"
 #include "card_collection.hpp"
+#include "memory.hpp"
+
+// table of pointers by card index which may be read and set from any thread
+// (slots are allocated in blocks as they are needed, lookups never lock, and
+// a slot never changes once it is set)
+template <class T>
+struct AtomicPointerTable {
+    // number of slots per block
+    static constexpr std::size_t block_size = 32;
+    // number of blocks
+    static constexpr std::size_t block_count = 256 / block_size;
+    // block of slots
+    struct Block {
+        std::atomic<T *> item[block_size];
+        // allocate a block, counting it towards tracked memory
+        static void * operator new(std::size_t size) {
+            TrackMemory(kMemoryCardCollections, (int64_t) size);
+            return ::operator new(size);
+        }
+        // free a block
+        static void operator delete(void * ptr, std::size_t size) {
+            TrackMemory(kMemoryCardCollections, -(int64_t) size);
+            ::operator delete(ptr);
+        }
+    };
+    // blocks, or nullptr if not needed yet
+    mutable std::atomic<Block *> block[block_count];
+    // constructor
+    AtomicPointerTable() {
+        for (auto & this_block : block) {
+            this_block.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+    // destructor
+    ~AtomicPointerTable() {
+        for (auto & this_block : block) {
+            delete this_block.load(std::memory_order_relaxed);
+        }
+    }
+    // return the pointer at the given index, or nullptr if not set
+    T * Get(std::size_t index) const {
+        const Block * this_block =
+            block[index / block_size].load(std::memory_order_acquire);
+        if (this_block == nullptr) {
+            return nullptr;
+        }
+        return this_block->item[index % block_size].load(std::memory_order_acquire);
+    }
+    // delete the items pointed to
+    void DeleteItems() {
+        for (auto & this_block : block) {
+            Block * block_ptr = this_block.load(std::memory_order_relaxed);
+            if (block_ptr == nullptr) {
+                continue;
+            }
+            for (auto & item : block_ptr->item) {
+                delete item.exchange(nullptr, std::memory_order_relaxed);
+            }
+        }
+    }
+    // set the pointer at the given index unless it's already set, and return
+    // the pointer at that index
+    T * Set(std::size_t index, T * value) const {
+        auto & this_block_ptr = block[index / block_size];
+        Block * this_block = this_block_ptr.load(std::memory_order_acquire);
+        if (this_block == nullptr) {
+            Block * new_block = new Block;
+            for (auto & item : new_block->item) {
+                item.store(nullptr, std::memory_order_relaxed);
+            }
+            if (this_block_ptr.compare_exchange_strong(
+                    this_block, new_block, std::memory_order_acq_rel)) {
+                this_block = new_block;
+            } else {
+                // another thread added it first
+                delete new_block;
+            }
+        }
+        T * expected = nullptr;
+        if (this_block->item[index % block_size].compare_exchange_strong(
+                expected, value, std::memory_order_acq_rel)) {
+            return value;
+        }
+        return expected;
+    }
+};
+
+struct CardCollectionPtr;
+
+struct SolverContext;
+
+// list of ways to select cards as (probability, cards_selected, cards_left)
+typedef std::vector<std::pair<double, std::pair<CardCollectionPtr, CardCollectionPtr>>,
+    TrackedAllocator<std::pair<double, std::pair<CardCollectionPtr, CardCollectionPtr>>,
+        kMemoryDrawCache>>
+    CardSelectionList;
 
 // holds a deck along with how to get to other nearby decks
 struct CardCollectionNode {
     // card collection itself
     CardCollection collection;
+    // context which owns this node
+    SolverContext * context;
     // new card collection node if we add a given card index
-    mutable std::vector<const CardCollectionNode *> add_card_node;
+    AtomicPointerTable<const CardCollectionNode> add_card_node;
     // new card collection node if we add a remove a card index
-    mutable std::vector<const CardCollectionNode *> remove_card_node;
+    AtomicPointerTable<const CardCollectionNode> remove_card_node;
+    // cached results of selecting a given number of cards
+    AtomicPointerTable<CardSelectionList> selection;
+    // constructor
+    CardCollectionNode(const CardCollection & collection_, SolverContext * context_) :
+            collection(collection_),
+            context(context_) {
+        TrackMemory(kMemoryCardCollections, GetMemoryUsage());
+    }
+    // destructor
+    ~CardCollectionNode() {
+        selection.DeleteItems();
+        TrackMemory(kMemoryCardCollections, -GetMemoryUsage());
+    }
+    // return the bytes this node and its cards take up
+    // (counting the links of the set node holding it, but not its tables,
+    // which are counted as they're allocated)
+    int64_t GetMemoryUsage() const {
+        return (int64_t) (sizeof(*this) + 4 * sizeof(void *) +
+            collection.card.capacity() * sizeof(deck_item_t));
+    }
     // comparison
     bool operator < (const CardCollectionNode & that) const {
         return collection < that.collection;
     };
+    // comparison against a collection
+    bool operator < (const CardCollection & that) const {
+        return collection < that;
+    };
+    // comparison against a collection
+    friend bool operator < (
+            const CardCollection & one,
+            const CardCollectionNode & two) {
+        return one < two.collection;
+    };
+};
+
+// part of the set of all card collections
+struct CardCollectionShard {
+    // guards collection
+    std::mutex mutex;
+    // card collections in this shard
+    std::set<CardCollectionNode, std::less<>> collection;
+};
+
+// A SolverContext owns all card collections made in it, along with the links
+// between them and their cached draws.  Collections only grow while a context
+// lives, and destroying it frees them all, so a long-running process can solve
+// in a fresh context each time and keep its memory flat.
+//
+// Each thread works in its own current context (the default context unless
+// a SolverContextScope says otherwise).  Adding or removing a card stays in
+// the context of the collection it started from, so collections from
+// different contexts should not be mixed.
+struct SolverContext {
+    // number of shards the set of all collections is split into
+    static constexpr std::size_t shard_count = 64;
+    // set of all card collections, split into shards
+    CardCollectionShard deck_collection[shard_count];
+    // empty card collection
+    CardCollectionNode empty_node;
+    // constructor
+    SolverContext() : empty_node(CardCollection(), this) {
+    }
+    // return the hash of a collection, used to pick its shard
+    static std::size_t Hash(const CardCollection & collection) {
+        std::size_t hash = 0;
+        for (const auto & item : collection.card) {
+            hash = hash * 31 + item.first * 7 + item.second;
+        }
+        return hash;
+    }
+    // return the node holding the given collection, creating it if necessary
+    const CardCollectionNode * Intern(const CardCollection & collection) {
+        CardCollectionShard & shard =
+            deck_collection[Hash(collection) % shard_count];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.collection.find(collection);
+        if (it == shard.collection.end()) {
+            it = shard.collection.emplace(collection, this).first;
+        }
+        return &*it;
+    }
+    // return the number of collections in this context
+    std::size_t CountCollections() {
+        std::size_t count = 0;
+        for (auto & shard : deck_collection) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            count += shard.collection.size();
+        }
+        return count;
+    }
+};
+
+// context used by threads with no context set
+SolverContext default_solver_context;
+
+// context of this thread (or nullptr for the default context)
+thread_local SolverContext * current_solver_context = nullptr;
+
+// return the context of this thread
+SolverContext & GetSolverContext() {
+    if (current_solver_context == nullptr) {
+        return default_solver_context;
+    }
+    return *current_solver_context;
+}
+
+// sets the context of this thread until it goes out of scope
+struct SolverContextScope {
+    // context to restore
+    SolverContext * previous_context;
+    // constructor
+    SolverContextScope(SolverContext & context) :
+            previous_context(current_solver_context) {
+        current_solver_context = &context;
+    }
+    // destructor
+    ~SolverContextScope() {
+        current_solver_context = previous_context;
+    }
 };
 
 // card collection pointer acts like a card collection but with massive optimizations
 // for comparing and adding/removing cards
+//
+// Collections may be added to and removed from in any number of threads at
+// once.  Links between collections are read without locking.  When a link is
+// missing, the new collection is found or created in one shard of the set of
+// all collections in its context, which is the only place a lock is held.
 struct CardCollectionPtr {
-    // set of all current card collections
-    static std::set<CardCollectionNode> deck_collection;
-    // empty card collection
-    static CardCollectionNode empty_node;
     // pointer to card collection node
     const CardCollectionNode * node_ptr;
     // clear the deck
     void Clear() {
-        node_ptr = &empty_node;
+        node_ptr = &GetSolverContext().empty_node;
     }
     // default constructor
-    CardCollectionPtr() : node_ptr(&empty_node) {
+    CardCollectionPtr() : node_ptr(&GetSolverContext().empty_node) {
     }
     // comparison
     bool operator == (const CardCollectionPtr & that) const {
@@ -56,45 +273,23 @@ struct CardCollectionPtr {
     }
     // return true if pile is empty
     bool IsEmpty() const {
-        return node_ptr == &empty_node;
+        return node_ptr->collection.total == 0;
     }
     // add a card
     void AddCard(card_index_t index) {
         // see if it's calculated already
-        if (node_ptr->add_card_node.size() > index) {
-            if (node_ptr->add_card_node[index] != nullptr) {
-                node_ptr = node_ptr->add_card_node[index];
-                return;
-            }
-        } else {
-            node_ptr->add_card_node.resize((std::size_t) index + 1, nullptr);
-        }
-        // create new collection
-        CardCollectionNode node = {
-            node_ptr->collection,
-            std::vector<const CardCollectionNode *>(),
-            std::vector<const CardCollectionNode *>()};
-        node.collection.AddCard(index);
-        // see if it exists
-        auto it = deck_collection.find(node);
-        if (it == deck_collection.end()) {
-            // doesn't exist, so create a new entry and add it
-            auto result = deck_collection.insert(node);
-            const CardCollectionNode * new_node_ptr = &*result.first;
-            node_ptr->add_card_node[index] = new_node_ptr;
-            new_node_ptr->remove_card_node.resize((std::size_t) index + 1, nullptr);
-            new_node_ptr->remove_card_node[index] = node_ptr;
-            node_ptr = new_node_ptr;
-        } else {
-            // already exists, so just update add/remove pointers
-            const CardCollectionNode * new_node_ptr = &*it;
-            node_ptr->add_card_node[index] = new_node_ptr;
-            if (new_node_ptr->remove_card_node.size() <= index) {
-                new_node_ptr->remove_card_node.resize((std::size_t) index + 1, nullptr);
-            }
-            new_node_ptr->remove_card_node[index] = node_ptr;
+        const CardCollectionNode * new_node_ptr = node_ptr->add_card_node.Get(index);
+        if (new_node_ptr != nullptr) {
             node_ptr = new_node_ptr;
+            return;
         }
+        // find or create the new collection and link them
+        CardCollection collection = node_ptr->collection;
+        collection.AddCard(index);
+        new_node_ptr = node_ptr->context->Intern(collection);
+        node_ptr->add_card_node.Set(index, new_node_ptr);
+        new_node_ptr->remove_card_node.Set(index, node_ptr);
+        node_ptr = new_node_ptr;
     }
     void AddCard(card_index_t index, card_count_t count) {
         for (card_count_t i = 0; i < count; ++i) {
@@ -114,44 +309,22 @@ struct CardCollectionPtr {
         // if only one card, set it to the empty deck
         assert(CountCard(index) > 0);
         if (node_ptr->collection.total == 1) {
-            node_ptr = &empty_node;
+            node_ptr = &node_ptr->context->empty_node;
             return;
         }
         // see if it's calculated already
-        if (node_ptr->remove_card_node.size() > index) {
-            if (node_ptr->remove_card_node[index] != nullptr) {
-                node_ptr = node_ptr->remove_card_node[index];
-                return;
-            }
-        } else {
-            node_ptr->remove_card_node.resize((std::size_t) index + 1, nullptr);
-        }
-        // create new collection
-        CardCollectionNode node = {
-            node_ptr->collection,
-            std::vector<const CardCollectionNode *>(),
-            std::vector<const CardCollectionNode *>()};
-        node.collection.RemoveCard(index);
-        // see if it exists
-        auto it = deck_collection.find(node);
-        if (it == deck_collection.end()) {
-            // doesn't exist, so create a new entry and add it
-            auto result = deck_collection.insert(node);
-            const CardCollectionNode * new_node_ptr = &*result.first;
-            node_ptr->remove_card_node[index] = new_node_ptr;
-            new_node_ptr->add_card_node.resize((std::size_t) index + 1, nullptr);
-            new_node_ptr->add_card_node[index] = node_ptr;
-            node_ptr = new_node_ptr;
-        } else {
-            // already exists, so just update add/remove pointers
-            const CardCollectionNode * new_node_ptr = &*it;
-            node_ptr->remove_card_node[index] = new_node_ptr;
-            if (new_node_ptr->add_card_node.size() <= index) {
-                new_node_ptr->add_card_node.resize((std::size_t) index + 1, nullptr);
-            }
-            new_node_ptr->add_card_node[index] = node_ptr;
+        const CardCollectionNode * new_node_ptr = node_ptr->remove_card_node.Get(index);
+        if (new_node_ptr != nullptr) {
             node_ptr = new_node_ptr;
+            return;
         }
+        // find or create the new collection and link them
+        CardCollection collection = node_ptr->collection;
+        collection.RemoveCard(index);
+        new_node_ptr = node_ptr->context->Intern(collection);
+        node_ptr->remove_card_node.Set(index, new_node_ptr);
+        new_node_ptr->add_card_node.Set(index, node_ptr);
+        node_ptr = new_node_ptr;
     }
     void RemoveCard(card_index_t index, card_count_t count) {
         for (card_count_t i = 0; i < count; ++i) {
@@ -169,7 +342,9 @@ struct CardCollectionPtr {
     // add an entire deck
     void AddDeck(const CardCollectionPtr & that) {
         // if this is empty, just set the pointer to the other deck
-        if (IsEmpty()) {
+        // (unless it's from another context, whose collections would then
+        // get linked to ones in this context)
+        if (IsEmpty() && that.node_ptr->context == node_ptr->context) {
             *this = that;
             return;
         }
@@ -279,22 +454,15 @@ struct CardCollectionPtr {
     }
     // return all combination of selecting X cards at random without replacement
     // results are returned as (probability, cards_selected, cards_left)
-    std::vector<std::pair<double, std::pair<CardCollectionPtr, CardCollectionPtr>>> *
-            Select(card_count_t count) const {
-        // cache results
-        static std::map<const std::pair<const CardCollectionNode * const, card_count_t>, std::vector<std::pair<double, std::pair<CardCollectionPtr, CardCollectionPtr>>> *>
-            selection_cache;
+    CardSelectionList * Select(card_count_t count) const {
         // look for cached result
-        const std::pair<const CardCollectionNode * const, card_count_t>
-            key(node_ptr, count);
-        auto it = selection_cache.find(key);
-        if (it != selection_cache.end()) {
-            return it->second;
+        CardSelectionList * cached_result = node_ptr->selection.Get(count);
+        if (cached_result != nullptr) {
+            return cached_result;
         }
         // hold results
         const auto & card = node_ptr->collection.card;
-        std::vector<std::pair<double, std::pair<CardCollectionPtr, CardCollectionPtr>>> * result;
-        result = new std::vector<std::pair<double, std::pair<CardCollectionPtr, CardCollectionPtr>>>();
+        CardSelectionList * result = new CardSelectionList();
         card_count_t unique_card_count = (card_count_t) card.size();
         // get number of cards
         card_count_t card_count = node_ptr->collection.total;
@@ -393,9 +561,13 @@ struct CardCollectionPtr {
         // sort by lease probable first
         std::sort(result->begin(), result->end(), LeastProbableSort);
         // cache result
-        selection_cache[key] = result;
+        // (if another thread got here first, use its result instead)
+        cached_result = node_ptr->selection.Set(count, result);
+        if (cached_result != result) {
+            delete result;
+        }
         // return result
-        return result;
+        return cached_result;
     }
     // return the max damage we can do with this hand against a single target
     // (this is allowed to underestimate the amount of damage done)
@@ -433,9 +605,3 @@ struct CardCollectionPtr {
         return damage;
     }
 };
-
-// empty card collection
-CardCollectionNode CardCollectionPtr::empty_node;
-
-// set of all current card collections
-std::set<CardCollectionNode> CardCollectionPtr::deck_collection;
@@ -1,9 +1,14 @@
 #pragma once
 
+#include <cstdio>
+#include <cstdlib>
 #include <cstdint>
 #include <cassert>
 #include <vector>
+#include <array>
 #include <string>
+#include <mutex>
+#include <atomic>
 
 #include "defines.h"
 #include "orbs.hpp"
@@ -14,7 +19,15 @@ struct Card;
 
 // list of all cards in use
 // map between card index and card
-std::vector<const Card *> card_map;
+// (a fixed array, so adding a card never moves the existing entries)
+std::array<const Card *, 256> card_map = {};
+
+// number of entries in card_map
+// (entries below this count never change, so they may be read without a lock)
+std::atomic<std::size_t> card_map_count(0);
+
+// guards additions to card_map
+std::mutex card_map_mutex;
 
 // list of card flags
 struct CardFlagStruct {
@@ -77,16 +90,32 @@ struct Card {
     // list of actions
     Action action[MAX_CARD_ACTIONS];
     // card index
+    // (cards may be added while solving in multiple threads, and entries
+    // already in card_map never change)
     uint8_t GetIndex() const {
-        for (std::size_t i = 0; i < card_map.size(); ++i) {
+        // look for an existing index
+        const std::size_t count = card_map_count.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < count; ++i) {
+            if (card_map[i] == this) {
+                return (uint8_t) i;
+            }
+        }
+        std::lock_guard<std::mutex> lock(card_map_mutex);
+        // another thread may have added it
+        const std::size_t new_count = card_map_count.load(std::memory_order_relaxed);
+        for (std::size_t i = count; i < new_count; ++i) {
             if (card_map[i] == this) {
                 return (uint8_t) i;
             }
         }
         // add new card
-        assert(card_map.size() < 256);
-        card_map.push_back(this);
-        return (uint8_t) (card_map.size() - 1);
+        if (new_count == card_map.size()) {
+            printf("ERROR: too many cards\n");
+            exit(1);
+        }
+        card_map[new_count] = this;
+        card_map_count.store(new_count + 1, std::memory_order_release);
+        return (uint8_t) new_count;
     }
     // constructor
     Card(std::string name_, uint8_t base_cost_, uint8_t cost_, const Card * upgraded_version_,
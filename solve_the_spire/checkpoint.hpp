@@ -0,0 +1,404 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+#include "defines.h"
+#include "card_collection_map.hpp"
+#include "monster.hpp"
+#include "node.hpp"
+#include "subgame_memo.hpp"
+#include "wire_format.hpp"
+#include "trace.hpp"
+
+// A checkpoint holds a solve in progress so that it can be resumed after the
+// process stops.  It holds the tree, the nodes waiting to be expanded, the
+// terminal and recalled nodes and the solve counters.  Cards, piles and mobs
+// are written once to tables which nodes refer to by index, and nodes are
+// written in depth first order with their number of children.
+//
+// On Linux, checkpoints are written by a forked copy of the process, so the
+// solver only pauses for the fork.  A new checkpoint is skipped while the
+// last one is still being written.  Checkpoints are written to a temporary
+// file which then replaces the old checkpoint, so a crash while writing
+// leaves the last checkpoint alone.
+
+template <unsigned int mob_slots>
+struct BasicTreeStruct;
+
+// writes cards and mobs as indices into tables, and piles as indices into a
+// table of the piles in the tree
+struct CheckpointNameWriter {
+    // index of each pile in the pile table
+    std::unordered_map<const CardCollectionNode *, uint32_t> pile_index;
+    // piles in the order they're written to the table
+    std::vector<CardCollectionPtr> pile;
+    // add a pile to the table if it's not there yet
+    void AddPile(const CardCollectionPtr & this_pile) {
+        if (pile_index.emplace(this_pile.node_ptr, (uint32_t) pile.size()).second) {
+            pile.push_back(this_pile);
+        }
+    }
+    // write a card (cards are indexed by card_map)
+    void WriteCard(WireWriter & out, card_index_t index) {
+        out.Put(index);
+    }
+    // write a pile
+    void WritePile(WireWriter & out, const CardCollectionPtr & this_pile) {
+        out.Put(pile_index.at(this_pile.node_ptr));
+    }
+    // write a mob (0 for none, else 1 + its index in all_base_mobs)
+    void WriteMob(WireWriter & out, const BaseMonster * base) {
+        uint8_t index = 0;
+        for (std::size_t i = 0; base != nullptr && i < all_base_mobs.size(); ++i) {
+            if (all_base_mobs[i] == base) {
+                index = (uint8_t) (i + 1);
+            }
+        }
+        out.Put(index);
+    }
+    // write the card, mob and pile tables
+    void WriteTables(WireWriter & out) {
+        const std::size_t card_count = card_map_count.load();
+        out.Put((uint16_t) card_count);
+        for (std::size_t i = 0; i < card_count; ++i) {
+            out.PutString(card_map[i]->name);
+        }
+        out.Put((uint8_t) all_base_mobs.size());
+        for (const BaseMonster * base : all_base_mobs) {
+            out.PutString(base->name);
+        }
+        out.Put((uint32_t) pile.size());
+        for (const auto & this_pile : pile) {
+            uint16_t count = 0;
+            for (const auto & deck_item : this_pile) {
+                (void) deck_item;
+                ++count;
+            }
+            out.Put(count);
+            for (const auto & deck_item : this_pile) {
+                out.Put(deck_item.first);
+                out.Put(deck_item.second);
+            }
+        }
+    }
+};
+
+// reads cards, piles and mobs written by CheckpointNameWriter
+struct CheckpointNameReader {
+    // index in this process of each card in the card table
+    std::vector<card_index_t> card_index;
+    // each mob in the mob table
+    std::vector<const BaseMonster *> mob;
+    // each pile in the pile table
+    std::vector<CardCollectionPtr> pile;
+    // read a card, return true if successful
+    bool ReadCard(WireReader & in, card_index_t & index) {
+        const card_index_t table_index = in.Get<card_index_t>();
+        if (!in.good || table_index >= card_index.size()) {
+            return false;
+        }
+        index = card_index[table_index];
+        return true;
+    }
+    // read a pile, return true if successful
+    bool ReadPile(WireReader & in, CardCollectionPtr & this_pile) {
+        const uint32_t index = in.Get<uint32_t>();
+        if (!in.good || index >= pile.size()) {
+            return false;
+        }
+        this_pile = pile[index];
+        return true;
+    }
+    // read a mob, return true if successful
+    bool ReadMob(WireReader & in, const BaseMonster * & base) {
+        const uint8_t index = in.Get<uint8_t>();
+        if (!in.good || index > mob.size()) {
+            return false;
+        }
+        base = (index == 0) ? nullptr : mob[index - 1];
+        return true;
+    }
+    // read the card, mob and pile tables, return true if successful
+    bool ReadTables(WireReader & in) {
+        card_index.resize(in.Get<uint16_t>());
+        for (auto & index : card_index) {
+            const Card * card = GetCardByName(in.GetString());
+            if (!in.good || card == nullptr) {
+                return false;
+            }
+            index = card->GetIndex();
+        }
+        mob.resize(in.Get<uint8_t>());
+        for (auto & base : mob) {
+            base = GetBaseMobByName(in.GetString());
+            if (!in.good || base == nullptr) {
+                return false;
+            }
+        }
+        pile.resize(in.Get<uint32_t>());
+        for (auto & this_pile : pile) {
+            this_pile.Clear();
+            const uint16_t count = in.Get<uint16_t>();
+            for (uint16_t i = 0; in.good && i < count; ++i) {
+                card_index_t index = 0;
+                if (!ReadCard(in, index)) {
+                    return false;
+                }
+                this_pile.AddCard(index, in.Get<card_count_t>());
+            }
+        }
+        return in.good;
+    }
+};
+
+// write a checkpoint of the tree, return true if successful
+template <unsigned int mob_slots>
+bool WriteCheckpoint(const BasicTreeStruct<mob_slots> & tree, std::string filename) {
+    typedef BasicNode<mob_slots> Node;
+    // list nodes in depth first order
+    std::vector<const Node *> node;
+    std::unordered_map<const Node *, uint32_t> node_index;
+    std::vector<const Node *> stack(1, tree.top_node_ptr);
+    while (!stack.empty()) {
+        const Node * node_ptr = stack.back();
+        stack.pop_back();
+        node_index[node_ptr] = (uint32_t) node.size();
+        node.push_back(node_ptr);
+        for (auto it = node_ptr->child.rbegin(); it != node_ptr->child.rend(); ++it) {
+            stack.push_back(*it);
+        }
+    }
+    CheckpointNameWriter names;
+    names.AddPile(NodeShared::deck);
+    for (const Node * node_ptr : node) {
+        names.AddPile(node_ptr->hand);
+        names.AddPile(node_ptr->draw_pile);
+        names.AddPile(node_ptr->discard_pile);
+        names.AddPile(node_ptr->exhaust_pile);
+    }
+    std::string temp_filename = filename + ".tmp";
+    FILE * file = fopen(temp_filename.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    WireWriter out;
+    out.file = file;
+    out.data.append("STSCKPT", 8);
+    out.Put((uint32_t) solve_cache_version);
+    out.Put((uint8_t) mob_slots);
+    out.Put(tree.fight_type);
+    out.Put((uint8_t) tree.keep_all_nodes);
+    out.Put((uint8_t) tree.generate_all_mob_hp);
+    out.Put((uint8_t) NodeShared::last_card_attack_matters);
+    out.Put((uint8_t) NodeShared::last_card_skill_matters);
+    out.Put((uint64_t) tree.created_node_count);
+    out.Put((uint64_t) tree.reused_node_count);
+    out.Put((uint64_t) tree.expanded_node_count);
+    out.Put(tree.solve_duration_s);
+    names.WriteTables(out);
+    names.WritePile(out, NodeShared::deck);
+    out.Put((uint32_t) node.size());
+    for (const Node * node_ptr : node) {
+        WriteNode(out, *node_ptr, names);
+        out.Put(node_ptr->objective);
+        out.Put(node_ptr->probability);
+        out.Put(node_ptr->parent_decision.type);
+        if (node_ptr->parent_decision.type == kDecisionPlayCard) {
+            names.WriteCard(out, (card_index_t) node_ptr->parent_decision.argument[0]);
+        } else {
+            out.Put(node_ptr->parent_decision.argument[0]);
+        }
+        out.Put(node_ptr->parent_decision.argument[1]);
+        out.Put((uint32_t) node_ptr->child.size());
+    }
+    // nodes waiting to be expanded, in order
+    out.Put((uint32_t) tree.optional_nodes.size());
+    for (const Node * node_ptr : tree.optional_nodes) {
+        out.Put(node_index.at(node_ptr));
+    }
+    out.Put((uint32_t) tree.terminal_nodes.size());
+    for (const Node * node_ptr : tree.terminal_nodes) {
+        out.Put(node_index.at(node_ptr));
+    }
+    out.Put((uint32_t) tree.recalled_nodes.size());
+    for (const auto & item : tree.recalled_nodes) {
+        out.Put(node_index.at(item.first));
+        out.Put(item.second);
+    }
+    out.Flush();
+    if (fclose(file) != 0 || out.failed) {
+        std::remove(temp_filename.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    std::remove(filename.c_str());
+#endif
+    return std::rename(temp_filename.c_str(), filename.c_str()) == 0;
+}
+
+#ifndef _WIN32
+// process writing the last checkpoint (or 0)
+pid_t checkpoint_writer_pid = 0;
+#endif
+
+// wait for the last checkpoint to be written
+void WaitForCheckpoint() {
+#ifndef _WIN32
+    if (checkpoint_writer_pid > 0) {
+        waitpid(checkpoint_writer_pid, nullptr, 0);
+        checkpoint_writer_pid = 0;
+    }
+#endif
+}
+
+// write a checkpoint of the tree without stopping the solve for long
+// (does nothing if the last checkpoint is still being written)
+template <unsigned int mob_slots>
+void WriteCheckpointInBackground(
+        const BasicTreeStruct<mob_slots> & tree,
+        const std::string & filename) {
+    TraceScope trace_scope("write_checkpoint");
+#ifdef _WIN32
+    if (!WriteCheckpoint(tree, filename)) {
+        printf("Note: could not write checkpoint %s\n", filename.c_str());
+    }
+#else
+    if (checkpoint_writer_pid > 0) {
+        if (waitpid(checkpoint_writer_pid, nullptr, WNOHANG) == 0) {
+            return;
+        }
+        checkpoint_writer_pid = 0;
+    }
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid == 0) {
+        _exit(WriteCheckpoint(tree, filename) ? 0 : 1);
+    }
+    if (pid < 0) {
+        if (!WriteCheckpoint(tree, filename)) {
+            printf("Note: could not write checkpoint %s\n", filename.c_str());
+        }
+        return;
+    }
+    checkpoint_writer_pid = pid;
+#endif
+}
+
+// read the header of a checkpoint, return true if it's a valid checkpoint
+bool ReadCheckpointHeader(WireReader & in, uint8_t & mob_slots) {
+    char magic[8];
+    for (auto & c : magic) {
+        c = in.Get<char>();
+    }
+    if (memcmp(magic, "STSCKPT", 8) != 0 ||
+            in.Get<uint32_t>() != solve_cache_version) {
+        return false;
+    }
+    mob_slots = in.Get<uint8_t>();
+    return in.good;
+}
+
+// read a checkpoint into an empty tree, return true if successful
+// (the tree then continues the solve when expanded)
+template <unsigned int mob_slots>
+bool ReadCheckpoint(WireReader & in, BasicTreeStruct<mob_slots> & tree) {
+    typedef BasicNode<mob_slots> Node;
+    uint8_t slots = 0;
+    if (!ReadCheckpointHeader(in, slots) || slots != mob_slots) {
+        return false;
+    }
+    tree.fight_type = in.Get<FightEnum>();
+    tree.keep_all_nodes = in.Get<uint8_t>() != 0;
+    tree.generate_all_mob_hp = in.Get<uint8_t>() != 0;
+    NodeShared::last_card_attack_matters = in.Get<uint8_t>() != 0;
+    NodeShared::last_card_skill_matters = in.Get<uint8_t>() != 0;
+    tree.created_node_count = (std::size_t) in.Get<uint64_t>();
+    tree.reused_node_count = (std::size_t) in.Get<uint64_t>();
+    tree.expanded_node_count = (std::size_t) in.Get<uint64_t>();
+    tree.solve_duration_s = in.Get<double>();
+    CheckpointNameReader names;
+    if (!names.ReadTables(in) || !names.ReadPile(in, NodeShared::deck)) {
+        return false;
+    }
+    // read nodes, attaching each to the closest node above it which is
+    // still missing children
+    std::vector<Node *> node(in.Get<uint32_t>(), nullptr);
+    std::vector<std::pair<Node *, uint32_t>> stack;
+    for (std::size_t i = 0; in.good && i < node.size(); ++i) {
+        Node * node_ptr = (i == 0) ? tree.top_node_ptr : new Node;
+        node[i] = node_ptr;
+        if (!ReadNode(in, *node_ptr, names)) {
+            return false;
+        }
+        node_ptr->objective = in.Get<double>();
+        node_ptr->probability = in.Get<double>();
+        node_ptr->parent_decision.type = in.Get<DecisionTypeEnum>();
+        if (node_ptr->parent_decision.type == kDecisionPlayCard) {
+            card_index_t index = 0;
+            if (!names.ReadCard(in, index)) {
+                return false;
+            }
+            node_ptr->parent_decision.argument[0] = index;
+        } else {
+            node_ptr->parent_decision.argument[0] = in.Get<uint16_t>();
+        }
+        node_ptr->parent_decision.argument[1] = in.Get<uint16_t>();
+        const uint32_t child_count = in.Get<uint32_t>();
+        while (!stack.empty() && stack.back().second == 0) {
+            stack.pop_back();
+        }
+        if (i > 0) {
+            if (stack.empty()) {
+                return false;
+            }
+            node_ptr->parent = stack.back().first;
+            node_ptr->parent->child.push_back(node_ptr);
+            --stack.back().second;
+        }
+        stack.push_back(std::make_pair(node_ptr, child_count));
+    }
+    if (!in.good || node.empty()) {
+        return false;
+    }
+    auto get_node = [&](uint32_t index) {
+        return index < node.size() ? node[index] : nullptr;
+    };
+    tree.optional_nodes.resize(in.Get<uint32_t>());
+    for (auto & node_ptr : tree.optional_nodes) {
+        node_ptr = get_node(in.Get<uint32_t>());
+        if (node_ptr == nullptr) {
+            return false;
+        }
+    }
+    tree.terminal_nodes.clear();
+    for (uint32_t i = in.Get<uint32_t>(); in.good && i > 0; --i) {
+        Node * node_ptr = get_node(in.Get<uint32_t>());
+        if (node_ptr == nullptr) {
+            return false;
+        }
+        tree.terminal_nodes.insert(node_ptr);
+    }
+    tree.recalled_nodes.clear();
+    for (uint32_t i = in.Get<uint32_t>(); in.good && i > 0; --i) {
+        Node * node_ptr = get_node(in.Get<uint32_t>());
+        const SubgameValue value = in.Get<SubgameValue>();
+        if (node_ptr == nullptr) {
+            return false;
+        }
+        tree.recalled_nodes[node_ptr] = value;
+    }
+    tree.resumed = in.good;
+    return in.good;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstdio>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+#include "node.hpp"
+#include "fight.hpp"
+#include "tree.hpp"
+
+// a variation of a fight to solve as part of a comparison
+struct CompareVariant {
+    // name printed for this variant
+    std::string name;
+    // starting node
+    Node top_node;
+};
+
+// return a starting node with the given deck
+// (the deck is shared by all nodes, so it's only used to fill the draw pile
+// and then restored, which lets variants with different decks be solved at
+// the same time)
+Node GetVariantStartingNode(const Node & top_node, const CardCollectionPtr & deck) {
+    const CardCollectionPtr original_deck = NodeShared::deck;
+    Node node = top_node;
+    node.child.clear();
+    NodeShared::deck = deck;
+    node.InitializeStartingNode();
+    NodeShared::deck = original_deck;
+    return node;
+}
+
+// solve each variant and write a line with its objective to the given file
+// (solves are split among threads, and each line is written as soon as its
+// solve finishes, so lines are in the order they finish; the first variant
+// is the base case which the others are compared against; returns the
+// objective of each variant)
+// (if generate_all_mob_hp is true, fights are solved with every mob HP)
+std::vector<double> RunComparison(
+        const std::vector<CompareVariant> & variant,
+        FightEnum fight_type,
+        std::string filename,
+        unsigned int thread_count,
+        bool generate_all_mob_hp = false) {
+    if (variant.empty()) {
+        return std::vector<double>();
+    }
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+    if (thread_count > variant.size()) {
+        thread_count = (unsigned int) variant.size();
+    }
+    printf("Solving %u variants using %u threads\n",
+        (unsigned int) variant.size(), thread_count);
+    FILE * file = fopen(filename.c_str(), "w");
+    if (file == nullptr) {
+        printf("ERROR: could not open %s\n", filename.c_str());
+        exit(1);
+    }
+    fprintf(file, "%s\n", variant[0].top_node.ToString().c_str());
+    fflush(file);
+    // next variant to solve
+    std::atomic<std::size_t> next_index(0);
+    // objective of each variant
+    std::vector<double> objective(variant.size(), 0.0);
+    // true if the base case is solved
+    bool base_solved = false;
+    // variants solved before the base case, which are written after it
+    std::vector<std::size_t> waiting;
+    // number of solves done
+    unsigned int solved_count = 0;
+    // guards the above and the file
+    std::mutex output_mutex;
+    // write the line for a solved variant
+    auto write_line = [&](std::size_t index) {
+        char buffer[64];
+        if (index == 0) {
+            snprintf(buffer, sizeof(buffer), "%g", objective[0]);
+        } else {
+            snprintf(buffer, sizeof(buffer), "%g (%+g)",
+                objective[index], objective[index] - objective[0]);
+        }
+        fprintf(file, "%s: %s\n", variant[index].name.c_str(), buffer);
+        fflush(file);
+        printf("- %s: %s (%u of %u)\n", variant[index].name.c_str(), buffer,
+            solved_count, (unsigned int) variant.size());
+    };
+    // workers use the context of this thread
+    SolverContext & context = GetSolverContext();
+    auto worker = [&]() {
+        SolverContextScope scope(context);
+        while (true) {
+            const std::size_t index = next_index.fetch_add(1);
+            if (index >= variant.size()) {
+                break;
+            }
+            Node top_node = variant[index].top_node;
+            TreeStruct tree(top_node);
+            tree.fight_type = fight_type;
+            tree.generate_all_mob_hp = generate_all_mob_hp;
+            tree.quiet = true;
+            tree.ExpandFight();
+            std::lock_guard<std::mutex> lock(output_mutex);
+            objective[index] = top_node.objective;
+            ++solved_count;
+            if (index == 0) {
+                base_solved = true;
+                write_line(0);
+                for (std::size_t i : waiting) {
+                    write_line(i);
+                }
+                waiting.clear();
+            } else if (base_solved) {
+                write_line(index);
+            } else {
+                waiting.push_back(index);
+            }
+        }
+    };
+    std::vector<std::thread> thread;
+    for (unsigned int i = 1; i < thread_count; ++i) {
+        thread.push_back(std::thread(worker));
+    }
+    worker();
+    for (auto & this_thread : thread) {
+        this_thread.join();
+    }
+    fclose(file);
+    printf("Comparison written to %s\n", filename.c_str());
+    return objective;
+}
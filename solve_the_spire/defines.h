@@ -3,11 +3,14 @@
 #include <cstdint>
 
 // max number of mobs per node
-constexpr unsigned int MAX_MOBS_PER_NODE = 2;
+constexpr unsigned int MAX_MOBS_PER_NODE = 5;
 
 // max number of mobs per node
 constexpr unsigned int MAX_PENDING_ACTIONS = 2;
 
+// max number of intents per mob
+constexpr unsigned int MAX_MOB_INTENTS = 3;
+
 // max number of actions per card
 constexpr unsigned int MAX_CARD_ACTIONS = 4;
 
@@ -20,11 +23,12 @@ constexpr bool print_around_pruning = false;
 // if true, use average HP values when generating mobs
 constexpr bool normalize_mob_variations = true;
 
-// if true, print completed tree to file
+// if true, write completed tree to tree.bin
+// (query it with --query=stats, --query=subtree or --query=path)
 constexpr bool print_completed_tree_to_file = true;
 
-// maximum nodes to print to file
-// (if tree is more than this many nodes, it will not be output to a file)
+// maximum nodes to print when querying a subtree of a tree file
+// (nodes past this many are cut off)
 constexpr unsigned int max_nodes_to_print = 800000;
 
 // if true, makes probably-better choices when Miracle is in hand
@@ -49,5 +53,53 @@ constexpr bool upgrades_strictly_better = true;
 // damage to the mob could be done
 constexpr bool always_avoid_dying = false;
 
-// when we reach this many nodes stored, stop storing the entire tree
-constexpr unsigned int max_nodes_to_store = 10000000;
+// when a tree holds this many bytes, stop storing the entire tree
+// (as estimated by BasicTreeStruct::GetTreeMemory, so that trees solved at
+// the same time don't affect each other)
+constexpr int64_t max_bytes_to_store = 3ll << 30;
+
+// max number of solved lane groups to remember when solving mob HP lanes
+// (once this is reached, new groups are no longer stored)
+constexpr unsigned int max_lane_memo_size = 2000000;
+
+// when solving mob HP lanes, fights lasting longer than this many turns are
+// given up on and solved by the tree instead
+constexpr unsigned int max_lane_turns = 30;
+
+// version of stored solve results
+// (increase this when a change to the solver changes results, so that old
+// results in the solve cache are no longer used)
+constexpr unsigned int solve_cache_version = 3;
+
+// when the subgame memo journal holds this many values (and at least a quarter
+// as many values as the table), it is merged into the table
+constexpr unsigned int min_subgame_memo_journal_size = 4096;
+
+// default seconds of solving between checkpoints of a solve
+constexpr double default_checkpoint_interval_s = 600.0;
+
+// maximum bytes of a tree stream waiting to be written before the solver
+// waits for the disk
+constexpr unsigned int max_tree_stream_queue_bytes = 64 << 20;
+
+// bytes of output buffered by the tree exporter between writes
+constexpr unsigned int export_buffer_size = 4 << 20;
+
+// average number of states per bucket of a policy table
+// (larger buckets make the table smaller but slower to build)
+constexpr unsigned int policy_keys_per_bucket = 4;
+
+// most solved decision states the solve server keeps between requests
+// (about 40 bytes each)
+constexpr unsigned int max_server_solved_states = 1 << 22;
+
+// bytes of memory changes a thread counts before adding them to the shared
+// account
+constexpr int64_t memory_flush_bytes = 64 << 10;
+
+// events each thread keeps in its trace buffer before overwriting the oldest
+// (24 bytes each, see trace.hpp)
+constexpr uint64_t trace_buffer_events = 1 << 18;
+
+// default shortest event in nanoseconds which is recorded in a trace
+constexpr uint64_t default_trace_min_duration_ns = 20000;
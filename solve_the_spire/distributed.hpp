@@ -0,0 +1,421 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+#include "defines.h"
+#include "presets.hpp"
+#include "card_collection_map.hpp"
+#include "monster.hpp"
+#include "node.hpp"
+#include "tree.hpp"
+#include "wire_format.hpp"
+
+// Distributed solving splits a fight between a coordinator and worker
+// processes.  The coordinator solves the first turn itself and cuts the tree
+// off at the start of the next turn.  Each cut off state is sent to a worker,
+// which solves it and sends back its value.  Until a state is solved, the
+// coordinator gives it its best possible value, so once a solve of the first
+// turn only reaches states with known values, it is exact.  Until then, the
+// states it reached are solved and the first turn is solved again.
+//
+// Workers read requests on stdin and write results to stdout, so a worker is
+// any command which runs "solve_the_spire --worker=on", whether it's a local
+// process or something like "ssh host ./solve_the_spire --worker=on".
+// States are sent in the wire format with cards and mobs named inline, so
+// workers must run the same build as the coordinator.
+//
+// (workers are only supported on Linux)
+
+// a request to solve a cut off state
+// (holds solve_cache_version, the number of mob slots to solve with, the
+// shared node flags and the node)
+template <unsigned int mob_slots>
+std::string GetWorkerRequest(const Node & node) {
+    WireWriter out;
+    out.Put((uint32_t) solve_cache_version);
+    out.Put((uint8_t) mob_slots);
+    out.Put((uint8_t) NodeShared::last_card_attack_matters);
+    out.Put((uint8_t) NodeShared::last_card_skill_matters);
+    InlineNameWriter names;
+    WriteNode(out, node, names);
+    return out.data;
+}
+
+// result of solving a cut off state
+struct WorkerResult {
+    // check hash of the state as the worker read it
+    uint64_t check;
+    // solved value
+    SubgameValue value;
+    // number of nodes expanded
+    uint64_t expanded_node_count;
+    // time to solve
+    double solve_duration_s;
+};
+
+// solve a cut off state with the given number of mob slots
+template <unsigned int slots>
+WorkerResult SolveCutNode(const Node & node) {
+    BasicNode<slots> top_node;
+    top_node.CopyStateFrom(node);
+    top_node.objective = top_node.GetMaxFinalObjective();
+    BasicTreeStruct<slots> tree(top_node);
+    tree.quiet = true;
+    tree.Expand();
+    WorkerResult result;
+    result.value = {top_node.objective, tree.final_hp, tree.death_chance};
+    result.expanded_node_count = tree.expanded_node_count;
+    result.solve_duration_s = tree.solve_duration_s;
+    return result;
+}
+
+// solve a request from GetWorkerRequest and return the reply
+// (each request is solved in its own SolverContext)
+std::string SolveWorkerRequest(const std::string & request) {
+    WireReader in(request);
+    if (in.Get<uint32_t>() != solve_cache_version) {
+        fprintf(stderr, "ERROR: worker is a different version\n");
+        exit(1);
+    }
+    const uint8_t slots = in.Get<uint8_t>();
+    WorkerResult result;
+    {
+        SolverContext context;
+        SolverContextScope scope(context);
+        NodeShared::last_card_attack_matters = in.Get<uint8_t>() != 0;
+        NodeShared::last_card_skill_matters = in.Get<uint8_t>() != 0;
+        Node node;
+        InlineNameReader names;
+        if (!ReadNode(in, node, names)) {
+            fprintf(stderr, "ERROR: could not read worker request\n");
+            exit(1);
+        }
+        const uint64_t check = node.GetCanonicalStateCheckHash();
+        if (slots <= 1) {
+            result = SolveCutNode<1>(node);
+        } else if (slots <= 2) {
+            result = SolveCutNode<2>(node);
+        } else if (slots <= 3) {
+            result = SolveCutNode<3>(node);
+        } else {
+            result = SolveCutNode<MAX_MOBS_PER_NODE>(node);
+        }
+        result.check = check;
+    }
+    WireWriter out;
+    out.Put(result);
+    return out.data;
+}
+
+#ifndef _WIN32
+
+// write a message prefixed by its size, return true if successful
+bool WriteMessage(int fd, const std::string & message) {
+    std::string data;
+    const uint32_t size = (uint32_t) message.size();
+    data.append((const char *) &size, sizeof(size));
+    data += message;
+    std::size_t offset = 0;
+    while (offset < data.size()) {
+        const ssize_t count = write(fd, data.data() + offset, data.size() - offset);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        offset += (std::size_t) count;
+    }
+    return true;
+}
+
+// read exactly size bytes, return true if successful
+bool ReadBytes(int fd, char * buffer, std::size_t size) {
+    std::size_t offset = 0;
+    while (offset < size) {
+        const ssize_t count = read(fd, buffer + offset, size - offset);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        offset += (std::size_t) count;
+    }
+    return true;
+}
+
+// read a message written by WriteMessage, return true if successful
+bool ReadMessage(int fd, std::string & message) {
+    uint32_t size = 0;
+    if (!ReadBytes(fd, (char *) &size, sizeof(size))) {
+        return false;
+    }
+    message.resize(size);
+    return size == 0 || ReadBytes(fd, &message[0], size);
+}
+
+// solve requests from stdin and write results to stdout until stdin closes
+// (anything else printed goes to stderr so it can't corrupt the results)
+void RunWorker() {
+    const int in_fd = 0;
+    const int out_fd = dup(1);
+    dup2(2, 1);
+    std::string request;
+    while (ReadMessage(in_fd, request)) {
+        if (!WriteMessage(out_fd, SolveWorkerRequest(request))) {
+            exit(1);
+        }
+    }
+    exit(0);
+}
+
+// a worker process and the pipes to it
+struct WorkerProcess {
+    // process id
+    pid_t pid;
+    // pipe to its stdin
+    int to_fd;
+    // pipe from its stdout
+    int from_fd;
+};
+
+// start a worker process running the given shell command
+WorkerProcess StartWorker(const std::string & command) {
+    int to_pipe[2];
+    int from_pipe[2];
+    if (pipe(to_pipe) != 0 || pipe(from_pipe) != 0) {
+        printf("ERROR: could not create pipes to worker\n");
+        exit(1);
+    }
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid < 0) {
+        printf("ERROR: could not start worker\n");
+        exit(1);
+    }
+    if (pid == 0) {
+        dup2(to_pipe[0], 0);
+        dup2(from_pipe[1], 1);
+        close(to_pipe[0]);
+        close(to_pipe[1]);
+        close(from_pipe[0]);
+        close(from_pipe[1]);
+        execl("/bin/sh", "sh", "-c", command.c_str(), (char *) nullptr);
+        _exit(127);
+    }
+    close(to_pipe[0]);
+    close(from_pipe[1]);
+    return WorkerProcess{pid, to_pipe[1], from_pipe[0]};
+}
+
+// return the command to start a local worker
+std::string GetLocalWorkerCommand() {
+    char path[4096];
+    const ssize_t size = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (size <= 0) {
+        printf("ERROR: could not find the path of this program\n");
+        exit(1);
+    }
+    path[size] = '\0';
+    return "'" + std::string(path) + "' --worker=on";
+}
+
+// worker processes which solve cut off states
+struct WorkerPool {
+    // workers
+    std::vector<WorkerProcess> worker;
+    // number of states solved
+    std::size_t solved_count;
+    // number of nodes expanded by workers
+    uint64_t expanded_node_count;
+    // total time workers spent solving
+    double solve_duration_s;
+    // start the given number of workers running the given command
+    WorkerPool(const std::string & command, unsigned int worker_count) :
+            solved_count(0),
+            expanded_node_count(0),
+            solve_duration_s(0.0) {
+        // (if a worker dies, writing to it should fail rather than exit)
+        signal(SIGPIPE, SIG_IGN);
+        for (unsigned int i = 0; i < worker_count; ++i) {
+            worker.push_back(StartWorker(command));
+        }
+    }
+    // close the pipes and wait for the workers to exit
+    ~WorkerPool() {
+        for (auto & this_worker : worker) {
+            close(this_worker.to_fd);
+        }
+        for (auto & this_worker : worker) {
+            close(this_worker.from_fd);
+            waitpid(this_worker.pid, nullptr, 0);
+        }
+    }
+    // solve each request and return the results in the same order
+    // (each worker is sent one request at a time and is given the next one
+    // as soon as it replies)
+    std::vector<WorkerResult> Solve(const std::vector<std::string> & request) {
+        std::vector<WorkerResult> result(request.size());
+        // next request to send
+        std::atomic<std::size_t> next_index(0);
+        // set if a worker failed
+        std::atomic<bool> failed(false);
+        auto run = [&](const WorkerProcess & this_worker) {
+            std::string reply;
+            while (!failed) {
+                const std::size_t index = next_index.fetch_add(1);
+                if (index >= request.size()) {
+                    break;
+                }
+                if (!WriteMessage(this_worker.to_fd, request[index]) ||
+                        !ReadMessage(this_worker.from_fd, reply) ||
+                        reply.size() != sizeof(WorkerResult)) {
+                    failed = true;
+                    break;
+                }
+                memcpy(&result[index], reply.data(), sizeof(WorkerResult));
+            }
+        };
+        std::vector<std::thread> thread;
+        for (const auto & this_worker : worker) {
+            thread.push_back(std::thread(run, std::cref(this_worker)));
+        }
+        for (auto & this_thread : thread) {
+            this_thread.join();
+        }
+        if (failed) {
+            printf("ERROR: worker process failed\n");
+            exit(1);
+        }
+        for (const auto & this_result : result) {
+            expanded_node_count += this_result.expanded_node_count;
+            solve_duration_s += this_result.solve_duration_s;
+        }
+        solved_count += result.size();
+        return result;
+    }
+};
+
+// return the requests for the cut off states of a tree
+// (requests are for the number of mob slots needed by the fight)
+std::vector<std::string> GetWorkerRequests(
+        const std::map<uint64_t, Node> & cut_nodes,
+        FightEnum fight_type) {
+    const unsigned int mob_count = GetFightMobCount(fight_type);
+    std::vector<std::string> request;
+    for (const auto & item : cut_nodes) {
+        if (mob_count <= 1) {
+            request.push_back(GetWorkerRequest<1>(item.second));
+        } else if (mob_count <= 2) {
+            request.push_back(GetWorkerRequest<2>(item.second));
+        } else if (mob_count <= 3) {
+            request.push_back(GetWorkerRequest<3>(item.second));
+        } else {
+            request.push_back(GetWorkerRequest<MAX_MOBS_PER_NODE>(item.second));
+        }
+    }
+    return request;
+}
+
+// solve the fight of the given tree, solving states after the first turn on
+// worker processes started with the given command
+// (the tree is solved as with ExpandFight, but without the solve cache)
+void SolveDistributed(
+        TreeStruct & tree,
+        std::string worker_command,
+        unsigned int worker_count) {
+    if (tree.use_mob_hp_lanes) {
+        printf("ERROR: distributed solving does not support mob HP lanes\n");
+        exit(1);
+    }
+    if (worker_count == 0) {
+        worker_count = 1;
+    }
+    if (worker_command.empty()) {
+        worker_command = GetLocalWorkerCommand();
+    }
+    if (!tree.quiet) {
+        printf("Starting %u workers: %s\n", worker_count, worker_command.c_str());
+    }
+    const auto start_time = std::chrono::steady_clock::now();
+    WorkerPool pool(worker_command, worker_count);
+    std::unordered_map<uint64_t, SubgameMemo::Slot> cut_values;
+    for (unsigned int round = 1; ; ++round) {
+        Node top_node;
+        top_node.CopyStateFrom(*tree.top_node_ptr);
+        TreeStruct round_tree(top_node);
+        round_tree.fight_type = tree.fight_type;
+        round_tree.generate_all_mob_hp = tree.generate_all_mob_hp;
+        round_tree.keep_all_nodes = tree.keep_all_nodes;
+        round_tree.memo = tree.memo;
+        round_tree.quiet = true;
+        round_tree.cut_values = &cut_values;
+        round_tree.cut_turn = tree.cut_turn;
+        round_tree.ExpandFight();
+        if (round_tree.cut_nodes.empty()) {
+            break;
+        }
+        if (!tree.quiet) {
+            printf("Round %u: solving %u states on workers\n",
+                round, (unsigned int) round_tree.cut_nodes.size());
+        }
+        auto result = pool.Solve(
+            GetWorkerRequests(round_tree.cut_nodes, tree.fight_type));
+        std::size_t i = 0;
+        for (const auto & item : round_tree.cut_nodes) {
+            cut_values[item.first] = {item.first, result[i].check, result[i].value};
+            ++i;
+        }
+    }
+    if (!tree.quiet) {
+        printf("Workers solved %u states, expanding %lu nodes in %.3g s "
+            "(%.3g s elapsed)\n",
+            (unsigned int) pool.solved_count,
+            (long unsigned) pool.expanded_node_count,
+            pool.solve_duration_s,
+            std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start_time).count());
+    }
+    // every state the first turn reaches is now known, so this is exact
+    tree.cut_values = &cut_values;
+    tree.ExpandFight();
+    tree.cut_values = nullptr;
+    if (!tree.cut_nodes.empty()) {
+        printf("ERROR: final solve reached unsolved states\n");
+        exit(1);
+    }
+}
+
+#else
+
+// solve requests from stdin (not supported)
+void RunWorker() {
+    printf("ERROR: workers are only supported on Linux\n");
+    exit(1);
+}
+
+// solve the fight using workers (not supported)
+void SolveDistributed(TreeStruct &, std::string, unsigned int) {
+    printf("ERROR: distributed solving is only supported on Linux\n");
+    exit(1);
+}
+
+#endif
@@ -24,7 +24,8 @@ enum FightEnum : uint8_t {
 };
 
 // fight generation
-typedef std::vector<std::pair<double, std::vector<Monster>>>(*MonsterGenerationFunction)();
+// (the argument is true to generate every mob HP, see GenerateMob)
+typedef std::vector<std::pair<double, std::vector<Monster>>>(*MonsterGenerationFunction)(bool);
 
 // 
 struct FightStruct {
@@ -73,9 +74,10 @@ std::vector<std::pair<double, std::vector<Monster>>> ApplyBurningEliteBuffs(std:
 
 // generate mobs
 std::vector<std::pair<double, std::vector<Monster>>> GenerateFightSingleMob(
-        const BaseMonster & base_mob) {
+        const BaseMonster & base_mob,
+        bool all_mob_hp) {
     std::vector<std::pair<double, std::vector<Monster>>> result;
-    auto mobs = GenerateMob(base_mob);
+    auto mobs = GenerateMob(base_mob, all_mob_hp);
     for (auto & item : mobs) {
         result.push_back(std::pair<double, std::vector<Monster>>());
         result.rbegin()->first = item.first;
@@ -105,11 +107,11 @@ std::vector<std::pair<double, std::vector<Monster>>> GenerateFightSingleMob(
 //}
 
 // generate mobs for the two louse fight
-std::vector<std::pair<double, std::vector<Monster>>> GenerateFightTwoLouses() {
+std::vector<std::pair<double, std::vector<Monster>>> GenerateFightTwoLouses(bool all_mob_hp) {
     // 50% red louse
-    auto red_louses = GenerateLouse(base_mob_red_louse);
+    auto red_louses = GenerateLouse(base_mob_red_louse, all_mob_hp);
     // 50% green louse
-    auto green_louses = GenerateLouse(base_mob_green_louse);
+    auto green_louses = GenerateLouse(base_mob_green_louse, all_mob_hp);
     std::vector<std::pair<double, std::vector<Monster>>> result;
     // 25% chance of two red louses
     for (unsigned int i = 0; i < red_louses.size(); ++i) {
@@ -154,11 +156,11 @@ std::vector<std::pair<double, std::vector<Monster>>> GenerateFightTwoLouses() {
 }
 
 // generate mobs for the two louse fight
-std::vector<std::pair<double, std::vector<Monster>>> GenerateFightOneLouse() {
+std::vector<std::pair<double, std::vector<Monster>>> GenerateFightOneLouse(bool all_mob_hp) {
     // 50% red louse
-    auto red_louses = GenerateLouse(base_mob_red_louse);
+    auto red_louses = GenerateLouse(base_mob_red_louse, all_mob_hp);
     // 50% green louse
-    auto green_louses = GenerateLouse(base_mob_green_louse);
+    auto green_louses = GenerateLouse(base_mob_green_louse, all_mob_hp);
     std::vector<std::pair<double, std::vector<Monster>>> result;
     // 50% red louse
     for (auto & mob_one : red_louses) {
@@ -185,3 +187,35 @@ std::map<FightEnum, FightStruct> fight_map = {
     {kFightAct1BurningEliteGremlinNob, {"Gremlin Nob", &base_mob_gremlin_nob, true, nullptr}},
     {kFightAct1EliteLagavulin, {"Lagavulin", &base_mob_lagavulin, false, nullptr}},
 };
+
+// return all mob layouts for the given fight along with their probabilities
+// (if all_mob_hp is true, mobs are generated at every HP, see GenerateMob)
+std::vector<std::pair<double, std::vector<Monster>>> GenerateFight(
+        FightEnum fight_type,
+        bool all_mob_hp) {
+    if (fight_map.find(fight_type) == fight_map.end()) {
+        printf("ERROR: fight_type not found in fight_map\n");
+        exit(1);
+    }
+    const FightStruct & fight = fight_map[fight_type];
+    if (fight.base_mob == nullptr) {
+        return fight.generation_function(all_mob_hp);
+    }
+    std::vector<std::pair<double, std::vector<Monster>>> mob_layouts =
+        GenerateFightSingleMob(*fight.base_mob, all_mob_hp);
+    if (fight.burning_elite) {
+        mob_layouts = ApplyBurningEliteBuffs(mob_layouts, 1);
+    }
+    return mob_layouts;
+}
+
+// return the most mobs which can be present at once in the given fight
+unsigned int GetFightMobCount(FightEnum fight_type) {
+    unsigned int count = 0;
+    for (const auto & layout : GenerateFight(fight_type, false)) {
+        if (layout.second.size() > count) {
+            count = (unsigned int) layout.second.size();
+        }
+    }
+    return count;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdio>
+#include <vector>
+#include <map>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+#include "node.hpp"
+#include "fight.hpp"
+#include "tree.hpp"
+
+// result of solving a fight at a single starting HP
+struct HPSweepResult {
+    // starting hp
+    uint16_t hp;
+    // composite objective
+    double objective;
+    // expected final hp
+    double final_hp;
+    // chance to die
+    double death_chance;
+    // chance of ending at each final hp
+    std::map<uint16_t, double> final_hp_distribution;
+};
+
+// solve the fight at every starting HP from 1 to max HP
+// (solves are split among threads and share the card collections and draw
+// tables built by the others, but each HP is otherwise solved from scratch:
+// solved states aren't shared through a subgame memo, since recalled
+// subtrees would be missing from final_hp_distribution)
+// (if generate_all_mob_hp is true, fights are solved with every mob HP)
+std::vector<HPSweepResult> SweepStartingHP(
+        const Node & top_node,
+        FightEnum fight_type,
+        unsigned int thread_count,
+        bool generate_all_mob_hp = false) {
+    const unsigned int max_hp = top_node.max_hp;
+    std::vector<HPSweepResult> result(max_hp);
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+    if (thread_count > max_hp) {
+        thread_count = max_hp;
+    }
+    printf("Solving %u starting HPs using %u threads\n", max_hp, thread_count);
+    // next starting hp to solve
+    // (highest first, since those solves tend to take longest)
+    std::atomic<int> next_hp((int) max_hp);
+    // number of solves done
+    unsigned int solved_count = 0;
+    // guards solved_count and printing
+    std::mutex progress_mutex;
+    // workers use the context and deck of this thread
+    SolverContext & context = GetSolverContext();
+    const CardCollectionPtr deck = top_node.deck;
+    auto worker = [&]() {
+        SolverContextScope scope(context);
+        NodeShared::deck = deck;
+        while (true) {
+            const int hp = next_hp.fetch_sub(1);
+            if (hp <= 0) {
+                break;
+            }
+            Node this_top_node = top_node;
+            this_top_node.hp = (uint8_t) hp;
+            this_top_node.InitializeStartingNode();
+            TreeStruct tree(this_top_node);
+            tree.fight_type = fight_type;
+            tree.generate_all_mob_hp = generate_all_mob_hp;
+            tree.quiet = true;
+            tree.ExpandFight();
+            HPSweepResult & this_result = result[hp - 1];
+            this_result.hp = (uint16_t) hp;
+            this_result.objective = this_top_node.objective;
+            this_result.final_hp = tree.final_hp;
+            this_result.death_chance = tree.death_chance;
+            this_result.final_hp_distribution = tree.final_hp_distribution;
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            ++solved_count;
+            printf("- Starting HP %d: expected final HP of %.6g (%u of %u)\n",
+                hp, this_result.final_hp, solved_count, max_hp);
+        }
+    };
+    std::vector<std::thread> thread;
+    for (unsigned int i = 1; i < thread_count; ++i) {
+        thread.push_back(std::thread(worker));
+    }
+    worker();
+    for (auto & this_thread : thread) {
+        this_thread.join();
+    }
+    return result;
+}
+
+// print the results of a sweep to a file
+// (one line per starting HP, followed by each final HP and its chance)
+void PrintHPSweepToFile(
+        const std::vector<HPSweepResult> & result,
+        std::string filename) {
+    printf("Printing HP sweep to %s\n", filename.c_str());
+    FILE * file = fopen(filename.c_str(), "w");
+    if (file == nullptr) {
+        printf("ERROR: could not open %s\n", filename.c_str());
+        exit(1);
+    }
+    fprintf(file, "# start_hp  expected_final_hp  death_chance  final_hp:chance ...\n");
+    for (const auto & this_result : result) {
+        fprintf(file, "%u %.6f %.6f",
+            (unsigned int) this_result.hp,
+            this_result.final_hp,
+            this_result.death_chance);
+        for (const auto & item : this_result.final_hp_distribution) {
+            fprintf(file, " %u:%.6g", (unsigned int) item.first, item.second);
+        }
+        fprintf(file, "\n");
+    }
+    fclose(file);
+}
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+#include "card_collection.hpp"
+#include "card_collection_map.hpp"
+#include "relics.hpp"
+#include "fight.hpp"
+#include "node.hpp"
+#include "tree.hpp"
+
+// values of a flat JSON object by key
+// (strings are unescaped, other values, including nested objects and arrays,
+// are kept as their text)
+typedef std::map<std::string, std::string> JsonObject;
+
+// parse a JSON object on one line, return true if successful
+bool ParseJsonObject(const std::string & line, JsonObject & object) {
+    object.clear();
+    std::size_t i = 0;
+    auto skip_space = [&]() {
+        while (i < line.size() && isspace((unsigned char) line[i])) {
+            ++i;
+        }
+    };
+    // read a string starting at the opening quote
+    auto read_string = [&](std::string & text) {
+        text.clear();
+        if (i >= line.size() || line[i] != '"') {
+            return false;
+        }
+        ++i;
+        while (i < line.size() && line[i] != '"') {
+            if (line[i] == '\\' && i + 1 < line.size()) {
+                ++i;
+                switch (line[i]) {
+                case 'n': text += '\n'; break;
+                case 't': text += '\t'; break;
+                case 'r': text += '\r'; break;
+                default: text += line[i]; break;
+                }
+            } else {
+                text += line[i];
+            }
+            ++i;
+        }
+        if (i >= line.size()) {
+            return false;
+        }
+        ++i;
+        return true;
+    };
+    skip_space();
+    if (i >= line.size() || line[i] != '{') {
+        return false;
+    }
+    ++i;
+    skip_space();
+    if (i < line.size() && line[i] == '}') {
+        return true;
+    }
+    while (true) {
+        skip_space();
+        std::string key;
+        if (!read_string(key)) {
+            return false;
+        }
+        skip_space();
+        if (i >= line.size() || line[i] != ':') {
+            return false;
+        }
+        ++i;
+        skip_space();
+        std::string value;
+        if (i < line.size() && line[i] == '"') {
+            if (!read_string(value)) {
+                return false;
+            }
+        } else if (i < line.size() && (line[i] == '{' || line[i] == '[')) {
+            // keep nested objects and arrays as their text
+            const std::size_t start = i;
+            int depth = 0;
+            bool in_string = false;
+            for (; i < line.size(); ++i) {
+                if (in_string) {
+                    if (line[i] == '\\') {
+                        ++i;
+                    } else if (line[i] == '"') {
+                        in_string = false;
+                    }
+                } else if (line[i] == '"') {
+                    in_string = true;
+                } else if (line[i] == '{' || line[i] == '[') {
+                    ++depth;
+                } else if (line[i] == '}' || line[i] == ']') {
+                    if (--depth == 0) {
+                        ++i;
+                        break;
+                    }
+                }
+            }
+            if (depth != 0) {
+                return false;
+            }
+            value = line.substr(start, i - start);
+        } else {
+            while (i < line.size() && line[i] != ',' && line[i] != '}' &&
+                    !isspace((unsigned char) line[i])) {
+                value += line[i];
+                ++i;
+            }
+            if (value.empty()) {
+                return false;
+            }
+        }
+        object[key] = value;
+        skip_space();
+        if (i >= line.size()) {
+            return false;
+        }
+        if (line[i] == '}') {
+            return true;
+        }
+        if (line[i] != ',') {
+            return false;
+        }
+        ++i;
+    }
+}
+
+// return the text as a quoted JSON string
+std::string ToJsonString(const std::string & text) {
+    std::string result = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (c == '\n') {
+            result += "\\n";
+        } else if (c == '\t') {
+            result += "\\t";
+        } else if (c == '\r') {
+            result += "\\r";
+        } else {
+            result += c;
+        }
+    }
+    result += "\"";
+    return result;
+}
+
+// a fight to solve in a batch
+struct Job {
+    // identifier written with the result
+    std::string id;
+    // deck
+    CardCollection deck;
+    // relics
+    RelicStruct relics;
+    // starting hp
+    uint8_t hp;
+    // max hp
+    uint8_t max_hp;
+    // fight
+    FightEnum fight_type;
+};
+
+// return the ids of the jobs with results in the given file
+std::set<std::string> ReadFinishedJobs(std::string filename) {
+    std::set<std::string> id;
+    std::ifstream file(filename);
+    std::string line;
+    while (std::getline(file, line)) {
+        JsonObject object;
+        if (ParseJsonObject(line, object) && object.count("id")) {
+            id.insert(object["id"]);
+        }
+    }
+    return id;
+}
+
+// solve the jobs and append one result line for each to the output file
+// (jobs with results already in the file are skipped, solves are split among
+// threads, and each line is written as soon as its job finishes; each job is
+// solved in its own SolverContext so memory doesn't grow from job to job)
+void RunJobs(
+        const std::vector<Job> & job,
+        std::string output_filename,
+        unsigned int thread_count) {
+    const std::set<std::string> finished_id = ReadFinishedJobs(output_filename);
+    std::vector<const Job *> todo;
+    for (const auto & this_job : job) {
+        if (finished_id.find(this_job.id) == finished_id.end()) {
+            todo.push_back(&this_job);
+        }
+    }
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+    if (thread_count > todo.size() && !todo.empty()) {
+        thread_count = (unsigned int) todo.size();
+    }
+    printf("Solving %u jobs (%u already done) using %u threads\n",
+        (unsigned int) todo.size(),
+        (unsigned int) (job.size() - todo.size()),
+        thread_count);
+    if (todo.empty()) {
+        return;
+    }
+    FILE * file = fopen(output_filename.c_str(), "a");
+    if (file == nullptr) {
+        printf("ERROR: could not open %s\n", output_filename.c_str());
+        exit(1);
+    }
+    // next job to solve
+    std::atomic<std::size_t> next_index(0);
+    // number of jobs done
+    unsigned int solved_count = 0;
+    // guards solved_count, printing and the file
+    std::mutex output_mutex;
+    auto worker = [&]() {
+        while (true) {
+            const std::size_t index = next_index.fetch_add(1);
+            if (index >= todo.size()) {
+                break;
+            }
+            const Job & this_job = *todo[index];
+            std::string line;
+            {
+                SolverContext context;
+                SolverContextScope scope(context);
+                NodeShared::deck.Clear();
+                NodeShared::deck.AddDeck(this_job.deck);
+                Node top_node;
+                top_node.hp = this_job.hp;
+                top_node.max_hp = this_job.max_hp;
+                top_node.relics = this_job.relics;
+                top_node.InitializeStartingNode();
+                TreeStruct tree(top_node);
+                tree.fight_type = this_job.fight_type;
+                tree.quiet = true;
+                tree.ExpandFight();
+                char buffer[256];
+                snprintf(buffer, sizeof(buffer),
+                    "\"objective\": %.10g, \"final_hp\": %.10g, "
+                    "\"death_chance\": %.10g, ",
+                    top_node.objective, tree.final_hp, tree.death_chance);
+                line = "{\"id\": " + ToJsonString(this_job.id) + ", " + buffer;
+                line += "\"turns\": {";
+                bool first = true;
+                for (const auto & item : tree.turn_distribution) {
+                    snprintf(buffer, sizeof(buffer), "%s\"%u\": %.10g",
+                        first ? "" : ", ", (unsigned int) item.first, item.second);
+                    line += buffer;
+                    first = false;
+                }
+                snprintf(buffer, sizeof(buffer),
+                    "}, \"solve_time_s\": %.6g, \"nodes_created\": %lu, "
+                    "\"nodes_expanded\": %lu}\n",
+                    tree.solve_duration_s,
+                    (long unsigned) tree.created_node_count,
+                    (long unsigned) tree.expanded_node_count);
+                line += buffer;
+            }
+            NodeShared::deck.Clear();
+            std::lock_guard<std::mutex> lock(output_mutex);
+            fputs(line.c_str(), file);
+            fflush(file);
+            ++solved_count;
+            printf("- Job %s done (%u of %u)\n", this_job.id.c_str(),
+                solved_count, (unsigned int) todo.size());
+        }
+    };
+    std::vector<std::thread> thread;
+    for (unsigned int i = 1; i < thread_count; ++i) {
+        thread.push_back(std::thread(worker));
+    }
+    worker();
+    for (auto & this_thread : thread) {
+        this_thread.join();
+    }
+    fclose(file);
+    printf("Results written to %s\n", output_filename.c_str());
+}
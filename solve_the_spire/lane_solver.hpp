@@ -0,0 +1,603 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <limits>
+#include <algorithm>
+
+#include "defines.h"
+#include "node.hpp"
+#include "fight.hpp"
+#include "stopwatch.hpp"
+
+// result of a single lane
+struct LaneResult {
+    // composite objective
+    double objective;
+    // expected final HP
+    double final_hp;
+    // chance of dying
+    double death_chance;
+    // chance of ending at each final hp
+    std::map<uint16_t, double> final_hp_distribution;
+    // chance of ending on each turn
+    std::map<uint16_t, double> turn_distribution;
+};
+
+// A lane solver solves a fight for every mob HP variant at once.
+// Each variant is a lane.  Lanes whose states only differ in mob HP (with
+// each mob having taken the same damage) are solved together as a group, so
+// the choices, draws and intents below them are only explored once.  Groups
+// split when a transition treats their lanes differently, such as a mob
+// dying in some lanes but not others.  Player choices are made per lane.
+// Transitions are generated by the same node functions the tree uses.
+//
+// The search is depth first with a cutoff per lane: a group is solved
+// exactly for lanes where its objective beats the cutoff, and for other
+// lanes it only returns a value at or below the cutoff.
+//
+// Since stalling lines have no bound on their depth, the solver gives up once
+// a lane passes max_lane_turns, and the fight must then be solved by the tree.
+template <unsigned int mob_slots>
+struct BasicLaneSolver {
+    // node type used by this solver
+    typedef BasicNode<mob_slots> Node;
+    // a group of lanes with the same state except for mob HP
+    typedef std::vector<Node> LaneGroup;
+    // hash of a lane group
+    struct LaneGroupHash {
+        std::size_t operator() (const LaneGroup & group) const {
+            std::size_t hash = group.size();
+            for (const auto & node : group) {
+                hash = (hash ^ node.GetStateHash()) * 1099511628211ULL;
+            }
+            return hash;
+        }
+    };
+    // equality of lane groups
+    struct LaneGroupEqual {
+        bool operator() (const LaneGroup & one, const LaneGroup & two) const {
+            if (one.size() != two.size()) {
+                return false;
+            }
+            for (std::size_t i = 0; i < one.size(); ++i) {
+                if (!one[i].IsSameState(two[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+    // lanes reached during a turn, with the index of each one in the group
+    // the turn started from
+    struct TurnState {
+        LaneGroup group;
+        std::vector<std::size_t> lane;
+    };
+    // lanes of each decision state reached during a turn
+    typedef std::unordered_map<
+        LaneGroup,
+        std::vector<std::vector<std::size_t>>,
+        LaneGroupHash,
+        LaneGroupEqual> TurnStateMap;
+    // solved lane group along with the cutoffs it was solved with
+    struct MemoEntry {
+        std::vector<LaneResult> result;
+        std::vector<double> cutoff;
+    };
+    // top node
+    Node & top_node;
+    // fight type
+    FightEnum fight_type;
+    // if true, generate every mob HP (see GenerateMob)
+    bool generate_all_mob_hp;
+    // solved lane groups at player decision points
+    std::unordered_map<LaneGroup, MemoEntry, LaneGroupHash, LaneGroupEqual> memo;
+    // probability of each lane
+    std::vector<double> lane_probability;
+    // starting mobs of each lane
+    std::vector<std::vector<Monster>> lane_mobs;
+    // result of each lane (populated when solved)
+    std::vector<LaneResult> lane_result;
+    // number of groups expanded
+    std::size_t expanded_group_count;
+    // number of groups found in the memo
+    std::size_t memo_hit_count;
+    // number of times a group was split
+    std::size_t split_count;
+    // number of lane endings skipped for being worse or equal to another
+    std::size_t dominated_count;
+    // true if a lane lasted longer than max_lane_turns
+    bool turn_limit_reached;
+    // expected final hp (populated when solved)
+    double final_hp;
+    // expected death chance (populated when solved)
+    double death_chance;
+    // chance of ending at each final hp (populated when solved)
+    std::map<uint16_t, double> final_hp_distribution;
+    // chance of ending on each turn (populated when solved)
+    std::map<uint16_t, double> turn_distribution;
+    // duration to solve
+    double solve_duration_s;
+    // constructor
+    BasicLaneSolver(Node & node) : top_node(node) {
+        fight_type = kFightNone;
+        generate_all_mob_hp = false;
+        expanded_group_count = 0;
+        memo_hit_count = 0;
+        split_count = 0;
+        dominated_count = 0;
+        turn_limit_reached = false;
+        solve_duration_s = 0;
+    }
+    // return the result of a node where the battle is over
+    static LaneResult GetFinalResult(const Node & node) {
+        Node final_node = node;
+        final_node.CalculateFinalObjective();
+        LaneResult result;
+        result.objective = final_node.objective;
+        result.final_hp = node.hp;
+        result.death_chance = node.IsDead() ? 1.0 : 0.0;
+        result.final_hp_distribution[node.hp] = 1.0;
+        result.turn_distribution[node.turn] = 1.0;
+        return result;
+    }
+    // add the given chance of each value in a distribution to another
+    static void AddDistribution(
+            std::map<uint16_t, double> & distribution,
+            double p,
+            const std::map<uint16_t, double> & other) {
+        for (const auto & item : other) {
+            distribution[item.first] += p * item.second;
+        }
+    }
+    // return an upper bound on the objective of a node
+    static double GetMaxObjective(const Node & node) {
+        if (node.IsBattleDone()) {
+            return GetFinalResult(node).objective;
+        }
+        return node.GetMaxFinalObjective();
+    }
+    // split lanes into groups of lanes with the same state except for mob HP
+    // (group_lane holds the index of each lane in each group)
+    void SplitLanes(
+            const std::vector<Node> & lane,
+            std::vector<LaneGroup> & group,
+            std::vector<std::vector<std::size_t>> & group_lane) {
+        group.clear();
+        group_lane.clear();
+        for (std::size_t i = 0; i < lane.size(); ++i) {
+            std::size_t g = 0;
+            while (g < group.size() && !group[g][0].IsSameState(lane[i], true)) {
+                ++g;
+            }
+            if (g == group.size()) {
+                group.push_back(LaneGroup());
+                group_lane.push_back(std::vector<std::size_t>());
+            }
+            group[g].push_back(lane[i]);
+            group_lane[g].push_back(i);
+        }
+        if (group.size() > 1) {
+            split_count += group.size() - 1;
+        }
+    }
+    // split lanes into groups, solve each one and return the lane results
+    std::vector<LaneResult> SolveLanes(
+            const std::vector<Node> & lane,
+            const std::vector<double> & cutoff) {
+        std::vector<LaneResult> result(lane.size());
+        std::vector<LaneGroup> group;
+        std::vector<std::vector<std::size_t>> group_lane;
+        SplitLanes(lane, group, group_lane);
+        for (std::size_t g = 0; g < group.size(); ++g) {
+            std::vector<double> group_cutoff;
+            for (auto i : group_lane[g]) {
+                group_cutoff.push_back(cutoff[i]);
+            }
+            std::vector<LaneResult> group_result =
+                SolveGroup(group[g], group_cutoff);
+            for (std::size_t i = 0; i < group_lane[g].size(); ++i) {
+                result[group_lane[g][i]] = group_result[i];
+            }
+        }
+        return result;
+    }
+    // return the group after applying a transition to every lane
+    template <class Function>
+    static std::vector<Node> ApplyTransition(
+            const LaneGroup & group,
+            const Function & transition) {
+        std::vector<Node> lane(group);
+        for (auto & node : lane) {
+            transition(node);
+        }
+        return lane;
+    }
+    // solve a chance node whose outcomes are listed by calling
+    // for_each_outcome(outcome) as with Node::ForEachDrawOutcome
+    // (outcomes are solved in order and lanes stop once they fall below their
+    // cutoff even if every remaining outcome reaches its upper bound)
+    template <class Function>
+    std::vector<LaneResult> SolveChance(
+            const LaneGroup & group,
+            const std::vector<double> & cutoff,
+            Function for_each_outcome) {
+        const double inf = std::numeric_limits<double>::infinity();
+        // outcomes don't change player HP, so they share the same bound
+        const double max_objective = GetMaxObjective(group[0]);
+        std::vector<LaneResult> result(group.size(), LaneResult{0, 0, 0});
+        std::vector<bool> cut(group.size(), false);
+        double remaining_probability = 1.0;
+        bool needed = true;
+        for_each_outcome([&](double p, const auto & transition) {
+            if (!needed) {
+                return;
+            }
+            remaining_probability -= p;
+            if (remaining_probability < 0) {
+                remaining_probability = 0;
+            }
+            std::vector<double> outcome_cutoff(group.size());
+            needed = false;
+            for (std::size_t j = 0; j < group.size(); ++j) {
+                if (cut[j]) {
+                    outcome_cutoff[j] = inf;
+                    continue;
+                }
+                needed = true;
+                outcome_cutoff[j] = (cutoff[j] - result[j].objective -
+                    remaining_probability * max_objective) / p;
+            }
+            if (!needed) {
+                return;
+            }
+            auto outcome = SolveLanes(
+                ApplyTransition(group, transition),
+                outcome_cutoff);
+            for (std::size_t j = 0; j < group.size(); ++j) {
+                if (cut[j]) {
+                    continue;
+                }
+                if (outcome[j].objective <= outcome_cutoff[j]) {
+                    cut[j] = true;
+                    result[j].objective = cutoff[j];
+                    continue;
+                }
+                result[j].objective += p * outcome[j].objective;
+                result[j].final_hp += p * outcome[j].final_hp;
+                result[j].death_chance += p * outcome[j].death_chance;
+                AddDistribution(result[j].final_hp_distribution, p,
+                    outcome[j].final_hp_distribution);
+                AddDistribution(result[j].turn_distribution, p,
+                    outcome[j].turn_distribution);
+            }
+        });
+        return result;
+    }
+    // generate mob intents for all lanes
+    // (intents only depend on the intent history and damage taken, which are
+    // the same in every lane)
+    std::vector<LaneResult> GenerateMobIntents(
+            const LaneGroup & group,
+            const std::vector<double> & cutoff) {
+        return SolveChance(group, cutoff, [&](const auto & outcome) {
+            group[0].ForEachIntentOutcome(outcome);
+        });
+    }
+    // draw cards for all lanes
+    std::vector<LaneResult> DrawCards(
+            const LaneGroup & group,
+            const std::vector<double> & cutoff) {
+        return SolveChance(group, cutoff, [&](const auto & outcome) {
+            group[0].ForEachDrawOutcome(outcome);
+        });
+    }
+    // add the lanes reached from a state in this turn to the ending states or
+    // to the decision states still to expand
+    void AddTurnState(
+            const TurnState & state,
+            const std::vector<Node> & lane,
+            std::vector<TurnState> & ending,
+            std::vector<TurnState> & decision,
+            TurnStateMap & seen) {
+        std::vector<LaneGroup> group;
+        std::vector<std::vector<std::size_t>> group_lane;
+        SplitLanes(lane, group, group_lane);
+        for (std::size_t g = 0; g < group.size(); ++g) {
+            TurnState new_state;
+            new_state.group = std::move(group[g]);
+            for (auto i : group_lane[g]) {
+                new_state.lane.push_back(state.lane[i]);
+            }
+            const Node & node = new_state.group[0];
+            if (node.IsBattleDone() || node.HasPendingActions()) {
+                ending.push_back(std::move(new_state));
+                continue;
+            }
+            // skip decisions already reached through another order of plays
+            auto & seen_lane = seen[new_state.group];
+            if (std::find(seen_lane.begin(), seen_lane.end(), new_state.lane) !=
+                    seen_lane.end()) {
+                continue;
+            }
+            seen_lane.push_back(new_state.lane);
+            decision.push_back(std::move(new_state));
+        }
+    }
+    // make the best player choice in each lane
+    // (as in BasicTreeStruct::FindPlayerChoices, every way to play out the
+    // turn is found first, and in each lane, endings which are worse or equal
+    // to another ending are not solved)
+    std::vector<LaneResult> FindPlayerChoices(
+            const LaneGroup & group,
+            const std::vector<double> & cutoff) {
+        const double inf = std::numeric_limits<double>::infinity();
+        // states where the player no longer has a choice this turn
+        // (after ending the turn, winning or dying, or drawing cards)
+        std::vector<TurnState> ending;
+        // states where the player must make a choice
+        std::vector<TurnState> decision(1);
+        decision[0].group = group;
+        for (std::size_t i = 0; i < group.size(); ++i) {
+            decision[0].lane.push_back(i);
+        }
+        TurnStateMap seen;
+        while (!decision.empty()) {
+            std::vector<TurnState> new_decision;
+            for (const auto & state : decision) {
+                AddTurnState(
+                    state,
+                    ApplyTransition(state.group, [](Node & new_node) {
+                        new_node.EndTurn();
+                        new_node.SortMobs();
+                    }),
+                    ending,
+                    new_decision,
+                    seen);
+                state.group[0].ForEachCardPlay([&](const auto & transition) {
+                    AddTurnState(
+                        state,
+                        ApplyTransition(state.group, transition),
+                        ending,
+                        new_decision,
+                        seen);
+                    return true;
+                });
+            }
+            decision.swap(new_decision);
+        }
+        // in each lane, mark endings worse or equal to another ending as bad
+        // (once an ending is marked bad, don't use it as a comparison)
+        std::vector<std::vector<bool>> bad(ending.size());
+        std::vector<std::vector<std::pair<std::size_t, std::size_t>>> lane_ending(
+            group.size());
+        for (std::size_t e = 0; e < ending.size(); ++e) {
+            bad[e].resize(ending[e].lane.size(), false);
+            for (std::size_t i = 0; i < ending[e].lane.size(); ++i) {
+                lane_ending[ending[e].lane[i]].push_back(std::make_pair(e, i));
+            }
+        }
+        for (const auto & this_lane_ending : lane_ending) {
+            for (const auto & item_i : this_lane_ending) {
+                if (bad[item_i.first][item_i.second]) {
+                    continue;
+                }
+                const Node & node_i = ending[item_i.first].group[item_i.second];
+                for (const auto & item_j : this_lane_ending) {
+                    if (item_i == item_j || bad[item_j.first][item_j.second]) {
+                        continue;
+                    }
+                    const Node & node_j =
+                        ending[item_j.first].group[item_j.second];
+                    if (node_j.IsWorseOrEqual(node_i)) {
+                        bad[item_j.first][item_j.second] = true;
+                        ++dominated_count;
+                    }
+                }
+            }
+            // if options exist where we don't die, mark options where we die as bad
+            if (always_avoid_dying) {
+                bool alive = false;
+                for (const auto & item : this_lane_ending) {
+                    if (!bad[item.first][item.second] &&
+                            !ending[item.first].group[item.second].IsDead()) {
+                        alive = true;
+                    }
+                }
+                for (const auto & item : this_lane_ending) {
+                    if (alive && ending[item.first].group[item.second].IsDead()) {
+                        bad[item.first][item.second] = true;
+                    }
+                }
+            }
+        }
+        // solve endings with the highest bound first so that they cut off the
+        // others sooner
+        std::vector<std::size_t> order(ending.size());
+        for (std::size_t e = 0; e < ending.size(); ++e) {
+            order[e] = e;
+        }
+        std::vector<double> max_objective(ending.size());
+        for (std::size_t e = 0; e < ending.size(); ++e) {
+            max_objective[e] = GetMaxObjective(ending[e].group[0]);
+        }
+        std::stable_sort(order.begin(), order.end(),
+            [&](std::size_t one, std::size_t two) {
+                return max_objective[one] > max_objective[two];
+            });
+        // solve each ending in the lanes where it can beat the best choice so
+        // far and keep it for each lane where it is better
+        std::vector<LaneResult> result(group.size(), LaneResult{-inf, 0, 0});
+        for (auto e : order) {
+            const TurnState & state = ending[e];
+            std::vector<Node> lane;
+            std::vector<std::size_t> lane_index;
+            std::vector<double> choice_cutoff;
+            for (std::size_t i = 0; i < state.lane.size(); ++i) {
+                const std::size_t l = state.lane[i];
+                const double this_cutoff = std::max(cutoff[l], result[l].objective);
+                if (bad[e][i] || GetMaxObjective(state.group[i]) <= this_cutoff) {
+                    continue;
+                }
+                lane.push_back(state.group[i]);
+                lane_index.push_back(l);
+                choice_cutoff.push_back(this_cutoff);
+            }
+            if (lane.empty()) {
+                continue;
+            }
+            auto choice = SolveLanes(lane, choice_cutoff);
+            for (std::size_t i = 0; i < lane.size(); ++i) {
+                if (choice[i].objective > result[lane_index[i]].objective) {
+                    result[lane_index[i]] = choice[i];
+                }
+            }
+        }
+        // lanes where no choice beats the cutoff
+        for (std::size_t i = 0; i < group.size(); ++i) {
+            if (result[i].objective < cutoff[i]) {
+                result[i].objective = cutoff[i];
+            }
+        }
+        return result;
+    }
+    // solve a group of lanes and return the result of each one
+    // (results are exact where they are above the cutoff)
+    std::vector<LaneResult> SolveGroup(
+            const LaneGroup & group,
+            const std::vector<double> & cutoff) {
+        const Node & node = group[0];
+        // once the turn limit is reached, the result is thrown away, so cut
+        // off everything to return as soon as possible
+        if (turn_limit_reached || node.turn > max_lane_turns) {
+            turn_limit_reached = true;
+            std::vector<LaneResult> result;
+            for (auto this_cutoff : cutoff) {
+                result.push_back(LaneResult{this_cutoff, 0, 0});
+            }
+            return result;
+        }
+        ++expanded_group_count;
+        if (node.IsBattleDone()) {
+            std::vector<LaneResult> result;
+            for (const auto & lane_node : group) {
+                result.push_back(GetFinalResult(lane_node));
+            }
+            return result;
+        }
+        if (node.pending_action[0].type == kActionDrawCards) {
+            return DrawCards(group, cutoff);
+        } else if (node.pending_action[0].type == kActionGenerateMobIntents) {
+            return GenerateMobIntents(group, cutoff);
+        } else if (node.pending_action[0].type != kActionNone) {
+            printf("ERROR: unexpected preaction type\n");
+            exit(1);
+        }
+        // player decisions are stored so that the same position reached
+        // through a different order of plays is only solved once
+        auto it = memo.find(group);
+        if (it != memo.end()) {
+            // a stored result can be used for each lane if it was exact or
+            // if it was cut off at or below the current cutoff
+            const MemoEntry & entry = it->second;
+            bool usable = true;
+            for (std::size_t i = 0; i < group.size(); ++i) {
+                if (entry.result[i].objective <= entry.cutoff[i] &&
+                        entry.cutoff[i] > cutoff[i]) {
+                    usable = false;
+                    break;
+                }
+            }
+            if (usable) {
+                ++memo_hit_count;
+                return entry.result;
+            }
+        }
+        std::vector<LaneResult> result = FindPlayerChoices(group, cutoff);
+        // once the memo is full, only groups already in it are updated
+        if (it != memo.end()) {
+            it->second = MemoEntry{result, cutoff};
+        } else if (memo.size() < max_lane_memo_size) {
+            memo.emplace(group, MemoEntry{result, cutoff});
+        }
+        return result;
+    }
+    // solve the fight
+    // (returns false if a lane lasts longer than max_lane_turns, in which case
+    // the fight must be solved another way)
+    bool Solve() {
+        Stopwatch stopwatch;
+        assert(top_node.pending_action[0].type == kActionGenerateBattle);
+        // create the starting node of each lane
+        std::vector<Node> lane;
+        for (const auto & layout : GenerateFight(fight_type, generate_all_mob_hp)) {
+            Node new_node = top_node;
+            new_node.child.clear();
+            new_node.parent = nullptr;
+            new_node.PopPendingAction();
+            new_node.PlaceMobs(layout.second);
+            new_node.StartBattle();
+            new_node.SortMobs();
+            lane.push_back(new_node);
+            lane_probability.push_back(layout.first);
+            lane_mobs.push_back(layout.second);
+        }
+        printf("Solving %u mob variations as lanes\n",
+            (unsigned int) lane.size());
+        lane_result = SolveLanes(
+            lane,
+            std::vector<double>(
+                lane.size(),
+                -std::numeric_limits<double>::infinity()));
+        solve_duration_s = stopwatch.GetTime();
+        if (turn_limit_reached) {
+            printf("Lanes lasted more than %u turns after %.3f seconds\n",
+                max_lane_turns, solve_duration_s);
+            return false;
+        }
+        // combine lanes
+        top_node.objective = 0;
+        final_hp = 0;
+        death_chance = 0;
+        final_hp_distribution.clear();
+        turn_distribution.clear();
+        for (std::size_t i = 0; i < lane.size(); ++i) {
+            const double p = lane_probability[i];
+            top_node.objective += p * lane_result[i].objective;
+            final_hp += p * lane_result[i].final_hp;
+            death_chance += p * lane_result[i].death_chance;
+            AddDistribution(final_hp_distribution, p,
+                lane_result[i].final_hp_distribution);
+            AddDistribution(turn_distribution, p,
+                lane_result[i].turn_distribution);
+        }
+        PrintResult();
+        return true;
+    }
+    // print the result of each lane and the combined result
+    void PrintResult() const {
+        printf("\nLane results:\n");
+        for (std::size_t i = 0; i < lane_result.size(); ++i) {
+            printf("- %5.2f%%:", lane_probability[i] * 100);
+            for (const auto & mob : lane_mobs[i]) {
+                printf(" %s (%d HP)", mob.base->name.c_str(), (int) mob.hp);
+            }
+            printf(", final HP of %.6g\n", lane_result[i].final_hp);
+        }
+        printf("\nResult summary:\n");
+        printf("- Solution took %.3f seconds\n", solve_duration_s);
+        printf("- Expanded %u lane groups, %u memo hits, %u splits, "
+            "%u dominated endings\n",
+            (unsigned int) expanded_group_count,
+            (unsigned int) memo_hit_count,
+            (unsigned int) split_count,
+            (unsigned int) dominated_count);
+        printf("- Expected final HP of %.6g (change of %+.6g)\n",
+            final_hp,
+            final_hp - top_node.hp);
+        printf("- Death chance of %.6g%%\n", death_chance * 100);
+    }
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// a file mapped read only into memory, so only the pages which are used get
+// read from disk
+// (on Windows, the file is read into memory instead of being mapped)
+struct MappedFile {
+    // file contents (or nullptr)
+    const uint8_t * data = nullptr;
+    // size of the file
+    std::size_t size = 0;
+#ifdef _WIN32
+    // file contents
+    std::vector<uint8_t> buffer;
+#endif
+    // constructor
+    MappedFile() {
+    }
+    // (the mapping can't be shared)
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator= (const MappedFile &) = delete;
+    // destructor
+    ~MappedFile() {
+        Close();
+    }
+    // map a file, return true if successful
+    bool Open(const std::string & filename) {
+        Close();
+#ifdef _WIN32
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        if (!file.good()) {
+            return false;
+        }
+        buffer.resize((std::size_t) file.tellg());
+        file.seekg(0);
+        file.read((char *) buffer.data(), buffer.size());
+        data = buffer.data();
+        size = buffer.size();
+        return size > 0;
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        void * mapped = mmap(nullptr, (std::size_t) info.st_size,
+            PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        data = (const uint8_t *) mapped;
+        size = (std::size_t) info.st_size;
+        return true;
+#endif
+    }
+    // unmap the file
+    void Close() {
+#ifdef _WIN32
+        buffer.clear();
+#else
+        if (data != nullptr) {
+            munmap((void *) data, size);
+        }
+#endif
+        data = nullptr;
+        size = 0;
+    }
+    // copy a value from the file
+    template <class T>
+    T Get(uint64_t offset) const {
+        T value;
+        memcpy((void *) &value, data + offset, sizeof(value));
+        return value;
+    }
+    // read a string written by WireWriter::PutString, return true if successful
+    bool GetString(uint64_t & offset, std::string & text) const {
+        if (offset + sizeof(uint32_t) > size) {
+            return false;
+        }
+        const uint32_t length = Get<uint32_t>(offset);
+        offset += sizeof(uint32_t);
+        if (offset + length > size) {
+            return false;
+        }
+        text.assign((const char *) data + offset, length);
+        offset += length;
+        return true;
+    }
+};
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "defines.h"
+
+// Memory accounting tracks the bytes held by each subsystem of the solver,
+// along with the most each has held at once.  Allocations are counted where
+// they happen: nodes through their own operator new, containers through a
+// TrackedAllocator, and card collections in their constructors.
+//
+// Each thread sums its changes locally and adds them to the shared account
+// once they pass memory_flush_bytes, so threads don't fight over the counters
+// and the account is off by at most that much per thread and subsystem.
+
+// subsystems whose memory is tracked
+enum MemorySubsystemEnum : uint8_t {
+    // nodes, including deleted ones awaiting reuse
+    kMemoryNodes,
+    // child pointer arrays of nodes
+    kMemoryChildArrays,
+    // interned card collections and the links between them
+    kMemoryCardCollections,
+    // cached ways to draw cards from each collection
+    kMemoryDrawCache,
+    // nodes waiting to be expanded
+    kMemoryFrontier,
+    // set of terminal nodes
+    kMemoryTerminalSet,
+    kMemoryFinal
+};
+
+// name of each subsystem
+const char * const memory_subsystem_name[kMemoryFinal] = {
+    "nodes",
+    "child_arrays",
+    "card_collections",
+    "draw_cache",
+    "frontier",
+    "terminal_set",
+};
+
+// bytes held by all threads
+struct MemoryAccount {
+    // bytes held by each subsystem
+    std::atomic<int64_t> current[kMemoryFinal];
+    // most bytes each subsystem has held
+    std::atomic<int64_t> peak[kMemoryFinal];
+    // most bytes all subsystems have held together
+    std::atomic<int64_t> peak_total;
+};
+
+// account of this process
+MemoryAccount memory_account;
+
+// raise a peak to at least the given value
+inline void RaiseMemoryPeak(std::atomic<int64_t> & peak, int64_t value) {
+    int64_t old_value = peak.load(std::memory_order_relaxed);
+    while (value > old_value &&
+            !peak.compare_exchange_weak(old_value, value, std::memory_order_relaxed)) {
+    }
+}
+
+// changes of this thread not yet added to memory_account
+struct UnflushedMemory {
+    // bytes by subsystem
+    int64_t bytes[kMemoryFinal] = {0};
+    // add the changes of a subsystem to the account
+    void Flush(MemorySubsystemEnum subsystem) {
+        const int64_t change = bytes[subsystem];
+        bytes[subsystem] = 0;
+        const int64_t current = memory_account.current[subsystem].fetch_add(
+            change, std::memory_order_relaxed) + change;
+        RaiseMemoryPeak(memory_account.peak[subsystem], current);
+        int64_t total = 0;
+        for (auto & this_current : memory_account.current) {
+            total += this_current.load(std::memory_order_relaxed);
+        }
+        RaiseMemoryPeak(memory_account.peak_total, total);
+    }
+    // add all changes to the account
+    void FlushAll() {
+        for (int i = 0; i < kMemoryFinal; ++i) {
+            if (bytes[i] != 0) {
+                Flush((MemorySubsystemEnum) i);
+            }
+        }
+    }
+    // destructor
+    // (so changes made by a thread aren't lost when it ends)
+    ~UnflushedMemory() {
+        FlushAll();
+    }
+};
+
+// changes of this thread
+thread_local UnflushedMemory unflushed_memory;
+
+// count bytes allocated (or freed, if negative) by a subsystem
+inline void TrackMemory(MemorySubsystemEnum subsystem, int64_t bytes) {
+    int64_t & this_bytes = unflushed_memory.bytes[subsystem];
+    this_bytes += bytes;
+    if (this_bytes >= memory_flush_bytes || this_bytes <= -memory_flush_bytes) {
+        unflushed_memory.Flush(subsystem);
+    }
+}
+
+// return the bytes held by one subsystem
+inline int64_t GetTrackedMemory(MemorySubsystemEnum subsystem) {
+    return memory_account.current[subsystem].load(std::memory_order_relaxed) +
+        unflushed_memory.bytes[subsystem];
+}
+
+// return the bytes held by all subsystems
+// (changes of other threads since they last flushed aren't included)
+inline int64_t GetTrackedMemory() {
+    int64_t total = 0;
+    for (int i = 0; i < kMemoryFinal; ++i) {
+        total += GetTrackedMemory((MemorySubsystemEnum) i);
+    }
+    return total;
+}
+
+// return the most bytes all subsystems have held together
+inline int64_t GetTrackedMemoryPeak() {
+    unflushed_memory.FlushAll();
+    return memory_account.peak_total.load(std::memory_order_relaxed);
+}
+
+// return bytes in a human readable form, such as "512 B", "1.50 MB" or "12.3 GB"
+std::string FormatBytes(int64_t bytes) {
+    char buffer[32];
+    const char * unit[] = {"B", "kB", "MB", "GB", "TB"};
+    double value = (double) bytes;
+    int i = 0;
+    while (i < 4 && (value >= 1000.0 || value <= -1000.0)) {
+        value /= 1024.0;
+        ++i;
+    }
+    if (i == 0) {
+        snprintf(buffer, sizeof(buffer), "%lld B", (long long) bytes);
+    } else {
+        snprintf(buffer, sizeof(buffer), "%.3g %s", value, unit[i]);
+    }
+    return buffer;
+}
+
+// print the current and peak bytes of each subsystem
+void PrintTrackedMemory() {
+    unflushed_memory.FlushAll();
+    printf("\nTracked memory:\n");
+    int64_t total = 0;
+    for (int i = 0; i < kMemoryFinal; ++i) {
+        const int64_t current = memory_account.current[i].load();
+        total += current;
+        printf("- %-16s %10s (peak %s)\n",
+            memory_subsystem_name[i],
+            FormatBytes(current).c_str(),
+            FormatBytes(memory_account.peak[i].load()).c_str());
+    }
+    printf("- %-16s %10s (peak %s)\n",
+        "total",
+        FormatBytes(total).c_str(),
+        FormatBytes(memory_account.peak_total.load()).c_str());
+}
+
+// allocator which counts the memory of a container towards a subsystem
+template <class T, MemorySubsystemEnum subsystem>
+struct TrackedAllocator {
+    typedef T value_type;
+    // allocator of another type for the same subsystem
+    template <class U>
+    struct rebind {
+        typedef TrackedAllocator<U, subsystem> other;
+    };
+    // constructor
+    TrackedAllocator() noexcept {
+    }
+    // conversion from an allocator of another type
+    template <class U>
+    TrackedAllocator(const TrackedAllocator<U, subsystem> &) noexcept {
+    }
+    // allocate space for n items
+    T * allocate(std::size_t n) {
+        TrackMemory(subsystem, (int64_t) (n * sizeof(T)));
+        return std::allocator<T>().allocate(n);
+    }
+    // free space for n items
+    void deallocate(T * ptr, std::size_t n) {
+        TrackMemory(subsystem, -(int64_t) (n * sizeof(T)));
+        std::allocator<T>().deallocate(ptr, n);
+    }
+    // (allocators for the same subsystem are interchangeable)
+    template <class U>
+    bool operator == (const TrackedAllocator<U, subsystem> &) const {
+        return true;
+    }
+    template <class U>
+    bool operator != (const TrackedAllocator<U, subsystem> &) const {
+        return false;
+    }
+};
@@ -9,12 +9,123 @@
 #include "action.hpp"
 #include "buff_state.hpp"
 
-// list of intent possibilities
-typedef std::vector<std::pair<double, uint8_t>> IntentPossibilites;
+// a single intent possibility
+struct IntentChance {
+    // probability of selecting this intent
+    double probability;
+    // intent index
+    uint8_t intent;
+};
+
+// fixed-size list of intent possibilities
+struct IntentPossibilites {
+    // number of possibilities
+    uint8_t count = 0;
+    // possibilities
+    IntentChance item[MAX_MOB_INTENTS] = {};
+    // add a possibility
+    constexpr void Add(double probability, uint8_t intent) {
+        item[count].probability = probability;
+        item[count].intent = intent;
+        ++count;
+    }
+    // return the number of possibilities
+    constexpr std::size_t size() const {
+        return count;
+    }
+    // access a possibility
+    constexpr const IntentChance & operator[] (std::size_t index) const {
+        return item[index];
+    }
+    // range iterator loops through possibilities
+    constexpr const IntentChance * begin() const {
+        return item;
+    }
+    // range iterator loops through possibilities
+    constexpr const IntentChance * end() const {
+        return item + count;
+    }
+};
+
+// the part of the mob state an intent choice is allowed to depend on
+struct IntentHistory {
+    // last 3 intents (255 for none)
+    uint8_t last_intent[3];
+    // true if mob hp is not at max hp
+    bool damaged;
+};
+
+// an intent rule maps an intent history to the possible next intents
+// (rules must be constexpr and free of side effects)
+typedef IntentPossibilites (*IntentRule)(const IntentHistory &);
 
-// typedef of an intent function
-struct Monster;
-typedef IntentPossibilites (*IntentFunction)(Monster &);
+// number of values each slot of the intent history can take
+// (one per intent plus one for no intent)
+constexpr std::size_t INTENT_HISTORY_VALUES = MAX_MOB_INTENTS + 1;
+
+// number of rows in an intent table
+constexpr std::size_t INTENT_TABLE_SIZE =
+    INTENT_HISTORY_VALUES * INTENT_HISTORY_VALUES * INTENT_HISTORY_VALUES * 2;
+
+// intent transition table for a monster, indexed by its intent history
+struct IntentTable {
+    // possibilities for each history
+    IntentPossibilites row[INTENT_TABLE_SIZE];
+    // convert a last intent value into a history slot value
+    static constexpr std::size_t GetSlot(uint8_t last_intent) {
+        return (last_intent < MAX_MOB_INTENTS) ? last_intent : MAX_MOB_INTENTS;
+    }
+    // return the row index for the given history
+    static constexpr std::size_t GetIndex(const uint8_t last_intent[3], bool damaged) {
+        std::size_t index = GetSlot(last_intent[2]);
+        index = index * INTENT_HISTORY_VALUES + GetSlot(last_intent[1]);
+        index = index * INTENT_HISTORY_VALUES + GetSlot(last_intent[0]);
+        return index * 2 + (damaged ? 1 : 0);
+    }
+    // return the possibilities for the given history
+    constexpr const IntentPossibilites & Lookup(
+            const uint8_t last_intent[3], bool damaged) const {
+        return row[GetIndex(last_intent, damaged)];
+    }
+};
+
+// evaluate an intent rule for every possible history
+constexpr IntentTable BuildIntentTable(IntentRule rule) {
+    IntentTable table = {};
+    for (std::size_t i = 0; i < INTENT_HISTORY_VALUES; ++i) {
+        for (std::size_t j = 0; j < INTENT_HISTORY_VALUES; ++j) {
+            for (std::size_t k = 0; k < INTENT_HISTORY_VALUES; ++k) {
+                for (std::size_t d = 0; d < 2; ++d) {
+                    IntentHistory history = {};
+                    history.last_intent[0] = (k == MAX_MOB_INTENTS) ? 255 : (uint8_t) k;
+                    history.last_intent[1] = (j == MAX_MOB_INTENTS) ? 255 : (uint8_t) j;
+                    history.last_intent[2] = (i == MAX_MOB_INTENTS) ? 255 : (uint8_t) i;
+                    history.damaged = d != 0;
+                    table.row[IntentTable::GetIndex(history.last_intent, history.damaged)] =
+                        rule(history);
+                }
+            }
+        }
+    }
+    return table;
+}
+
+// return true if every row of the table has probabilities which sum to 1
+constexpr bool IsValidIntentTable(const IntentTable & table) {
+    for (const auto & row : table.row) {
+        double total = 0.0;
+        for (const auto & chance : row) {
+            total += chance.probability;
+        }
+        if (row.count == 0 || total < 1.0 - 1e-9 || total > 1.0 + 1e-9) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// intent possibilities for a monster with only one intent
+constexpr IntentPossibilites single_intent_possibilities = {1, {{1.0, 0}}};
 
 // monster intent and actions
 struct MonsterIntent {
@@ -22,6 +133,8 @@ struct MonsterIntent {
     std::string name;
     // actions
     Action action[2];
+    // actions applied to the mob itself when this intent is selected
+    Action select_action[2];
 };
 
 // base monster flags
@@ -39,9 +152,9 @@ struct BaseMonster {
     // monster hp range
     std::pair<uint16_t, uint16_t> hp_range;
     // list of intents
-    MonsterIntent intent[3];
-    // intent function
-    IntentFunction intent_function;
+    MonsterIntent intent[MAX_MOB_INTENTS];
+    // intent transition table (or nullptr to always use the first intent)
+    const IntentTable * intent_table;
     // monster flags
     MonsterFlag flag;
 };
@@ -61,7 +174,7 @@ struct Monster {
     // block amount
     uint8_t block;
     // default constructor (no mob)
-    Monster() : base(nullptr), hp(0), last_intent{0}, block(0) {
+    Monster() : base(nullptr), hp(0), max_hp(0), last_intent{0}, block(0) {
     }
     // construct from base monster
     Monster(const BaseMonster & base_) {
@@ -140,20 +253,78 @@ struct Monster {
     bool IsMinion() const {
         return base->flag & kMonsterFlagMinion;
     }
-    // returned as a vector of (probability, intent index)
-    std::vector<std::pair<double, uint8_t>> GetIntents() {
-        if (base->intent_function == nullptr) {
-            std::vector<std::pair<double, uint8_t>> result;
-            result.push_back(std::pair<double, uint8_t>(1.0, 0));
-            return result;
+    // equality comparison
+    bool operator== (const Monster & that) const {
+        return base == that.base &&
+            hp == that.hp &&
+            max_hp == that.max_hp &&
+            block == that.block &&
+            memcmp(last_intent, that.last_intent, sizeof(last_intent)) == 0 &&
+            buff == that.buff;
+    }
+    // inequality comparison
+    bool operator!= (const Monster & that) const {
+        return !(*this == that);
+    }
+    // return true if this only differs from the other mob in max HP
+    // (both must have taken the same amount of damage)
+    bool IsSameExceptHP(const Monster & that) const {
+        return base == that.base &&
+            Exists() == that.Exists() &&
+            max_hp - hp == that.max_hp - that.hp &&
+            block == that.block &&
+            memcmp(last_intent, that.last_intent, sizeof(last_intent)) == 0 &&
+            buff == that.buff;
+    }
+    // return true if this comes before another mob of the same type in the
+    // canonical mob order
+    bool CanonicalLess(const Monster & that) const {
+        assert(base == that.base);
+        // intents go first so that mobs doing the same thing stay in the
+        // same position and can still be compared by IsWorseOrEqual
+        int x = memcmp(last_intent, that.last_intent, sizeof(last_intent));
+        if (x != 0) {
+            return x < 0;
+        }
+        if (max_hp != that.max_hp) {
+            return max_hp < that.max_hp;
         }
-        return base->intent_function(*this);
+        if (hp != that.hp) {
+            return hp < that.hp;
+        }
+        if (block != that.block) {
+            return block < that.block;
+        }
+        return memcmp(buff.value, that.buff.value, sizeof(buff.value)) < 0;
+    }
+    // return the possible next intents as (probability, intent index)
+    const IntentPossibilites & GetIntents() const {
+        if (base->intent_table == nullptr) {
+            return single_intent_possibilities;
+        }
+        return base->intent_table->Lookup(last_intent, hp != max_hp);
     }
     // select a new intent
     void SelectIntent(uint8_t intent_index) {
         last_intent[2] = last_intent[1];
         last_intent[1] = last_intent[0];
         last_intent[0] = intent_index;
+        // apply state changes tied to this intent
+        for (const auto & action : base->intent[intent_index].select_action) {
+            switch (action.type) {
+            case kActionNone:
+                break;
+            case kActionSetBlock:
+                block = (uint8_t) action.arg[0];
+                break;
+            case kActionSetBuff:
+                buff[action.arg[0]] = action.arg[1];
+                break;
+            default:
+                printf("ERROR: unexpected intent select action\n");
+                exit(1);
+            }
+        }
     }
     // convert to a string
     std::string ToString() const {
@@ -176,10 +347,14 @@ struct Monster {
 };
 
 // generate possibilities for the given base mob
-std::vector<std::pair<double, Monster>> GenerateMob(const BaseMonster & base) {
+// (if all_hp is true, generate one mob per value in its HP range even when
+// normalize_mob_variations is set)
+std::vector<std::pair<double, Monster>> GenerateMob(
+        const BaseMonster & base,
+        bool all_hp) {
     std::vector<std::pair<double, Monster>> result;
     // if we're just using an average, return a single mob
-    if (normalize_mob_variations) {
+    if (normalize_mob_variations && !all_hp) {
         result.push_back(std::pair<double, Monster>(1.0, Monster(base)));
         //result.rbegin()->second.max_hp =
         //    (base.hp_range.first + base.hp_range.second) / 2;
@@ -197,9 +372,11 @@ std::vector<std::pair<double, Monster>> GenerateMob(const BaseMonster & base) {
 }
 
 // return all possibilites for generating a red or green louse
-std::vector<std::pair<double, Monster>> GenerateLouse(const BaseMonster & base) {
+std::vector<std::pair<double, Monster>> GenerateLouse(
+        const BaseMonster & base,
+        bool all_hp) {
     // result
-    std::vector<std::pair<double, Monster>> result = GenerateMob(base);
+    std::vector<std::pair<double, Monster>> result = GenerateMob(base, all_hp);
     // strength possibilities (effective)
     {
         std::vector<std::pair<double, unsigned int>> strength;
@@ -245,16 +422,20 @@ std::vector<std::pair<double, Monster>> GenerateLouse(const BaseMonster & base)
 }
 
 // get intent of Cultist
-IntentPossibilites GetIntentCultist(Monster & mob) {
+constexpr IntentPossibilites GetIntentCultist(const IntentHistory & history) {
     IntentPossibilites result;
-    if (mob.last_intent[0] == 255) {
-        result.push_back(std::pair<double, uint8_t>(1.0, 0));
+    if (history.last_intent[0] == 255) {
+        result.Add(1.0, 0);
     } else {
-        result.push_back(std::pair<double, uint8_t>(1.0, 1));
+        result.Add(1.0, 1);
     }
     return result;
 }
 
+// intent table of Cultist
+constexpr IntentTable intent_table_cultist = BuildIntentTable(GetIntentCultist);
+static_assert(IsValidIntentTable(intent_table_cultist), "");
+
 // base models for each mob are below
 BaseMonster base_mob_cultist = {
     "Cultist",
@@ -263,34 +444,37 @@ BaseMonster base_mob_cultist = {
         {"Incantation", {{kActionBuff, kBuffRitual, 5}}},
         {"Dark Strike", {{kActionAttack, 6}}},
     },
-    GetIntentCultist,
+    &intent_table_cultist,
 };
 
 // get intent of Jaw Worm
-IntentPossibilites GetIntentJawWorm(Monster & mob) {
+constexpr IntentPossibilites GetIntentJawWorm(const IntentHistory & history) {
     IntentPossibilites result;
-    double x = (double) rand() / RAND_MAX;
-    if (mob.last_intent[0] == 0) {
+    if (history.last_intent[0] == 0) {
         // cannot chomp twice in a row
-        result.push_back(std::pair<double, uint8_t>(0.30 / 0.55, 1));
-        result.push_back(std::pair<double, uint8_t>(0.25 / 0.55, 2));
-    } else if (mob.last_intent[0] == 2) {
+        result.Add(0.30 / 0.55, 1);
+        result.Add(0.25 / 0.55, 2);
+    } else if (history.last_intent[0] == 2) {
         // cannot bellow twice in a row
-        result.push_back(std::pair<double, uint8_t>(0.45 / 0.75, 0));
-        result.push_back(std::pair<double, uint8_t>(0.30 / 0.75, 1));
-    } else if (mob.last_intent[0] == 1 && mob.last_intent[1] == 1) {
+        result.Add(0.45 / 0.75, 0);
+        result.Add(0.30 / 0.75, 1);
+    } else if (history.last_intent[0] == 1 && history.last_intent[1] == 1) {
         // cannot thrash 3x in a row
-        result.push_back(std::pair<double, uint8_t>(0.45 / 0.7, 0));
-        result.push_back(std::pair<double, uint8_t>(0.25 / 0.7, 2));
+        result.Add(0.45 / 0.7, 0);
+        result.Add(0.25 / 0.7, 2);
     } else {
         // can do any attack
-        result.push_back(std::pair<double, uint8_t>(0.45, 0));
-        result.push_back(std::pair<double, uint8_t>(0.30, 1));
-        result.push_back(std::pair<double, uint8_t>(0.25, 2));
+        result.Add(0.45, 0);
+        result.Add(0.30, 1);
+        result.Add(0.25, 2);
     }
     return result;
 }
 
+// intent table of Jaw Worm
+constexpr IntentTable intent_table_jaw_worm = BuildIntentTable(GetIntentJawWorm);
+static_assert(IsValidIntentTable(intent_table_jaw_worm), "");
+
 // base models for each mob are below
 BaseMonster base_mob_jaw_worm = {
     "Jaw Worm",
@@ -300,23 +484,27 @@ BaseMonster base_mob_jaw_worm = {
         {"Thrash", {{kActionAttack, 7}, {kActionBlock, 5}}},
         {"Bellow", {{kActionBuff, kBuffStrength, 5}, {kActionBlock, 9}}},
     },
-    GetIntentJawWorm,
+    &intent_table_jaw_worm,
 };
 
 // get intent of Blue Slaver
-IntentPossibilites GetIntentBlueSlaver(Monster & mob) {
+constexpr IntentPossibilites GetIntentBlueSlaver(const IntentHistory & history) {
     IntentPossibilites result;
-    if (mob.last_intent[0] == 0 && mob.last_intent[1] == 0) {
-        result.push_back(std::pair<double, uint8_t>(1.0, 1));
-    } else if (mob.last_intent[0] == 1) {
-        result.push_back(std::pair<double, uint8_t>(1.0, 0));
+    if (history.last_intent[0] == 0 && history.last_intent[1] == 0) {
+        result.Add(1.0, 1);
+    } else if (history.last_intent[0] == 1) {
+        result.Add(1.0, 0);
     } else {
-        result.push_back(std::pair<double, uint8_t>(0.60, 0));
-        result.push_back(std::pair<double, uint8_t>(0.40, 1));
+        result.Add(0.60, 0);
+        result.Add(0.40, 1);
     }
     return result;
 }
 
+// intent table of Blue Slaver
+constexpr IntentTable intent_table_blue_slaver = BuildIntentTable(GetIntentBlueSlaver);
+static_assert(IsValidIntentTable(intent_table_blue_slaver), "");
+
 // base models for each mob are below
 BaseMonster base_mob_blue_slaver = {
     "Blue Slaver",
@@ -325,23 +513,27 @@ BaseMonster base_mob_blue_slaver = {
         {"Stab", {{kActionAttack, 13}}},
         {"Rake", {{kActionAttack, 8}, {kActionDebuff, kBuffWeak, 2}}},
     },
-    GetIntentBlueSlaver,
+    &intent_table_blue_slaver,
 };
 
 // get intent of Red Louse
-IntentPossibilites GetIntentRedLouse(Monster & mob) {
+constexpr IntentPossibilites GetIntentRedLouse(const IntentHistory & history) {
     IntentPossibilites result;
-    if (mob.last_intent[0] == 0 && mob.last_intent[1] == 0) {
-        result.push_back(std::pair<double, uint8_t>(1.0, 1));
-    } else if (mob.last_intent[0] == 1) {
-        result.push_back(std::pair<double, uint8_t>(1.0, 0));
+    if (history.last_intent[0] == 0 && history.last_intent[1] == 0) {
+        result.Add(1.0, 1);
+    } else if (history.last_intent[0] == 1) {
+        result.Add(1.0, 0);
     } else {
-        result.push_back(std::pair<double, uint8_t>(0.75, 0));
-        result.push_back(std::pair<double, uint8_t>(0.25, 1));
+        result.Add(0.75, 0);
+        result.Add(0.25, 1);
     }
     return result;
 }
 
+// intent table of Red Louse and Green Louse
+constexpr IntentTable intent_table_louse = BuildIntentTable(GetIntentRedLouse);
+static_assert(IsValidIntentTable(intent_table_louse), "");
+
 // base models for each mob are below
 BaseMonster base_mob_red_louse = {
     "Red Louse",
@@ -350,7 +542,7 @@ BaseMonster base_mob_red_louse = {
         {"Bite", {{kActionAttack, 6}}},
         {"Grow", {{kActionBuff, kBuffStrength, 4}}},
     },
-    GetIntentRedLouse,
+    &intent_table_louse,
 };
 
 // base models for each mob are below
@@ -361,55 +553,61 @@ BaseMonster base_mob_green_louse = {
         {"Bite", {{kActionAttack, 6}}},
         {"Spit Web", {{kActionDebuff, kBuffWeak, 2}}},
     },
-    GetIntentRedLouse, // same intent function for red and green
+    &intent_table_louse, // same intent table for red and green
 };
 
 // get intent of Lagavulin
-IntentPossibilites GetIntentLagavulin(Monster & mob) {
+constexpr IntentPossibilites GetIntentLagavulin(const IntentHistory & history) {
     IntentPossibilites result;
     // sleep first
-    if (mob.last_intent[2] == 255 && mob.hp == mob.max_hp) {
-        mob.block = 8;
-        mob.buff[kBuffMetallicize] = 8;
-        result.push_back(std::pair<double, uint8_t>(1.0, 0));
-    } else if (mob.last_intent[0] == 1 && mob.last_intent[1] == 1) {
-        result.push_back(std::pair<double, uint8_t>(1.0, 2));
+    if (history.last_intent[2] == 255 && !history.damaged) {
+        result.Add(1.0, 0);
+    } else if (history.last_intent[0] == 1 && history.last_intent[1] == 1) {
+        result.Add(1.0, 2);
     } else {
-        mob.block = 0;
-        mob.buff[kBuffMetallicize] = 0;
-        result.push_back(std::pair<double, uint8_t>(1.0, 1));
+        result.Add(1.0, 1);
     }
     return result;
 }
 
+// intent table of Lagavulin
+constexpr IntentTable intent_table_lagavulin = BuildIntentTable(GetIntentLagavulin);
+static_assert(IsValidIntentTable(intent_table_lagavulin), "");
+
 // base models for each mob are below
 BaseMonster base_mob_lagavulin = {
     "Lagavulin",
     {112, 115},
     {
-        {"Sleep", {{kActionNone}}},
-        {"Attack", {{kActionAttack, 20}}},
+        {"Sleep", {{kActionNone}},
+                   {{kActionSetBlock, 8}, {kActionSetBuff, kBuffMetallicize, 8}}},
+        {"Attack", {{kActionAttack, 20}},
+                    {{kActionSetBlock, 0}, {kActionSetBuff, kBuffMetallicize, 0}}},
         {"Siphon Soul", {{kActionDebuff, kBuffStrength, -2},
                          {kActionDebuff, kBuffDexterity, -2}}},
     },
-    GetIntentLagavulin,
+    &intent_table_lagavulin,
     kMonsterFlagElite,
 };
 
 // get intent of Gremlin Nob
-IntentPossibilites GetIntentGremlinNob(Monster & mob) {
+constexpr IntentPossibilites GetIntentGremlinNob(const IntentHistory & history) {
     IntentPossibilites result;
     // sleep first
-    if (mob.last_intent[0] == 255) {
-        result.push_back(std::pair<double, uint8_t>(1.0, 0));
-    } else if (mob.last_intent[0] != 2 && mob.last_intent[1] != 2) {
-        result.push_back(std::pair<double, uint8_t>(1.0, 2));
+    if (history.last_intent[0] == 255) {
+        result.Add(1.0, 0);
+    } else if (history.last_intent[0] != 2 && history.last_intent[1] != 2) {
+        result.Add(1.0, 2);
     } else {
-        result.push_back(std::pair<double, uint8_t>(1.0, 1));
+        result.Add(1.0, 1);
     }
     return result;
 }
 
+// intent table of Gremlin Nob
+constexpr IntentTable intent_table_gremlin_nob = BuildIntentTable(GetIntentGremlinNob);
+static_assert(IsValidIntentTable(intent_table_gremlin_nob), "");
+
 // base models for each mob are below
 BaseMonster base_mob_gremlin_nob = {
     "Gremlin Nob",
@@ -420,7 +618,7 @@ BaseMonster base_mob_gremlin_nob = {
         {"Skull Bash", {{kActionAttack, 8},
                          {kActionDebuff, kBuffVulnerable, 2}}},
     },
-    GetIntentGremlinNob,
+    &intent_table_gremlin_nob,
     kMonsterFlagElite,
 };
 
@@ -434,3 +632,15 @@ BaseMonster base_mob_test_100hp_10hp_attacker = {
     nullptr,
     kMonsterFlagTest,
 };
+
+// list of all base monsters (for looking up mobs by name)
+std::vector<const BaseMonster *> all_base_mobs = {
+    &base_mob_cultist,
+    &base_mob_jaw_worm,
+    &base_mob_blue_slaver,
+    &base_mob_red_louse,
+    &base_mob_green_louse,
+    &base_mob_lagavulin,
+    &base_mob_gremlin_nob,
+    &base_mob_test_100hp_10hp_attacker,
+};
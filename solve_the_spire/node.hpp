@@ -19,6 +19,8 @@
 #include "relics.hpp"
 #include "fight.hpp"
 #include "orbs.hpp"
+#include "profiler.hpp"
+#include "memory.hpp"
 
 // enum for a decision
 enum DecisionTypeEnum : uint8_t {
@@ -65,12 +67,23 @@ struct NodeFlagStruct {
     bool last_card_skill : 1;
 };
 
-// A Node contains all information about a game node.
-struct Node {
+// state shared between all nodes regardless of their size
+// (each thread has its own, so solves in different threads and contexts
+// don't affect each other)
+struct NodeShared {
     // set to true at tree start if we have cards where the last skill played matters
-    static bool last_card_skill_matters;
+    static thread_local bool last_card_skill_matters;
     // set to true at tree start if we have cards where the last attack played matters
-    static bool last_card_attack_matters;
+    static thread_local bool last_card_attack_matters;
+    // pointer to deck
+    static thread_local CardCollectionPtr deck;
+};
+
+// A Node contains all information about a game node.
+// (mob_slots is the number of mobs it can hold, so that fights with fewer
+// mobs don't pay for the largest fight)
+template <unsigned int mob_slots>
+struct BasicNode : NodeShared {
     // turn number
     uint8_t turn;
     // player energy
@@ -97,8 +110,6 @@ struct Node {
     // orbs
     std::vector<OrbStruct> orbs;
 #endif
-    // pointer to deck
-    static CardCollectionPtr deck;
     // hand
     CardCollectionPtr hand;
     // draw pile
@@ -108,9 +119,9 @@ struct Node {
     // exhausted pile
     CardCollectionPtr exhaust_pile;
     // pointer to parent node
-    Node * parent;
+    BasicNode * parent;
     // monsters (in order of action)
-    Monster monster[MAX_MOBS_PER_NODE];
+    Monster monster[mob_slots];
     // pre-actions
     Action pending_action[MAX_PENDING_ACTIONS];
     // buffs
@@ -126,9 +137,19 @@ struct Node {
     // (if tree_solved=true, this is the final composite objective)
     double objective;
     // list of children
-    vector<Node *> child;
+    vector<BasicNode *, TrackedAllocator<BasicNode *, kMemoryChildArrays>> child;
+    // allocate a node, counting it towards tracked memory
+    static void * operator new(std::size_t size) {
+        TrackMemory(kMemoryNodes, (int64_t) size);
+        return ::operator new(size);
+    }
+    // free a node
+    static void operator delete(void * ptr, std::size_t size) {
+        TrackMemory(kMemoryNodes, -(int64_t) size);
+        ::operator delete(ptr);
+    }
     // add a single child node with 100% probability
-    void AddChild(Node & child_node) {
+    void AddChild(BasicNode & child_node) {
         child.push_back(&child_node);
         child_node.parent = this;
     }
@@ -148,7 +169,7 @@ struct Node {
     // evoke an orb
     void EvokeOrb(OrbStruct & orb) {
         if (orb.type == kOrbLightning) {
-            if (MAX_MOBS_PER_NODE > 1 && monster[1].Exists()) {
+            if (mob_slots > 1 && monster[1].Exists()) {
                 printf("Random targeting with 2+ enemies not implemented\n");
                 exit(1);
             }
@@ -158,7 +179,7 @@ struct Node {
         } else if (orb.type == kOrbFrost) {
             block += 5 + focus;
         } else if (orb.type == kOrbDark) {
-            if (MAX_MOBS_PER_NODE > 1 && monster[1].Exists()) {
+            if (mob_slots > 1 && monster[1].Exists()) {
                 printf("Random targeting with 2+ enemies not implemented\n");
                 exit(1);
             }
@@ -190,7 +211,7 @@ struct Node {
         for (auto & orb : orbs) {
             if (orb.type == kOrbLightning) {
                 // only implemented for 1 mob alive
-                if (MAX_MOBS_PER_NODE > 1 && monster[1].Exists()) {
+                if (mob_slots > 1 && monster[1].Exists()) {
                     printf("Random targeting with 2+ enemies not implemented\n");
                     exit(1);
                 }
@@ -251,7 +272,7 @@ struct Node {
         // this is illegal, isn't it? Since it looks at children?
         //return CalculateObjective() + 1000.0 * layer;
         double x = 5.0 * hp;
-        for (int i = 0; i < MAX_MOBS_PER_NODE; ++i) {
+        for (unsigned int i = 0; i < mob_slots; ++i) {
             if (monster[i].Exists()) {
                 x += monster[i].max_hp - monster[i].hp;
             }
@@ -383,8 +404,8 @@ struct Node {
         }
     }
     // return the number of links between this and the given ancestor
-    uint16_t CountLevelsBelow(const Node & that) const {
-        const Node * node_ptr = this;
+    uint16_t CountLevelsBelow(const BasicNode & that) const {
+        const BasicNode * node_ptr = this;
         uint16_t level = 0;
         while (node_ptr != &that) {
             if (node_ptr->parent == nullptr) {
@@ -399,8 +420,8 @@ struct Node {
         return level;
     }
     // return true if this node has the given ancestor
-    bool HasAncestor(const Node & that) const {
-        const Node * node_ptr = this;
+    bool HasAncestor(const BasicNode & that) const {
+        const BasicNode * node_ptr = this;
         while (node_ptr != &that) {
             if (node_ptr->parent == nullptr) {
                 return false;
@@ -489,7 +510,7 @@ struct Node {
         assert(!flag.battle_done);
         assert(hp > 0);
         // no mobs should be present
-        for (int i = 0; i < MAX_MOBS_PER_NODE; ++i) {
+        for (unsigned int i = 0; i < mob_slots; ++i) {
             assert(!monster[i].Exists());
         }
         if (relics.meat_on_the_bone && hp * 2 <= max_hp) {
@@ -526,6 +547,22 @@ struct Node {
         }
         energy += buff[kBuffBerserk];
     }
+    // place the mobs of the given layout
+    void PlaceMobs(const std::vector<Monster> & layout) {
+        if (layout.size() > mob_slots) {
+            std::cout << "ERROR: increase MAX_MOBS_PER_NODE to at least "
+                << layout.size() << std::endl;
+            exit(1);
+        }
+        for (std::size_t i = 0; i < layout.size(); ++i) {
+            Monster & mob = monster[i];
+            mob = layout[i];
+            if (relics.preserved_insect && mob.IsElite()) {
+                uint16_t x = mob.hp / 4;
+                mob.hp -= x;
+            }
+        }
+    }
     // reset state to beginning of battle
     void StartBattle() {
         assert(turn == 0);
@@ -677,7 +714,7 @@ struct Node {
             }
         }
 #endif
-        for (int i = 0; i < MAX_MOBS_PER_NODE; ++i) {
+        for (unsigned int i = 0; i < mob_slots; ++i) {
             if (!monster[i].Exists()) {
                 continue;
             }
@@ -716,7 +753,7 @@ struct Node {
     // print tree
     void PrintTree(
             bool collapse = false,
-            Node * highlight = nullptr,
+            BasicNode * highlight = nullptr,
             std::string indent = "",
             std::string hanging_indent = "") const {
         // if node only has a single child, don't bother printing it
@@ -793,6 +830,7 @@ struct Node {
     // process the end turn action
     // (simulate end of turn and mob actions)
     void EndTurn() {
+        ProfileScope profile_scope(kProfileEndTurn);
         // set tree information
         parent_decision.type = kDecisionEndTurn;
         // process orbs
@@ -843,7 +881,7 @@ struct Node {
         // combust
         if (buff[kBuffCombustHpLoss]) {
             TakeDamage(buff[kBuffCombustHpLoss]);
-            for (int i = 0; i < MAX_MOBS_PER_NODE; ++i) {
+            for (unsigned int i = 0; i < mob_slots; ++i) {
                 auto & mob = monster[i];
                 if (!mob.Exists()) {
                     continue;
@@ -873,7 +911,7 @@ struct Node {
         ///////////////////////
 
         // apply poison to mobs
-        for (int i = 0; i < MAX_MOBS_PER_NODE; ++i) {
+        for (unsigned int i = 0; i < mob_slots; ++i) {
             auto & mob = monster[i];
             if (!mob.Exists()) {
                 continue;
@@ -885,7 +923,7 @@ struct Node {
         }
 
         // remove block on mobs
-        for (int i = 0; i < MAX_MOBS_PER_NODE; ++i) {
+        for (unsigned int i = 0; i < mob_slots; ++i) {
             auto & mob = monster[i];
             if (!mob.Exists()) {
                 continue;
@@ -904,7 +942,7 @@ struct Node {
             }
         }
         // do mob actions
-        for (int i = 0; i < MAX_MOBS_PER_NODE; ++i) {
+        for (unsigned int i = 0; i < mob_slots; ++i) {
             auto & mob = monster[i];
             if (!mob.Exists()) {
                 continue;
@@ -960,7 +998,7 @@ struct Node {
             }
         }
         // cycle mob buffs
-        for (int i = 0; i < MAX_MOBS_PER_NODE; ++i) {
+        for (unsigned int i = 0; i < mob_slots; ++i) {
             auto & mob = monster[i];
             if (!mob.Exists()) {
                 continue;
@@ -1010,7 +1048,7 @@ struct Node {
     }
     // return true if any mobs are alive
     bool MobsAlive() const {
-        for (int i = 0; i < MAX_MOBS_PER_NODE; ++i) {
+        for (unsigned int i = 0; i < mob_slots; ++i) {
             if (monster[i].Exists()) {
                 return true;
             }
@@ -1037,19 +1075,74 @@ struct Node {
         }
         return count;
     }
-    // sort mobs
-    void SortMobs() {
-        for (int i = 0; i < MAX_MOBS_PER_NODE - 1; ++i) {
-            if (!monster[i].Exists() && monster[i + 1].Exists()) {
-                monster[i] = monster[i + 1];
-                monster[i + 1].hp = 0;
-                monster[i + 1].base = nullptr;
+    // sort mobs into a canonical order
+    // (living mobs are moved to the front, and mobs of the same type are
+    // ordered by state so that symmetric positions compare equal)
+    // (if old_index isn't nullptr, it's filled with the old index of the mob
+    // at each new position)
+    void SortMobs(uint8_t * old_index = nullptr) {
+        // old index of the mob at each new position
+        uint8_t order[mob_slots];
+        uint8_t count = 0;
+        for (uint8_t i = 0; i < mob_slots; ++i) {
+            if (monster[i].Exists()) {
+                order[count++] = i;
+            }
+        }
+        const uint8_t living_count = count;
+        for (uint8_t i = 0; i < mob_slots; ++i) {
+            if (!monster[i].Exists()) {
+                order[count++] = i;
+            }
+        }
+        // sort mobs of the same type among the positions that type occupies
+        if constexpr (mob_slots > 1) {
+            for (uint8_t i = 1; i < living_count; ++i) {
+                for (uint8_t j = i; j > 0; --j) {
+                    // find previous position with the same type of mob
+                    uint8_t k = j - 1;
+                    while (k > 0 &&
+                            monster[order[k]].base != monster[order[j]].base) {
+                        --k;
+                    }
+                    if (monster[order[k]].base != monster[order[j]].base ||
+                            !monster[order[j]].CanonicalLess(monster[order[k]])) {
+                        break;
+                    }
+                    std::swap(order[j], order[k]);
+                    j = k + 1;
+                }
+            }
+        }
+        if (old_index != nullptr) {
+            std::copy(order, order + mob_slots, old_index);
+        }
+        // rearrange mobs if their order changed
+        bool sorted = true;
+        for (uint8_t i = 0; i < mob_slots; ++i) {
+            if (order[i] != i) {
+                sorted = false;
+                break;
+            }
+        }
+        if (!sorted) {
+            Monster old_monster[mob_slots];
+            std::copy(monster, monster + mob_slots, old_monster);
+            for (uint8_t i = 0; i < mob_slots; ++i) {
+                monster[i] = old_monster[order[i]];
+            }
+        }
+        // clear dead mobs so that equal positions compare equal
+        for (uint8_t i = living_count; i < mob_slots; ++i) {
+            if (monster[i].base != nullptr) {
+                monster[i] = Monster();
             }
         }
     }
     // play a card
     // target is mob index or card in hand index
     void PlayCard(card_index_t index, uint8_t target = 0) {
+        ProfileScope profile_scope(kProfilePlayCard);
         const auto & card = *card_map[index];
         // set up decision information
         parent_decision.type = kDecisionPlayCard;
@@ -1223,7 +1316,7 @@ struct Node {
                         amount = amount * 3 / 4;
                     }
                     for (int16_t i = 0; i < count; ++i) {
-                        for (int16_t m = 0; m < MAX_MOBS_PER_NODE; ++m) {
+                        for (unsigned int m = 0; m < mob_slots; ++m) {
                             auto & this_mob = monster[m];
                             if (this_mob.Exists()) {
                                 this_mob.Attack(amount);
@@ -1264,7 +1357,7 @@ struct Node {
                 case kActionDebuffAll:
                 {
                     assert(!card.flag.targeted);
-                    for (int i = 0; i < MAX_MOBS_PER_NODE; ++i) {
+                    for (unsigned int i = 0; i < mob_slots; ++i) {
                         if (!monster[i].Exists()) {
                             continue;
                         }
@@ -1428,8 +1521,181 @@ struct Node {
         flag.last_card_attack = card.flag.attack;
         flag.last_card_skill = card.flag.skill;
     }
+    // call outcome(probability, transition) for each combination of mob
+    // intents, where transition(node) applies it to a copy of this node
+    template <class Function>
+    void ForEachIntentOutcome(Function outcome) const {
+        assert(pending_action[0].type == kActionGenerateMobIntents);
+        // hold new intent list for all mobs
+        const IntentPossibilites * new_intent[mob_slots] = {nullptr};
+        for (unsigned int i = 0; i < mob_slots; ++i) {
+            if (!monster[i].Exists()) {
+                continue;
+            }
+            new_intent[i] = &monster[i].GetIntents();
+        }
+        uint8_t intent_index[mob_slots] = {0};
+        while (true) {
+            double probability = 1.0;
+            for (unsigned int i = 0; i < mob_slots; ++i) {
+                if (new_intent[i] != nullptr) {
+                    probability *= (*new_intent[i])[intent_index[i]].probability;
+                }
+            }
+            outcome(probability, [&](BasicNode & new_node) {
+                new_node.PopPendingAction();
+                for (unsigned int i = 0; i < mob_slots; ++i) {
+                    if (new_intent[i] != nullptr) {
+                        new_node.monster[i].SelectIntent(
+                            (*new_intent[i])[intent_index[i]].intent);
+                    }
+                }
+                // identical mobs with swapped intents lead to the same state
+                new_node.SortMobs();
+            });
+            // increment
+            bool done = true;
+            for (unsigned int i = 0; i < mob_slots; ++i) {
+                if (new_intent[i] == nullptr) {
+                    continue;
+                }
+                ++intent_index[i];
+                if (intent_index[i] >= new_intent[i]->size()) {
+                    intent_index[i] = 0;
+                } else {
+                    done = false;
+                    break;
+                }
+            }
+            if (done) {
+                break;
+            }
+        }
+    }
+    // call outcome(probability, transition) for each result of the pending
+    // draw, where transition(node) applies it to a copy of this node
+    template <class Function>
+    void ForEachDrawOutcome(Function outcome) const {
+        assert(pending_action[0].type == kActionDrawCards);
+        assert(pending_action[0].arg[0] > 0);
+        // if draw pile is empty, move cards from discard to draw pile
+        if (draw_pile.IsEmpty() && !discard_pile.IsEmpty()) {
+            outcome(1.0, [](BasicNode & new_node) {
+                new_node.draw_pile = new_node.discard_pile;
+                new_node.discard_pile.Clear();
+            });
+            return;
+        }
+        // draw as many cards as we can
+        card_count_t to_draw = (card_count_t) pending_action[0].arg[0];
+        if (draw_pile.Count() < to_draw) {
+            to_draw = draw_pile.Count();
+        }
+        if (hand.Count() + to_draw > 10) {
+            to_draw = 10 - hand.Count();
+        }
+        // if there aren't any cards to draw, then don't
+        if (to_draw == 0) {
+            outcome(1.0, [](BasicNode & new_node) {
+                new_node.PopPendingAction();
+            });
+            return;
+        }
+        // else draw all cards we can
+        const auto & choices = *draw_pile.Select(to_draw);
+        for (const auto & choice : choices) {
+            outcome(choice.first, [&](BasicNode & new_node) {
+                if (to_draw == new_node.pending_action[0].arg[0]) {
+                    new_node.PopPendingAction();
+                } else {
+                    new_node.pending_action[0].arg[0] -= to_draw;
+                }
+                new_node.hand.AddDeck(choice.second.first);
+                new_node.draw_pile = choice.second.second;
+            });
+        }
+    }
+    // call choice(transition) for each unique card play available, where
+    // transition(node) plays it on a copy of this node
+    // (stops and returns false once choice returns false)
+    template <class Function>
+    bool ForEachCardPlay(Function choice) const {
+        for (const auto & deck_item : hand) {
+            // alias the card
+            const card_index_t card_index = deck_item.first;
+            const Card & card = *card_map[card_index];
+            // skip this card if it's unplayable or too expensive
+            if (card.flag.unplayable || card.cost > energy) {
+                continue;
+            }
+            // play the card, then add it to the exhaust or discard pile
+            auto play = [&card, card_index](BasicNode & new_node, uint8_t target) {
+                new_node.hand.RemoveCard(card_index);
+                new_node.PlayCard(card_index, target);
+                new_node.SortMobs();
+                if (!new_node.IsBattleDone()) {
+                    if (card.flag.exhausts) {
+                        new_node.exhaust_pile.AddCard(card_index);
+                    } else {
+                        new_node.discard_pile.AddCard(card_index);
+                    }
+                }
+            };
+            if (card.flag.targeted) {
+                assert(!card.flag.target_card_in_hand);
+                // if targeted, cycle among all possible targets
+                for (unsigned int m = 0; m < mob_slots; ++m) {
+                    if (!monster[m].Exists()) {
+                        continue;
+                    }
+                    if (!choice([&](BasicNode & new_node) {
+                            play(new_node, (uint8_t) m);
+                        })) {
+                        return false;
+                    }
+                }
+            } else if (card.flag.target_card_in_hand) {
+                assert(&card == &card_armaments);
+                // play on each card that has an upgraded version
+                const auto & deck = hand.node_ptr->collection.card;
+                for (card_index_t c = 0; c < deck.size(); ++c) {
+                    const card_index_t other_card_index = deck[c].first;
+                    // cannot target itself
+                    if (other_card_index == card_index && deck_item.second == 1) {
+                        continue;
+                    }
+                    // target all cards that can be upgraded
+                    if (card.upgraded_version == nullptr) {
+                        continue;
+                    }
+                    if (!choice([&](BasicNode & new_node) {
+                            CardCollectionPtr new_hand = new_node.hand;
+                            new_hand.RemoveCard(card_index);
+                            assert(new_hand.CountCard(other_card_index) > 0);
+                            play(new_node, (uint8_t)
+                                new_hand.GetLocalIndex(other_card_index));
+                        })) {
+                        return false;
+                    }
+                }
+                // play on nothing
+                if (!choice([&](BasicNode & new_node) {
+                        play(new_node, (uint8_t) -1);
+                    })) {
+                    return false;
+                }
+            } else {
+                if (!choice([&](BasicNode & new_node) {
+                        play(new_node, 0);
+                    })) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
     // return true if this node is strictly worse or equal to the given node
-    bool IsWorseOrEqual(const Node & that) const {
+    bool IsWorseOrEqual(const BasicNode & that) const {
         if (that.IsBattleDone() &&
             objective <= that.objective) {
             return true;
@@ -1490,7 +1756,7 @@ struct Node {
         if (hand != that.hand) {
             return false;
         }
-        for (int i = 0; i < MAX_MOBS_PER_NODE; ++i) {
+        for (unsigned int i = 0; i < mob_slots; ++i) {
             auto & mob = monster[i];
             auto & that_mob = that.monster[i];
             if (!mob.Exists()) {
@@ -1500,9 +1766,22 @@ struct Node {
                     continue;
                 }
             }
+            // a mob killed in that node is better than any live one
+            if (!that_mob.Exists()) {
+                continue;
+            }
+            // mobs in the same position may differ after sorting
+            if (mob.base != that_mob.base ||
+                    memcmp(mob.last_intent, that_mob.last_intent,
+                        sizeof(mob.last_intent)) != 0) {
+                return false;
+            }
             if (mob.hp < that_mob.hp) {
                 return false;
             }
+            if (mob.block < that_mob.block) {
+                return false;
+            }
             if (!mob.buff.MobIsWorseOrEqual(that_mob.buff)) {
                 return false;
             }
@@ -1512,20 +1791,261 @@ struct Node {
         }
         return true;
     }
+    // return true if the game state of this node matches the other node
+    // (tree links, probability and objective are ignored)
+    // (if ignore_mob_hp is true, mobs only need to have taken the same damage)
+    bool IsSameState(const BasicNode & that, bool ignore_mob_hp = false) const {
+        if (turn != that.turn ||
+                energy != that.energy ||
+                max_hp != that.max_hp ||
+                hp != that.hp ||
+                block != that.block ||
+                stance != that.stance) {
+            return false;
+        }
+        if (flag.battle_done != that.flag.battle_done ||
+                flag.last_card_attack != that.flag.last_card_attack ||
+                flag.last_card_skill != that.flag.last_card_skill) {
+            return false;
+        }
+#ifdef USE_ORBS
+        if (focus != that.focus || orb_slots != that.orb_slots ||
+                orbs.size() != that.orbs.size()) {
+            return false;
+        }
+        for (std::size_t i = 0; i < orbs.size(); ++i) {
+            if (orbs[i].type != that.orbs[i].type ||
+                    orbs[i].damage != that.orbs[i].damage) {
+                return false;
+            }
+        }
+#endif
+        if (hand != that.hand ||
+                draw_pile != that.draw_pile ||
+                discard_pile != that.discard_pile ||
+                exhaust_pile != that.exhaust_pile) {
+            return false;
+        }
+        for (unsigned int i = 0; i < mob_slots; ++i) {
+            if (ignore_mob_hp) {
+                if (!monster[i].IsSameExceptHP(that.monster[i])) {
+                    return false;
+                }
+            } else if (monster[i] != that.monster[i]) {
+                return false;
+            }
+        }
+        for (unsigned int i = 0; i < MAX_PENDING_ACTIONS; ++i) {
+            if (pending_action[i].type != that.pending_action[i].type ||
+                    pending_action[i].arg[0] != that.pending_action[i].arg[0] ||
+                    pending_action[i].arg[1] != that.pending_action[i].arg[1]) {
+                return false;
+            }
+        }
+        return buff == that.buff && relics == that.relics;
+    }
+    // return a hash of the game state
+    // (nodes with IsSameState() true have the same hash)
+    std::size_t GetStateHash(bool ignore_mob_hp = false) const {
+        std::size_t hash = 0;
+        auto add = [&hash](std::size_t x) {
+            hash = (hash ^ x) * 1099511628211ULL;
+        };
+        add(turn);
+        add(energy);
+        add(max_hp);
+        add(hp);
+        add(block);
+        add(stance);
+        add(flag.battle_done);
+        add((std::size_t) hand.node_ptr);
+        add((std::size_t) draw_pile.node_ptr);
+        add((std::size_t) discard_pile.node_ptr);
+        add((std::size_t) exhaust_pile.node_ptr);
+        for (const auto & mob : monster) {
+            add((std::size_t) mob.base);
+            add(ignore_mob_hp ? mob.max_hp - mob.hp : mob.hp);
+            add(mob.block);
+            add(mob.last_intent[0]);
+        }
+        for (const auto & action : pending_action) {
+            add(action.type);
+            add(action.arg[0]);
+        }
+        for (const auto & value : buff.value) {
+            add(value);
+        }
+        return hash;
+    }
+    // return the bits of a value mixed together (the splitmix64 finalizer)
+    static uint64_t MixHash(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xBF58476D1CE4E5B9ULL;
+        x ^= x >> 27;
+        x *= 0x94D049BB133111EBULL;
+        x ^= x >> 31;
+        return x;
+    }
+    // call add(x) with each part of the game state which is the same between
+    // runs, so that it may be hashed
+    // (cards and mobs are given by a hash of their name with the given seed
+    // rather than by index or pointer, and solver settings which change
+    // solved values are included)
+    template <class Function>
+    void AddCanonicalState(uint64_t seed, Function add) const {
+        auto name_hash = [seed](const std::string & text) {
+            uint64_t hash = 14695981039346656037ULL ^ seed;
+            for (unsigned char c : text) {
+                hash = (hash ^ c) * 1099511628211ULL;
+            }
+            return hash;
+        };
+        auto add_pile = [&](const CardCollectionPtr & pile) {
+            // cards are sorted by index, so combine them in an order
+            // independent way
+            uint64_t pile_hash = pile.Count();
+            for (const auto & deck_item : pile) {
+                pile_hash += MixHash(
+                    name_hash(card_map[deck_item.first]->name) +
+                    deck_item.second);
+            }
+            add(pile_hash);
+        };
+        add(solve_cache_version);
+        add(upgrades_strictly_better);
+        add(always_avoid_dying);
+        add(last_card_attack_matters);
+        add(last_card_skill_matters);
+        // (turn is left out since it doesn't change the value of a state)
+        add(energy);
+        add(max_hp);
+        add(hp);
+        add(block);
+        add(stance);
+        add(flag.battle_done);
+        add(flag.last_card_attack);
+        add(flag.last_card_skill);
+#ifdef USE_ORBS
+        add(focus);
+        add(orb_slots);
+        add(orbs.size());
+        for (const auto & orb : orbs) {
+            add(orb.type);
+            add(orb.damage);
+        }
+#endif
+        add_pile(hand);
+        add_pile(draw_pile);
+        add_pile(discard_pile);
+        add_pile(exhaust_pile);
+        for (const auto & mob : monster) {
+            add(mob.base == nullptr ? 0 : name_hash(mob.base->name));
+            add(mob.hp);
+            add(mob.max_hp);
+            add(mob.block);
+            for (const auto & intent : mob.last_intent) {
+                add(intent);
+            }
+            for (const auto & value : mob.buff.value) {
+                add((uint16_t) value);
+            }
+        }
+        for (const auto & action : pending_action) {
+            add(action.type);
+            add(action.arg[0]);
+            add(action.arg[1]);
+        }
+        for (const auto & value : buff.value) {
+            add((uint16_t) value);
+        }
+        uint32_t relic_bits = 0;
+        static_assert(sizeof(relic_bits) == sizeof(RelicStruct), "");
+        memcpy(&relic_bits, &relics, sizeof(relic_bits));
+        add(relic_bits);
+    }
+    // return a hash of the game state which is the same between runs
+    uint64_t GetCanonicalStateHash() const {
+        uint64_t hash = 14695981039346656037ULL;
+        AddCanonicalState(0, [&hash](uint64_t x) {
+            for (int i = 0; i < 8; ++i) {
+                hash = (hash ^ (x & 0xFF)) * 1099511628211ULL;
+                x >>= 8;
+            }
+        });
+        return hash;
+    }
+    // return a second hash of the game state which is the same between runs
+    // (it is computed independently of GetCanonicalStateHash, so a state
+    // found by that hash can be checked against this one)
+    uint64_t GetCanonicalStateCheckHash() const {
+        uint64_t hash = 0x9E3779B97F4A7C15ULL;
+        AddCanonicalState(0x5851F42D4C957F2DULL, [&hash](uint64_t x) {
+            hash = MixHash(hash ^ x) + 0x9E3779B97F4A7C15ULL;
+        });
+        return hash;
+    }
     // return true if this is a terminal node
     bool IsTerminal() const {
         return child.empty() && IsBattleDone();
     }
+    // copy the state of a node with a different number of mob slots
+    // (parent and children are not copied)
+    template <unsigned int other_slots>
+    void CopyStateFrom(const BasicNode<other_slots> & that) {
+        turn = that.turn;
+        energy = that.energy;
+        layer = that.layer;
+        max_hp = that.max_hp;
+        hp = that.hp;
+        block = that.block;
+        stance = that.stance;
+        flag = that.flag;
+#ifdef USE_ORBS
+        focus = that.focus;
+        orb_slots = that.orb_slots;
+        orbs = that.orbs;
+#endif
+        hand = that.hand;
+        draw_pile = that.draw_pile;
+        discard_pile = that.discard_pile;
+        exhaust_pile = that.exhaust_pile;
+        parent = nullptr;
+        for (unsigned int i = 0; i < mob_slots; ++i) {
+            monster[i] = (i < other_slots) ? that.monster[i] : Monster();
+        }
+        for (unsigned int i = mob_slots; i < other_slots; ++i) {
+            if (that.monster[i].Exists()) {
+                printf("ERROR: not enough mob slots to copy node\n");
+                exit(1);
+            }
+        }
+        std::copy(
+            that.pending_action,
+            that.pending_action + MAX_PENDING_ACTIONS,
+            pending_action);
+        buff = that.buff;
+        relics = that.relics;
+        probability = that.probability;
+        parent_decision = that.parent_decision;
+        objective = that.objective;
+        child.clear();
+    }
 };
 
+// node large enough for any fight
+typedef BasicNode<MAX_MOBS_PER_NODE> Node;
+
 // output to a stringstream
-std::stringstream & operator<< (std::stringstream & out, const Node & node) {
+template <unsigned int mob_slots>
+std::stringstream & operator<< (
+        std::stringstream & out,
+        const BasicNode<mob_slots> & node) {
     out << node.ToString();
     return out;
 }
 
-bool Node::last_card_skill_matters = false;
-bool Node::last_card_attack_matters = false;
+thread_local bool NodeShared::last_card_skill_matters = false;
+thread_local bool NodeShared::last_card_attack_matters = false;
 
 // emtpy deck
-CardCollectionPtr Node::deck = CardCollectionPtr();
+thread_local CardCollectionPtr NodeShared::deck = CardCollectionPtr();
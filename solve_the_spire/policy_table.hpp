@@ -0,0 +1,398 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+#include "defines.h"
+#include "card_collection_map.hpp"
+#include "node.hpp"
+#include "wire_format.hpp"
+#include "mapped_file.hpp"
+#include "trace.hpp"
+
+// A policy table maps each decision state in a solved tree to the decision
+// the solver made there, so the best play can be looked up without solving.
+// States are keyed by their canonical state hash, which uses card and mob
+// names and so doesn't depend on the process which built the table.
+//
+// The table uses a minimal perfect hash built by hash and displace: keys are
+// split into buckets, and each bucket stores a seed which sends all of its
+// keys to free slots.  A lookup hashes the key to a bucket, then the seed
+// gives its slot, and the key and check hash stored in the slot tell whether
+// the state is in the table at all.  The file is memory mapped, so a lookup
+// touches two pages.
+//
+// States are hashed with their mobs sorted, as in the tree, so a lookup
+// sorts the mobs of the state first and gives the target in the caller's
+// mob order.
+//
+// File layout:
+// * PolicyTableHeader
+// * uint32 seed for each bucket
+// * PolicyTableSlot for each key
+// * card table: uint16 count, then each card name
+
+// policy table file header
+struct PolicyTableHeader {
+    // file type
+    char magic[8];
+    // solve_cache_version of the program which wrote the file
+    uint32_t version;
+    // number of mob slots of the nodes whose states were hashed
+    uint8_t mob_slots;
+    // NodeShared::last_card_attack_matters during the solve
+    uint8_t last_card_attack_matters;
+    // NodeShared::last_card_skill_matters during the solve
+    uint8_t last_card_skill_matters;
+    // unused
+    uint8_t reserved;
+    // number of keys (and slots)
+    uint64_t key_count;
+    // number of buckets
+    uint64_t bucket_count;
+    // file offset of the card table
+    uint64_t card_table_offset;
+    // total file size
+    uint64_t file_size;
+};
+
+// policy table slot
+struct PolicyTableSlot {
+    // canonical state hash
+    uint64_t key;
+    // canonical state check hash
+    uint64_t check;
+    // decision type
+    DecisionTypeEnum type;
+    // card table index of the card to play, if any
+    card_index_t card;
+    // mob to target, if any
+    uint16_t target;
+    // unused
+    uint32_t reserved;
+};
+
+// mix the bits of a value (the splitmix64 finalizer)
+inline uint64_t MixPolicyHash(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// return the bucket of a key
+inline uint64_t GetPolicyBucket(uint64_t key, uint64_t bucket_count) {
+    return MixPolicyHash(key) % bucket_count;
+}
+
+// return the slot of a key given its bucket's seed
+inline uint64_t GetPolicySlot(uint64_t key, uint32_t seed, uint64_t key_count) {
+    return MixPolicyHash(key ^ MixPolicyHash(0x9E3779B97F4A7C15ULL + seed)) % key_count;
+}
+
+// decision made at a state, and the state's check hash
+struct PolicyDecision {
+    // canonical state check hash
+    uint64_t check;
+    // decision made
+    Decision decision;
+};
+
+// collect the decision made at each solved decision state below a node by
+// canonical state hash
+// (a state reached more than once keeps its first decision)
+// (states are stored with their mobs sorted, and targets in that order,
+// since the top node of a tree may not be sorted)
+template <unsigned int mob_slots>
+void CollectPolicy(
+        const BasicNode<mob_slots> & top_node,
+        std::unordered_map<uint64_t, PolicyDecision> & policy) {
+    std::vector<const BasicNode<mob_slots> *> stack(1, &top_node);
+    while (!stack.empty()) {
+        const BasicNode<mob_slots> & node = *stack.back();
+        stack.pop_back();
+        if (node.flag.tree_solved && !node.HasPendingActions() &&
+                !node.IsBattleDone() && node.child.size() == 1) {
+            BasicNode<mob_slots> sorted_node;
+            sorted_node.CopyStateFrom(node);
+            uint8_t old_index[mob_slots];
+            sorted_node.SortMobs(old_index);
+            Decision decision = node.child[0]->parent_decision;
+            if (decision.type == kDecisionPlayCard) {
+                for (uint8_t i = 0; i < mob_slots; ++i) {
+                    if (old_index[i] == decision.argument[1]) {
+                        decision.argument[1] = i;
+                        break;
+                    }
+                }
+            }
+            policy.emplace(sorted_node.GetCanonicalStateHash(), PolicyDecision{
+                sorted_node.GetCanonicalStateCheckHash(), decision});
+        }
+        for (const auto & child_ptr : node.child) {
+            stack.push_back(child_ptr);
+        }
+    }
+}
+
+// write the policy of a solved tree to a policy table, return true if
+// successful
+template <unsigned int mob_slots>
+bool WritePolicyTable(const BasicNode<mob_slots> & top_node, std::string filename) {
+    TraceScope trace_scope("write_policy_table");
+    std::unordered_map<uint64_t, PolicyDecision> policy;
+    CollectPolicy(top_node, policy);
+    PolicyTableHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "STSPLCY", 8);
+    header.version = solve_cache_version;
+    header.mob_slots = (uint8_t) mob_slots;
+    header.last_card_attack_matters = NodeShared::last_card_attack_matters;
+    header.last_card_skill_matters = NodeShared::last_card_skill_matters;
+    header.key_count = policy.size();
+    header.bucket_count = std::max<uint64_t>(1, policy.size() / policy_keys_per_bucket);
+    // sort keys into buckets
+    std::vector<std::vector<uint64_t>> bucket(header.bucket_count);
+    for (const auto & item : policy) {
+        bucket[GetPolicyBucket(item.first, header.bucket_count)].push_back(item.first);
+    }
+    // place the largest buckets first, while most slots are free
+    std::vector<uint32_t> bucket_order(header.bucket_count);
+    for (uint32_t i = 0; i < bucket_order.size(); ++i) {
+        bucket_order[i] = i;
+    }
+    std::stable_sort(bucket_order.begin(), bucket_order.end(),
+        [&bucket](uint32_t a, uint32_t b) {
+            return bucket[a].size() > bucket[b].size();
+        });
+    std::vector<uint32_t> seed(header.bucket_count, 0);
+    std::vector<PolicyTableSlot> slot(header.key_count);
+    std::vector<bool> used(header.key_count, false);
+    std::vector<uint64_t> this_slot;
+    for (uint32_t b : bucket_order) {
+        if (bucket[b].empty()) {
+            break;
+        }
+        for (uint32_t this_seed = 0; ; ++this_seed) {
+            if (this_seed == 0xFFFFFFFF) {
+                return false;
+            }
+            this_slot.clear();
+            bool good = true;
+            for (uint64_t key : bucket[b]) {
+                const uint64_t s = GetPolicySlot(key, this_seed, header.key_count);
+                if (used[s] || std::find(this_slot.begin(), this_slot.end(), s) !=
+                        this_slot.end()) {
+                    good = false;
+                    break;
+                }
+                this_slot.push_back(s);
+            }
+            if (!good) {
+                continue;
+            }
+            seed[b] = this_seed;
+            for (std::size_t i = 0; i < bucket[b].size(); ++i) {
+                const uint64_t key = bucket[b][i];
+                const PolicyDecision & item = policy.at(key);
+                const Decision & decision = item.decision;
+                PolicyTableSlot & entry = slot[this_slot[i]];
+                entry.key = key;
+                entry.check = item.check;
+                entry.type = decision.type;
+                if (decision.type == kDecisionPlayCard) {
+                    entry.card = (card_index_t) decision.argument[0];
+                    entry.target = decision.argument[1];
+                }
+                used[this_slot[i]] = true;
+            }
+            break;
+        }
+    }
+    FILE * file = fopen(filename.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    header.card_table_offset = sizeof(header) +
+        header.bucket_count * sizeof(uint32_t) +
+        header.key_count * sizeof(PolicyTableSlot);
+    WireWriter out;
+    out.file = file;
+    out.Put(header);
+    for (uint32_t this_seed : seed) {
+        out.Put(this_seed);
+    }
+    for (const auto & entry : slot) {
+        out.Put(entry);
+    }
+    const std::size_t card_count = card_map_count.load();
+    out.Put((uint16_t) card_count);
+    for (std::size_t i = 0; i < card_count; ++i) {
+        out.PutString(card_map[i]->name);
+    }
+    header.file_size = out.GetPosition();
+    out.Flush();
+    bool good = !out.failed &&
+        fseek(file, 0, SEEK_SET) == 0 &&
+        fwrite(&header, sizeof(header), 1, file) == 1;
+    if (fclose(file) != 0) {
+        good = false;
+    }
+    return good;
+}
+
+// a policy table opened for lookups
+struct PolicyTable {
+    // mapped file
+    MappedFile file;
+    // index in this process of each card in the card table
+    std::vector<card_index_t> card_index;
+    // destructor
+    ~PolicyTable() {
+        Close();
+    }
+    // return the header
+    const PolicyTableHeader & GetHeader() const {
+        return *(const PolicyTableHeader *) file.data;
+    }
+    // return the seed of a bucket
+    uint32_t GetSeed(uint64_t bucket) const {
+        return file.Get<uint32_t>(sizeof(PolicyTableHeader) + bucket * sizeof(uint32_t));
+    }
+    // return a slot
+    const PolicyTableSlot & GetSlot(uint64_t index) const {
+        return ((const PolicyTableSlot *) (file.data + sizeof(PolicyTableHeader) +
+            GetHeader().bucket_count * sizeof(uint32_t)))[index];
+    }
+    // return the number of states in the table
+    uint64_t GetStateCount() const {
+        return GetHeader().key_count;
+    }
+    // return true if the header of the opened file is valid
+    bool IsValid() const {
+        if (file.size < sizeof(PolicyTableHeader)) {
+            return false;
+        }
+        const PolicyTableHeader & header = GetHeader();
+        return memcmp(header.magic, "STSPLCY", 8) == 0 &&
+            header.version == solve_cache_version &&
+            header.mob_slots >= 1 &&
+            header.mob_slots <= MAX_MOBS_PER_NODE &&
+            header.file_size == file.size &&
+            header.bucket_count > 0 &&
+            header.card_table_offset == sizeof(PolicyTableHeader) +
+                header.bucket_count * sizeof(uint32_t) +
+                header.key_count * sizeof(PolicyTableSlot) &&
+            header.card_table_offset + sizeof(uint16_t) <= file.size;
+    }
+    // open a policy table, return true if successful
+    bool Open(std::string filename) {
+        Close();
+        if (!file.Open(filename) || !IsValid()) {
+            Close();
+            return false;
+        }
+        uint64_t offset = GetHeader().card_table_offset;
+        card_index.resize(file.Get<uint16_t>(offset));
+        offset += sizeof(uint16_t);
+        for (auto & index : card_index) {
+            std::string name;
+            const Card * card = nullptr;
+            if (file.GetString(offset, name)) {
+                card = GetCardByName(name);
+            }
+            if (card == nullptr) {
+                Close();
+                return false;
+            }
+            index = card->GetIndex();
+        }
+        return true;
+    }
+    // close the table
+    void Close() {
+        file.Close();
+        card_index.clear();
+    }
+    // look up a state by its canonical state hash and check hash, return
+    // true if found
+    bool Lookup(uint64_t key, uint64_t check, Decision & decision) const {
+        const PolicyTableHeader & header = GetHeader();
+        if (header.key_count == 0) {
+            return false;
+        }
+        const uint64_t bucket = GetPolicyBucket(key, header.bucket_count);
+        const PolicyTableSlot & entry =
+            GetSlot(GetPolicySlot(key, GetSeed(bucket), header.key_count));
+        if (entry.key != key || entry.check != check) {
+            return false;
+        }
+        decision.type = entry.type;
+        decision.argument[0] = 0;
+        decision.argument[1] = 0;
+        if (entry.type == kDecisionPlayCard) {
+            decision.argument[0] = card_index[entry.card];
+            decision.argument[1] = entry.target;
+        }
+        return true;
+    }
+    // look up the state of a node, return true if found
+    // (the state is hashed as it was during the solve, and the target is in
+    // the node's mob order)
+    template <unsigned int mob_slots>
+    bool LookupNode(const BasicNode<mob_slots> & node, Decision & decision) const {
+        const PolicyTableHeader & header = GetHeader();
+        for (unsigned int i = header.mob_slots; i < mob_slots; ++i) {
+            if (node.monster[i].Exists()) {
+                return false;
+            }
+        }
+        const bool old_attack_matters = NodeShared::last_card_attack_matters;
+        const bool old_skill_matters = NodeShared::last_card_skill_matters;
+        NodeShared::last_card_attack_matters = header.last_card_attack_matters != 0;
+        NodeShared::last_card_skill_matters = header.last_card_skill_matters != 0;
+        bool found = false;
+        switch (header.mob_slots) {
+            case 1:
+                found = LookupSorted<1>(node, decision);
+                break;
+            case 2:
+                found = LookupSorted<2>(node, decision);
+                break;
+            case 3:
+                found = LookupSorted<3>(node, decision);
+                break;
+            default:
+                found = LookupSorted<MAX_MOBS_PER_NODE>(node, decision);
+                break;
+        }
+        NodeShared::last_card_attack_matters = old_attack_matters;
+        NodeShared::last_card_skill_matters = old_skill_matters;
+        return found;
+    }
+    // look up the state of a node with the given mob slots and its mobs
+    // sorted, return true if found
+    // (the target is mapped back to the node's mob order)
+    template <unsigned int slots, unsigned int mob_slots>
+    bool LookupSorted(const BasicNode<mob_slots> & node, Decision & decision) const {
+        BasicNode<slots> copy;
+        copy.CopyStateFrom(node);
+        uint8_t old_index[slots];
+        copy.SortMobs(old_index);
+        if (!Lookup(copy.GetCanonicalStateHash(),
+                copy.GetCanonicalStateCheckHash(), decision)) {
+            return false;
+        }
+        if (decision.type == kDecisionPlayCard && decision.argument[1] < slots) {
+            decision.argument[1] = old_index[decision.argument[1]];
+        }
+        return true;
+    }
+};
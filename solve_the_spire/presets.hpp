@@ -1,6 +1,7 @@
 #pragma once
 
 #include <map>
+#include <vector>
 
 #include "defines.h"
 #include "card_collection_map.hpp"
@@ -25,10 +26,253 @@ std::map<std::string, CharacterType> character_map = {
     {"watcher", {"Watcher", "starting_watcher_cursed", "pure_water", 72}},
 };
 
+// list of all cards (for looking up cards by name)
+std::vector<const Card *> all_cards = {
+    &card_strike_plus,
+    &card_strike,
+    &card_defend_plus,
+    &card_defend,
+    &card_ascenders_bane,
+    &card_wound,
+    &card_dazed,
+    &card_burn,
+    &card_bandage_up,
+    &card_blind,
+    &card_dark_shackles,
+    &card_flash_of_steel,
+    &card_bash_plus,
+    &card_bash,
+    &card_anger_plus,
+    &card_anger,
+    &card_armaments_plus,
+    &card_armaments,
+    &card_body_slam_plus,
+    &card_body_slam,
+    &card_cleave_plus,
+    &card_cleave,
+    &card_clothesline_plus,
+    &card_clothesline,
+    &card_flex_plus,
+    &card_flex,
+    &card_heavy_blade_plus,
+    &card_heavy_blade,
+    &card_iron_wave_plus,
+    &card_iron_wave,
+    &card_perfected_strike_plus,
+    &card_perfected_strike,
+    &card_pommel_strike_plus,
+    &card_pommel_strike,
+    &card_shrug_it_off_plus,
+    &card_shrug_it_off,
+    &card_sword_boomerang_plus,
+    &card_sword_boomerang,
+    &card_thunderclap_plus,
+    &card_thunderclap,
+    &card_twin_strike_plus,
+    &card_twin_strike,
+    &card_wild_strike_plus,
+    &card_wild_strike,
+    &card_battle_trance_plus,
+    &card_battle_trance,
+    &card_bloodletting_plus,
+    &card_bloodletting,
+    &card_carnage_plus,
+    &card_carnage,
+    &card_combust_plus,
+    &card_combust,
+    &card_disarm_plus,
+    &card_disarm,
+    &card_ghostly_armor_plus,
+    &card_ghostly_armor,
+    &card_hemokinesis_plus,
+    &card_hemokinesis,
+    &card_inflame_plus,
+    &card_inflame,
+    &card_intimidate_plus,
+    &card_intimidate,
+    &card_metallicize_plus,
+    &card_metallicize,
+    &card_power_through_plus,
+    &card_power_through,
+    &card_pummel_plus,
+    &card_pummel,
+    &card_rage_plus,
+    &card_rage,
+    &card_reckless_charge_plus,
+    &card_reckless_charge,
+    &card_searing_blow_plus4,
+    &card_searing_blow_plus3,
+    &card_searing_blow_plus2,
+    &card_searing_blow_plus,
+    &card_searing_blow,
+    &card_seeing_red_plus,
+    &card_seeing_red,
+    &card_shockwave_plus,
+    &card_shockwave,
+    &card_uppercut_plus,
+    &card_uppercut,
+    &card_whirlwind_plus,
+    &card_whirlwind,
+    &card_barricade_plus,
+    &card_barricade,
+    &card_berserk_plus,
+    &card_berserk,
+    &card_bludgeon_plus,
+    &card_bludgeon,
+    &card_brutality_plus,
+    &card_brutality,
+    &card_demon_form_plus,
+    &card_demon_form,
+    &card_fiend_fire_plus,
+    &card_fiend_fire,
+    &card_immolate_plus,
+    &card_immolate,
+    &card_impervious_plus,
+    &card_impervious,
+    &card_offering_plus,
+    &card_offering,
+    &card_neutralize_plus,
+    &card_neutralize,
+    &card_survivor_plus,
+    &card_survivor,
+    &card_backflip_plus,
+    &card_backflip,
+    &card_bane_plus,
+    &card_bane,
+    &card_dagger_spray_plus,
+    &card_dagger_spray,
+    &card_deadly_poison_plus,
+    &card_deadly_poison,
+    &card_deflect_plus,
+    &card_deflect,
+    &card_poisoned_stab_plus,
+    &card_poisoned_stab,
+    &card_quick_slash_plus,
+    &card_quick_slash,
+    &card_slice_plus,
+    &card_slice,
+    &card_sucker_punch_plus,
+    &card_sucker_punch,
+    &card_crippling_cloud_plus,
+    &card_crippling_cloud,
+    &card_dash_plus,
+    &card_dash,
+    &card_footwork_plus,
+    &card_footwork,
+    &card_led_sweep_plus,
+    &card_leg_sweep,
+    &card_noxious_fumes_plus,
+    &card_noxious_fumes,
+    &card_riddle_with_holes_plus,
+    &card_riddle_with_holes,
+    &card_terror_plus,
+    &card_terror,
+    &card_adrenaline_plus,
+    &card_adrenaline,
+    &card_die_die_die_plus,
+    &card_die_die_die,
+    &card_zap_plus,
+    &card_zap,
+    &card_dualcast_plus,
+    &card_dualcast,
+    &card_eruption_plus,
+    &card_eruption,
+    &card_vigilance_plus,
+    &card_vigilance,
+    &card_miracle_plus,
+    &card_miracle,
+    &card_smite_plus,
+    &card_smite,
+    &card_through_violence_plus,
+    &card_through_violence,
+    &card_bowling_bash_plus,
+    &card_bowling_bash,
+    &card_consecrate_plus,
+    &card_consecrate,
+    &card_crescendo_plus,
+    &card_crescendo,
+    &card_crush_joints_plus,
+    &card_crush_joints,
+    &card_empty_body_plus,
+    &card_empty_body,
+    &card_empty_fist_plus,
+    &card_empty_fist,
+    &card_insight_plus,
+    &card_insight,
+    &card_evaluate_plus,
+    &card_evaluate,
+    &card_flurry_of_blows_plus,
+    &card_flurry_of_blows,
+    &card_flying_sleeves_plus,
+    &card_flying_sleeves,
+    &card_follow_up_plus,
+    &card_follow_up,
+    &card_halt_plus,
+    &card_halt,
+    &card_just_lucky_plus,
+    &card_just_lucky,
+    &card_prostrate_plus,
+    &card_prostrate,
+    &card_protect_plus,
+    &card_protect,
+    &card_sash_whip_plus,
+    &card_sash_whip,
+    &card_third_eye_plus,
+    &card_third_eye,
+    &card_tranquility_plus,
+    &card_tranquility,
+    &card_carve_reality_plus,
+    &card_carve_reality,
+    &card_reach_heaven_plus,
+    &card_reach_heaven,
+};
+
 // map between deck names and decks
 // (populated within PopulateDecks)
 std::map<std::string, CardCollectionPtr> deck_map;
 
+// populate deck maps
+void PopulateDecks() {
+
+    CardCollectionPtr deck;
+
+    deck.Clear();
+    deck.AddCard(card_strike, 5);
+    deck.AddCard(card_defend, 4);
+    deck.AddCard(card_bash, 1);
+    deck_map["starting_ironclad"] = deck;
+    deck.AddCard(card_ascenders_bane, 1);
+    deck_map["starting_ironclad_cursed"] = deck;
+
+    deck.Clear();
+    deck.AddCard(card_strike, 5);
+    deck.AddCard(card_defend, 5);
+    deck.AddCard(card_survivor, 1);
+    deck.AddCard(card_neutralize, 1);
+    deck_map["starting_silent"] = deck;
+    deck.AddCard(card_ascenders_bane, 1);
+    deck_map["starting_silent_cursed"] = deck;
+
+    deck.Clear();
+    deck.AddCard(card_strike, 4);
+    deck.AddCard(card_defend, 4);
+    deck.AddCard(card_zap, 1);
+    deck.AddCard(card_dualcast, 1);
+    deck_map["starting_defect"] = deck;
+    deck.AddCard(card_ascenders_bane, 1);
+    deck_map["starting_defect_cursed"] = deck;
+
+    deck.Clear();
+    deck.AddCard(card_strike, 4);
+    deck.AddCard(card_defend, 4);
+    deck.AddCard(card_eruption, 1);
+    deck.AddCard(card_vigilance, 1);
+    deck_map["starting_watcher"] = deck;
+    deck.AddCard(card_ascenders_bane, 1);
+    deck_map["starting_watcher_cursed"] = deck;
+
+}
+
 // map between string and card flags
 std::map<std::string, CardFlagStruct> card_flag_map = {
     {"attack", {.attack = 1}},
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "defines.h"
+
+#if defined(USE_PROFILER) && (defined(__x86_64__) || defined(_M_X64))
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+// The profiler times the phases of a solve, so a slowdown can be traced to
+// the code it came from without an external profiler.  A ProfileScope at the
+// top of a function charges the time until it ends to that function's phase.
+// Time is charged to the innermost phase only, so the phases add up to the
+// whole solve: the time PlayCard spends inside FindPlayerChoices counts
+// towards play_card, not move_generation.
+//
+// Unless USE_PROFILER is defined, a ProfileScope is empty and compiles to
+// nothing.
+
+// phases of a solve
+enum ProfilePhaseEnum : uint8_t {
+    // time in Expand outside every other phase
+    kProfileOther,
+    kProfileCreateChild,
+    kProfileDrawCards,
+    kProfileGenerateMobIntents,
+    // FindPlayerChoices, while it plays out each decision
+    kProfileMoveGeneration,
+    // FindPlayerChoices, while it removes dominated decisions
+    kProfileDominance,
+    kProfilePlayCard,
+    kProfileEndTurn,
+    kProfileUpdateTree,
+    kProfileFinal
+};
+
+// name of each phase
+const char * const profile_phase_name[kProfileFinal] = {
+    "other",
+    "create_child",
+    "draw_cards",
+    "generate_mob_intents",
+    "move_generation",
+    "dominance",
+    "play_card",
+    "end_turn",
+    "update_tree",
+};
+
+// true if the profiler is compiled in
+#ifdef USE_PROFILER
+constexpr bool profiler_enabled = true;
+#else
+constexpr bool profiler_enabled = false;
+#endif
+
+// return a timestamp in ticks
+// (the time stamp counter where there is one, else nanoseconds)
+inline uint64_t GetProfileTicks() {
+#if defined(USE_PROFILER) && (defined(__x86_64__) || defined(_M_X64))
+    return __rdtsc();
+#else
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// time spent in and calls to each phase
+struct ProfileCounters {
+    // ticks spent in each phase
+    uint64_t ticks[kProfileFinal] = {0};
+    // number of times each phase was entered
+    uint64_t calls[kProfileFinal] = {0};
+    // wall clock time covered by the ticks
+    double duration_s = 0.0;
+    // return the total ticks of all phases
+    uint64_t GetTotalTicks() const {
+        uint64_t total = 0;
+        for (auto this_ticks : ticks) {
+            total += this_ticks;
+        }
+        return total;
+    }
+    // return true if nothing was timed
+    bool IsEmpty() const {
+        return GetTotalTicks() == 0;
+    }
+    // return the fraction of time spent in a phase
+    double GetFraction(ProfilePhaseEnum phase) const {
+        const uint64_t total = GetTotalTicks();
+        return total == 0 ? 0.0 : (double) ticks[phase] / total;
+    }
+    // return the counters since the given ones were taken
+    ProfileCounters operator- (const ProfileCounters & that) const {
+        ProfileCounters result;
+        for (int i = 0; i < kProfileFinal; ++i) {
+            result.ticks[i] = ticks[i] - that.ticks[i];
+            result.calls[i] = calls[i] - that.calls[i];
+        }
+        return result;
+    }
+    // return the share of each phase on one line, such as
+    // "other 5.1%   create_child 20.3%   ..."
+    std::string ToLine() const {
+        std::string line;
+        char buffer[64];
+        for (int i = 0; i < kProfileFinal; ++i) {
+            snprintf(buffer, sizeof(buffer), "%s%s %.1f%%",
+                i == 0 ? "" : "   ",
+                profile_phase_name[i],
+                GetFraction((ProfilePhaseEnum) i) * 100.0);
+            line += buffer;
+        }
+        return line;
+    }
+    // print the time, share and calls of each phase
+    void Print() const {
+        printf("\nProfile:\n");
+        for (int i = 0; i < kProfileFinal; ++i) {
+            const double fraction = GetFraction((ProfilePhaseEnum) i);
+            const double time_s = fraction * duration_s;
+            printf("- %-20s %9.3f s  %5.1f%%  %12llu calls  %8.1f ns/call\n",
+                profile_phase_name[i],
+                time_s,
+                fraction * 100.0,
+                (unsigned long long) calls[i],
+                calls[i] == 0 ? 0.0 : time_s * 1e9 / calls[i]);
+        }
+    }
+};
+
+// counters of this thread
+thread_local ProfileCounters profile_counters;
+
+// phase being timed in this thread (or kProfileFinal if none)
+thread_local ProfilePhaseEnum profile_phase = kProfileFinal;
+
+// timestamp since which time hasn't been charged to profile_phase
+thread_local uint64_t profile_phase_start = 0;
+
+// charge the time so far to the current phase and return the counters of
+// this thread
+inline const ProfileCounters & GetProfileCounters() {
+    if (profiler_enabled && profile_phase != kProfileFinal) {
+        const uint64_t now = GetProfileTicks();
+        profile_counters.ticks[profile_phase] += now - profile_phase_start;
+        profile_phase_start = now;
+    }
+    return profile_counters;
+}
+
+// charges the time until it's destroyed to a phase
+struct ProfileScope {
+#ifdef USE_PROFILER
+    // phase to return to
+    ProfilePhaseEnum previous_phase;
+    // constructor
+    ProfileScope(ProfilePhaseEnum phase) : previous_phase(profile_phase) {
+        const uint64_t now = GetProfileTicks();
+        if (previous_phase != kProfileFinal) {
+            profile_counters.ticks[previous_phase] += now - profile_phase_start;
+        }
+        ++profile_counters.calls[phase];
+        profile_phase = phase;
+        profile_phase_start = now;
+    }
+    // destructor
+    ~ProfileScope() {
+        const uint64_t now = GetProfileTicks();
+        profile_counters.ticks[profile_phase] += now - profile_phase_start;
+        profile_phase = previous_phase;
+        profile_phase_start = now;
+    }
+#else
+    // constructor
+    ProfileScope(ProfilePhaseEnum) {
+    }
+#endif
+    // (a scope belongs to the block it's declared in)
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope & operator= (const ProfileScope &) = delete;
+};
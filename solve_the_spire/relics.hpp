@@ -2,6 +2,7 @@
 
 #include <string>
 #include <map>
+#include <cstring>
 
 struct RelicStruct {
     // starting relics
@@ -125,6 +126,16 @@ struct RelicStruct {
         }
     }
 
+    // equality comparison
+    bool operator== (const RelicStruct & that) const {
+        return memcmp(this, &that, sizeof(*this)) == 0;
+    }
+
+    // inequality comparison
+    bool operator!= (const RelicStruct & that) const {
+        return !(*this == that);
+    }
+
     // return true if this contains the given relic
     bool Contains(const RelicStruct & that) const {
         auto one_ptr = (uint8_t *) this;
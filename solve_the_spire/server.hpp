@@ -0,0 +1,515 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "defines.h"
+#include "card_collection_map.hpp"
+#include "node.hpp"
+#include "tree.hpp"
+#include "policy_table.hpp"
+#include "jobs.hpp"
+
+// A solve server answers requests for the best play from a game state.  It
+// keeps running between requests, so the card tables, the interned decks and
+// their cached draws stay warm, and each solved tree leaves behind the value
+// and best decision of every decision state in it.  An advisor which asks
+// about each card it plays usually finds the later states of a fight already
+// solved by its first request.  Turn-start states are also shared through the
+// subgame memo when it's on.
+//
+// Requests and replies are JSON objects, one per line.  A request holds a
+// game state (see ParseServerRequest in solve_the_spire.cpp for its keys) and
+// an optional "id" which is copied to its reply.  Requests are solved by
+// several threads at once, so replies may come back in a different order.
+//
+// The server reads requests on stdin and writes replies to stdout, or listens
+// on a Unix socket, where each connection is a separate stream of requests.
+//
+// (the server is only supported on Linux)
+
+// a request to solve
+struct ServerRequest {
+    // identifier copied to the reply
+    std::string id;
+    // game state to solve
+    Node node;
+    // if set, the node is a fight start and this fight is solved
+    FightEnum fight_type = kFightNone;
+};
+
+// fills in a request from its JSON object, or sets an error and returns false
+// (called with the server's SolverContext current)
+typedef bool (*ServerRequestParser)(
+    const JsonObject & object,
+    ServerRequest & request,
+    std::string & error);
+
+// value and best decision of a solved decision state
+struct ServerSolvedState {
+    // check hash of the state (see SolveServer::GetStateCheck)
+    uint64_t check;
+    // best decision
+    Decision decision;
+    // expected final hp
+    double final_hp;
+    // chance to die
+    double death_chance;
+};
+
+// answers requests while keeping caches warm between them
+struct SolveServer {
+    // fills in requests
+    ServerRequestParser parse_request;
+    // context which holds the decks of all requests
+    SolverContext context;
+    // solved decision states by GetStateKey
+    std::unordered_map<uint64_t, ServerSolvedState> solved_state;
+    // guards solved_state
+    std::mutex mutex;
+    // number of requests answered
+    std::atomic<uint64_t> request_count;
+    // number of requests answered from solved_state
+    std::atomic<uint64_t> hit_count;
+    // constructor
+    SolveServer(ServerRequestParser parse_request_) :
+            parse_request(parse_request_),
+            request_count(0),
+            hit_count(0) {
+    }
+    // return the key of a state in solved_state
+    // (the canonical state hash depends on the number of mob slots)
+    template <unsigned int mob_slots>
+    static uint64_t GetStateKey(const BasicNode<mob_slots> & node) {
+        return MixPolicyHash(node.GetCanonicalStateHash() + mob_slots);
+    }
+    // return the check hash of a state in solved_state
+    // (a state is only answered from solved_state if its key and check hash
+    // both match)
+    template <unsigned int mob_slots>
+    static uint64_t GetStateCheck(const BasicNode<mob_slots> & node) {
+        return MixPolicyHash(node.GetCanonicalStateCheckHash() + mob_slots);
+    }
+    // return an error reply
+    static std::string GetErrorReply(const std::string & id, const std::string & error) {
+        return "{\"id\": " + ToJsonString(id) + ", \"error\": " +
+            ToJsonString(error) + "}\n";
+    }
+    // return the reply for a solved decision state
+    // (node is the state with its mobs sorted, and old_index gives the index
+    // of each of its mobs in the request, so the target is in the request's
+    // order)
+    template <unsigned int mob_slots>
+    static std::string GetDecisionReply(
+            const std::string & id,
+            const BasicNode<mob_slots> & node,
+            const uint8_t * old_index,
+            const ServerSolvedState & state,
+            bool cached,
+            double solve_duration_s) {
+        const Decision & decision = state.decision;
+        std::string reply = "{\"id\": " + ToJsonString(id) +
+            ", \"decision\": " + ToJsonString(decision.ToString());
+        char buffer[256];
+        if (decision.type == kDecisionPlayCard) {
+            const Card & card = *card_map[decision.argument[0]];
+            reply += ", \"card\": " + ToJsonString(card.name);
+            if (card.flag.targeted && decision.argument[1] < mob_slots) {
+                const Monster & mob = node.monster[decision.argument[1]];
+                snprintf(buffer, sizeof(buffer), ", \"target\": %u",
+                    (unsigned int) old_index[decision.argument[1]]);
+                reply += buffer;
+                if (mob.base != nullptr) {
+                    reply += ", \"target_mob\": " + ToJsonString(mob.base->name);
+                }
+            }
+        }
+        snprintf(buffer, sizeof(buffer),
+            ", \"final_hp\": %.10g, \"death_chance\": %.10g, "
+            "\"cached\": %s, \"solve_time_s\": %.6g}\n",
+            state.final_hp, state.death_chance,
+            cached ? "true" : "false", solve_duration_s);
+        reply += buffer;
+        return reply;
+    }
+    // store the value and best decision of each decision state of a solved
+    // tree (states whose subtrees were pruned are left out)
+    template <unsigned int mob_slots>
+    void StoreSolvedStates(const BasicTreeStruct<mob_slots> & tree) {
+        typedef BasicNode<mob_slots> Node;
+        // a node whose children are being visited
+        struct Frame {
+            // node
+            const Node * node;
+            // index of the next child to visit
+            std::size_t next_child;
+            // sum of probability times final hp of the battles below
+            double hp_sum;
+            // sum of the probability of the deaths below
+            double death_sum;
+            // true if no part of the subtree was pruned
+            bool complete;
+        };
+        std::vector<std::pair<uint64_t, ServerSolvedState>> item;
+        std::vector<Frame> stack;
+        stack.push_back({tree.top_node_ptr, 0, 0.0, 0.0, true});
+        while (!stack.empty()) {
+            Frame & frame = stack.back();
+            const Node & node = *frame.node;
+            if (frame.next_child < node.child.size()) {
+                const Node * child = node.child[frame.next_child++];
+                stack.push_back({child, 0, 0.0, 0.0, true});
+                continue;
+            }
+            const double p = node.probability;
+            if (node.child.empty()) {
+                auto it = tree.recalled_nodes.find((Node *) &node);
+                if (node.IsBattleDone()) {
+                    frame.hp_sum = p * node.hp;
+                    frame.death_sum = node.hp == 0 ? p : 0.0;
+                } else if (it != tree.recalled_nodes.end()) {
+                    frame.hp_sum = p * it->second.final_hp;
+                    frame.death_sum = p * it->second.death_chance;
+                } else {
+                    frame.complete = false;
+                }
+            }
+            if (frame.complete && p > 0.0 && node.flag.tree_solved &&
+                    !node.HasPendingActions() && !node.IsBattleDone() &&
+                    node.child.size() == 1) {
+                item.push_back({GetStateKey(node), ServerSolvedState{
+                    GetStateCheck(node),
+                    node.child[0]->parent_decision,
+                    frame.hp_sum / p,
+                    frame.death_sum / p}});
+            }
+            const Frame done = frame;
+            stack.pop_back();
+            if (!stack.empty()) {
+                stack.back().hp_sum += done.hp_sum;
+                stack.back().death_sum += done.death_sum;
+                stack.back().complete = stack.back().complete && done.complete;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        // (rather than track which states are still useful, start over)
+        if (solved_state.size() + item.size() > max_server_solved_states) {
+            solved_state.clear();
+        }
+        solved_state.insert(item.begin(), item.end());
+    }
+    // solve a decision state with the given number of mob slots and return
+    // the reply
+    template <unsigned int slots>
+    std::string SolveState(const ServerRequest & request) {
+        BasicNode<slots> top_node;
+        top_node.CopyStateFrom(request.node);
+        uint8_t old_index[slots];
+        top_node.SortMobs(old_index);
+        const uint64_t key = GetStateKey(top_node);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = solved_state.find(key);
+            if (it != solved_state.end() &&
+                    it->second.check == GetStateCheck(top_node)) {
+                ++hit_count;
+                return GetDecisionReply(
+                    request.id, top_node, old_index, it->second, true, 0.0);
+            }
+        }
+        top_node.objective = top_node.GetMaxFinalObjective();
+        BasicTreeStruct<slots> tree(top_node);
+        tree.quiet = true;
+        tree.Expand();
+        if (top_node.child.size() != 1) {
+            return GetErrorReply(request.id, "state has no decision to make");
+        }
+        StoreSolvedStates(tree);
+        const ServerSolvedState state = {
+            GetStateCheck(top_node),
+            top_node.child[0]->parent_decision,
+            tree.final_hp,
+            tree.death_chance};
+        return GetDecisionReply(request.id, top_node, old_index, state, false,
+            tree.solve_duration_s);
+    }
+    // solve a fight from the start and return the reply
+    std::string SolveFight(ServerRequest & request) {
+        Node & top_node = request.node;
+        top_node.InitializeStartingNode();
+        TreeStruct tree(top_node);
+        tree.fight_type = request.fight_type;
+        tree.quiet = true;
+        tree.need_solved_tree = true;
+        tree.ExpandFight();
+        tree.ForSolvedTree([this](auto & solved_tree) {
+            StoreSolvedStates(solved_tree);
+        });
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer),
+            ", \"final_hp\": %.10g, \"death_chance\": %.10g, "
+            "\"solve_time_s\": %.6g}\n",
+            tree.final_hp, tree.death_chance, tree.solve_duration_s);
+        return "{\"id\": " + ToJsonString(request.id) + buffer;
+    }
+    // answer one request line
+    std::string HandleLine(const std::string & line) {
+        ++request_count;
+        JsonObject object;
+        if (!ParseJsonObject(line, object)) {
+            return GetErrorReply("", "could not parse request");
+        }
+        const std::string id = object.count("id") ? object["id"] : "";
+        std::string reply;
+        {
+            SolverContextScope scope(context);
+            ServerRequest request;
+            request.id = id;
+            std::string error;
+            if (!parse_request(object, request, error)) {
+                reply = GetErrorReply(id, error);
+            } else if (request.fight_type != kFightNone) {
+                reply = SolveFight(request);
+            } else {
+                // (use as few mob slots as will hold the mobs)
+                unsigned int mob_count = 0;
+                for (unsigned int i = 0; i < MAX_MOBS_PER_NODE; ++i) {
+                    if (request.node.monster[i].Exists()) {
+                        mob_count = i + 1;
+                    }
+                }
+                if (mob_count == 0) {
+                    reply = GetErrorReply(id, "state has no mobs");
+                } else if (mob_count <= 1) {
+                    reply = SolveState<1>(request);
+                } else if (mob_count <= 2) {
+                    reply = SolveState<2>(request);
+                } else if (mob_count <= 3) {
+                    reply = SolveState<3>(request);
+                } else {
+                    reply = SolveState<MAX_MOBS_PER_NODE>(request);
+                }
+            }
+        }
+        // (the deck may point into the server's context, which this thread
+        // may outlive)
+        NodeShared::deck.Clear();
+        return reply;
+    }
+};
+
+#ifndef _WIN32
+
+// a stream of requests and the stream their replies go to
+struct ServerConnection {
+    // requests are read from this
+    int in_fd;
+    // replies are written to this
+    int out_fd;
+    // guards writing replies
+    std::mutex mutex;
+    // constructor
+    ServerConnection(int in_fd_, int out_fd_) : in_fd(in_fd_), out_fd(out_fd_) {
+    }
+    // destructor
+    ~ServerConnection() {
+        close(in_fd);
+        if (out_fd != in_fd) {
+            close(out_fd);
+        }
+    }
+    // write a reply, return true if successful
+    bool Write(const std::string & reply) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::size_t offset = 0;
+        while (offset < reply.size()) {
+            const ssize_t count =
+                write(out_fd, reply.data() + offset, reply.size() - offset);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                return false;
+            }
+            offset += (std::size_t) count;
+        }
+        return true;
+    }
+    // read the next line, return true if successful
+    // (pending holds what was read past the end of the line)
+    bool ReadLine(std::string & pending, std::string & line) {
+        while (true) {
+            const std::size_t end = pending.find('\n');
+            if (end != std::string::npos) {
+                line = pending.substr(0, end);
+                pending.erase(0, end + 1);
+                return true;
+            }
+            char buffer[4096];
+            const ssize_t count = read(in_fd, buffer, sizeof(buffer));
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                // (the last line may not end in a newline)
+                line.swap(pending);
+                pending.clear();
+                return !line.empty();
+            }
+            pending.append(buffer, (std::size_t) count);
+        }
+    }
+};
+
+// requests waiting for a thread to solve them
+struct ServerQueue {
+    // requests and the connections they came from
+    std::deque<std::pair<std::shared_ptr<ServerConnection>, std::string>> request;
+    // true once no more requests will be added
+    bool closed = false;
+    // guards request and closed
+    std::mutex mutex;
+    // signaled when a request is added or the queue is closed
+    std::condition_variable condition;
+    // add a request
+    void Push(const std::shared_ptr<ServerConnection> & connection, std::string line) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            request.emplace_back(connection, std::move(line));
+        }
+        condition.notify_one();
+    }
+    // take the next request, return false once the queue is closed and empty
+    bool Pop(std::shared_ptr<ServerConnection> & connection, std::string & line) {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]() {
+            return closed || !request.empty();
+        });
+        if (request.empty()) {
+            return false;
+        }
+        connection = std::move(request.front().first);
+        line = std::move(request.front().second);
+        request.pop_front();
+        return true;
+    }
+    // stop waiting for requests
+    void Close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        condition.notify_all();
+    }
+};
+
+// queue the requests of a connection until it closes
+void ReadServerRequests(std::shared_ptr<ServerConnection> connection, ServerQueue & queue) {
+    std::string pending;
+    std::string line;
+    while (connection->ReadLine(pending, line)) {
+        if (line.find_first_not_of(" \t\r") != std::string::npos) {
+            queue.Push(connection, line);
+        }
+    }
+}
+
+// answer requests on stdin (if address is "stdio") or on connections to the
+// Unix socket at address, using the given number of threads
+// (with stdin, the server exits once it closes and every request is answered)
+void RunServer(
+        const std::string & address,
+        ServerRequestParser parse_request,
+        unsigned int thread_count) {
+    // (a client which goes away shouldn't take the server with it)
+    signal(SIGPIPE, SIG_IGN);
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+    SolveServer server(parse_request);
+    ServerQueue queue;
+    auto solver = [&]() {
+        std::shared_ptr<ServerConnection> connection;
+        std::string line;
+        while (queue.Pop(connection, line)) {
+            connection->Write(server.HandleLine(line));
+            connection.reset();
+        }
+    };
+    std::vector<std::thread> thread;
+    for (unsigned int i = 0; i < thread_count; ++i) {
+        thread.push_back(std::thread(solver));
+    }
+    if (address == "stdio") {
+        // (anything else printed goes to stderr so it can't corrupt replies)
+        const int out_fd = dup(1);
+        dup2(2, 1);
+        fprintf(stderr, "Serving requests on stdin using %u threads\n", thread_count);
+        ReadServerRequests(std::make_shared<ServerConnection>(0, out_fd), queue);
+        queue.Close();
+        for (auto & this_thread : thread) {
+            this_thread.join();
+        }
+        fprintf(stderr, "Answered %lu requests (%lu from solved states)\n",
+            (long unsigned) server.request_count.load(),
+            (long unsigned) server.hit_count.load());
+        exit(0);
+    }
+    const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un socket_address;
+    memset(&socket_address, 0, sizeof(socket_address));
+    socket_address.sun_family = AF_UNIX;
+    if (listen_fd < 0 || address.size() >= sizeof(socket_address.sun_path)) {
+        printf("ERROR: could not create socket %s\n", address.c_str());
+        exit(1);
+    }
+    strcpy(socket_address.sun_path, address.c_str());
+    unlink(address.c_str());
+    if (bind(listen_fd, (const sockaddr *) &socket_address, sizeof(socket_address)) != 0 ||
+            listen(listen_fd, 16) != 0) {
+        printf("ERROR: could not listen on %s\n", address.c_str());
+        exit(1);
+    }
+    printf("Serving requests on %s using %u threads\n", address.c_str(), thread_count);
+    fflush(stdout);
+    while (true) {
+        const int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("ERROR: could not accept a connection on %s\n", address.c_str());
+            exit(1);
+        }
+        std::thread(ReadServerRequests,
+            std::make_shared<ServerConnection>(fd, fd), std::ref(queue)).detach();
+    }
+}
+
+#else
+
+// answer requests (not supported)
+void RunServer(const std::string &, ServerRequestParser, unsigned int) {
+    printf("ERROR: the solve server is only supported on Linux\n");
+    exit(1);
+}
+
+#endif
@@ -0,0 +1,341 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <mutex>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#endif
+
+#include "defines.h"
+#include "cards.hpp"
+#include "card_collection_map.hpp"
+#include "relics.hpp"
+#include "fight.hpp"
+#include "monster.hpp"
+
+// result of a solve as stored in the cache
+struct SolveCacheResult {
+    // composite objective of the top node
+    double objective;
+    // expected final hp
+    double final_hp;
+    // chance to die
+    double death_chance;
+    // chance of ending at each final hp
+    std::map<uint16_t, double> final_hp_distribution;
+    // chance of ending on each turn
+    std::map<uint16_t, double> turn_distribution;
+};
+
+// A SolveCache stores solved fights on disk so they only need to be solved
+// once.  Each result is a line appended to a log file, and an index file
+// holds the offset and length of each line in the log by key hash.  If the
+// index falls behind the log, the missing entries are rebuilt from the log.
+//
+// Keys are a canonical text description of the fight and the solver settings,
+// so results are only reused when they would be solved the same way.
+//
+// Several processes may share the files, so appends and index rebuilds are
+// done while holding a lock file, as in SubgameMemo.
+struct SolveCache {
+    // location of a record in the log file
+    struct RecordLocation {
+        uint64_t offset;
+        uint64_t length;
+    };
+    // log file holding the records
+    std::string log_filename;
+    // index file holding the record locations
+    std::string index_filename;
+    // true once the index is loaded
+    bool loaded;
+    // record locations by key hash
+    std::unordered_multimap<uint64_t, RecordLocation> index;
+    // guards all file access within this process
+    std::mutex mutex;
+    // constructor
+    SolveCache(std::string log_filename_, std::string index_filename_) :
+            log_filename(log_filename_),
+            index_filename(index_filename_),
+            loaded(false) {
+    }
+    // return the hash of a key
+    static uint64_t Hash(const std::string & key) {
+        uint64_t hash = 14695981039346656037ULL;
+        for (unsigned char c : key) {
+            hash = (hash ^ c) * 1099511628211ULL;
+        }
+        return hash;
+    }
+    // return the key for the given fight
+    // (cards are sorted by name so the key doesn't depend on card indices)
+    static std::string GetKey(
+            const CardCollectionPtr & deck,
+            const RelicStruct & relics,
+            unsigned int hp,
+            unsigned int max_hp,
+            FightEnum fight_type,
+            bool generate_all_mob_hp,
+            bool use_mob_hp_lanes) {
+        std::vector<std::pair<std::string, unsigned int>> card;
+        for (const auto & deck_item : deck) {
+            card.push_back(std::pair<std::string, unsigned int>(
+                card_map[deck_item.first]->name, deck_item.second));
+        }
+        std::sort(card.begin(), card.end());
+        uint32_t relic_bits = 0;
+        static_assert(sizeof(relic_bits) == sizeof(RelicStruct), "");
+        memcpy(&relic_bits, &relics, sizeof(relic_bits));
+        std::ostringstream ss;
+        ss << "v" << solve_cache_version;
+        ss << ";deck=";
+        for (std::size_t i = 0; i < card.size(); ++i) {
+            if (i > 0) {
+                ss << ",";
+            }
+            ss << card[i].second << "x" << card[i].first;
+        }
+        ss << ";relics=" << std::hex << relic_bits << std::dec;
+        ss << ";hp=" << hp << "/" << max_hp;
+        ss << ";fight=" << fight_map.at(fight_type).name;
+        ss << ";settings=" <<
+            normalize_mob_variations <<
+            upgrades_strictly_better <<
+            always_avoid_dying <<
+            generate_all_mob_hp <<
+            use_mob_hp_lanes;
+        return ss.str();
+    }
+    // lock the files against changes from other processes
+    // (returns a handle to pass to UnlockFiles)
+    int LockFiles() const {
+#ifdef _WIN32
+        return -1;
+#else
+        std::string lock_filename = log_filename + ".lock";
+        int fd = open(lock_filename.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd >= 0) {
+            flock(fd, LOCK_EX);
+        }
+        return fd;
+#endif
+    }
+    // unlock the files
+    void UnlockFiles(int fd) const {
+#ifndef _WIN32
+        if (fd >= 0) {
+            flock(fd, LOCK_UN);
+            close(fd);
+        }
+#endif
+    }
+    // convert a result to a log record
+    static std::string ToRecord(
+            const std::string & key,
+            const SolveCacheResult & result) {
+        char buffer[128];
+        std::ostringstream ss;
+        snprintf(buffer, sizeof(buffer), "%016llx",
+            (unsigned long long) Hash(key));
+        ss << buffer << "\t" << key;
+        snprintf(buffer, sizeof(buffer), "\t%.17g\t%.17g\t%.17g\t",
+            result.objective, result.final_hp, result.death_chance);
+        ss << buffer;
+        AddDistribution(ss, result.final_hp_distribution);
+        ss << "\t";
+        AddDistribution(ss, result.turn_distribution);
+        ss << "\n";
+        return ss.str();
+    }
+    // add a distribution to a log record as comma separated value:chance
+    static void AddDistribution(
+            std::ostringstream & ss,
+            const std::map<uint16_t, double> & distribution) {
+        char buffer[64];
+        bool first = true;
+        for (const auto & item : distribution) {
+            snprintf(buffer, sizeof(buffer), "%s%u:%.17g",
+                first ? "" : ",", (unsigned int) item.first, item.second);
+            ss << buffer;
+            first = false;
+        }
+    }
+    // parse a distribution from a log record, return true if successful
+    static bool ParseDistribution(
+            const std::string & text,
+            std::map<uint16_t, double> & distribution) {
+        distribution.clear();
+        std::istringstream ss(text);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            auto colon = item.find(':');
+            if (colon == std::string::npos) {
+                return false;
+            }
+            distribution[(uint16_t) atoi(item.c_str())] =
+                atof(item.c_str() + colon + 1);
+        }
+        return true;
+    }
+    // parse a log record, return true if successful
+    static bool FromRecord(
+            const std::string & record,
+            std::string & key,
+            SolveCacheResult & result) {
+        std::vector<std::string> field;
+        std::string::size_type start = 0;
+        while (true) {
+            auto end = record.find('\t', start);
+            field.push_back(record.substr(start, end - start));
+            if (end == std::string::npos) {
+                break;
+            }
+            start = end + 1;
+        }
+        if (field.size() != 7) {
+            return false;
+        }
+        key = field[1];
+        result.objective = atof(field[2].c_str());
+        result.final_hp = atof(field[3].c_str());
+        result.death_chance = atof(field[4].c_str());
+        return ParseDistribution(field[5], result.final_hp_distribution) &&
+            ParseDistribution(field[6], result.turn_distribution);
+    }
+    // add the records in the log from the given offset to the index
+    // (and to the index file)
+    void IndexLog(uint64_t offset) {
+        std::ifstream log_file(log_filename, std::ios::binary);
+        log_file.seekg((std::streamoff) offset);
+        std::ofstream index_file(index_filename, std::ios::app);
+        std::string line;
+        while (std::getline(log_file, line)) {
+            if (log_file.eof()) {
+                // last record is incomplete
+                break;
+            }
+            RecordLocation location = {offset, line.size() + 1};
+            std::string key;
+            SolveCacheResult result;
+            if (FromRecord(line, key, result)) {
+                uint64_t hash = Hash(key);
+                index.insert(std::make_pair(hash, location));
+                index_file << hash << " " << location.offset << " " <<
+                    location.length << "\n";
+            }
+            offset += location.length;
+        }
+    }
+    // load the index from the index file
+    // (files must be locked)
+    void Load() {
+        loaded = true;
+        index.clear();
+        // size of the log file
+        uint64_t log_size = 0;
+        {
+            std::ifstream log_file(log_filename, std::ios::binary | std::ios::ate);
+            if (log_file.good()) {
+                log_size = (uint64_t) log_file.tellg();
+            }
+        }
+        // read the index, noting where it ends
+        uint64_t indexed_size = 0;
+        {
+            std::ifstream index_file(index_filename);
+            uint64_t hash;
+            RecordLocation location;
+            while (index_file >> hash >> location.offset >> location.length) {
+                index.insert(std::make_pair(hash, location));
+                indexed_size = std::max(
+                    indexed_size, location.offset + location.length);
+            }
+        }
+        // if the log was replaced, rebuild the whole index
+        if (indexed_size > log_size) {
+            index.clear();
+            std::ofstream index_file(index_filename, std::ios::trunc);
+            indexed_size = 0;
+        }
+        // index any records added since the index was written
+        if (indexed_size < log_size) {
+            IndexLog(indexed_size);
+        }
+    }
+    // look up a result, return true if found
+    bool Lookup(const std::string & key, SolveCacheResult & result) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!loaded) {
+            int lock_fd = LockFiles();
+            Load();
+            UnlockFiles(lock_fd);
+        }
+        auto range = index.equal_range(Hash(key));
+        if (range.first == range.second) {
+            return false;
+        }
+        std::ifstream log_file(log_filename, std::ios::binary);
+        for (auto it = range.first; it != range.second; ++it) {
+            const RecordLocation & location = it->second;
+            std::string line(location.length, '\0');
+            log_file.seekg((std::streamoff) location.offset);
+            if (!log_file.read(&line[0], (std::streamsize) location.length)) {
+                log_file.clear();
+                continue;
+            }
+            line.pop_back();
+            std::string record_key;
+            if (FromRecord(line, record_key, result) && record_key == key) {
+                return true;
+            }
+        }
+        return false;
+    }
+    // store a result
+    // (the record's offset is found while the files are locked, so records
+    // appended by other processes are never overlapped)
+    void Store(const std::string & key, const SolveCacheResult & result) {
+        std::lock_guard<std::mutex> lock(mutex);
+        int lock_fd = LockFiles();
+        if (!loaded) {
+            Load();
+        }
+        std::string record = ToRecord(key, result);
+        std::ofstream log_file(log_filename, std::ios::binary | std::ios::app);
+        log_file.seekp(0, std::ios::end);
+        RecordLocation location = {(uint64_t) log_file.tellp(), record.size()};
+        log_file << record;
+        log_file.close();
+        if (!log_file) {
+            UnlockFiles(lock_fd);
+            printf("ERROR: could not write to %s\n", log_filename.c_str());
+            exit(1);
+        }
+        uint64_t hash = Hash(key);
+        index.insert(std::make_pair(hash, location));
+        {
+            std::ofstream index_file(index_filename, std::ios::app);
+            index_file << hash << " " << location.offset << " " <<
+                location.length << "\n";
+        }
+        UnlockFiles(lock_fd);
+    }
+};
+
+// if true, solved fights are stored in and recalled from solve_cache
+bool use_solve_cache = false;
+
+// cache of solved fights
+SolveCache solve_cache("solve_cache.log", "solve_cache.idx");
@@ -15,11 +15,64 @@
 #include "fight.hpp"
 #include "stopwatch.hpp"
 #include "tree.hpp"
+#include "hp_sweep.hpp"
+#include "tablebase.hpp"
+#include "compare.hpp"
+#include "jobs.hpp"
+#include "distributed.hpp"
+#include "tree_export.hpp"
+#include "server.hpp"
 
 /*
 
 --character=ironclad --relics=pure_water --fight=gremlin_nob --hp=full
 
+--character=ironclad --fight=gremlin_nob --mob_hp=lanes
+
+--character=ironclad --fight=cultist --hp_sweep=on
+
+--character=ironclad --fight=gremlin_nob --cache=on
+
+--character=ironclad --fight=gremlin_nob --memo=on
+
+--character=ironclad --fight=cultist --make_tablebase=cultist.bin --tablebase_mob_hp=10 --tablebase_cards=5 --tablebase_intents=incantation
+
+--character=ironclad --fight=cultist --tablebase=cultist.bin
+
+--character=ironclad --fight=gremlin_nob --compare=cards
+
+--character=ironclad --fight=gremlin_nob --checkpoint=ckpt.bin --checkpoint_interval=600
+--resume=ckpt.bin
+
+--character=ironclad --fight=gremlin_nob --workers=8
+--character=ironclad --fight=gremlin_nob --workers=2 --worker_command="ssh host ./solve_the_spire --worker=on"
+
+--character=ironclad --fight=gremlin_nob --tree_stream=tree.stream
+
+--character=ironclad --fight=gremlin_nob --export_policy=policy.bin
+
+--character=ironclad --fight=gremlin_nob --tree_shape=tree_shape.json
+
+--character=ironclad --fight=gremlin_nob --trace=trace.json
+--jobs=jobs.jsonl --trace=trace.json --trace_min_time=100
+  (open the trace in chrome://tracing or ui.perfetto.dev, --trace_min_time
+  is the shortest event recorded in microseconds)
+
+--serve=stdio
+--serve=/tmp/solve_the_spire.sock --memo=on
+  (each request line is like {"id": "a", "character": "ironclad", "hp": 60, "relics": "burning_blood", "turn": 1, "energy": 3, "hand": "3xStrike,Defend,Bash", "draw_pile": "2xStrike,3xDefend", "mob0": "cultist", "mob0_hp": "48/48", "mob0_intents": "incantation"})
+
+--query=stats --tree_file=tree.bin
+--query=subtree --node=0 --depth=2
+--query=path --node=12345
+
+--export=text --tree_file=tree.bin --export_file=tree.txt
+--export=dot --export_depth=6 --min_probability=0.01 --collapse=on
+--export=json --export_file=tree.json
+
+--jobs=jobs.jsonl --jobs_output=job_results.jsonl
+  (each line is like {"id": "a", "character": "ironclad", "deck": "5xStrike,4xDefend,Bash", "relics": "burning_blood", "hp": 72, "max_hp": 80, "fight": "gremlin_nob"})
+
 --character=silent
 --deck=5xstrike,5xdefend
 --hp=67/100
@@ -77,42 +130,42 @@ void CompareRelics(const TreeStruct & tree, const Node & top_node) {
     relic_list.rbegin()->first = "cursed_key";
     relic_list.rbegin()->second.cursed_key = 1;
 
-    std::ofstream outFile("relic_comparison.txt");
-    std::streambuf * oldCoutStreamBuf = std::cout.rdbuf();
-    bool base = true;
-    double base_objective = 0;
-    outFile << top_node.ToString() << std::endl;
+    std::vector<CompareVariant> variant;
     for (auto & this_list : relic_list) {
-        Node this_top_node = top_node;
-        this_top_node.relics = this_list.second;
-        TreeStruct this_tree(this_top_node);
-        this_tree.fight_type = tree.fight_type;
-        this_tree.Expand();
-        if (base) {
-            outFile << this_list.first << ": " << this_top_node.objective << std::endl;
-            base_objective = this_top_node.objective;
-            base = false;
-        } else {
-            outFile << this_list.first << ": " << this_top_node.objective;
-            outFile << " (";
-            double delta = this_top_node.objective - base_objective;
-            if (delta > 0) {
-                outFile << "+";
-            }
-            outFile << delta << ")";
-            outFile << std::endl;
-        }
+        variant.push_back({this_list.first, GetVariantStartingNode(top_node, top_node.deck)});
+        variant.rbegin()->top_node.relics = this_list.second;
     }
-    outFile.close();
-
+    RunComparison(
+        variant,
+        tree.fight_type,
+        "relic_comparison.txt",
+        std::thread::hardware_concurrency(),
+        tree.generate_all_mob_hp);
+}
 
+// compare the effect on adding each of the given cards on the given fight
+void CompareAddedCards(
+        const TreeStruct & tree,
+        const Node & top_node,
+        const std::vector<const Card *> & card_list) {
+    std::vector<CompareVariant> variant;
+    variant.push_back({"base", GetVariantStartingNode(top_node, top_node.deck)});
+    for (auto & this_card_ptr : card_list) {
+        CardCollectionPtr deck = top_node.deck;
+        deck.AddCard(*this_card_ptr);
+        variant.push_back({this_card_ptr->name, GetVariantStartingNode(top_node, deck)});
+    }
+    RunComparison(
+        variant,
+        tree.fight_type,
+        "card_comparison.txt",
+        std::thread::hardware_concurrency(),
+        tree.generate_all_mob_hp);
 }
 
 // compare the effect on addings cards on the given fight
-void CompareIroncladCards(const Node & top_node) {
+void CompareIroncladCards(const TreeStruct & tree, const Node & top_node) {
     std::vector<const Card *> card_list;
-    // add base case
-    card_list.push_back(nullptr);
 
     // add cards
     card_list.push_back(&card_anger);
@@ -126,45 +179,16 @@ void CompareIroncladCards(const Node & top_node) {
     card_list.push_back(&card_twin_strike);
     card_list.push_back(&card_wild_strike);
 
-    std::ofstream outFile("card_comparison.txt");
-    std::streambuf * oldCoutStreamBuf = std::cout.rdbuf();
-    bool base = true;
-    double base_objective = 0;
-    outFile << top_node.ToString() << std::endl;
-    for (auto & this_card_ptr : card_list) {
-        Node this_top_node = top_node;
-        if (this_card_ptr != nullptr) {
-            this_top_node.deck.AddCard(*this_card_ptr);
-        }
-        this_top_node.InitializeStartingNode();
-        TreeStruct tree(this_top_node);
-        tree.Expand();
-        if (this_card_ptr == nullptr) {
-            outFile << "base: " << this_top_node.objective << std::endl;
-            base_objective = this_top_node.objective;
-            base = false;
-        } else {
-            outFile << this_card_ptr->name << ": " << this_top_node.objective;
-            outFile << " (";
-            double delta = this_top_node.objective - base_objective;
-            if (delta > 0) {
-                outFile << "+";
-            }
-            outFile << delta << ")";
-            outFile << std::endl;
-        }
-    }
-    outFile.close();
+    CompareAddedCards(tree, top_node, card_list);
 }
 
 // compare the effect on addings cards with the given flags on the given fight
 void CompareCards(
+        const TreeStruct & tree,
         const Node & top_node,
         const CardFlagStruct card_flag,
         const CardFlagStruct bad_flag) {
     std::vector<const Card *> card_list;
-    // add base case
-    card_list.push_back(nullptr);
 
     // add cards
     card_list.push_back(&card_anger);
@@ -182,42 +206,12 @@ void CompareCards(
     card_list.push_back(&card_uppercut);
     card_list.push_back(&card_shockwave);
 
-    std::ofstream outFile("card_comparison.txt");
-    std::streambuf * oldCoutStreamBuf = std::cout.rdbuf();
-    bool base = true;
-    double base_objective = 0;
-    outFile << top_node.ToString() << std::endl;
-    for (auto & this_card_ptr : card_list) {
-        Node this_top_node = top_node;
-        if (this_card_ptr != nullptr) {
-            this_top_node.deck.AddCard(*this_card_ptr);
-        }
-        this_top_node.InitializeStartingNode();
-        TreeStruct tree(this_top_node);
-        tree.Expand();
-        if (this_card_ptr == nullptr) {
-            outFile << "base: " << this_top_node.objective << std::endl;
-            base_objective = this_top_node.objective;
-            base = false;
-        } else {
-            outFile << this_card_ptr->name << ": " << this_top_node.objective;
-            outFile << " (";
-            double delta = this_top_node.objective - base_objective;
-            if (delta > 0) {
-                outFile << "+";
-            }
-            outFile << delta << ")";
-            outFile << std::endl;
-        }
-    }
-    outFile.close();
+    CompareAddedCards(tree, top_node, card_list);
 }
 
 // compare the effect on addings cards on the given fight
-void CompareWatcherCards(const Node & top_node) {
+void CompareWatcherCards(const TreeStruct & tree, const Node & top_node) {
     std::vector<const Card *> card_list;
-    // add base case
-    card_list.push_back(nullptr);
 
     // add cards
     card_list.push_back(&card_bowling_bash);
@@ -235,122 +229,29 @@ void CompareWatcherCards(const Node & top_node) {
     card_list.push_back(&card_sash_whip);
     card_list.push_back(&card_tranquility);
 
-    std::ofstream outFile("card_comparison.txt");
-    std::streambuf * oldCoutStreamBuf = std::cout.rdbuf();
-    bool base = true;
-    double base_objective = 0;
-    outFile << top_node.ToString() << std::endl;
-    for (auto & this_card_ptr : card_list) {
-        Node this_top_node = top_node;
-        if (this_card_ptr != nullptr) {
-            this_top_node.deck.AddCard(*this_card_ptr);
-        }
-        this_top_node.InitializeStartingNode();
-        TreeStruct tree(this_top_node);
-        tree.Expand();
-        if (this_card_ptr == nullptr) {
-            outFile << "base: " << this_top_node.objective << std::endl;
-            base_objective = this_top_node.objective;
-            base = false;
-        } else {
-            outFile << this_card_ptr->name << ": " << this_top_node.objective;
-            outFile << " (";
-            double delta = this_top_node.objective - base_objective;
-            if (delta > 0) {
-                outFile << "+";
-            }
-            outFile << delta << ")";
-            outFile << std::endl;
-        }
-    }
-    outFile.close();
+    CompareAddedCards(tree, top_node, card_list);
 }
 
 // compare the effect of upgrading cards on the given fight
-void CompareUpgrades(const Node & top_node) {
-    std::vector<card_index_t> upgrade_list;
-
-    // add base cards to upgrade
-    upgrade_list.push_back(-1);
+void CompareUpgrades(const TreeStruct & tree, const Node & top_node) {
+    std::vector<CompareVariant> variant;
+    variant.push_back({"base", GetVariantStartingNode(top_node, top_node.deck)});
     for (const auto & deck_item : top_node.deck) {
-        if (card_map[deck_item.first]->upgraded_version != nullptr) {
-            upgrade_list.push_back(deck_item.first);
-        }
-    }
-
-    std::ofstream outFile("upgrade_comparison.txt");
-    std::streambuf * oldCoutStreamBuf = std::cout.rdbuf();
-    bool base = true;
-    double base_objective = 0;
-    outFile << top_node.ToString() << std::endl;
-    for (auto & index : upgrade_list) {
-        Node this_top_node = top_node;
-        if (index != -1) {
-            this_top_node.deck.RemoveCard(index);
-            this_top_node.deck.AddCard(*card_map[index]->upgraded_version);
-        }
-        this_top_node.InitializeStartingNode();
-        TreeStruct tree(this_top_node);
-        tree.Expand();
-        if (index == 65535) {
-            outFile << "base: " << this_top_node.objective << std::endl;
-            base_objective = this_top_node.objective;
-            base = false;
-        } else {
-            outFile << card_map[index]->upgraded_version->name << ": " <<
-                this_top_node.objective;
-            outFile << " (";
-            double delta = this_top_node.objective - base_objective;
-            if (delta > 0) {
-                outFile << "+";
-            }
-            outFile << delta << ")";
-            outFile << std::endl;
+        const Card * upgraded_card = card_map[deck_item.first]->upgraded_version;
+        if (upgraded_card == nullptr) {
+            continue;
         }
+        CardCollectionPtr deck = top_node.deck;
+        deck.RemoveCard(deck_item.first);
+        deck.AddCard(*upgraded_card);
+        variant.push_back({upgraded_card->name, GetVariantStartingNode(top_node, deck)});
     }
-    outFile.close();
-}
-
-// populate deck maps
-void PopulateDecks() {
-
-    CardCollectionPtr deck;
-
-    deck.Clear();
-    deck.AddCard(card_strike, 5);
-    deck.AddCard(card_defend, 4);
-    deck.AddCard(card_bash, 1);
-    deck_map["starting_ironclad"] = deck;
-    deck.AddCard(card_ascenders_bane, 1);
-    deck_map["starting_ironclad_cursed"] = deck;
-
-    deck.Clear();
-    deck.AddCard(card_strike, 5);
-    deck.AddCard(card_defend, 5);
-    deck.AddCard(card_survivor, 1);
-    deck.AddCard(card_neutralize, 1);
-    deck_map["starting_silent"] = deck;
-    deck.AddCard(card_ascenders_bane, 1);
-    deck_map["starting_silent_cursed"] = deck;
-
-    deck.Clear();
-    deck.AddCard(card_strike, 4);
-    deck.AddCard(card_defend, 4);
-    deck.AddCard(card_zap, 1);
-    deck.AddCard(card_dualcast, 1);
-    deck_map["starting_defect"] = deck;
-    deck.AddCard(card_ascenders_bane, 1);
-    deck_map["starting_defect_cursed"] = deck;
-
-    deck.Clear();
-    deck.AddCard(card_strike, 4);
-    deck.AddCard(card_defend, 4);
-    deck.AddCard(card_eruption, 1);
-    deck.AddCard(card_vigilance, 1);
-    deck_map["starting_watcher"] = deck;
-    deck.AddCard(card_ascenders_bane, 1);
-    deck_map["starting_watcher_cursed"] = deck;
-
+    RunComparison(
+        variant,
+        tree.fight_type,
+        "upgrade_comparison.txt",
+        std::thread::hardware_concurrency(),
+        tree.generate_all_mob_hp);
 }
 
 // normalize the string
@@ -379,9 +280,10 @@ void CombineRelic(RelicStruct & one, const RelicStruct & two) {
     //}
 }
 
-// return a relic struct of the given relic string
-RelicStruct ParseRelics(std::string text) {
-    RelicStruct relic = {0};
+// parse a relic string, return false and set unknown_name if a relic
+// isn't found
+bool TryParseRelics(std::string text, RelicStruct & relic, std::string & unknown_name) {
+    relic = {0};
     text += ",";
     while (!text.empty()) {
         // get this relic
@@ -395,15 +297,473 @@ RelicStruct ParseRelics(std::string text) {
             }
         }
         if (!found) {
-            printf("Unknown relic name: \"%s\"\n", relic_name.c_str());
-            exit(1);
+            unknown_name = relic_name;
+            return false;
         }
         // skip to next comma
         text = text.substr(text.find(',') + 1);
     }
+    return true;
+}
+
+// return a relic struct of the given relic string
+RelicStruct ParseRelics(std::string text) {
+    RelicStruct relic = {0};
+    std::string unknown_name;
+    if (!TryParseRelics(text, relic, unknown_name)) {
+        printf("Unknown relic name: \"%s\"\n", unknown_name.c_str());
+        exit(1);
+    }
     return relic;
 }
 
+// return the card with the given name, or nullptr if not found
+// (names are compared like NormalizeString, except a "+" must match)
+const Card * FindCard(const std::string & name) {
+    auto get_key = [](const std::string & text) {
+        std::string key = NormalizeString(text);
+        if (text.find('+') != std::string::npos) {
+            key += "+";
+        }
+        return key;
+    };
+    const std::string key = get_key(name);
+    for (const Card * card : all_cards) {
+        if (get_key(card->name) == key) {
+            return card;
+        }
+    }
+    return nullptr;
+}
+
+// parse a deck from text such as "5xStrike,4xDefend,Bash+", return false
+// and set unknown_name if a card isn't found
+bool TryParseDeck(std::string text, CardCollectionPtr & deck, std::string & unknown_name) {
+    deck.Clear();
+    text += ",";
+    while (!text.empty()) {
+        std::string item = text.substr(0, text.find(','));
+        text = text.substr(text.find(',') + 1);
+        // get the count, if any
+        std::size_t start = 0;
+        while (start < item.size() && isspace((unsigned char) item[start])) {
+            ++start;
+        }
+        std::size_t end = start;
+        while (end < item.size() && isdigit((unsigned char) item[end])) {
+            ++end;
+        }
+        card_count_t count = 1;
+        if (end > start && end < item.size() && tolower(item[end]) == 'x') {
+            count = (card_count_t) atoi(item.substr(start, end - start).c_str());
+            item = item.substr(end + 1);
+        }
+        if (NormalizeString(item).empty()) {
+            continue;
+        }
+        const Card * card = FindCard(item);
+        if (card == nullptr) {
+            unknown_name = item;
+            return false;
+        }
+        deck.AddCard(*card, count);
+    }
+    return true;
+}
+
+// return a deck parsed from text such as "5xStrike,4xDefend,Bash+"
+CardCollectionPtr ParseDeck(std::string text) {
+    CardCollectionPtr deck;
+    std::string unknown_name;
+    if (!TryParseDeck(text, deck, unknown_name)) {
+        printf("Unknown card name: \"%s\"\n", unknown_name.c_str());
+        exit(1);
+    }
+    return deck;
+}
+
+// set up the deck, relics and hp of the given character, return true if found
+bool SetCharacter(Node & node, const std::string & name) {
+    for (auto & item : character_map) {
+        if (name == NormalizeString(item.first)) {
+            node.deck = deck_map[item.second.deck];
+            node.relics = ParseRelics(item.second.relics);
+            node.max_hp = item.second.max_hp;
+            node.hp = node.max_hp * 9 / 10;
+            return true;
+        }
+    }
+    return false;
+}
+
+// return the fight with the given name, or kFightNone if not found
+FightEnum FindFight(const std::string & name) {
+    for (auto & item : fight_map) {
+        if (name == NormalizeString(item.second.name)) {
+            return item.first;
+        }
+    }
+    return kFightNone;
+}
+
+// parse an hp value such as "67", "67/80" or "full"
+// (max_hp is only changed if given)
+void ParseHP(const std::string & text, uint8_t & hp, uint8_t & max_hp) {
+    if (NormalizeString(text) == "full") {
+        hp = max_hp;
+        return;
+    }
+    hp = (uint8_t) atoi(text.c_str());
+    if (text.find('/') != std::string::npos) {
+        max_hp = (uint8_t) atoi(text.substr(text.find('/') + 1).c_str());
+    }
+}
+
+// load the jobs in a JSON lines file
+// (each line is an object with an optional "id", a "character" and/or
+// "deck", optional "relics", "hp" and "max_hp", and a "fight")
+std::vector<Job> LoadJobs(std::string filename) {
+    std::ifstream file(filename);
+    if (!file.good()) {
+        printf("ERROR: could not open %s\n", filename.c_str());
+        exit(1);
+    }
+    // the deck is shared by nodes in this thread, so restore it afterwards
+    const CardCollectionPtr original_deck = NodeShared::deck;
+    std::vector<Job> job;
+    std::string line;
+    unsigned int line_number = 0;
+    while (std::getline(file, line)) {
+        ++line_number;
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        JsonObject object;
+        if (!ParseJsonObject(line, object)) {
+            printf("ERROR: could not parse line %u of %s\n",
+                line_number, filename.c_str());
+            exit(1);
+        }
+        for (auto & item : object) {
+            if (item.first != "id" && item.first != "character" &&
+                    item.first != "deck" && item.first != "relics" &&
+                    item.first != "hp" && item.first != "max_hp" &&
+                    item.first != "fight") {
+                printf("ERROR: unknown key \"%s\" on line %u of %s\n",
+                    item.first.c_str(), line_number, filename.c_str());
+                exit(1);
+            }
+        }
+        Node node;
+        node.hp = 0;
+        node.max_hp = 0;
+        node.relics = {0};
+        node.deck.Clear();
+        if (object.count("character") &&
+                !SetCharacter(node, NormalizeString(object["character"]))) {
+            printf("ERROR: unknown character on line %u of %s\n",
+                line_number, filename.c_str());
+            exit(1);
+        }
+        if (object.count("deck")) {
+            node.deck = ParseDeck(object["deck"]);
+        }
+        if (object.count("relics")) {
+            CombineRelic(node.relics, ParseRelics(object["relics"]));
+        }
+        if (object.count("max_hp")) {
+            node.max_hp = (uint8_t) atoi(object["max_hp"].c_str());
+        }
+        if (object.count("hp")) {
+            ParseHP(object["hp"], node.hp, node.max_hp);
+        }
+        if (node.max_hp == 0) {
+            node.max_hp = node.hp;
+        }
+        Job this_job;
+        this_job.id = object.count("id") ? object["id"] : line;
+        this_job.deck = node.deck.node_ptr->collection;
+        this_job.relics = node.relics;
+        this_job.hp = node.hp;
+        this_job.max_hp = node.max_hp;
+        this_job.fight_type = FindFight(NormalizeString(object["fight"]));
+        if (this_job.deck.IsEmpty() || this_job.hp == 0 ||
+                this_job.hp > this_job.max_hp ||
+                this_job.fight_type == kFightNone) {
+            printf("ERROR: invalid job on line %u of %s\n",
+                line_number, filename.c_str());
+            exit(1);
+        }
+        job.push_back(this_job);
+    }
+    NodeShared::deck = original_deck;
+    return job;
+}
+
+// return the mob with the given name, or nullptr if not found
+// (names are compared like NormalizeString)
+const BaseMonster * FindMob(const std::string & name) {
+    const std::string key = NormalizeString(name);
+    for (const BaseMonster * base_mob : all_base_mobs) {
+        if (NormalizeString(base_mob->name) == key) {
+            return base_mob;
+        }
+    }
+    return nullptr;
+}
+
+// parse buffs such as "strength=2,vulnerable=1", return false and set error
+// if a buff isn't found
+bool ParseBuffs(std::string text, BuffState & buff, std::string & error) {
+    text += ",";
+    while (!text.empty()) {
+        std::string item = text.substr(0, text.find(','));
+        text = text.substr(text.find(',') + 1);
+        if (NormalizeString(item).empty()) {
+            continue;
+        }
+        const std::string name = NormalizeString(item.substr(0, item.find('=')));
+        bool found = false;
+        for (unsigned int i = 0; i < kBuffFinal; ++i) {
+            if (NormalizeString(buff_name[i]) == name) {
+                buff[(BuffType) i] = (int16_t) atoi(item.substr(item.find('=') + 1).c_str());
+                found = true;
+                break;
+            }
+        }
+        if (!found || item.find('=') == std::string::npos) {
+            error = "unknown buff \"" + item + "\"";
+            return false;
+        }
+    }
+    return true;
+}
+
+// fill in a solve server request (see server.hpp)
+// A request to solve a fight from the start has the keys of a job line (see
+// LoadJobs).  A request for the best play in a fight adds the state at the
+// decision: "hand", "draw_pile", "discard_pile" and "exhaust_pile" (like
+// "deck", which defaults to all of them), "turn", "energy", "block", player
+// "buffs" such as "strength=2,weak=1", and for each mob N from 0, "mobN" (its
+// name), "mobN_hp" (like "40/48"), "mobN_block", "mobN_buffs" and
+// "mobN_intents" (its intent this turn, then the ones before it, such as
+// "dark_strike,incantation").  The fight isn't needed.
+bool ParseServerRequest(
+        const JsonObject & object,
+        ServerRequest & request,
+        std::string & error) {
+    const std::set<std::string> pile_key = {
+        "hand", "draw_pile", "discard_pile", "exhaust_pile"};
+    const std::set<std::string> mob_key = {
+        "", "_hp", "_block", "_buffs", "_intents"};
+    std::set<std::string> known_key = {
+        "id", "character", "deck", "relics", "hp", "max_hp", "fight",
+        "turn", "energy", "block", "buffs"};
+    known_key.insert(pile_key.begin(), pile_key.end());
+    for (unsigned int i = 0; i < MAX_MOBS_PER_NODE; ++i) {
+        for (const auto & suffix : mob_key) {
+            known_key.insert("mob" + std::to_string(i) + suffix);
+        }
+    }
+    for (const auto & item : object) {
+        if (known_key.find(item.first) == known_key.end()) {
+            error = "unknown key \"" + item.first + "\"";
+            return false;
+        }
+    }
+    auto get = [&object](const std::string & key) {
+        auto it = object.find(key);
+        return it == object.end() ? std::string() : it->second;
+    };
+    std::string unknown_name;
+    Node & node = request.node;
+    node.hp = 0;
+    node.max_hp = 0;
+    node.relics = {0};
+    node.deck.Clear();
+    if (object.count("character") && !SetCharacter(node, NormalizeString(get("character")))) {
+        error = "unknown character";
+        return false;
+    }
+    if (object.count("deck") && !TryParseDeck(get("deck"), node.deck, unknown_name)) {
+        error = "unknown card \"" + unknown_name + "\"";
+        return false;
+    }
+    if (object.count("relics")) {
+        RelicStruct relics;
+        if (!TryParseRelics(get("relics"), relics, unknown_name)) {
+            error = "unknown relic \"" + unknown_name + "\"";
+            return false;
+        }
+        CombineRelic(node.relics, relics);
+    }
+    if (object.count("max_hp")) {
+        node.max_hp = (uint8_t) atoi(get("max_hp").c_str());
+    }
+    if (object.count("hp")) {
+        ParseHP(get("hp"), node.hp, node.max_hp);
+    }
+    if (node.max_hp == 0) {
+        node.max_hp = node.hp;
+    }
+    if (node.hp == 0 || node.hp > node.max_hp) {
+        error = "invalid hp";
+        return false;
+    }
+    // a fight start
+    if (!object.count("hand")) {
+        request.fight_type = FindFight(NormalizeString(get("fight")));
+        if (request.fight_type == kFightNone) {
+            error = "unknown fight";
+            return false;
+        }
+        if (node.deck.IsEmpty()) {
+            error = "empty deck";
+            return false;
+        }
+        return true;
+    }
+    // a decision state
+    std::map<std::string, CardCollectionPtr> pile;
+    for (const auto & key : pile_key) {
+        if (!TryParseDeck(get(key), pile[key], unknown_name)) {
+            error = "unknown card \"" + unknown_name + "\"";
+            return false;
+        }
+    }
+    if (!object.count("deck")) {
+        for (const auto & item : pile) {
+            node.deck.AddDeck(item.second);
+        }
+    }
+    node.InitializeStartingNode();
+    node.PopPendingAction();
+    node.hand = pile["hand"];
+    node.draw_pile = pile["draw_pile"];
+    node.discard_pile = pile["discard_pile"];
+    node.exhaust_pile = pile["exhaust_pile"];
+    node.turn = (uint8_t) (object.count("turn") ? atoi(get("turn").c_str()) : 1);
+    node.energy = (uint8_t) (object.count("energy") ? atoi(get("energy").c_str()) : 3);
+    node.block = (uint8_t) atoi(get("block").c_str());
+    if (!ParseBuffs(get("buffs"), node.buff, error)) {
+        return false;
+    }
+    for (unsigned int i = 0; i < MAX_MOBS_PER_NODE; ++i) {
+        const std::string key = "mob" + std::to_string(i);
+        if (!object.count(key)) {
+            continue;
+        }
+        const BaseMonster * base_mob = FindMob(get(key));
+        if (base_mob == nullptr) {
+            error = "unknown mob \"" + get(key) + "\"";
+            return false;
+        }
+        Monster & mob = node.monster[i];
+        mob = Monster(*base_mob);
+        const std::string hp_text = get(key + "_hp");
+        if (!hp_text.empty()) {
+            mob.hp = (uint16_t) atoi(hp_text.c_str());
+            mob.max_hp = mob.hp;
+            if (hp_text.find('/') != std::string::npos) {
+                mob.max_hp = (uint16_t) atoi(hp_text.substr(hp_text.find('/') + 1).c_str());
+            }
+        }
+        mob.block = (uint8_t) atoi(get(key + "_block").c_str());
+        if (!ParseBuffs(get(key + "_buffs"), mob.buff, error)) {
+            return false;
+        }
+        // find each intent, most recent first
+        std::string intents = get(key + "_intents") + ",";
+        unsigned int intent_count = 0;
+        while (!intents.empty()) {
+            const std::string intent_name = NormalizeString(intents.substr(0, intents.find(',')));
+            intents = intents.substr(intents.find(',') + 1);
+            if (intent_name.empty()) {
+                continue;
+            }
+            uint8_t intent = 255;
+            for (uint8_t j = 0; j < MAX_MOB_INTENTS; ++j) {
+                if (!base_mob->intent[j].name.empty() &&
+                        intent_name == NormalizeString(base_mob->intent[j].name)) {
+                    intent = j;
+                    break;
+                }
+            }
+            if (intent == 255 || intent_count == sizeof(mob.last_intent)) {
+                error = "unknown intent \"" + intent_name + "\"";
+                return false;
+            }
+            mob.last_intent[intent_count++] = intent;
+        }
+        if (intent_count == 0) {
+            error = "missing " + key + "_intents";
+            return false;
+        }
+    }
+    node.objective = node.GetMaxFinalObjective();
+    return true;
+}
+
+// if true, solve every starting HP instead of just the given one
+bool sweep_starting_hp = false;
+
+// if not empty, generate a tablebase to this file instead of solving
+std::string tablebase_output_filename;
+
+// thresholds of the tablebase to generate
+TablebaseSettings tablebase_settings;
+
+// names of the intent history of the tablebase mob (most recent first)
+std::vector<std::string> tablebase_intent_names;
+
+// if not empty, run this comparison instead of solving
+// (relics, cards, ironclad_cards, watcher_cards or upgrades)
+std::string comparison;
+
+// if not empty, solve the jobs in this file instead
+std::string jobs_filename;
+
+// file to write job results to
+std::string jobs_output_filename = "job_results.jsonl";
+
+// if true, run as a worker for a distributed solve (see distributed.hpp)
+bool run_as_worker = false;
+
+// if not 0, solve states after the first turn on this many worker processes
+unsigned int worker_count = 0;
+
+// command to start a worker (or empty to start this program locally)
+std::string worker_command;
+
+// if not empty, answer solve requests on stdin ("stdio") or on this Unix
+// socket instead of solving (see server.hpp)
+std::string server_address;
+
+// if not empty, continue the solve in this checkpoint
+std::string resume_filename;
+
+// if not empty, answer this query about a tree file instead of solving
+std::string tree_query;
+
+// tree file to query
+std::string tree_query_filename = "tree.bin";
+
+// node to query
+uint64_t tree_query_node = 0;
+
+// depth of the subtree to print
+unsigned int tree_query_depth = 2;
+
+// if true, export the tree file instead of solving
+bool export_tree = false;
+
+// settings for exporting the tree file
+TreeExportSettings tree_export_settings;
+
+// file to export the tree file to (or empty for tree.txt, tree.dot or
+// tree.json)
+std::string tree_export_filename;
+
 // process the given argument, return true if successful
 bool ProcessArgument(TreeStruct & tree, std::string original_argument) {
     Node & node = *tree.top_node_ptr;
@@ -415,46 +775,182 @@ bool ProcessArgument(TreeStruct & tree, std::string original_argument) {
     std::string name = argument.substr(0, argument.find("="));
     // argument value
     std::string value = argument.substr(argument.find("=") + 1);
+    // argument value as given (for filenames and numbers)
+    std::string raw_value =
+        original_argument.substr(original_argument.find("=") + 1);
     if (name == "character") {
-        bool found = false;
-        for (auto & item : character_map) {
-            if (value == NormalizeString(item.first)) {
-                found = true;
-                node.deck = deck_map[character_map[value].deck];
-                node.relics = ParseRelics(character_map[value].relics);
-                node.max_hp = character_map[value].max_hp;
-                node.hp = node.max_hp * 9 / 10;
-                break;
-            }
-        }
-        return found;
+        return SetCharacter(node, value);
+    } else if (name == "deck") {
+        node.deck = ParseDeck(raw_value);
+        printf("Setting deck to %s\n", node.deck.ToString().c_str());
     } else if (name == "relic" || name == "relics") {
         CombineRelic(node.relics, ParseRelics(value));
     } else if (name == "fight") {
-        bool found = false;
-        for (auto & item : fight_map) {
-            if (value == NormalizeString(item.second.name)) {
-                tree.fight_type = item.first;
-                printf("Setting fight to %s\n", item.second.name.c_str());
-                found = true;
-                break;
-            }
+        tree.fight_type = FindFight(value);
+        if (tree.fight_type == kFightNone) {
+            return false;
         }
-        return found;
+        printf("Setting fight to %s\n", fight_map[tree.fight_type].name.c_str());
     } else if (name == "maxhp") {
-        node.max_hp = atoi(value.c_str());
+        node.max_hp = atoi(raw_value.c_str());
         printf("Setting max HP to %d\n", (int) node.max_hp);
     } else if (name == "hp") {
-        if (value == "full") {
-            node.hp = node.max_hp;
-        } else {
-            node.hp = atoi(value.c_str());;
-        }
+        ParseHP(raw_value, node.hp, node.max_hp);
         printf("Setting HP to %d\n", (int) node.hp);
         if (node.max_hp == 0) {
             node.max_hp = node.hp;
             printf("Setting max HP to %d\n", (int) node.max_hp);
         }
+    } else if (name == "mobhp") {
+        // average: one mob with the average HP
+        // each: one subtree for each possible mob HP
+        // lanes: all possible mob HPs solved together
+        if (value == "average") {
+            tree.generate_all_mob_hp = false;
+            tree.use_mob_hp_lanes = false;
+        } else if (value == "each") {
+            tree.generate_all_mob_hp = true;
+            tree.use_mob_hp_lanes = false;
+        } else if (value == "lanes") {
+            tree.generate_all_mob_hp = true;
+            tree.use_mob_hp_lanes = true;
+        } else {
+            return false;
+        }
+        printf("Setting mob HP mode to %s\n", value.c_str());
+    } else if (name == "hpsweep") {
+        if (value == "on") {
+            sweep_starting_hp = true;
+        } else if (value == "off") {
+            sweep_starting_hp = false;
+        } else {
+            return false;
+        }
+        printf("Setting HP sweep to %s\n", value.c_str());
+    } else if (name == "cache") {
+        if (value == "on") {
+            use_solve_cache = true;
+        } else if (value == "off") {
+            use_solve_cache = false;
+        } else {
+            return false;
+        }
+        printf("Setting solve cache to %s\n", value.c_str());
+    } else if (name == "memo") {
+        if (value == "on") {
+            use_subgame_memo = true;
+        } else if (value == "off") {
+            use_subgame_memo = false;
+        } else {
+            return false;
+        }
+        tree.memo = use_subgame_memo ? &subgame_memo : nullptr;
+        printf("Setting subgame memo to %s\n", value.c_str());
+    } else if (name == "worker") {
+        if (value == "on") {
+            run_as_worker = true;
+        } else if (value == "off") {
+            run_as_worker = false;
+        } else {
+            return false;
+        }
+    } else if (name == "workers") {
+        worker_count = atoi(raw_value.c_str());
+        printf("Setting worker count to %u\n", worker_count);
+    } else if (name == "workercommand") {
+        worker_command = raw_value;
+    } else if (name == "checkpoint") {
+        tree.checkpoint_filename = raw_value;
+        printf("Writing checkpoints to %s\n", raw_value.c_str());
+    } else if (name == "checkpointinterval") {
+        tree.checkpoint_interval_s = atof(raw_value.c_str());
+        printf("Setting checkpoint interval to %g seconds\n",
+            tree.checkpoint_interval_s);
+    } else if (name == "treestream") {
+        tree.tree_stream_filename = raw_value;
+        printf("Writing solved subtrees to %s\n", raw_value.c_str());
+    } else if (name == "exportpolicy") {
+        tree.policy_filename = raw_value;
+        printf("Writing policy table to %s\n", raw_value.c_str());
+    } else if (name == "treeshape") {
+        tree.tree_shape_filename = raw_value;
+    } else if (name == "trace") {
+        StartTrace(raw_value);
+        printf("Writing trace to %s\n", raw_value.c_str());
+    } else if (name == "tracemintime") {
+        trace_min_duration_ns = (uint64_t) (atof(raw_value.c_str()) * 1000.0);
+        printf("Recording trace events of at least %g us\n",
+            trace_min_duration_ns / 1000.0);
+    } else if (name == "serve") {
+        server_address = value == "stdio" ? value : raw_value;
+    } else if (name == "resume") {
+        resume_filename = raw_value;
+    } else if (name == "query") {
+        if (value != "stats" && value != "subtree" && value != "path") {
+            return false;
+        }
+        tree_query = value;
+    } else if (name == "treefile") {
+        tree_query_filename = raw_value;
+    } else if (name == "node") {
+        tree_query_node = strtoull(raw_value.c_str(), nullptr, 10);
+    } else if (name == "depth") {
+        tree_query_depth = atoi(raw_value.c_str());
+    } else if (name == "export") {
+        if (value == "text") {
+            tree_export_settings.format = kTreeExportText;
+        } else if (value == "dot") {
+            tree_export_settings.format = kTreeExportDot;
+        } else if (value == "json") {
+            tree_export_settings.format = kTreeExportJson;
+        } else {
+            return false;
+        }
+        export_tree = true;
+    } else if (name == "exportfile") {
+        tree_export_filename = raw_value;
+    } else if (name == "exportdepth") {
+        tree_export_settings.max_depth = atoi(raw_value.c_str());
+    } else if (name == "minprobability") {
+        tree_export_settings.min_probability = atof(raw_value.c_str());
+    } else if (name == "collapse") {
+        if (value == "on") {
+            tree_export_settings.collapse = true;
+        } else if (value == "off") {
+            tree_export_settings.collapse = false;
+        } else {
+            return false;
+        }
+    } else if (name == "jobs") {
+        jobs_filename = raw_value;
+    } else if (name == "jobsoutput") {
+        jobs_output_filename = raw_value;
+    } else if (name == "compare") {
+        if (value != "relics" && value != "cards" && value != "ironcladcards" &&
+                value != "watchercards" && value != "upgrades") {
+            return false;
+        }
+        comparison = value;
+        printf("Setting comparison to %s\n", value.c_str());
+    } else if (name == "tablebase") {
+        use_tablebase = true;
+        tablebase.filename = raw_value;
+        printf("Using tablebase %s\n", raw_value.c_str());
+    } else if (name == "maketablebase") {
+        tablebase_output_filename = raw_value;
+    } else if (name == "tablebasemobhp") {
+        tablebase_settings.max_mob_hp = (uint16_t) atoi(raw_value.c_str());
+    } else if (name == "tablebasecards") {
+        tablebase_settings.max_cards = atoi(raw_value.c_str());
+    } else if (name == "tablebaseintents") {
+        tablebase_intent_names.clear();
+        if (value != "none") {
+            value += ",";
+            while (!value.empty()) {
+                tablebase_intent_names.push_back(value.substr(0, value.find(',')));
+                value = value.substr(value.find(',') + 1);
+            }
+        }
     } else {
         printf("ERROR: argument name \"%s\" not recognized\n", name.c_str());
         return false;
@@ -540,6 +1036,49 @@ int main(int argc, char ** argv) {
 
     }
 
+    if (run_as_worker) {
+        RunWorker();
+    }
+
+    if (!server_address.empty()) {
+        RunServer(
+            server_address,
+            ParseServerRequest,
+            std::thread::hardware_concurrency());
+    }
+
+    if (!tree_query.empty()) {
+        RunTreeQuery(
+            tree_query_filename,
+            tree_query,
+            tree_query_node,
+            tree_query_depth);
+        exit(0);
+    }
+
+    if (export_tree) {
+        if (tree_export_filename.empty()) {
+            const char * extension[] = {"txt", "dot", "json"};
+            tree_export_filename =
+                std::string("tree.") + extension[tree_export_settings.format];
+        }
+        RunTreeExport(tree_query_filename, tree_export_filename, tree_export_settings);
+        exit(0);
+    }
+
+    if (!resume_filename.empty()) {
+        tree.ResumeFromCheckpoint(resume_filename);
+        exit(0);
+    }
+
+    if (!jobs_filename.empty()) {
+        RunJobs(
+            LoadJobs(jobs_filename),
+            jobs_output_filename,
+            std::thread::hardware_concurrency());
+        exit(0);
+    }
+
     if (start_node.deck.IsEmpty() || start_node.hp == 0 || tree.fight_type == kFightNone) {
         printf("ERROR: invalid settings\n");
         exit(1);
@@ -547,14 +1086,83 @@ int main(int argc, char ** argv) {
 
     start_node.InitializeStartingNode();
 
-    tree.Expand();
+    if (!tablebase_output_filename.empty()) {
+        const FightStruct & fight = fight_map[tree.fight_type];
+        if (fight.base_mob == nullptr || fight.burning_elite) {
+            printf("ERROR: tablebases need a fight with a single mob\n");
+            exit(1);
+        }
+        tablebase_settings.base_mob = fight.base_mob;
+        for (const auto & intent_name : tablebase_intent_names) {
+            bool found = false;
+            for (uint8_t i = 0; i < MAX_MOB_INTENTS; ++i) {
+                if (intent_name == NormalizeString(fight.base_mob->intent[i].name)) {
+                    tablebase_settings.last_intent.push_back(i);
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                printf("ERROR: unknown intent \"%s\"\n", intent_name.c_str());
+                exit(1);
+            }
+        }
+        GenerateTablebase(start_node, tablebase_settings, tablebase_output_filename);
+        exit(0);
+    }
+
+    if (!comparison.empty()) {
+        if (comparison == "relics") {
+            CompareRelics(tree, start_node);
+        } else if (comparison == "cards") {
+            CompareCards(tree, start_node, {0}, {0});
+        } else if (comparison == "ironcladcards") {
+            CompareIroncladCards(tree, start_node);
+        } else if (comparison == "watchercards") {
+            CompareWatcherCards(tree, start_node);
+        } else if (comparison == "upgrades") {
+            CompareUpgrades(tree, start_node);
+        }
+        exit(0);
+    }
+
+    if (sweep_starting_hp) {
+        if (tree.use_mob_hp_lanes) {
+            printf("ERROR: HP sweep does not support mob HP lanes\n");
+            exit(1);
+        }
+        auto result = SweepStartingHP(
+            start_node,
+            tree.fight_type,
+            std::thread::hardware_concurrency(),
+            tree.generate_all_mob_hp);
+        PrintHPSweepToFile(result, "hp_sweep.txt");
+        exit(0);
+    }
+
+    // (a fight solved as lanes has no tree to write out)
+    if (tree.use_mob_hp_lanes && (
+            !tree.policy_filename.empty() ||
+            !tree.tree_stream_filename.empty() ||
+            !tree.tree_shape_filename.empty() ||
+            !tree.checkpoint_filename.empty())) {
+        printf("ERROR: mob HP lanes do not support --export_policy, "
+            "--tree_stream, --tree_shape or --checkpoint\n");
+        exit(1);
+    }
+
+    if (worker_count > 0) {
+        SolveDistributed(tree, worker_command, worker_count);
+    } else {
+        tree.ExpandFight();
+    }
 
-    //CompareUpgrades(start_node);
+    //CompareUpgrades(tree, start_node);
 
     //CompareRelics(tree, start_node);
 
-    //CompareCards(start_node, {0}, {0});
-    //CompareWatcherCards(start_node);
+    //CompareCards(tree, start_node, {0}, {0});
+    //CompareWatcherCards(tree, start_node);
 
     exit(0);
 
@@ -1,6 +1,6 @@
 #pragma once
 
-#include <ctime>
+#include <chrono>
 
 // Example usage:
 //   Stopwatch watch;
@@ -8,16 +8,18 @@
 //   std::cout << "Elapsed time is " << watch.GetTime() << " seconds.\n";
 
 // A Stopwatch is a class for keeping track of elapsed time.
+// (it measures wall clock time, since CPU time counts every thread)
 struct Stopwatch {
-    std::clock_t start;
+    std::chrono::steady_clock::time_point start;
     void Reset() {
-        start = clock();
+        start = std::chrono::steady_clock::now();
     }
     Stopwatch() {
         Reset();
     }
     double GetTime() const {
-        return ((double) clock() - start) / CLOCKS_PER_SEC;
+        return std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
     }
     operator double() const {
         return GetTime();
@@ -0,0 +1,458 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "defines.h"
+
+// solved value of a subgame
+struct SubgameValue {
+    // composite objective
+    double objective;
+    // expected final hp
+    double final_hp;
+    // chance to die
+    double death_chance;
+};
+
+// A SubgameMemo stores the solved values of turn-start states on disk so that
+// later solves can skip their subtrees.
+//
+// States are found by their canonical hash, and a value is only used if an
+// independent check hash of the state also matches, so that two states with
+// the same hash are never confused.
+//
+// The table is an open addressing hash table in a file which is memory mapped
+// read only, so any number of processes may read it at once.  New values are
+// appended to a journal file and kept in memory.  Compaction merges the table
+// and journal into a new table file which replaces the old one by renaming,
+// so readers holding the old mapping are never disturbed.
+//
+// (on Windows, the table is read into memory instead of being mapped)
+struct SubgameMemo {
+    // file type of tables and journals
+    static constexpr char file_magic[8] = "STSMEMO";
+    // table and journal file header
+    // (a journal has a header with no slots)
+    struct Header {
+        // file type
+        char magic[8];
+        // solve_cache_version used to build the table
+        uint32_t version;
+        // unused
+        uint32_t reserved;
+        // number of slots (a power of 2)
+        uint64_t capacity;
+        // number of used slots
+        uint64_t count;
+    };
+    // table slot
+    struct Slot {
+        // state hash (0 if unused)
+        uint64_t key;
+        // check hash of the state
+        uint64_t check;
+        // solved value
+        SubgameValue value;
+    };
+    // table filename
+    std::string filename;
+    // true once the table and journal are loaded
+    bool loaded;
+    // mapped table file (or nullptr)
+    const uint8_t * table;
+    // size of the mapped table file
+    std::size_t table_size;
+#ifdef _WIN32
+    // table contents
+    std::vector<uint8_t> table_buffer;
+#endif
+    // values in the journal, which aren't in the table yet
+    std::unordered_map<uint64_t, Slot> journal;
+    // number of lookups
+    std::size_t lookup_count;
+    // number of lookups which found a value
+    std::size_t hit_count;
+    // guards the journal and counters
+    std::mutex mutex;
+    // constructor
+    SubgameMemo(std::string filename_) :
+            filename(filename_),
+            loaded(false),
+            table(nullptr),
+            table_size(0),
+            lookup_count(0),
+            hit_count(0) {
+    }
+    // destructor
+    ~SubgameMemo() {
+        Unload();
+    }
+    // return the journal filename
+    std::string GetJournalFilename() const {
+        return filename + ".journal";
+    }
+    // return the header of the mapped table
+    const Header & GetHeader() const {
+        return *(const Header *) table;
+    }
+    // return the slots of the mapped table
+    const Slot * GetSlots() const {
+        return (const Slot *) (table + sizeof(Header));
+    }
+    // return true if a file header is of the current format
+    static bool IsValidHeader(const Header & header) {
+        return memcmp(header.magic, file_magic, 8) == 0 &&
+            header.version == solve_cache_version;
+    }
+    // return the header to start a new file with
+    static Header GetNewHeader() {
+        Header header = {};
+        memcpy(header.magic, file_magic, 8);
+        header.version = solve_cache_version;
+        return header;
+    }
+    // return true if a table file of the given size is valid
+    static bool IsValidTable(const uint8_t * data, std::size_t size) {
+        if (size < sizeof(Header)) {
+            return false;
+        }
+        const Header & header = *(const Header *) data;
+        return IsValidHeader(header) &&
+            header.capacity > 0 &&
+            (header.capacity & (header.capacity - 1)) == 0 &&
+            size == sizeof(Header) + header.capacity * sizeof(Slot);
+    }
+    // lock the files against changes from other processes
+    // (returns a handle to pass to UnlockFiles)
+    int LockFiles() const {
+#ifdef _WIN32
+        return -1;
+#else
+        std::string lock_filename = filename + ".lock";
+        int fd = open(lock_filename.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd >= 0) {
+            flock(fd, LOCK_EX);
+        }
+        return fd;
+#endif
+    }
+    // unlock the files
+    void UnlockFiles(int fd) const {
+#ifndef _WIN32
+        if (fd >= 0) {
+            flock(fd, LOCK_UN);
+            close(fd);
+        }
+#endif
+    }
+    // map the table file if it exists
+    void MapTable() {
+#ifdef _WIN32
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        if (!file.good()) {
+            return;
+        }
+        table_buffer.resize((std::size_t) file.tellg());
+        file.seekg(0);
+        file.read((char *) table_buffer.data(), table_buffer.size());
+        if (!IsValidTable(table_buffer.data(), table_buffer.size())) {
+            printf("Note: ignoring invalid subgame memo %s\n", filename.c_str());
+            table_buffer.clear();
+            return;
+        }
+        table = table_buffer.data();
+        table_size = table_buffer.size();
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            close(fd);
+            return;
+        }
+        void * data = mmap(nullptr, (std::size_t) info.st_size,
+            PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            return;
+        }
+        if (!IsValidTable((const uint8_t *) data, (std::size_t) info.st_size)) {
+            printf("Note: ignoring invalid subgame memo %s\n", filename.c_str());
+            munmap(data, (std::size_t) info.st_size);
+            return;
+        }
+        table = (const uint8_t *) data;
+        table_size = (std::size_t) info.st_size;
+#endif
+    }
+    // unmap the table file
+    void UnmapTable() {
+#ifdef _WIN32
+        table_buffer.clear();
+#else
+        if (table != nullptr) {
+            munmap((void *) table, table_size);
+        }
+#endif
+        table = nullptr;
+        table_size = 0;
+    }
+    // read the journal into memory
+    // (a journal of another format is ignored)
+    void ReadJournal() {
+        journal.clear();
+        FILE * file = fopen(GetJournalFilename().c_str(), "rb");
+        if (file == nullptr) {
+            return;
+        }
+        Header header;
+        if (fread(&header, sizeof(header), 1, file) != 1 ||
+                !IsValidHeader(header)) {
+            fclose(file);
+            return;
+        }
+        Slot slot;
+        while (fread(&slot, sizeof(slot), 1, file) == 1) {
+            journal[slot.key] = slot;
+        }
+        fclose(file);
+    }
+    // open the journal to append to, starting a new one if it doesn't exist
+    // or is of another format
+    // (files must be locked)
+    FILE * OpenJournal() const {
+        FILE * file = fopen(GetJournalFilename().c_str(), "rb");
+        bool valid = false;
+        if (file != nullptr) {
+            Header header;
+            valid = fread(&header, sizeof(header), 1, file) == 1 &&
+                IsValidHeader(header);
+            fclose(file);
+        }
+        if (valid) {
+            return fopen(GetJournalFilename().c_str(), "ab");
+        }
+        file = fopen(GetJournalFilename().c_str(), "wb");
+        if (file != nullptr) {
+            Header header = GetNewHeader();
+            fwrite(&header, sizeof(header), 1, file);
+        }
+        return file;
+    }
+    // load the table and journal
+    void Load() {
+        loaded = true;
+        MapTable();
+        ReadJournal();
+    }
+    // release the table and journal
+    void Unload() {
+        UnmapTable();
+        journal.clear();
+        loaded = false;
+    }
+    // return the number of values stored
+    std::size_t Count() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!loaded) {
+            Load();
+        }
+        return (table ? GetHeader().count : 0) + journal.size();
+    }
+    // look for a slot with the given key in the table
+    const Slot * FindInTable(uint64_t key) const {
+        if (table == nullptr) {
+            return nullptr;
+        }
+        const Header & header = GetHeader();
+        const Slot * slot = GetSlots();
+        const uint64_t mask = header.capacity - 1;
+        for (uint64_t i = key & mask; slot[i].key != 0; i = (i + 1) & mask) {
+            if (slot[i].key == key) {
+                return &slot[i];
+            }
+        }
+        return nullptr;
+    }
+    // return the slot with the given key, or nullptr
+    const Slot * Find(uint64_t key) const {
+        auto it = journal.find(key);
+        if (it != journal.end()) {
+            return &it->second;
+        }
+        return FindInTable(key);
+    }
+    // look up a state by its hash and check hash, return true if found
+    bool Lookup(uint64_t key, uint64_t check, SubgameValue & value) {
+        if (key == 0) {
+            key = 1;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!loaded) {
+            Load();
+        }
+        ++lookup_count;
+        const Slot * slot = Find(key);
+        if (slot == nullptr || slot->check != check) {
+            return false;
+        }
+        value = slot->value;
+        ++hit_count;
+        return true;
+    }
+    // store values and compact the table if the journal has grown too large
+    // (if a state has the same key as a stored state but not the same check
+    // hash, it isn't stored)
+    // (returns the number of values which were new)
+    std::size_t Store(const std::vector<Slot> & item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!loaded) {
+            Load();
+        }
+        std::vector<Slot> slot;
+        for (const auto & this_item : item) {
+            Slot this_slot = this_item;
+            if (this_slot.key == 0) {
+                this_slot.key = 1;
+            }
+            if (Find(this_slot.key) != nullptr) {
+                continue;
+            }
+            journal[this_slot.key] = this_slot;
+            slot.push_back(this_slot);
+        }
+        if (slot.empty()) {
+            return 0;
+        }
+        int lock_fd = LockFiles();
+        FILE * file = OpenJournal();
+        if (file == nullptr) {
+            UnlockFiles(lock_fd);
+            printf("ERROR: could not write to %s\n",
+                GetJournalFilename().c_str());
+            exit(1);
+        }
+        fwrite(slot.data(), sizeof(Slot), slot.size(), file);
+        fclose(file);
+        const std::size_t table_count = table ? GetHeader().count : 0;
+        if (journal.size() >= min_subgame_memo_journal_size &&
+                journal.size() * 4 >= table_count) {
+            Compact();
+        }
+        UnlockFiles(lock_fd);
+        return slot.size();
+    }
+    // merge the journal into the table now
+    void Flush() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!loaded) {
+            Load();
+        }
+        if (journal.empty()) {
+            return;
+        }
+        int lock_fd = LockFiles();
+        Compact();
+        UnlockFiles(lock_fd);
+    }
+    // merge the journal into a new table
+    // (files must be locked)
+    void Compact() {
+        // pick up values from other processes
+        UnmapTable();
+        MapTable();
+        std::unordered_map<uint64_t, Slot> new_journal = journal;
+        ReadJournal();
+        journal.insert(new_journal.begin(), new_journal.end());
+        // size the table to be at most half full
+        std::size_t count = journal.size();
+        if (table != nullptr) {
+            count += GetHeader().count;
+        }
+        uint64_t capacity = 1024;
+        while (capacity < 2 * count) {
+            capacity *= 2;
+        }
+        std::vector<Slot> slot((std::size_t) capacity, Slot{0, 0, {0, 0, 0}});
+        uint64_t new_count = 0;
+        auto insert = [&](const Slot & new_slot) {
+            uint64_t i = new_slot.key & (capacity - 1);
+            while (slot[i].key != 0) {
+                if (slot[i].key == new_slot.key) {
+                    return;
+                }
+                i = (i + 1) & (capacity - 1);
+            }
+            slot[i] = new_slot;
+            ++new_count;
+        };
+        if (table != nullptr) {
+            const Slot * old_slot = GetSlots();
+            for (uint64_t i = 0; i < GetHeader().capacity; ++i) {
+                if (old_slot[i].key != 0) {
+                    insert(old_slot[i]);
+                }
+            }
+        }
+        for (const auto & item : journal) {
+            insert(item.second);
+        }
+        Header header = GetNewHeader();
+        header.capacity = capacity;
+        header.count = new_count;
+        // write new table, then replace the old one
+        std::string temp_filename = filename + ".tmp";
+        FILE * file = fopen(temp_filename.c_str(), "wb");
+        if (file == nullptr) {
+            printf("ERROR: could not write to %s\n", temp_filename.c_str());
+            exit(1);
+        }
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(slot.data(), sizeof(Slot), slot.size(), file);
+        if (fclose(file) != 0) {
+            printf("ERROR: could not write to %s\n", temp_filename.c_str());
+            exit(1);
+        }
+        UnmapTable();
+#ifdef _WIN32
+        std::remove(filename.c_str());
+#endif
+        if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+            printf("ERROR: could not replace %s\n", filename.c_str());
+            exit(1);
+        }
+        std::remove(GetJournalFilename().c_str());
+        journal.clear();
+        MapTable();
+    }
+};
+
+// if true, solved turn-start states are stored in and recalled from subgame_memo
+bool use_subgame_memo = false;
+
+// memo of solved turn-start states
+SubgameMemo subgame_memo("subgame_memo.bin");
+
+// if true, turn-start states are recalled from tablebase
+bool use_tablebase = false;
+
+// endgame tablebase of solved late-fight states (see tablebase.hpp)
+SubgameMemo tablebase("tablebase.bin");
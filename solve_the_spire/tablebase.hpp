@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "defines.h"
+#include "card_collection_map.hpp"
+#include "monster.hpp"
+#include "node.hpp"
+#include "tree.hpp"
+#include "subgame_memo.hpp"
+
+// An endgame tablebase holds the solved values of every late-fight state
+// below some thresholds.  It uses the subgame memo file format, so a tree
+// recalls a state from it exactly like it recalls one from the subgame memo,
+// and a state is only recalled if both its hash and check hash match.
+//
+// Each state is a turn-start state (before mob intents are generated and
+// cards are drawn) against a single mob with an empty hand and exhaust pile.
+
+// thresholds of the states in a tablebase
+struct TablebaseSettings {
+    // mob in each state
+    const BaseMonster * base_mob = nullptr;
+    // intent history of the mob (most recent first)
+    std::vector<uint8_t> last_intent;
+    // highest mob hp
+    uint16_t max_mob_hp = 10;
+    // most cards in the draw and discard piles together
+    unsigned int max_cards = 5;
+};
+
+// call the function with each way of splitting up to max_cards cards from
+// the pool between the draw and discard piles
+template <class T>
+void ForEachTablebasePiles(
+        const std::vector<card_index_t> & pool,
+        unsigned int max_cards,
+        CardCollectionPtr & draw_pile,
+        CardCollectionPtr & discard_pile,
+        std::size_t next_index,
+        T function) {
+    if (next_index == 2 * pool.size()) {
+        function();
+        return;
+    }
+    CardCollectionPtr & pile = (next_index % 2 == 0) ? draw_pile : discard_pile;
+    const card_index_t card_index = pool[next_index / 2];
+    const unsigned int card_count = draw_pile.Count() + discard_pile.Count();
+    for (unsigned int count = 0; card_count + count <= max_cards; ++count) {
+        if (count > 0) {
+            pile.AddCard(card_index);
+        }
+        ForEachTablebasePiles(
+            pool, max_cards, draw_pile, discard_pile, next_index + 1, function);
+    }
+    if (card_count < max_cards) {
+        pile.RemoveCard(card_index, (card_count_t) (max_cards - card_count));
+    }
+}
+
+// solve every state below the thresholds and store them in the given file
+// (the card pool is the cards in the deck of the template node, and hp, max
+// hp, buffs and relics also come from it; returns the number of states)
+std::size_t GenerateTablebase(
+        const Node & template_node,
+        const TablebaseSettings & settings,
+        std::string filename) {
+    if (settings.base_mob == nullptr) {
+        printf("ERROR: tablebase mob not set\n");
+        exit(1);
+    }
+    if (settings.last_intent.size() > 3) {
+        printf("ERROR: tablebase intent history is too long\n");
+        exit(1);
+    }
+    // card pool
+    std::vector<card_index_t> pool;
+    for (const auto & deck_item : template_node.deck) {
+        pool.push_back(deck_item.first);
+    }
+    // values are stored here as each state is solved, and states deeper in
+    // the tree are recalled from it, so later states solve quickly
+    SubgameMemo memo(filename);
+    printf("Generating tablebase %s against %s with mob HP up to %u and up "
+        "to %u cards (%u already stored)\n",
+        filename.c_str(),
+        settings.base_mob->name.c_str(),
+        (unsigned int) settings.max_mob_hp,
+        settings.max_cards,
+        (unsigned int) memo.Count());
+    std::size_t state_count = 0;
+    for (uint16_t mob_hp = 1; mob_hp <= settings.max_mob_hp; ++mob_hp) {
+        std::size_t new_count = 0;
+        const std::size_t first_state_count = state_count;
+        for (uint16_t hp = 1; hp <= template_node.max_hp; ++hp) {
+            BasicNode<1> node;
+            node.CopyStateFrom(template_node);
+            node.turn = 2;
+            node.layer = 0;
+            node.hp = (uint8_t) hp;
+            node.block = 0;
+            node.stance = kStanceNone;
+            node.flag.battle_done = false;
+            node.flag.tree_solved = false;
+            node.flag.last_card_attack = false;
+            node.flag.last_card_skill = false;
+            node.hand.Clear();
+            node.draw_pile.Clear();
+            node.discard_pile.Clear();
+            node.exhaust_pile.Clear();
+            node.energy = 0;
+            node.ResetEnergy();
+            node.monster[0] = Monster(*settings.base_mob);
+            node.monster[0].hp = mob_hp;
+            if (node.monster[0].max_hp < mob_hp) {
+                node.monster[0].max_hp = mob_hp;
+            }
+            for (std::size_t i = 0; i < settings.last_intent.size(); ++i) {
+                node.monster[0].last_intent[i] = settings.last_intent[i];
+            }
+            for (auto & action : node.pending_action) {
+                action.type = kActionNone;
+                action.arg[0] = 0;
+                action.arg[1] = 0;
+            }
+            node.pending_action[0].type = kActionGenerateMobIntents;
+            node.pending_action[1].type = kActionDrawCards;
+            node.pending_action[1].arg[0] = 5;
+            node.probability = 1.0;
+            ForEachTablebasePiles(
+                pool, settings.max_cards, node.draw_pile, node.discard_pile, 0,
+                [&]() {
+                    ++state_count;
+                    SubgameValue value;
+                    if (memo.Lookup(node.GetCanonicalStateHash(),
+                            node.GetCanonicalStateCheckHash(), value)) {
+                        return;
+                    }
+                    BasicNode<1> top_node;
+                    top_node.CopyStateFrom(node);
+                    top_node.objective = top_node.GetMaxFinalObjective();
+                    BasicTreeStruct<1> tree(top_node);
+                    tree.quiet = true;
+                    tree.memo = &memo;
+                    tree.Expand();
+                    ++new_count;
+                });
+        }
+        printf("- Mob HP %u: %u states (%u solved)\n",
+            (unsigned int) mob_hp,
+            (unsigned int) (state_count - first_state_count),
+            (unsigned int) new_count);
+    }
+    memo.Flush();
+    printf("Tablebase holds %u states\n", (unsigned int) memo.Count());
+    return state_count;
+}
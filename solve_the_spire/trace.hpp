@@ -0,0 +1,191 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "defines.h"
+
+// The trace records what each thread was doing over time, so expansion
+// bursts, pruning storms and I/O stalls can be seen on a timeline.  A
+// TraceScope at the top of a function records one event from when it's
+// made until it's destroyed.  Events shorter than trace_min_duration_ns are
+// dropped, which keeps the hot functions from flooding the trace.
+//
+// Each thread records into its own ring buffer, which only it writes to, so
+// recording doesn't take a lock.  When a buffer is full the oldest events
+// are overwritten.  The trace is written as Chrome trace JSON, which can be
+// opened in chrome://tracing or ui.perfetto.dev.
+//
+// Tracing is off unless StartTrace is called, and a TraceScope then costs a
+// single check of trace_enabled.
+
+// true if events are being recorded
+bool trace_enabled = false;
+
+// events shorter than this many nanoseconds aren't recorded
+uint64_t trace_min_duration_ns = default_trace_min_duration_ns;
+
+// file to write the trace to when the program exits (or empty)
+std::string trace_filename;
+
+// time the trace started
+std::chrono::steady_clock::time_point trace_start_time;
+
+// return nanoseconds since the trace started
+inline uint64_t GetTraceTime() {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - trace_start_time).count();
+}
+
+// a span of time spent in one function
+struct TraceEvent {
+    // name of the event
+    // (must be a string literal, since only the pointer is kept)
+    const char * name;
+    // nanoseconds since the trace started
+    uint64_t start_ns;
+    // length of the event in nanoseconds
+    uint64_t duration_ns;
+};
+
+// ring buffer of the events of one thread
+struct TraceBuffer {
+    // number of the thread
+    uint32_t thread_number;
+    // number of events ever recorded
+    // (the last trace_buffer_events of them are in event)
+    std::atomic<uint64_t> event_count;
+    // recorded events
+    std::vector<TraceEvent> event;
+    // constructor
+    TraceBuffer(uint32_t thread_number_) :
+            thread_number(thread_number_),
+            event_count(0),
+            event(trace_buffer_events) {
+    }
+    // record an event
+    void Add(const TraceEvent & this_event) {
+        const uint64_t count = event_count.load(std::memory_order_relaxed);
+        event[count % trace_buffer_events] = this_event;
+        event_count.store(count + 1, std::memory_order_release);
+    }
+};
+
+// guards trace_buffers
+std::mutex trace_mutex;
+
+// buffers of all threads which recorded events
+// (kept after a thread ends so its events are still written)
+std::vector<std::unique_ptr<TraceBuffer>> trace_buffers;
+
+// buffer of this thread (or nullptr until it records an event)
+thread_local TraceBuffer * trace_buffer = nullptr;
+
+// record an event for this thread
+inline void AddTraceEvent(const char * name, uint64_t start_ns, uint64_t end_ns) {
+    if (end_ns - start_ns < trace_min_duration_ns) {
+        return;
+    }
+    if (trace_buffer == nullptr) {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        trace_buffers.push_back(
+            std::make_unique<TraceBuffer>((uint32_t) trace_buffers.size() + 1));
+        trace_buffer = trace_buffers.back().get();
+    }
+    trace_buffer->Add({name, start_ns, end_ns - start_ns});
+}
+
+// records the time until it's destroyed as an event
+struct TraceScope {
+    // name of the event
+    const char * name;
+    // time the event started (only valid if tracing)
+    uint64_t start_ns;
+    // constructor
+    TraceScope(const char * name_) : name(name_) {
+        if (trace_enabled) {
+            start_ns = GetTraceTime();
+        }
+    }
+    // destructor
+    ~TraceScope() {
+        if (trace_enabled) {
+            AddTraceEvent(name, start_ns, GetTraceTime());
+        }
+    }
+    // (a scope belongs to the block it's declared in)
+    TraceScope(const TraceScope &) = delete;
+    TraceScope & operator= (const TraceScope &) = delete;
+};
+
+// start recording events
+// (should be called before any TraceScope is made)
+void EnableTrace() {
+    trace_start_time = std::chrono::steady_clock::now();
+    trace_enabled = true;
+}
+
+// write the events of all threads as Chrome trace JSON, return true if
+// successful
+bool WriteTrace(const std::string & filename) {
+    FILE * file = fopen(filename.c_str(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    fprintf(file, "{\"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+        "\"args\": {\"name\": \"solve_the_spire\"}}");
+    uint64_t dropped_count = 0;
+    for (auto & buffer : trace_buffers) {
+        fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+            "\"tid\": %u, \"args\": {\"name\": \"thread %u\"}}",
+            buffer->thread_number, buffer->thread_number);
+        const uint64_t count = buffer->event_count.load(std::memory_order_acquire);
+        const uint64_t first = count > trace_buffer_events ? count - trace_buffer_events : 0;
+        dropped_count += first;
+        for (uint64_t i = first; i < count; ++i) {
+            const TraceEvent & event = buffer->event[i % trace_buffer_events];
+            fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, "
+                "\"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                event.name,
+                buffer->thread_number,
+                event.start_ns / 1000.0,
+                event.duration_ns / 1000.0);
+        }
+    }
+    fprintf(file, "\n],\n\"displayTimeUnit\": \"ms\",\n"
+        "\"otherData\": {\"min_duration_us\": %.3f, \"overwritten_events\": %llu}}\n",
+        trace_min_duration_ns / 1000.0,
+        (unsigned long long) dropped_count);
+    const bool good = !ferror(file);
+    return fclose(file) == 0 && good;
+}
+
+// write the trace to trace_filename
+// (registered to run when the program exits)
+void WriteTraceAtExit() {
+    trace_enabled = false;
+    if (!WriteTrace(trace_filename)) {
+        printf("ERROR: could not write trace to %s\n", trace_filename.c_str());
+        return;
+    }
+    printf("Wrote trace to %s\n", trace_filename.c_str());
+}
+
+// start recording events and write them to the given file when the program
+// exits
+void StartTrace(const std::string & filename) {
+    if (trace_filename.empty()) {
+        atexit(WriteTraceAtExit);
+    }
+    trace_filename = filename;
+    EnableTrace();
+}
@@ -6,8 +6,26 @@
 #include <deque>
 #include <utility>
 #include <ctime>
+#include <chrono>
 #include <sstream>
 #include <fstream>
+#include <algorithm>
+#include <memory>
+#include <variant>
+#include <map>
+#include <unordered_map>
+
+#include "lane_solver.hpp"
+#include "solve_cache.hpp"
+#include "subgame_memo.hpp"
+#include "checkpoint.hpp"
+#include "tree_file.hpp"
+#include "tree_stream.hpp"
+#include "policy_table.hpp"
+#include "memory.hpp"
+#include "tree_shape.hpp"
+#include "trace.hpp"
+#include "stopwatch.hpp"
 
 struct MobLayout {
     // probability
@@ -117,18 +135,32 @@ std::list<MobLayout> GenerateAllMobs(FightEnum fight_type) {
     }
 }
 
+template <unsigned int mob_slots>
+struct BasicSizedTree;
+
 // hold a structure for solving for optimal play decisions
-struct TreeStruct {
+template <unsigned int mob_slots>
+struct BasicTreeStruct {
+    // node type used in this tree
+    typedef BasicNode<mob_slots> Node;
     // if true, save all nodes, else prune solved nodes as much as possible
-    // (value is changed to false when nodes exceed max_nodes_to_store)
+    // (value is changed to false when the memory of this tree exceeds
+    // max_bytes_to_store)
     bool keep_all_nodes = true;
     // pointer to top node
     Node * top_node_ptr;
     // fight type
     FightEnum fight_type;
+    // if true, generate one mob per value in its HP range even when
+    // normalize_mob_variations is set
+    bool generate_all_mob_hp = false;
+    // if true, solve all mob HP variations together with a lane solver
+    bool use_mob_hp_lanes = false;
+    // if true, don't print progress or results while solving
+    bool quiet = false;
     // list of pointers to deleted nodes which we can reuse
     // (in order to avoid thrashing memory with new/delete)
-    std::vector<Node *> deleted_nodes;
+    std::vector<Node *, TrackedAllocator<Node *, kMemoryNodes>> deleted_nodes;
     // number of nodes created
     std::size_t created_node_count;
     // number of nodes reused
@@ -136,27 +168,80 @@ struct TreeStruct {
     // number of nodes which were expanded
     std::size_t expanded_node_count;
     // nodes which need expanded after a path is formed
-    std::vector<Node *> optional_nodes;
+    std::vector<Node *, TrackedAllocator<Node *, kMemoryFrontier>> optional_nodes;
     // list of terminal nodes
     // (a terminal node is a node where the battle is over)
-    std::set<Node *> terminal_nodes;
-    // duration to solve
+    std::set<Node *, std::less<Node *>,
+        TrackedAllocator<Node *, kMemoryTerminalSet>> terminal_nodes;
+    // tree the fight was solved in if it has fewer mob slots than this one
+    // (empty if the fight was solved in this tree, see ForSolvedTree)
+    std::variant<
+        std::monostate,
+        std::unique_ptr<BasicSizedTree<1>>,
+        std::unique_ptr<BasicSizedTree<2>>,
+        std::unique_ptr<BasicSizedTree<3>>> sized_tree;
+    // nodes solved by recalling their value from the tablebase or subgame memo
+    std::map<Node *, SubgameValue> recalled_nodes;
+    // memo to store solved turn-start states in and recall them from
+    // (or nullptr)
+    SubgameMemo * memo;
+    // if not nullptr, turn-start states from cut_turn on are solved elsewhere
+    // (states with values here are recalled if their check hash matches, and
+    // the rest are given their max objective and added to cut_nodes; see
+    // distributed.hpp)
+    const std::unordered_map<uint64_t, SubgameMemo::Slot> * cut_values = nullptr;
+    // turn from which states are cut off
+    uint8_t cut_turn = 2;
+    // cut off states which have no value yet, by state hash
+    std::map<uint64_t, BasicNode<MAX_MOBS_PER_NODE>> cut_nodes;
+    // if not empty, checkpoints of the solve are written to this file
+    std::string checkpoint_filename;
+    // seconds of solving between checkpoints
+    double checkpoint_interval_s = default_checkpoint_interval_s;
+    // true if the tree was read from a checkpoint or re-rooted and not yet
+    // expanded (expanding continues from optional_nodes)
+    bool resumed = false;
+    // if not empty, solved subtrees are written to this tree stream before
+    // they're pruned (see tree_stream.hpp)
+    std::string tree_stream_filename;
+    // tree stream being written while expanding (or nullptr)
+    TreeStreamWriter * tree_stream = nullptr;
+    // if not empty, the policy of the solved tree is written to this policy
+    // table (see policy_table.hpp)
+    std::string policy_filename;
+    // if not empty, the shape of the tree is written to this JSON file after
+    // solving (see tree_shape.hpp)
+    std::string tree_shape_filename;
+    // branching and pruning stats gathered while expanding
+    TreeShapeStats shape;
+    // if true, the solved tree is used after ExpandFight(), so results are
+    // never recalled from the solve cache
+    bool need_solved_tree = false;
+    // wall clock seconds to solve
     double solve_duration_s;
+    // time spent in each phase of the solve (empty unless USE_PROFILER is
+    // defined, see profiler.hpp)
+    ProfileCounters profile;
     // expected final hp (populated when solved)
     double final_hp;
     // expected death chance (populated when solved)
     double death_chance;
     // expected remaining mob hp (populated when solved)
     double remaining_mob_hp;
+    // chance of ending at each final hp (populated when solved)
+    std::map<uint16_t, double> final_hp_distribution;
+    // chance of the battle ending on each turn (populated when solved)
+    std::map<uint16_t, double> turn_distribution;
     // constructor
-    TreeStruct(Node & node) : top_node_ptr(&node) {
+    BasicTreeStruct(Node & node) : top_node_ptr(&node) {
         expanded_node_count = 0;
         created_node_count = 0;
         reused_node_count = 0;
         fight_type = kFightNone;
+        memo = use_subgame_memo ? &subgame_memo : nullptr;
     }
     // destructor
-    ~TreeStruct() {
+    ~BasicTreeStruct() {
         // delete all nodes
         DeleteNodeAndChildren(*top_node_ptr, false);
         // delete unused nodes
@@ -174,6 +259,7 @@ struct TreeStruct {
     }
     // create a new node and return a reference to it
     Node & CreateChild(Node & node, bool add_to_optional) {
+        ProfileScope profile_scope(kProfileCreateChild);
         //static std::size_t next_index = 0;
         //++next_index;
         // if deleted node list has items, reuse the last one
@@ -201,99 +287,147 @@ struct TreeStruct {
         }
         return new_node;
     }
+    // if the last child of this node has the same mobs as an earlier child,
+    // fold it into that child and return true
+    bool MergeSymmetricChild(Node & node) {
+        Node & last_child = *node.child.back();
+        for (std::size_t i = 0; i + 1 < node.child.size(); ++i) {
+            Node & sibling = *node.child[i];
+            if (std::equal(
+                    last_child.monster,
+                    last_child.monster + mob_slots,
+                    sibling.monster)) {
+                sibling.probability += last_child.probability;
+                node.child.pop_back();
+                deleted_nodes.push_back(&last_child);
+                return true;
+            }
+        }
+        return false;
+    }
     // generate mob intents
     void GenerateMobIntents(Node & node) {
-        //assert(node.generate_mob_intents);
+        ProfileScope profile_scope(kProfileGenerateMobIntents);
         assert(node.pending_action[0].type == kActionGenerateMobIntents);
-        //node.player_choice = false;
-        // hold new intent list for all mobs
-        std::vector<std::pair<double, uint8_t>> new_intent[MAX_MOBS_PER_NODE];
-        for (int i = 0; i < MAX_MOBS_PER_NODE; ++i) {
-            if (!node.monster[i].Exists()) {
-                continue;
-            }
-            new_intent[i] = node.monster[i].GetIntents();
-        }
-        // now create all child nodes
-        uint8_t intent_index[MAX_MOBS_PER_NODE] = {0};
-        while (true) {
-            // add this node
-            Node & new_node = CreateChild(node, true);
-            new_node.PopPendingAction();
-            //new_node.generate_mob_intents = false;
+        // create a child node for each combination of intents
+        node.ForEachIntentOutcome([&](double probability, const auto & transition) {
+            Node & new_node = CreateChild(node, false);
+            transition(new_node);
+            new_node.probability *= probability;
             new_node.objective = new_node.GetMaxFinalObjective();
-            for (int i = 0; i < MAX_MOBS_PER_NODE; ++i) {
-                if (!node.monster[i].Exists()) {
-                    continue;
-                }
-                new_node.monster[i].SelectIntent(
-                    new_intent[i][intent_index[i]].second);
-                new_node.probability *= new_intent[i][intent_index[i]].first;
-            }
-            // increment
-            bool done = true;
-            for (int i = 0; i < MAX_MOBS_PER_NODE; ++i) {
-                ++intent_index[i];
-                if (intent_index[i] >= new_intent[i].size()) {
-                    intent_index[i] = 0;
-                } else {
-                    done = false;
-                    break;
-                }
-            }
-            if (done) {
-                break;
+            if (!MergeSymmetricChild(node)) {
+                AddOptionalNode(new_node);
             }
-        }
+        });
     }
     // draw cards
     void DrawCards(Node & node) {
-        //assert(node.cards_to_draw > 0);
+        ProfileScope profile_scope(kProfileDrawCards);
         assert(node.pending_action[0].type == kActionDrawCards);
-        assert(node.pending_action[0].arg[0] > 0);
-        //node.player_choice = false;
-        // if draw pile is empty, move cards from discard to draw pile
-        if (node.draw_pile.IsEmpty() && !node.discard_pile.IsEmpty()) {
-            // add new node
-            Node & new_node = CreateChild(node, true);
-            // move discard pile to draw pile
-            new_node.draw_pile = new_node.discard_pile;
-            new_node.discard_pile.Clear();
-            return;
-        }
-        // draw as many cards as we can
-        card_count_t to_draw = (card_count_t) node.pending_action[0].arg[0];
-        if (node.draw_pile.Count() < to_draw) {
-            to_draw = node.draw_pile.Count();
-        }
-        if (node.hand.Count() + to_draw > 10) {
-            to_draw = 10 - node.hand.Count();
-        }
-        // if there aren't any cards to draw, then don't
-        if (to_draw == 0) {
-            // we have no cards to draw and/or our hand is full
+        // add each possible draw as a child node
+        node.ForEachDrawOutcome([&](double probability, const auto & transition) {
             Node & new_node = CreateChild(node, true);
-            new_node.PopPendingAction();
+            transition(new_node);
+            new_node.probability *= probability;
+        });
+    }
+    // if this turn-start state is in the tablebase or subgame memo, mark it
+    // as solved and return true
+    bool RecallSubgame(Node & node) {
+        if ((!use_tablebase && memo == nullptr && cut_values == nullptr) ||
+                node.parent == nullptr) {
+            return false;
+        }
+        const uint64_t hash = node.GetCanonicalStateHash();
+        const uint64_t check = node.GetCanonicalStateCheckHash();
+        SubgameValue value;
+        if (!(use_tablebase && tablebase.Lookup(hash, check, value)) &&
+                !(memo != nullptr && memo->Lookup(hash, check, value)) &&
+                !CutSubgame(node, hash, check, value)) {
+            return false;
+        }
+        node.objective = value.objective;
+        node.flag.tree_solved = true;
+        recalled_nodes[&node] = value;
+        UpdateTree(node.parent);
+        return true;
+    }
+    // if this turn-start state is cut off, get its value and return true
+    // (if its value isn't known yet, assume the best and store it to be
+    // solved later; a state whose hash matches a different state's value is
+    // solved here instead)
+    bool CutSubgame(
+            const Node & node,
+            uint64_t hash,
+            uint64_t check,
+            SubgameValue & value) {
+        if (cut_values == nullptr || node.turn < cut_turn) {
+            return false;
+        }
+        auto it = cut_values->find(hash);
+        if (it != cut_values->end()) {
+            if (it->second.check != check) {
+                return false;
+            }
+            value = it->second.value;
+            return true;
+        }
+        const double max_objective = node.GetMaxFinalObjective();
+        value = {max_objective, max_objective, 0.0};
+        cut_nodes[hash].CopyStateFrom(node);
+        return true;
+    }
+    // return the value of this solved node and add the values of all
+    // turn-start states at or below it to the list
+    SubgameValue CollectSubgames(
+            const Node & node,
+            std::vector<SubgameMemo::Slot> & item) {
+        auto it = recalled_nodes.find((Node *) &node);
+        if (it != recalled_nodes.end()) {
+            return it->second;
+        }
+        SubgameValue value = {node.objective, 0.0, 0.0};
+        if (node.child.empty()) {
+            value.final_hp = node.hp;
+            value.death_chance = node.IsDead() ? 1.0 : 0.0;
+            return value;
+        }
+        for (auto & child_ptr : node.child) {
+            SubgameValue child_value = CollectSubgames(*child_ptr, item);
+            const double p = child_ptr->probability / node.probability;
+            value.final_hp += p * child_value.final_hp;
+            value.death_chance += p * child_value.death_chance;
+        }
+        if (node.pending_action[0].type == kActionGenerateMobIntents) {
+            item.push_back(SubgameMemo::Slot{node.GetCanonicalStateHash(),
+                node.GetCanonicalStateCheckHash(), value});
+        }
+        return value;
+    }
+    // store the values of all turn-start states in the memo
+    // (only possible if the entire tree was kept)
+    void StoreSubgames() {
+        if (!keep_all_nodes) {
+            if (!quiet) {
+                printf("Note: tree was pruned, so subgames were not stored\n");
+            }
             return;
         }
-        // else draw all cards we can and add each as a child node
-        auto choices = node.draw_pile.Select(to_draw);
-        for (const auto & choice : *choices) {
-            // add new node
-            Node & new_node = CreateChild(node, true);
-            if (to_draw == new_node.pending_action[0].arg[0]) {
-                new_node.PopPendingAction();
-            } else {
-                new_node.pending_action[0].arg[0] -= to_draw;
-            }
-            new_node.probability *= choice.first;
-            new_node.hand.AddDeck(choice.second.first);
-            new_node.draw_pile = choice.second.second;
-            new_node.child.clear();
+        std::vector<SubgameMemo::Slot> item;
+        CollectSubgames(*top_node_ptr, item);
+        std::size_t stored_count = memo->Store(item);
+        if (!quiet) {
+            printf("Stored %u new subgames in the subgame memo (%u recalled)\n",
+                (unsigned int) stored_count,
+                (unsigned int) recalled_nodes.size());
         }
     }
     // delete this node and any children
     void DeleteNodeAndChildren(Node & node, bool update_terminal = true) {
+        TraceScope trace_scope("delete_nodes");
+        if (tree_stream != nullptr) {
+            tree_stream->ForgetNode(&node);
+        }
         // if this is a terminal node, delete it from the terminal node list
         if (update_terminal && node.IsTerminal()) {
             auto it = terminal_nodes.find(&node);
@@ -304,6 +438,10 @@ struct TreeStruct {
                 terminal_nodes.erase(it);
             }
         }
+        // if this node was recalled, delete it from the recalled node list
+        if (!recalled_nodes.empty() && node.child.empty()) {
+            recalled_nodes.erase(&node);
+        }
         // if this node has yet to be expanded, delete it from the optional list
         if (!node.flag.tree_solved &&
                 update_terminal &&
@@ -384,8 +522,22 @@ struct TreeStruct {
             AddNodesToSet(*this_child, node_set);
         }
     }
+    // choose an ending which finishes the battle at the best possible
+    // objective, skipping the other decisions at the top node
+    // (helper function used during FindPlayerChoices)
+    void SelectBestEnding(Node & top_node, Node & path_node, std::size_t ending_count) {
+        const std::size_t deleted_count = deleted_nodes.size();
+        SelectTerminalDecisionPath(top_node, path_node);
+        shape.pruned[kPruneBestEnding] += deleted_nodes.size() - deleted_count;
+        shape.choice_endings += ending_count + 1;
+        ++shape.choice_survivors;
+        shape.AddExpansion(kShapeDecision, 1, top_node.turn, top_node.layer);
+    }
     // find player choice nodes
     void FindPlayerChoices(Node & top_node) {
+        ProfileScope profile_scope(kProfileMoveGeneration);
+        TraceScope trace_scope("find_player_choices");
+        ++shape.choice_calls;
         // nodes we must make a decision at
         std::vector<Node *> decision_nodes;
         decision_nodes.push_back(&top_node);
@@ -399,8 +551,6 @@ struct TreeStruct {
         //if (mob_hp <= top_node.hand.GetMaxSingleTargetDamage(top_node.energy)) {
         //    printf("shortcut!\n");
         //}
-        // TODO: determine if order matters
-        bool order_matters = true;
         // nodes at which the player no longer has a choice
         // (e.g. after pressing end turn or after player is dead or all mobs are dead)
         std::vector<Node *> ending_node;
@@ -417,127 +567,29 @@ struct TreeStruct {
                 {
                     Node & end_turn_node = CreateChild(this_node, false);
                     end_turn_node.EndTurn();
+                    end_turn_node.SortMobs();
                     // if this path ends the battle at the best possible objective,
                     // choose and and don't evaluate other decisions
                     if (end_turn_node.IsBattleDone() &&
                             end_turn_node.objective ==
                             max_top_objective) {
-                        SelectTerminalDecisionPath(top_node, end_turn_node);
+                        SelectBestEnding(top_node, end_turn_node, ending_node.size());
                         return;
                     }
                     ending_node.push_back(&end_turn_node);
                 }
                 // play all possible unique cards
-                for (auto & deck_item : this_node.hand) {
-                    // alias the card
-                    const card_index_t &card_index = deck_item.first;
-                    const Card & card = *card_map[card_index];
-                    // skip this card if it's unplayable or too expensive
-                    if (card.flag.unplayable || card.cost > this_node.energy) {
-                        continue;
-                    }
-                    // if order doesn't matter, only play cards with increasing card index
-                    if (!order_matters && &this_node != &top_node &&card_index < this_node.parent_decision.argument[0]) {
-                        continue;
-                    }
-                    // play this card
-                    if (card.flag.targeted) {
-                        assert(!card.flag.target_card_in_hand);
-                        // if targeted, cycle among all possible targets
-                        for (int m = 0; m < MAX_MOBS_PER_NODE; ++m) {
-                            if (!this_node.monster[m].Exists()) {
-                                continue;
-                            }
-                            Node & new_node = CreateChild(this_node, false);
-                            //card_index_t index = deck_item.first;
-                            //const Card & card = *card_map[index];
-                            new_node.hand.RemoveCard(card_index);
-                            new_node.PlayCard(card_index, m);
-                            new_node.SortMobs();
-                            // if this is the best possible objective,
-                            // don't process any further choices
-                            if (new_node.IsBattleDone() &&
-                                    new_node.objective ==
-                                    max_top_objective) {
-                                SelectTerminalDecisionPath(top_node, new_node);
-                                return;
-                            }
-                            // add to exhaust or discard pile
-                            if (!new_node.flag.battle_done) {
-                                if (card.flag.exhausts) {
-                                    new_node.exhaust_pile.AddCard(card_index);
-                                } else {
-                                    new_node.discard_pile.AddCard(card_index);
-                                }
-                            }
-                            // add new decision point
-                            if (new_node.IsBattleDone() || new_node.HasPendingActions()) {
-                                ending_node.push_back(&new_node);
-                            } else {
-                                new_decision_nodes.push_back(&new_node);
-                            }
-                        }
-                    } else if (card.flag.target_card_in_hand) {
-                        assert(!card.flag.targeted);
-                        assert(&card == &card_armaments);
-                        // play on each card that has an upgraded version
-                        const auto & deck = this_node.hand.node_ptr->collection.card;
-                        for (card_index_t c = 0; c < deck.size(); ++c) {
-                            const card_index_t & other_card_index = deck[c].first;
-                            const Card & other_card = *card_map[other_card_index];
-                            // cannot target itself
-                            if (other_card_index == card_index && deck_item.second == 1) {
-                                continue;
-                            }
-                            // target all cards that can be upgraded
-                            if (card.upgraded_version != nullptr) {
-                                Node & new_node = CreateChild(this_node, false);
-                                new_node.hand.RemoveCard(card_index);
-                                assert(new_node.hand.CountCard(other_card_index) > 0);
-                                new_node.PlayCard(
-                                    card_index,
-                                    new_node.hand.GetLocalIndex(other_card_index));
-                                new_node.SortMobs();
-                                // if this is the best possible objective,
-                                // don't process any further choices
-                                if (new_node.IsBattleDone() &&
-                                        new_node.objective ==
-                                        max_top_objective) {
-                                    SelectTerminalDecisionPath(top_node, new_node);
-                                    return;
-                                }
-                                // add to exhaust or discard pile
-                                if (card.flag.exhausts) {
-                                    new_node.exhaust_pile.AddCard(card_index);
-                                } else {
-                                    new_node.discard_pile.AddCard(card_index);
-                                }
-                                // add new decision point
-                                if (new_node.IsBattleDone() || new_node.HasPendingActions()) {
-                                    ending_node.push_back(&new_node);
-                                } else {
-                                    new_decision_nodes.push_back(&new_node);
-                                }
-                            }
-                        }
-                        // play on nothing
+                const bool keep_going = this_node.ForEachCardPlay(
+                    [&](const auto & transition) {
                         Node & new_node = CreateChild(this_node, false);
-                        new_node.hand.RemoveCard(card_index);
-                        new_node.PlayCard(card_index, -1);
-                        new_node.SortMobs();
+                        transition(new_node);
                         // if this is the best possible objective,
                         // don't process any further choices
                         if (new_node.IsBattleDone() &&
                                 new_node.objective ==
                                 max_top_objective) {
-                            SelectTerminalDecisionPath(top_node, new_node);
-                            return;
-                        }
-                        // add to exhaust or discard pile
-                        if (card.flag.exhausts) {
-                            new_node.exhaust_pile.AddCard(card_index);
-                        } else {
-                            new_node.discard_pile.AddCard(card_index);
+                            SelectBestEnding(top_node, new_node, ending_node.size());
+                            return false;
                         }
                         // add new decision point
                         if (new_node.IsBattleDone() || new_node.HasPendingActions()) {
@@ -545,44 +597,30 @@ struct TreeStruct {
                         } else {
                             new_decision_nodes.push_back(&new_node);
                         }
-                    } else {
-                        Node & new_node = CreateChild(this_node, false);
-                        new_node.hand.RemoveCard(card_index);
-                        new_node.PlayCard(card_index);
-                        new_node.SortMobs();
-                        // if this is the best possible objective,
-                        // don't process any further choices
-                        if (new_node.IsBattleDone() &&
-                                new_node.objective ==
-                                max_top_objective) {
-                            SelectTerminalDecisionPath(top_node, new_node);
-                            return;
-                        }
-                        if (card.flag.exhausts) {
-                            new_node.exhaust_pile.AddCard(card_index);
-                        } else {
-                            new_node.discard_pile.AddCard(card_index);
-                        }
-                        if (new_node.IsBattleDone() || new_node.HasPendingActions()) {
-                            ending_node.push_back(&new_node);
-                        } else {
-                            new_decision_nodes.push_back(&new_node);
-                        }
-                    }
+                        return true;
+                    });
+                if (!keep_going) {
+                    return;
                 }
             }
             decision_nodes = new_decision_nodes;
         }
         // find nodes which are equal or worse than another node and remove them
+        ProfileScope dominance_profile_scope(kProfileDominance);
         std::vector<bool> bad_node(ending_node.size(), false);
         // if we have multiple nodes that end up dead, mark all except the best one as bad
         Node * best_dead_node = nullptr;
         std::size_t best_dead_node_index = 0;
+        // number of nodes marked bad for dying worse than another
+        uint16_t worse_death_count = 0;
         for (std::size_t i = 0; i < ending_node.size(); ++i) {
             Node & node = *ending_node[i];
             if (!node.IsDead()) {
                 continue;
             }
+            if (best_dead_node != nullptr) {
+                ++worse_death_count;
+            }
             if (best_dead_node == nullptr ||
                     node.objective > best_dead_node->objective) {
                 if (best_dead_node != nullptr) {
@@ -668,6 +706,11 @@ struct TreeStruct {
         }
         // at least one node must be good
         assert(good_node_count > 0);
+        shape.choice_endings += ending_node.size();
+        shape.choice_survivors += good_node_count;
+        shape.pruned[kPruneWorseDeath] += worse_death_count;
+        shape.pruned[kPruneDominated] += bad_node_count - worse_death_count;
+        shape.AddExpansion(kShapeDecision, good_node_count, top_node.turn, top_node.layer);
         // remove bad choices and their parents where possible
         for (std::size_t i = 0; i < ending_node.size(); ++i) {
             if (!bad_node[i]) {
@@ -712,20 +755,8 @@ struct TreeStruct {
     void GenerateBattle(Node & this_node) {
         assert(this_node.turn == 0);
         assert(this_node.pending_action[0].type == kActionGenerateBattle);
-        if (fight_map.find(fight_type) == fight_map.end()) {
-            printf("ERROR: fight_type not found in fight_map\n");
-            exit(1);
-        }
-        std::vector<std::pair<double, std::vector<Monster>>> mob_layouts;
-        if (fight_map[fight_type].base_mob != nullptr) {
-            mob_layouts = GenerateFightSingleMob(
-                *fight_map[fight_type].base_mob);
-            if (fight_map[fight_type].burning_elite) {
-                mob_layouts = ApplyBurningEliteBuffs(mob_layouts, 1);
-            }
-        } else {
-            mob_layouts = fight_map[fight_type].generation_function();
-        }
+        std::vector<std::pair<double, std::vector<Monster>>> mob_layouts =
+            GenerateFight(fight_type, generate_all_mob_hp);
         // sort by probability to happen, with most probable first
         std::sort(mob_layouts.begin(), mob_layouts.end(), MyBattleSort);
         //std::cout << "Generated " << mob_layouts.size() << " different mob layouts.\n";
@@ -734,23 +765,13 @@ struct TreeStruct {
             Node & new_node = CreateChild(this_node, false);
             new_node.PopPendingAction();
             new_node.probability *= layout.first;
-            if (layout.second.size() > MAX_MOBS_PER_NODE) {
-                std::cout << "ERROR: increase MAX_MOBS_PER_NODE to at least "
-                    << layout.second.size() << std::endl;
-                exit(1);
-            }
-            for (std::size_t i = 0; i < layout.second.size(); ++i) {
-                Monster & mob = new_node.monster[i];
-                mob = layout.second[i];
-                if (new_node.relics.preserved_insect &&
-                    new_node.monster[i].IsElite()) {
-                    uint16_t x = mob.hp / 4;
-                    mob.hp -= x;
-                }
-            }
+            new_node.PlaceMobs(layout.second);
             new_node.StartBattle();
             new_node.objective = new_node.GetMaxFinalObjective();
-            AddOptionalNode(new_node);
+            new_node.SortMobs();
+            if (!MergeSymmetricChild(this_node)) {
+                AddOptionalNode(new_node);
+            }
         }
     }
     // print the current tree to a file
@@ -818,7 +839,34 @@ struct TreeStruct {
             ToString(expanded_node_count).c_str(),
             ToString(top_node_ptr->CountNodes()).c_str(),
             solve_duration_s);
-        return std::string(profile_line);
+        std::string line = profile_line;
+        if (!profile.IsEmpty()) {
+            line.insert(line.size() - 1, "   " + profile.ToLine());
+        }
+        return line;
+    }
+    // calculate the final hp and turn distributions, expected final hp and
+    // death chance
+    void CalculateFinalHPDistribution() {
+        final_hp_distribution.clear();
+        turn_distribution.clear();
+        final_hp = 0.0;
+        death_chance = 0.0;
+        for (auto & node_ptr : terminal_nodes) {
+            auto & p = node_ptr->probability;
+            final_hp_distribution[node_ptr->hp] += p;
+            turn_distribution[node_ptr->turn] += p;
+            final_hp += p * node_ptr->hp;
+            if (node_ptr->hp == 0) {
+                death_chance += p;
+            }
+        }
+        // (recalled subtrees add to the expectations but not the distribution)
+        for (auto & item : recalled_nodes) {
+            auto & p = item.first->probability;
+            final_hp += p * item.second.final_hp;
+            death_chance += p * item.second.death_chance;
+        }
     }
     // print stats from the tree
     void PrintTreeStats() {
@@ -840,11 +888,22 @@ struct TreeStruct {
             (long unsigned) top_node_ptr->CountNodes());
         printf("- There are %lu terminal nodes\n",
             (long unsigned) terminal_nodes.size());
+        PrintTrackedMemory();
+        shape.Print();
+        if (!profile.IsEmpty()) {
+            profile.Print();
+        }
         // total probability (for check)
         double p_total = 0;
         for (auto & node_ptr : terminal_nodes) {
             p_total += node_ptr->probability;
         }
+        // probability of subtrees recalled from the subgame memo
+        double p_recalled = 0;
+        for (auto & item : recalled_nodes) {
+            p_recalled += item.first->probability;
+        }
+        p_total += p_recalled;
         if (abs(p_total - 1.0) > 1e-6) {
             printf("ERROR: total probability %g != 1\n", p_total);
         }
@@ -987,8 +1046,24 @@ struct TreeStruct {
         if (normalize_mob_variations) {
             printf("- Variations in mob HP and stats are normalized\n");
         }
+        // recalled subtrees only add to the expected final HP and death chance
+        for (auto & item : recalled_nodes) {
+            auto & p = item.first->probability;
+            expected_hp_delta += p * (item.second.final_hp - top_node_ptr->hp);
+            final_hp += p * item.second.final_hp;
+            death_chance += p * item.second.death_chance;
+        }
         printf("\nResult summary:\n");
         printf("- Expected final HP of %.6g (change of %+.6g)\n", top_node_ptr->hp + expected_hp_delta, expected_hp_delta);
+        if (!recalled_nodes.empty()) {
+            printf("- Recalled %u subtrees (%.3g%% chance) from the tablebase, subgame memo or workers\n",
+                (unsigned int) recalled_nodes.size(), 100 * p_recalled);
+            printf("- Stats below only include subtrees which were solved\n");
+        }
+        if (hp_delta.empty()) {
+            printf("- Chance to die is %.3g%%\n", 100 * death_chance);
+            return;
+        }
         //printf("- Expected HP change is %+.6g\n", expected_hp_delta);
         printf("- Min/max final HP of %d to %d (change of %+d to %+d)\n",
             top_node_ptr->hp + hp_delta.begin()->first,
@@ -1097,12 +1172,28 @@ struct TreeStruct {
         }
         //top_node_ptr->PrintTree();
     }
+    // return an estimate of the bytes held by this tree's nodes, child
+    // arrays, frontier and terminal set
+    // (unlike the tracked memory of memory.hpp, this doesn't include other
+    // trees being solved at the same time)
+    int64_t GetTreeMemory() const {
+        // (each node other than the top node is in one child array, and each
+        // set entry holds three pointers and a color besides the value)
+        const int64_t node_count = (int64_t) created_node_count;
+        return node_count * (int64_t) (sizeof(Node) + sizeof(Node *)) +
+            (int64_t) ((optional_nodes.capacity() + deleted_nodes.capacity()) *
+                sizeof(Node *)) +
+            (int64_t) (terminal_nodes.size() * 5 * sizeof(Node *));
+    }
     // delete nodes depending on settings
     void DeleteChildren(Node & node) {
         // update flag
-        if (keep_all_nodes && created_node_count > max_nodes_to_store) {
+        if (keep_all_nodes && GetTreeMemory() > max_bytes_to_store) {
             keep_all_nodes = false;
-            printf("Note: no longer keeping all nodes\n");
+            if (!quiet) {
+                printf("Note: no longer keeping all nodes (tree memory is over %s)\n",
+                    FormatBytes(max_bytes_to_store).c_str());
+            }
             // TODO: go through tree and delete children of solved nodes
         }
         // if we're saving all nodes, just return
@@ -1115,9 +1206,15 @@ struct TreeStruct {
         }
         // if solved, delete all children
         if (node.flag.tree_solved) {
+            if (tree_stream != nullptr && !node.child.empty()) {
+                TraceScope trace_scope("write_tree_stream");
+                tree_stream->WriteSubtree(node);
+            }
+            const std::size_t deleted_count = deleted_nodes.size();
             for (auto & child_ptr : node.child) {
                 DeleteNodeAndChildren(*child_ptr);
             }
+            shape.pruned[kPruneSolvedSubtree] += deleted_nodes.size() - deleted_count;
             node.child.clear();
         }
         // TODO
@@ -1130,6 +1227,8 @@ struct TreeStruct {
     }
     // update tree and parents if possible
     void UpdateTree(Node * node_ptr) {
+        ProfileScope profile_scope(kProfileUpdateTree);
+        TraceScope trace_scope("update_tree");
         // loop until we can't update any more
         while (node_ptr != nullptr) {
             auto & node = *node_ptr;
@@ -1197,12 +1296,14 @@ struct TreeStruct {
             // (1) if all children solved, choose the best one
             if (!unsolved_children) {
                 // delete non-optimal children
+                const std::size_t deleted_count = deleted_nodes.size();
                 for (auto & child_ptr : node.child) {
                     if (child_ptr == max_solved_objective_ptr) {
                         continue;
                     }
                     DeleteNodeAndChildren(*child_ptr);
                 }
+                shape.pruned[kPruneAllSolved] += deleted_nodes.size() - deleted_count;
                 assert(max_solved_objective_ptr != nullptr);
                 Node & child = *max_solved_objective_ptr;
                 // keep best child
@@ -1233,6 +1334,7 @@ struct TreeStruct {
             //     eliminate solved paths that are not optimal
             assert(solved_children && unsolved_children);
             {
+                const std::size_t deleted_count = deleted_nodes.size();
                 std::size_t i = node.child.size();
                 while (i > 0) {
                     assert(i > 0);
@@ -1246,6 +1348,7 @@ struct TreeStruct {
                         node.child.erase(node.child.begin() + i);
                     }
                 }
+                shape.pruned[kPruneBounded] += deleted_nodes.size() - deleted_count;
             }
             // if path is now solved, mark it as such
             if (solved_children && node.child.size() == 1) {
@@ -1365,21 +1468,60 @@ struct TreeStruct {
         return pass;
     }
     // expand this tree
+    // (if the fight was solved in a tree with fewer mob slots, that tree is
+    // expanded instead)
     void Expand() {
+        if (!std::holds_alternative<std::monostate>(sized_tree)) {
+            ForSolvedTree([this](auto & solved_tree) {
+                solved_tree.Expand();
+                TakeResultsFrom(solved_tree);
+            });
+            return;
+        }
         //std::cout << "There are " <<
         //    top_node_ptr->deck.ptr->CountUniqueSubsets() <<
         //    " unique deck subsets\n";
-        std::cout << "\n\n\n";
-        std::clock_t start_clock = clock();
-        std::cout << "Expanding node: " << top_node_ptr->ToString() << "\n\n";
-        if (normalize_mob_variations) {
-            std::cout << "Mob variations in HP and stats are normalized.\n";
+        // (solve times are wall clock time, since other threads may be solving)
+        Stopwatch stopwatch;
+        double resumed_duration_s = 0.0;
+        const ProfileCounters profile_start = GetProfileCounters();
+        const auto profile_start_time = std::chrono::steady_clock::now();
+        // (time in Expand outside the other phases is charged to "other")
+        ProfileScope profile_scope(kProfileOther);
+        TraceScope trace_scope("expand");
+        if (!quiet) {
+            std::cout << "\n\n\n";
+            std::cout << "Expanding node: " << top_node_ptr->ToString() << "\n\n";
+            if (normalize_mob_variations) {
+                std::cout << "Mob variations in HP and stats are normalized.\n";
+            }
+            printf("sizeof(Node) = %u\n", (unsigned int) sizeof(Node));
+        }
+        // (subtrees pruned before a checkpoint aren't in it, so a resumed
+        // solve can't write a complete tree stream, and states cut off for
+        // workers aren't real)
+        TreeStreamWriter stream;
+        if (!tree_stream_filename.empty() && !resumed && cut_values == nullptr) {
+            if (!stream.Open(tree_stream_filename, mob_slots, fight_type)) {
+                printf("ERROR: could not write to %s\n", tree_stream_filename.c_str());
+                exit(1);
+            }
+            tree_stream = &stream;
         }
-        printf("sizeof(Node) = %u\n", (unsigned int) sizeof(Node));
-        optional_nodes.clear();
-        optional_nodes.push_back(top_node_ptr);
-        expanded_node_count = 0;
-        std::clock_t next_update = clock();
+        if (resumed) {
+            // continue from the checkpoint
+            resumed_duration_s = solve_duration_s;
+            resumed = false;
+        } else {
+            optional_nodes.clear();
+            optional_nodes.push_back(top_node_ptr);
+            expanded_node_count = 0;
+        }
+        // (states cut off for workers can't be resumed, so they're not saved)
+        const bool write_checkpoints =
+            !checkpoint_filename.empty() && cut_values == nullptr;
+        double next_checkpoint = checkpoint_interval_s;
+        double next_update = 0.0;
         bool stats_shown = false;
         bool show_stats = true;
         double update_duration = 1.0;
@@ -1397,7 +1539,7 @@ struct TreeStruct {
             ++iteration;
             // update every second
             stats_shown = false;
-            if (show_stats || clock() >= next_update) {
+            if (!quiet && (show_stats || stopwatch.GetTime() >= next_update)) {
                 auto est_obj_result = top_node_ptr->EstimateFinalObjective();
                 std::size_t tree_nodes =
                     1 + created_node_count - deleted_nodes.size();
@@ -1412,11 +1554,12 @@ struct TreeStruct {
                     ToString(expanded_node_count) <<
                     ", generated=" <<
                     ToString(created_node_count + reused_node_count) <<
-                    ", stored=" << ToString(tree_nodes);
+                    ", stored=" << ToString(tree_nodes) <<
+                    ", mem=" << FormatBytes(GetTrackedMemory()) <<
+                    " (peak " << FormatBytes(GetTrackedMemoryPeak()) << ")";
                 printf(", %.3g%% complete\n",
                     top_node_ptr->GetSolvedCompletionPercent() * 100);
-                next_update =
-                    clock() + (std::clock_t) (update_duration * CLOCKS_PER_SEC);
+                next_update = stopwatch.GetTime() + update_duration;
                 update_duration *= 2;
                 if (update_duration > 60) {
                     update_duration = 60;
@@ -1426,12 +1569,19 @@ struct TreeStruct {
             }
             // if we're done, show stats and exit
             if (optional_nodes.empty()) {
-                if (!stats_shown) {
+                if (!quiet && !stats_shown) {
                     show_stats = true;
                     continue;
                 }
                 break;
             }
+            // write a checkpoint now and then
+            if (write_checkpoints && iteration % 1024 == 0 &&
+                    stopwatch.GetTime() >= next_checkpoint) {
+                solve_duration_s = resumed_duration_s + stopwatch.GetTime();
+                WriteCheckpointInBackground(*this, checkpoint_filename);
+                next_checkpoint = stopwatch.GetTime() + checkpoint_interval_s;
+            }
             // find next node to expand and do it
             Node * this_node_ptr = nullptr;
             this_node_ptr = *optional_nodes.rbegin();
@@ -1443,16 +1593,25 @@ struct TreeStruct {
             if (this_node.pending_action[0].type != kActionNone) {
                 if (this_node.pending_action[0].type == kActionGenerateBattle) {
                     GenerateBattle(this_node);
+                    shape.AddExpansion(kShapeBattle, this_node.child.size(),
+                        this_node.turn, this_node.layer);
                     UpdateTree(&this_node);
                 } else if (this_node.pending_action[0].type == kActionDrawCards) {
                     DrawCards(this_node);
+                    shape.AddExpansion(kShapeDraw, this_node.child.size(),
+                        this_node.turn, this_node.layer);
                     UpdateTree(&this_node);
-                    if (this_node.turn == 1) {
+                    if (!quiet && this_node.turn == 1) {
                         printf("First hand has %u possible draws\n",
                             (unsigned int) this_node.child.size());
                     }
                 } else if (this_node.pending_action[0].type == kActionGenerateMobIntents) {
+                    if (RecallSubgame(this_node)) {
+                        continue;
+                    }
                     GenerateMobIntents(this_node);
+                    shape.AddExpansion(kShapeIntent, this_node.child.size(),
+                        this_node.turn, this_node.layer);
                     UpdateTree(&this_node);
                 } else {
                     printf("ERROR: unexpected preaction type\n");
@@ -1473,28 +1632,484 @@ struct TreeStruct {
             }
         }
         // tree should now be solved
-        const double duration = (double) (clock() - start_clock) / CLOCKS_PER_SEC;
+        const double duration = resumed_duration_s + stopwatch.GetTime();
+        solve_duration_s = duration;
+        profile = GetProfileCounters() - profile_start;
+        profile.duration_s = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - profile_start_time).count();
+        if (write_checkpoints) {
+            WaitForCheckpoint();
+        }
+        if (tree_stream != nullptr) {
+            tree_stream = nullptr;
+            if (!stream.Finish(*top_node_ptr)) {
+                printf("ERROR: could not write to %s\n", tree_stream_filename.c_str());
+                exit(1);
+            }
+        }
+        // (values assumed for cut off states aren't real, so don't store them)
+        if (memo != nullptr && cut_nodes.empty()) {
+            StoreSubgames();
+        }
+        CalculateFinalHPDistribution();
+        if (!policy_filename.empty() && cut_values == nullptr) {
+            if (!keep_all_nodes && !quiet) {
+                printf("Note: solved subtrees were pruned, so the policy only "
+                    "covers the states which were kept\n");
+            }
+            if (!WritePolicyTable(*top_node_ptr, policy_filename)) {
+                printf("ERROR: could not write to %s\n", policy_filename.c_str());
+                exit(1);
+            }
+        }
+        if (!tree_shape_filename.empty()) {
+            if (!quiet) {
+                std::cout << "Writing tree shape stats to " << tree_shape_filename << "\n";
+            }
+            if (!shape.WriteJson(tree_shape_filename)) {
+                printf("ERROR: could not write %s\n", tree_shape_filename.c_str());
+                exit(1);
+            }
+        }
+        if (quiet) {
+            return;
+        }
         std::cout << "Solution took " << duration << " seconds\n";
         PrintTreeStats();
-        // print solved tree to file
-        if (print_completed_tree_to_file &&
-            top_node_ptr->CountNodes() <= max_nodes_to_print) {
-            std::cout << "Printing solved tree to tree.txt\n";
-            std::ofstream outFile("tree.txt");
-            std::streambuf * oldCoutStreamBuf = std::cout.rdbuf();
-            std::cout.rdbuf(outFile.rdbuf());
-            std::cout << "Solution took " << duration << " seconds.\n";
-            std::cout << "Compiled on " << __DATE__ << " at " __TIME__ << "\n";
-            std::cout << "\n";
-            if (print_completed_tree_to_file &&
-                top_node_ptr->CountNodes() <= max_nodes_to_print) {
-                top_node_ptr->PrintTree();
-            }
-            std::cout.rdbuf(oldCoutStreamBuf);
-            outFile.close();
+        // write solved tree to file
+        if (print_completed_tree_to_file) {
+            std::cout << "Writing solved tree to tree.bin\n";
+            if (!WriteTreeFile(*top_node_ptr, fight_type, duration, "tree.bin")) {
+                printf("ERROR: could not write tree.bin\n");
+                exit(1);
+            }
         }
-        solve_duration_s = duration;
         VerifyNode(*top_node_ptr);
         printf("\nPROFILE: %s\n", GetProfileLine().c_str());
     }
+    // copy the top node objective and the solution stats of a solved tree
+    // with a different number of mob slots
+    template <unsigned int slots>
+    void TakeResultsFrom(BasicTreeStruct<slots> & small_tree) {
+        top_node_ptr->objective = small_tree.top_node_ptr->objective;
+        keep_all_nodes = small_tree.keep_all_nodes;
+        created_node_count = small_tree.created_node_count;
+        reused_node_count = small_tree.reused_node_count;
+        expanded_node_count = small_tree.expanded_node_count;
+        solve_duration_s = small_tree.solve_duration_s;
+        profile = small_tree.profile;
+        shape = small_tree.shape;
+        final_hp = small_tree.final_hp;
+        death_chance = small_tree.death_chance;
+        remaining_mob_hp = small_tree.remaining_mob_hp;
+        final_hp_distribution = small_tree.final_hp_distribution;
+        turn_distribution = small_tree.turn_distribution;
+        cut_nodes = std::move(small_tree.cut_nodes);
+    }
+    // call the given function with the tree the fight was solved in
+    // (this tree, or the one with fewer mob slots ExpandFight solved it in)
+    template <class Function>
+    void ForSolvedTree(Function function) {
+        if (std::holds_alternative<std::monostate>(sized_tree)) {
+            function(*this);
+            return;
+        }
+        std::visit([&function](auto & sized) {
+            if constexpr (!std::is_same_v<
+                    std::decay_t<decltype(sized)>, std::monostate>) {
+                function(sized->tree);
+            }
+        }, sized_tree);
+    }
+    // copy the settings which are not stored in a checkpoint to a tree with
+    // fewer mob slots
+    template <unsigned int slots>
+    void CopySettingsTo(BasicTreeStruct<slots> & small_tree) const {
+        small_tree.quiet = quiet;
+        small_tree.memo = memo;
+        small_tree.cut_values = cut_values;
+        small_tree.cut_turn = cut_turn;
+        small_tree.checkpoint_filename = checkpoint_filename;
+        small_tree.checkpoint_interval_s = checkpoint_interval_s;
+        small_tree.tree_stream_filename = tree_stream_filename;
+        small_tree.policy_filename = policy_filename;
+        small_tree.tree_shape_filename = tree_shape_filename;
+    }
+    // solve the tree using a node with the given number of mob slots
+    // (the top node objective and the solution stats are copied back, and
+    // the solved tree is kept in sized_tree)
+    template <unsigned int slots>
+    void ExpandWithMobSlots() {
+        if (use_mob_hp_lanes) {
+            BasicNode<slots> lane_top_node;
+            lane_top_node.CopyStateFrom(*top_node_ptr);
+            BasicLaneSolver<slots> solver(lane_top_node);
+            solver.fight_type = fight_type;
+            solver.generate_all_mob_hp = generate_all_mob_hp;
+            if (solver.Solve()) {
+                top_node_ptr->objective = lane_top_node.objective;
+                solve_duration_s = solver.solve_duration_s;
+                final_hp = solver.final_hp;
+                death_chance = solver.death_chance;
+                final_hp_distribution = solver.final_hp_distribution;
+                turn_distribution = solver.turn_distribution;
+                if (print_completed_tree_to_file && !quiet) {
+                    printf("Note: the fight was solved as lanes, so tree.bin "
+                        "was not written\n");
+                }
+                return;
+            }
+            printf("Solving each mob variation in the tree instead\n");
+        }
+        if constexpr (slots == mob_slots) {
+            Expand();
+        } else {
+            auto & sized = sized_tree.template emplace<
+                std::unique_ptr<BasicSizedTree<slots>>>(
+                    std::make_unique<BasicSizedTree<slots>>());
+            sized->top_node.CopyStateFrom(*top_node_ptr);
+            BasicTreeStruct<slots> & small_tree = sized->tree;
+            small_tree.keep_all_nodes = keep_all_nodes;
+            small_tree.fight_type = fight_type;
+            small_tree.generate_all_mob_hp = generate_all_mob_hp;
+            CopySettingsTo(small_tree);
+            small_tree.Expand();
+            TakeResultsFrom(small_tree);
+        }
+    }
+    // continue the solve in a checkpoint with the given number of mob slots
+    // (a checkpoint with fewer mob slots is read into sized_tree)
+    template <unsigned int slots>
+    void ResumeWithMobSlots(const std::string & data, std::string filename) {
+        if (checkpoint_filename.empty()) {
+            checkpoint_filename = filename;
+        }
+        WireReader in(data);
+        if constexpr (slots == mob_slots) {
+            sized_tree = std::monostate();
+            if (!ReadCheckpoint(in, *this)) {
+                printf("ERROR: could not read checkpoint %s\n", filename.c_str());
+                exit(1);
+            }
+            Expand();
+        } else {
+            auto & sized = sized_tree.template emplace<
+                std::unique_ptr<BasicSizedTree<slots>>>(
+                    std::make_unique<BasicSizedTree<slots>>());
+            BasicTreeStruct<slots> & small_tree = sized->tree;
+            if (!ReadCheckpoint(in, small_tree)) {
+                printf("ERROR: could not read checkpoint %s\n", filename.c_str());
+                exit(1);
+            }
+            top_node_ptr->CopyStateFrom(sized->top_node);
+            fight_type = small_tree.fight_type;
+            CopySettingsTo(small_tree);
+            small_tree.Expand();
+            TakeResultsFrom(small_tree);
+        }
+    }
+    // continue the solve in the given checkpoint
+    // (the top node is replaced by the one in the checkpoint, and new
+    // checkpoints are written to the same file unless another is set)
+    void ResumeFromCheckpoint(std::string filename) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file.good()) {
+            printf("ERROR: could not open %s\n", filename.c_str());
+            exit(1);
+        }
+        const std::string data(
+            (std::istreambuf_iterator<char>(file)),
+            std::istreambuf_iterator<char>());
+        WireReader in(data);
+        uint8_t slots = 0;
+        if (!ReadCheckpointHeader(in, slots) || slots > mob_slots) {
+            printf("ERROR: %s is not a valid checkpoint\n", filename.c_str());
+            exit(1);
+        }
+        if (!quiet) {
+            printf("Resuming solve from %s\n", filename.c_str());
+        }
+        if (slots == 1) {
+            ResumeWithMobSlots<1>(data, filename);
+        } else if (slots == 2) {
+            ResumeWithMobSlots<2>(data, filename);
+        } else if (slots == 3) {
+            ResumeWithMobSlots<3>(data, filename);
+        } else if (slots == mob_slots) {
+            ResumeWithMobSlots<mob_slots>(data, filename);
+        } else {
+            printf("ERROR: %s is not a valid checkpoint\n", filename.c_str());
+            exit(1);
+        }
+    }
+    // return the node with the same state as the given node which follows
+    // the top node by one decision and any random outcomes, or nullptr if
+    // there isn't one
+    // (only the children of the top node and the chance nodes below them are
+    // searched, so later decisions are never visited)
+    Node * FindState(const Node & state) {
+        Node sorted_state;
+        sorted_state.CopyStateFrom(state);
+        sorted_state.SortMobs();
+        if (top_node_ptr->IsSameState(sorted_state)) {
+            return top_node_ptr;
+        }
+        std::vector<Node *> stack(top_node_ptr->child.begin(),
+            top_node_ptr->child.end());
+        while (!stack.empty()) {
+            Node * node_ptr = stack.back();
+            stack.pop_back();
+            if (node_ptr->IsSameState(sorted_state)) {
+                return node_ptr;
+            }
+            if (node_ptr->HasPendingActions()) {
+                stack.insert(stack.end(), node_ptr->child.begin(),
+                    node_ptr->child.end());
+            }
+        }
+        return nullptr;
+    }
+    // reopen the solved nodes below the top node whose subtrees were pruned,
+    // so that expanding the tree solves them again, and return how many there
+    // were
+    // (their ancestors are unsolved until then)
+    std::size_t ReopenPrunedNodes() {
+        // a node whose children are being visited
+        struct Frame {
+            // node
+            Node * node;
+            // index of the next child to visit
+            std::size_t next_child;
+            // true if a node below was reopened
+            bool reopened;
+        };
+        std::size_t reopened_count = 0;
+        std::vector<Frame> stack(1, Frame{top_node_ptr, 0, false});
+        while (!stack.empty()) {
+            Frame & frame = stack.back();
+            Node & node = *frame.node;
+            if (frame.next_child < node.child.size()) {
+                Node * child_ptr = node.child[frame.next_child++];
+                stack.push_back(Frame{child_ptr, 0, false});
+                continue;
+            }
+            if (node.child.empty()) {
+                if (node.flag.tree_solved && !node.IsTerminal() &&
+                        recalled_nodes.find(&node) == recalled_nodes.end()) {
+                    node.flag.tree_solved = false;
+                    node.objective = node.GetMaxFinalObjective();
+                    optional_nodes.push_back(&node);
+                    frame.reopened = true;
+                    ++reopened_count;
+                }
+            } else if (frame.reopened) {
+                node.flag.tree_solved = false;
+                node.objective = node.CalculateObjective();
+            }
+            const bool reopened = frame.reopened;
+            stack.pop_back();
+            if (reopened && !stack.empty()) {
+                stack.back().reopened = true;
+            }
+        }
+        return reopened_count;
+    }
+    // make the node found by FindState() the top node, keeping its subtree
+    // and freeing the rest of the tree, and return false if there isn't one
+    // The top node object stays the same, so references to it stay valid, and
+    // probabilities are scaled so that it has probability 1.  Subtrees which
+    // were pruned are reopened and pruning starts over, so calling Expand()
+    // afterwards solves only what's missing.
+    // (if the fight was solved in a tree with fewer mob slots, that tree is
+    // re-rooted and the new top node state is copied to this one)
+    bool Reroot(const Node & state) {
+        if (!std::holds_alternative<std::monostate>(sized_tree)) {
+            bool found = false;
+            ForSolvedTree([&](auto & solved_tree) {
+                typename std::remove_reference_t<decltype(solved_tree)>::Node
+                    sized_state;
+                sized_state.CopyStateFrom(state);
+                found = solved_tree.Reroot(sized_state);
+                if (found) {
+                    top_node_ptr->CopyStateFrom(*solved_tree.top_node_ptr);
+                    TakeResultsFrom(solved_tree);
+                }
+            });
+            return found;
+        }
+        Node * new_top_ptr = FindState(state);
+        if (new_top_ptr == nullptr) {
+            return false;
+        }
+        Node & top_node = *top_node_ptr;
+        if (new_top_ptr != top_node_ptr) {
+            Node & new_top = *new_top_ptr;
+            // detach the new top node, then delete the rest of the tree
+            auto & sibling = new_top.parent->child;
+            sibling.erase(std::find(sibling.begin(), sibling.end(), new_top_ptr));
+            for (auto & child_ptr : top_node.child) {
+                DeleteNodeAndChildren(*child_ptr);
+            }
+            // move the new top node into the top node object
+            top_node = new_top;
+            top_node.parent = nullptr;
+            for (auto & child_ptr : top_node.child) {
+                child_ptr->parent = &top_node;
+            }
+            if (terminal_nodes.erase(new_top_ptr)) {
+                terminal_nodes.insert(&top_node);
+            }
+            auto it = recalled_nodes.find(new_top_ptr);
+            if (it != recalled_nodes.end()) {
+                recalled_nodes[&top_node] = it->second;
+                recalled_nodes.erase(it);
+            }
+            std::replace(optional_nodes.begin(), optional_nodes.end(),
+                new_top_ptr, &top_node);
+            new_top.child.clear();
+            deleted_nodes.push_back(new_top_ptr);
+            // scale probabilities
+            const double scale = 1.0 / top_node.probability;
+            std::vector<Node *> stack(1, &top_node);
+            while (!stack.empty()) {
+                Node & node = *stack.back();
+                stack.pop_back();
+                node.probability *= scale;
+                stack.insert(stack.end(), node.child.begin(), node.child.end());
+            }
+        }
+        // free the deleted nodes and start counting nodes over
+        for (auto & node_ptr : deleted_nodes) {
+            if (node_ptr != top_node_ptr) {
+                delete node_ptr;
+            }
+        }
+        deleted_nodes.clear();
+        created_node_count = top_node.CountNodes() - 1;
+        expanded_node_count = 0;
+        keep_all_nodes = true;
+        ReopenPrunedNodes();
+        resumed = true;
+        solve_duration_s = 0.0;
+        return true;
+    }
+    // print a result recalled from the solve cache
+    void PrintCachedResult() {
+        printf("\nRecalled result from solve cache\n");
+        if (print_completed_tree_to_file) {
+            printf("Note: the tree was not solved, so tree.bin was not written\n");
+        }
+        printf("\nResult summary:\n");
+        printf("- Expected final HP of %.6g (change of %+.6g)\n",
+            final_hp, final_hp - top_node_ptr->hp);
+        if (!final_hp_distribution.empty()) {
+            printf("- Min/max final HP of %d to %d\n",
+                (int) final_hp_distribution.begin()->first,
+                (int) final_hp_distribution.rbegin()->first);
+        }
+        if (death_chance > 0.0) {
+            printf("- Chance to die is %.3g%%\n", 100 * death_chance);
+        }
+        if (!final_hp_distribution.empty()) {
+            printf("\nFinal HP stats:\n");
+            for (auto & pair : final_hp_distribution) {
+                printf("- %d HP: %.3g%%\n", (int) pair.first, pair.second * 100.0);
+            }
+        }
+    }
+    // solve the fight using the smallest node which can hold all of its mobs
+    // (so single mob fights don't pay for the largest layout)
+    // (if use_solve_cache is set, results are recalled from and stored to
+    // the solve cache, unless states are cut off or the solved tree is
+    // needed)
+    void ExpandFight() {
+        sized_tree = std::monostate();
+        const bool tree_needed = need_solved_tree ||
+            !policy_filename.empty() ||
+            !tree_stream_filename.empty() ||
+            !tree_shape_filename.empty();
+        if (use_solve_cache && tree_needed && !quiet) {
+            printf("Note: not using the solve cache, since the solved tree "
+                "is needed\n");
+        }
+        const bool use_cache = use_solve_cache && !tree_needed &&
+            cut_values == nullptr &&
+            top_node_ptr->pending_action[0].type == kActionGenerateBattle;
+        std::string cache_key;
+        if (use_cache) {
+            // (before the battle starts, the draw pile holds the whole deck,
+            // and unlike the deck it isn't shared with other trees)
+            cache_key = SolveCache::GetKey(
+                top_node_ptr->draw_pile,
+                top_node_ptr->relics,
+                top_node_ptr->hp,
+                top_node_ptr->max_hp,
+                fight_type,
+                generate_all_mob_hp,
+                use_mob_hp_lanes);
+            SolveCacheResult result;
+            if (solve_cache.Lookup(cache_key, result)) {
+                top_node_ptr->objective = result.objective;
+                final_hp = result.final_hp;
+                death_chance = result.death_chance;
+                final_hp_distribution = result.final_hp_distribution;
+                turn_distribution = result.turn_distribution;
+                solve_duration_s = 0.0;
+                if (!quiet) {
+                    PrintCachedResult();
+                }
+                return;
+            }
+        }
+        const unsigned int mob_count = GetFightMobCount(fight_type);
+        if (mob_count > mob_slots) {
+            printf("ERROR: increase MAX_MOBS_PER_NODE to at least %u\n",
+                mob_count);
+            exit(1);
+        }
+        if (mob_count <= 1) {
+            ExpandWithMobSlots<1>();
+        } else if (mob_count <= 2) {
+            ExpandWithMobSlots<2>();
+        } else if (mob_count <= 3) {
+            ExpandWithMobSlots<3>();
+        } else {
+            ExpandWithMobSlots<mob_slots>();
+        }
+        // (subtrees recalled from the subgame memo or tablebase don't add to
+        // the final hp distribution, so the result is incomplete)
+        std::size_t recalled_count = 0;
+        ForSolvedTree([&recalled_count](auto & solved_tree) {
+            recalled_count = solved_tree.recalled_nodes.size();
+        });
+        if (use_cache && recalled_count > 0) {
+            if (!quiet) {
+                printf("Note: subgames were recalled, so the result was not "
+                    "stored in the solve cache\n");
+            }
+        } else if (use_cache) {
+            solve_cache.Store(cache_key, SolveCacheResult{
+                top_node_ptr->objective,
+                final_hp,
+                death_chance,
+                final_hp_distribution,
+                turn_distribution});
+        }
+    }
 };
+
+// tree with its own top node
+// (used to solve a fight with fewer mob slots than the caller's tree)
+template <unsigned int mob_slots>
+struct BasicSizedTree {
+    // top node
+    BasicNode<mob_slots> top_node;
+    // tree below the top node
+    BasicTreeStruct<mob_slots> tree;
+    // constructor
+    BasicSizedTree() : tree(top_node) {
+    }
+};
+
+// tree large enough for any fight
+typedef BasicTreeStruct<MAX_MOBS_PER_NODE> TreeStruct;
@@ -0,0 +1,532 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "defines.h"
+#include "card_collection_map.hpp"
+#include "monster.hpp"
+#include "node.hpp"
+#include "tree_file.hpp"
+
+// The tree exporter writes a solved tree as text (like Node::PrintTree),
+// Graphviz DOT or JSON.  It walks the tree with an explicit stack, so indents
+// are appended to and trimmed from a single string instead of copied for
+// each node, and all output goes through one large buffer with numbers
+// formatted in place.
+//
+// The exporter reads trees through a view, so the same code exports trees in
+// memory and trees in a tree file.
+
+// output format of a tree export
+enum TreeExportFormatEnum : uint8_t {
+    // text, as printed by Node::PrintTree
+    kTreeExportText,
+    // Graphviz DOT
+    kTreeExportDot,
+    // JSON
+    kTreeExportJson,
+};
+
+// settings for a tree export
+struct TreeExportSettings {
+    // output format
+    TreeExportFormatEnum format = kTreeExportText;
+    // if true, nodes with a single child are replaced by that child
+    bool collapse = false;
+    // nodes deeper than this are left out (the top node is at depth 0)
+    unsigned int max_depth = 0xFFFFFFFF;
+    // nodes less likely than this are left out
+    double min_probability = 0.0;
+};
+
+// buffered output of a tree export
+struct ExportBuffer {
+    // data not yet written
+    std::string data;
+    // file to write to (or nullptr to keep everything in data)
+    FILE * file = nullptr;
+    // true if writing to the file failed
+    bool failed = false;
+    // constructor
+    ExportBuffer() {
+        data.reserve(export_buffer_size + 4096);
+    }
+    // write data to the file
+    void Flush() {
+        if (file != nullptr && !data.empty()) {
+            if (fwrite(data.data(), 1, data.size(), file) != data.size()) {
+                failed = true;
+            }
+            data.clear();
+        }
+    }
+    // write data to the file if the buffer is full
+    void FlushIfFull() {
+        if (data.size() >= export_buffer_size) {
+            Flush();
+        }
+    }
+    // append text
+    void Append(const char * text, std::size_t length) {
+        data.append(text, length);
+    }
+    // append text
+    void Append(const char * text) {
+        data.append(text);
+    }
+    // append text
+    void Append(const std::string & text) {
+        data.append(text);
+    }
+    // append a character
+    void Append(char c) {
+        data.push_back(c);
+    }
+    // append an integer
+    void AppendInt(int64_t value) {
+        char text[24];
+        auto result = std::to_chars(text, text + sizeof(text), value);
+        data.append(text, result.ptr - text);
+    }
+    // append a number as std::ostream would with the given precision
+    void AppendDouble(double value, int precision) {
+        char text[48];
+        auto result = std::to_chars(
+            text, text + sizeof(text), value, std::chars_format::general, precision);
+        data.append(text, result.ptr - text);
+    }
+    // append a number with enough digits to read back exactly
+    void AppendExactDouble(double value) {
+        char text[48];
+        auto result = std::to_chars(text, text + sizeof(text), value);
+        data.append(text, result.ptr - text);
+    }
+    // append a pile as CardCollection::ToString would
+    void AppendPile(const CardCollectionPtr & pile) {
+        Append('{');
+        AppendInt(pile.node_ptr->collection.total);
+        Append(" cards");
+        bool first_card = true;
+        for (const auto & deck_item : pile) {
+            Append(first_card ? ": " : ", ");
+            first_card = false;
+            if (deck_item.second > 1) {
+                AppendInt(deck_item.second);
+                Append('x');
+            }
+            Append(card_map[deck_item.first]->name);
+        }
+        Append('}');
+    }
+    // escape JSON and DOT special characters in the data from the given offset
+    void EscapeFrom(std::size_t offset) {
+        std::size_t i = data.find_first_of("\"\\", offset);
+        while (i != std::string::npos) {
+            data.insert(data.begin() + i, '\\');
+            i = data.find_first_of("\"\\", i + 2);
+        }
+    }
+};
+
+// append a node as Node::ToString would
+// (the decision which led to the node is shown if show_decision is true)
+template <unsigned int mob_slots>
+void AppendNodeText(
+        ExportBuffer & out,
+        const BasicNode<mob_slots> & node,
+        bool show_decision,
+        const CardCollectionPtr & deck) {
+    out.Append("Game(");
+    if (node.flag.tree_solved) {
+        out.Append("solved, obj=");
+    } else {
+        out.Append("maxobj=");
+    }
+    out.AppendDouble(node.objective, 6);
+    if (node.IsBattleDone()) {
+        out.Append(node.hp == 0 ? ", dead" : ", done");
+    }
+    if (show_decision) {
+        out.Append(", ");
+        if (node.parent_decision.type == kDecisionPlayCard) {
+            out.Append("play ");
+            out.Append(card_map[node.parent_decision.argument[0]]->name);
+        } else if (node.parent_decision.type == kDecisionEndTurn) {
+            out.Append("end turn");
+        } else {
+            out.Append("unknown");
+        }
+    }
+    if (node.turn != 0) {
+        out.Append(", turn=");
+        out.AppendInt(node.turn);
+    }
+    out.Append(", p=");
+    out.AppendDouble(node.probability, 3);
+    out.Append(", hp=");
+    out.AppendInt(node.hp);
+    out.Append('/');
+    out.AppendInt(node.max_hp);
+    if (node.stance == kStanceWrath) {
+        out.Append(", Wrath");
+    } else if (node.stance == kStanceCalm) {
+        out.Append(", Calm");
+    }
+    if (node.turn == 0) {
+        out.Append(", deck=");
+        out.AppendPile(deck);
+    }
+    if (node.turn != 0 && node.pending_action[0].type == kActionDrawCards) {
+        out.Append(", to_draw=");
+        out.AppendInt(node.pending_action[0].arg[0]);
+    }
+    if (node.block) {
+        out.Append(", block=");
+        out.AppendInt(node.block);
+    }
+    if (!node.HasPendingActions()) {
+        out.Append(", energy=");
+        out.AppendInt(node.energy);
+        out.Append(", hand=");
+        out.AppendPile(node.hand);
+    } else if (!node.hand.IsEmpty()) {
+        out.Append(", hand=");
+        out.AppendPile(node.hand);
+    }
+#ifdef USE_ORBS
+    if (!node.orbs.empty()) {
+        out.Append(", orbs=");
+        out.Append(node.orbs[0].ToString());
+        for (int i = 1; i < node.orbs.size(); ++i) {
+            out.Append(',');
+            out.Append(node.orbs[i].ToString());
+        }
+    }
+#endif
+    const bool show_intents =
+        node.pending_action[0].type != kActionGenerateMobIntents &&
+        node.pending_action[1].type != kActionGenerateMobIntents;
+    for (unsigned int i = 0; i < mob_slots; ++i) {
+        const Monster & mob = node.monster[i];
+        if (!mob.Exists()) {
+            continue;
+        }
+        out.Append(", mob");
+        out.AppendInt(i);
+        out.Append("=(");
+        out.Append(mob.base->name);
+        out.Append(", ");
+        out.AppendInt(mob.hp);
+        out.Append("hp");
+        if (mob.block) {
+            out.Append(", block=");
+            out.AppendInt(mob.block);
+        }
+        if (show_intents) {
+            out.Append(", ");
+            out.Append(mob.base->intent[mob.last_intent[0]].name);
+        }
+        static const std::pair<BuffType, const char *> shown_buff[] = {
+            {kBuffStrength, "xStr"},
+            {kBuffMetallicize, "xMetallicize"},
+            {kBuffRegenerate, "xRegen"},
+            {kBuffVulnerable, "xVuln"},
+            {kBuffRitual, "xRitual"},
+            {kBuffEnrage, "xEnrage"},
+        };
+        for (const auto & buff : shown_buff) {
+            if (mob.buff[buff.first]) {
+                out.Append(", ");
+                out.AppendInt(mob.buff[buff.first]);
+                out.Append(buff.second);
+            }
+        }
+        out.Append(')');
+    }
+    out.Append(')');
+}
+
+// view of a tree held in memory
+template <unsigned int mob_slots>
+struct MemoryTreeView {
+    // reference to a node
+    typedef const BasicNode<mob_slots> * NodeRef;
+    // top node
+    NodeRef top_node_ptr;
+    // constructor
+    MemoryTreeView(const BasicNode<mob_slots> & top_node) : top_node_ptr(&top_node) {
+    }
+    // return the top node
+    NodeRef GetTop() const {
+        return top_node_ptr;
+    }
+    // return the number of children of a node
+    std::size_t GetChildCount(NodeRef node) const {
+        return node->child.size();
+    }
+    // return the child of a node with the given index
+    // (previous is its previous sibling, if any)
+    NodeRef GetChild(NodeRef node, std::size_t index, NodeRef previous) const {
+        (void) previous;
+        return node->child[index];
+    }
+    // return the chance to reach a node
+    double GetProbability(NodeRef node) const {
+        return node->probability;
+    }
+    // return the state of a node
+    const BasicNode<mob_slots> & GetState(NodeRef node) {
+        return *node;
+    }
+    // return true if the decision which led to a node is shown
+    bool IsDecisionShown(NodeRef node) const {
+        return node->parent != nullptr && !node->parent->HasPendingActions();
+    }
+    // return the starting deck
+    CardCollectionPtr GetDeck() const {
+        return NodeShared::deck;
+    }
+};
+
+// view of a tree in a tree file
+struct FileTreeView {
+    // reference to a node
+    typedef uint64_t NodeRef;
+    // tree file
+    TreeFile & tree_file;
+    // state of the last node read
+    Node state;
+    // constructor
+    FileTreeView(TreeFile & tree_file_) : tree_file(tree_file_), state() {
+    }
+    // return the top node
+    NodeRef GetTop() const {
+        return 0;
+    }
+    // return the number of children of a node
+    std::size_t GetChildCount(NodeRef node) const {
+        return tree_file.GetNode(node).child_count;
+    }
+    // return the child of a node with the given index
+    // (previous is its previous sibling, if any)
+    NodeRef GetChild(NodeRef node, std::size_t index, NodeRef previous) const {
+        if (index == 0) {
+            return node + 1;
+        }
+        return previous + tree_file.GetNode(previous).subtree_size;
+    }
+    // return the chance to reach a node
+    double GetProbability(NodeRef node) const {
+        return tree_file.GetNode(node).probability;
+    }
+    // return the state of a node
+    const Node & GetState(NodeRef node) {
+        tree_file.ReadState(node, state);
+        return state;
+    }
+    // return true if the decision which led to a node is shown
+    bool IsDecisionShown(NodeRef node) const {
+        return tree_file.IsDecisionShown(node);
+    }
+    // return the starting deck
+    CardCollectionPtr GetDeck() const {
+        return tree_file.GetDeck();
+    }
+};
+
+// export a tree, return the number of nodes exported
+template <class View>
+std::size_t ExportTree(View & view, const TreeExportSettings & settings, ExportBuffer & out) {
+    typedef typename View::NodeRef NodeRef;
+    // a node whose children are being exported
+    struct Frame {
+        // node
+        NodeRef node;
+        // depth of the node
+        unsigned int depth;
+        // DOT id of the node
+        std::size_t id;
+        // number of children
+        std::size_t child_count;
+        // index of the next child to look at
+        std::size_t next_index;
+        // last child looked at
+        NodeRef last_child;
+        // next child to export (valid if has_next)
+        NodeRef next_child;
+        // true if there's a next child to export
+        bool has_next;
+        // number of children exported so far
+        std::size_t exported_count;
+        // length of the hanging indent for the lines of its children
+        std::size_t hanging_length;
+    };
+    const CardCollectionPtr deck = view.GetDeck();
+    std::vector<Frame> stack;
+    // hanging indent of the node being exported (text only)
+    std::string hanging;
+    std::size_t node_count = 0;
+    // return true if a node at the given depth is exported
+    auto is_visible = [&](NodeRef node, unsigned int depth) {
+        return depth <= settings.max_depth &&
+            view.GetProbability(node) >= settings.min_probability;
+    };
+    // find the next child of the frame to export
+    auto advance = [&](Frame & frame) {
+        frame.has_next = false;
+        while (frame.next_index < frame.child_count) {
+            NodeRef child = view.GetChild(frame.node, frame.next_index, frame.last_child);
+            frame.last_child = child;
+            ++frame.next_index;
+            if (is_visible(child, frame.depth + 1)) {
+                frame.next_child = child;
+                frame.has_next = true;
+                return;
+            }
+        }
+    };
+    // export a node and push a frame for its children
+    // (for text, is_child is false for the top line, and last is true if the
+    // node is the last child exported)
+    auto visit = [&](NodeRef node, unsigned int depth, bool is_child, bool last) {
+        // skip past nodes with a single child
+        while (settings.collapse && view.GetChildCount(node) == 1 &&
+                is_visible(view.GetChild(node, 0, node), depth + 1)) {
+            node = view.GetChild(node, 0, node);
+            ++depth;
+        }
+        const std::size_t id = node_count++;
+        const auto & state = view.GetState(node);
+        const bool show_decision = view.IsDecisionShown(node);
+        if (settings.format == kTreeExportText) {
+            if (is_child) {
+                out.Append(hanging);
+                out.Append("+-");
+                hanging += last ? "  " : "| ";
+            }
+            AppendNodeText(out, state, show_decision, deck);
+            out.Append('\n');
+        } else {
+            if (settings.format == kTreeExportDot) {
+                if (is_child) {
+                    out.Append('n');
+                    out.AppendInt(stack.back().id);
+                    out.Append(" -> n");
+                    out.AppendInt(id);
+                    out.Append(";\n");
+                }
+                out.Append('n');
+                out.AppendInt(id);
+                out.Append(" [label=\"");
+            } else {
+                out.Append("{\"objective\": ");
+                out.AppendExactDouble(state.objective);
+                out.Append(", \"probability\": ");
+                out.AppendExactDouble(state.probability);
+                out.Append(", \"turn\": ");
+                out.AppendInt(state.turn);
+                out.Append(", \"hp\": ");
+                out.AppendInt(state.hp);
+                out.Append(", \"text\": \"");
+            }
+            const std::size_t start = out.data.size();
+            AppendNodeText(out, state, show_decision, deck);
+            out.EscapeFrom(start);
+            if (settings.format == kTreeExportDot) {
+                out.Append("\"];\n");
+            } else {
+                out.Append("\", \"children\": [");
+            }
+        }
+        out.FlushIfFull();
+        Frame frame;
+        frame.node = node;
+        frame.depth = depth;
+        frame.id = id;
+        frame.child_count = view.GetChildCount(node);
+        frame.next_index = 0;
+        frame.last_child = node;
+        frame.exported_count = 0;
+        frame.hanging_length = hanging.size();
+        advance(frame);
+        stack.push_back(frame);
+    };
+    if (settings.format == kTreeExportDot) {
+        out.Append("digraph tree {\nnode [shape=box];\n");
+    }
+    if (is_visible(view.GetTop(), 0)) {
+        visit(view.GetTop(), 0, false, true);
+    }
+    while (!stack.empty()) {
+        Frame & frame = stack.back();
+        if (!frame.has_next) {
+            // all children are done
+            if (settings.format == kTreeExportJson) {
+                if (frame.exported_count > 0) {
+                    out.Append('\n');
+                    out.data.append(2 * (stack.size() - 1), ' ');
+                }
+                out.Append("]}");
+            }
+            stack.pop_back();
+            continue;
+        }
+        const NodeRef child = frame.next_child;
+        const unsigned int depth = frame.depth + 1;
+        advance(frame);
+        const bool last = !frame.has_next;
+        if (settings.format == kTreeExportJson) {
+            if (frame.exported_count > 0) {
+                out.Append(',');
+            }
+            out.Append('\n');
+            out.data.append(2 * stack.size(), ' ');
+        }
+        ++frame.exported_count;
+        hanging.resize(frame.hanging_length);
+        // (frame may move once the child's frame is pushed)
+        visit(child, depth, true, last);
+    }
+    if (settings.format == kTreeExportDot) {
+        out.Append("}\n");
+    } else if (settings.format == kTreeExportJson) {
+        out.Append('\n');
+    }
+    out.Flush();
+    return node_count;
+}
+
+// export a tree file to another file
+void RunTreeExport(
+        std::string filename,
+        std::string output_filename,
+        const TreeExportSettings & settings) {
+    TreeFile tree_file;
+    if (!tree_file.Open(filename)) {
+        printf("ERROR: could not read tree file %s\n", filename.c_str());
+        exit(1);
+    }
+    ExportBuffer out;
+    out.file = fopen(output_filename.c_str(), "wb");
+    if (out.file == nullptr) {
+        printf("ERROR: could not write to %s\n", output_filename.c_str());
+        exit(1);
+    }
+    const auto start = std::chrono::steady_clock::now();
+    FileTreeView view(tree_file);
+    const std::size_t node_count = ExportTree(view, settings, out);
+    if (fclose(out.file) != 0 || out.failed) {
+        printf("ERROR: could not write to %s\n", output_filename.c_str());
+        exit(1);
+    }
+    const double duration = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    printf("Exported %llu nodes to %s in %.3g seconds\n",
+        (unsigned long long) node_count, output_filename.c_str(), duration);
+}
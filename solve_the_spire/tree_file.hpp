@@ -0,0 +1,656 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <iostream>
+#include <sstream>
+
+#include "defines.h"
+#include "card_collection_map.hpp"
+#include "monster.hpp"
+#include "node.hpp"
+#include "fight.hpp"
+#include "wire_format.hpp"
+#include "mapped_file.hpp"
+#include "trace.hpp"
+
+// A tree file holds a solved tree in a form which can be memory mapped and
+// queried without reading all of it.  Nodes are fixed size records in depth
+// first order, so the children of a node follow it and each subtree is a
+// contiguous run of records.  Piles, mob states and player buffs are stored
+// once in side tables which the records refer to by index.
+//
+// File layout:
+// * TreeFileHeader
+// * TreeFileNode for each node
+// * card table: uint16 count, then each card name
+// * mob table: uint8 count, then each mob name
+// * pile table: uint64 file offset of each pile, then for each pile a uint16
+//   number of distinct cards followed by (card, count) pairs
+// * mob state table: for each state and mob slot, the mob (0 for none, else 1
+//   + its index in the mob table), buffs, hp, max hp, last intents and block
+// * buff table: player BuffState for each distinct buff state
+//
+// Like the wire format, records are written as they're laid out in memory,
+// so a file can only be read by the same build.
+
+// tree file header
+struct TreeFileHeader {
+    // file type
+    char magic[8];
+    // solve_cache_version of the program which wrote the file
+    uint32_t version;
+    // number of mob slots in each mob state
+    uint8_t mob_slots;
+    // fight which was solved
+    FightEnum fight_type;
+    // unused
+    uint16_t reserved;
+    // number of nodes
+    uint64_t node_count;
+    // number of nodes without children
+    uint64_t terminal_count;
+    // depth of the deepest node (the top node is at depth 0)
+    uint32_t max_depth;
+    // index of the starting deck in the pile table
+    uint32_t deck_pile;
+    // time taken to solve the tree
+    double solve_duration_s;
+    // file offset of the card table
+    uint64_t card_table_offset;
+    // file offset of the mob table
+    uint64_t mob_table_offset;
+    // number of piles
+    uint64_t pile_count;
+    // file offset of the pile table
+    uint64_t pile_table_offset;
+    // number of mob states
+    uint64_t mob_state_count;
+    // file offset of the mob state table
+    uint64_t mob_state_table_offset;
+    // number of player buff states
+    uint64_t buff_count;
+    // file offset of the buff table
+    uint64_t buff_table_offset;
+    // total file size
+    uint64_t file_size;
+};
+
+// node record in a tree file
+struct TreeFileNode {
+    // objective (or maximum objective if not solved)
+    double objective;
+    // chance to reach this node from its parent
+    double probability;
+    // index of the parent node (or no_tree_file_parent for the top node)
+    uint32_t parent;
+    // number of children
+    uint32_t child_count;
+    // number of nodes in the subtree below and including this one
+    uint32_t subtree_size;
+    // hand, draw, discard and exhaust pile indices
+    uint32_t pile[4];
+    // index into the mob state table
+    uint32_t mob_state;
+    // index into the buff table
+    uint32_t buff;
+    // relics
+    RelicStruct relics;
+    // pending action arguments (card arguments are card table indices)
+    int16_t action_arg[MAX_PENDING_ACTIONS][2];
+    // pending action types
+    ActionType action_type[MAX_PENDING_ACTIONS];
+    // player state
+    uint8_t turn;
+    uint8_t energy;
+    uint8_t layer;
+    uint8_t max_hp;
+    uint8_t hp;
+    uint8_t block;
+    StanceEnum stance;
+    // node flags (battle_done, tree_solved, last_card_attack and
+    // last_card_skill in the low 4 bits)
+    uint8_t flags;
+    // decision which led to this node
+    DecisionTypeEnum decision_type;
+    // card table index of the card played, if any
+    card_index_t decision_card;
+    // target of the card played, if any
+    uint16_t decision_target;
+};
+
+// parent index of the top node
+constexpr uint32_t no_tree_file_parent = 0xFFFFFFFF;
+
+// size of each mob in a mob state
+constexpr std::size_t tree_file_mob_size =
+    sizeof(uint8_t) + sizeof(BuffState) + 2 * sizeof(uint16_t) + 3 + sizeof(uint8_t);
+
+// write the tree below the given node to a tree file, return true if successful
+template <unsigned int mob_slots>
+bool WriteTreeFile(
+        const BasicNode<mob_slots> & top_node,
+        FightEnum fight_type,
+        double solve_duration_s,
+        std::string filename) {
+    TraceScope trace_scope("write_tree_file");
+    typedef BasicNode<mob_slots> Node;
+    // list nodes in depth first order
+    std::vector<const Node *> node;
+    std::vector<const Node *> stack(1, &top_node);
+    while (!stack.empty()) {
+        const Node * node_ptr = stack.back();
+        stack.pop_back();
+        node.push_back(node_ptr);
+        for (auto it = node_ptr->child.rbegin(); it != node_ptr->child.rend(); ++it) {
+            stack.push_back(*it);
+        }
+    }
+    if (node.size() >= no_tree_file_parent) {
+        return false;
+    }
+    // find subtree sizes and parents, working up from the bottom
+    std::vector<uint32_t> subtree_size(node.size(), 1);
+    std::vector<uint32_t> parent(node.size(), no_tree_file_parent);
+    for (std::size_t i = node.size(); i > 0; --i) {
+        const uint32_t index = (uint32_t) (i - 1);
+        uint32_t child_index = index + 1;
+        for (std::size_t c = 0; c < node[index]->child.size(); ++c) {
+            parent[child_index] = index;
+            subtree_size[index] += subtree_size[child_index];
+            child_index += subtree_size[child_index];
+        }
+    }
+    FILE * file = fopen(filename.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    TreeFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "STSTREE", 8);
+    header.version = solve_cache_version;
+    header.mob_slots = (uint8_t) mob_slots;
+    header.fight_type = fight_type;
+    header.node_count = node.size();
+    header.solve_duration_s = solve_duration_s;
+    WireWriter out;
+    out.file = file;
+    out.Put(header);
+    // tables built as nodes are written
+    std::unordered_map<const CardCollectionNode *, uint32_t> pile_index;
+    std::vector<CardCollectionPtr> pile;
+    std::unordered_map<std::string, uint32_t> mob_state_index;
+    std::vector<std::string> mob_state;
+    std::unordered_map<std::string, uint32_t> buff_index;
+    std::vector<std::string> buff;
+    auto add_pile = [&](const CardCollectionPtr & this_pile) {
+        auto result = pile_index.emplace(this_pile.node_ptr, (uint32_t) pile.size());
+        if (result.second) {
+            pile.push_back(this_pile);
+        }
+        return result.first->second;
+    };
+    header.deck_pile = add_pile(NodeShared::deck);
+    std::vector<uint16_t> depth(node.size(), 0);
+    for (std::size_t i = 0; i < node.size(); ++i) {
+        const Node & this_node = *node[i];
+        if (parent[i] != no_tree_file_parent) {
+            depth[i] = depth[parent[i]] + 1;
+        }
+        if (depth[i] > header.max_depth) {
+            header.max_depth = depth[i];
+        }
+        if (this_node.child.empty()) {
+            ++header.terminal_count;
+        }
+        TreeFileNode record;
+        memset(&record, 0, sizeof(record));
+        record.objective = this_node.objective;
+        record.probability = this_node.probability;
+        record.parent = parent[i];
+        record.child_count = (uint32_t) this_node.child.size();
+        record.subtree_size = subtree_size[i];
+        record.pile[0] = add_pile(this_node.hand);
+        record.pile[1] = add_pile(this_node.draw_pile);
+        record.pile[2] = add_pile(this_node.discard_pile);
+        record.pile[3] = add_pile(this_node.exhaust_pile);
+        WireWriter mob_out;
+        for (const auto & mob : this_node.monster) {
+            uint8_t mob_index = 0;
+            for (std::size_t m = 0; mob.base != nullptr && m < all_base_mobs.size(); ++m) {
+                if (all_base_mobs[m] == mob.base) {
+                    mob_index = (uint8_t) (m + 1);
+                }
+            }
+            mob_out.Put(mob_index);
+            mob_out.Put(mob.buff);
+            mob_out.Put(mob.hp);
+            mob_out.Put(mob.max_hp);
+            mob_out.Put(mob.last_intent);
+            mob_out.Put(mob.block);
+        }
+        record.mob_state = mob_state_index.emplace(
+            mob_out.data, (uint32_t) mob_state.size()).first->second;
+        if (record.mob_state == mob_state.size()) {
+            mob_state.push_back(mob_out.data);
+        }
+        const std::string buff_data((const char *) &this_node.buff, sizeof(this_node.buff));
+        record.buff = buff_index.emplace(buff_data, (uint32_t) buff.size()).first->second;
+        if (record.buff == buff.size()) {
+            buff.push_back(buff_data);
+        }
+        record.relics = this_node.relics;
+        for (std::size_t a = 0; a < MAX_PENDING_ACTIONS; ++a) {
+            record.action_type[a] = this_node.pending_action[a].type;
+            record.action_arg[a][0] = this_node.pending_action[a].arg[0];
+            record.action_arg[a][1] = this_node.pending_action[a].arg[1];
+        }
+        record.turn = this_node.turn;
+        record.energy = this_node.energy;
+        record.layer = this_node.layer;
+        record.max_hp = this_node.max_hp;
+        record.hp = this_node.hp;
+        record.block = this_node.block;
+        record.stance = this_node.stance;
+        record.flags = (uint8_t) (
+            (this_node.flag.battle_done ? 1 : 0) |
+            (this_node.flag.tree_solved ? 2 : 0) |
+            (this_node.flag.last_card_attack ? 4 : 0) |
+            (this_node.flag.last_card_skill ? 8 : 0));
+        record.decision_type = this_node.parent_decision.type;
+        if (record.decision_type == kDecisionPlayCard) {
+            record.decision_card = (card_index_t) this_node.parent_decision.argument[0];
+            record.decision_target = this_node.parent_decision.argument[1];
+        }
+        out.Put(record);
+    }
+    // card table (cards are indexed by card_map)
+    header.card_table_offset = out.GetPosition();
+    const std::size_t card_count = card_map_count.load();
+    out.Put((uint16_t) card_count);
+    for (std::size_t i = 0; i < card_count; ++i) {
+        out.PutString(card_map[i]->name);
+    }
+    // mob table
+    header.mob_table_offset = out.GetPosition();
+    out.Put((uint8_t) all_base_mobs.size());
+    for (const BaseMonster * base : all_base_mobs) {
+        out.PutString(base->name);
+    }
+    // pile table
+    header.pile_count = pile.size();
+    header.pile_table_offset = out.GetPosition();
+    uint64_t pile_offset = header.pile_table_offset + pile.size() * sizeof(uint64_t);
+    for (const auto & this_pile : pile) {
+        out.Put(pile_offset);
+        std::size_t count = 0;
+        for (const auto & deck_item : this_pile) {
+            (void) deck_item;
+            ++count;
+        }
+        pile_offset += sizeof(uint16_t) + count * sizeof(deck_item_t);
+    }
+    for (const auto & this_pile : pile) {
+        uint16_t count = 0;
+        for (const auto & deck_item : this_pile) {
+            (void) deck_item;
+            ++count;
+        }
+        out.Put(count);
+        for (const auto & deck_item : this_pile) {
+            out.Put(deck_item.first);
+            out.Put(deck_item.second);
+        }
+    }
+    // mob state and buff tables
+    header.mob_state_count = mob_state.size();
+    header.mob_state_table_offset = out.GetPosition();
+    for (const auto & data : mob_state) {
+        out.data += data;
+        out.Flush();
+    }
+    header.buff_count = buff.size();
+    header.buff_table_offset = out.GetPosition();
+    for (const auto & data : buff) {
+        out.data += data;
+    }
+    header.file_size = out.GetPosition();
+    out.Flush();
+    // now that the tables are placed, rewrite the header
+    bool good = !out.failed &&
+        fseek(file, 0, SEEK_SET) == 0 &&
+        fwrite(&header, sizeof(header), 1, file) == 1;
+    if (fclose(file) != 0) {
+        good = false;
+    }
+    return good;
+}
+
+// a tree file opened for queries
+struct TreeFile {
+    // mapped file
+    MappedFile file;
+    // index in this process of each card in the card table
+    std::vector<card_index_t> card_index;
+    // each mob in the mob table
+    std::vector<const BaseMonster *> mob;
+    // piles read so far
+    std::unordered_map<uint32_t, CardCollectionPtr> pile;
+    // destructor
+    ~TreeFile() {
+        Close();
+    }
+    // return the header
+    const TreeFileHeader & GetHeader() const {
+        return *(const TreeFileHeader *) file.data;
+    }
+    // return the record of the given node
+    const TreeFileNode & GetNode(uint64_t index) const {
+        return ((const TreeFileNode *) (file.data + sizeof(TreeFileHeader)))[index];
+    }
+    // return the number of nodes
+    uint64_t GetNodeCount() const {
+        return GetHeader().node_count;
+    }
+    // copy a value from the file
+    template <class T>
+    T Get(uint64_t offset) const {
+        return file.Get<T>(offset);
+    }
+    // return true if the header of the opened file is valid
+    bool IsValid() const {
+        if (file.size < sizeof(TreeFileHeader)) {
+            return false;
+        }
+        const TreeFileHeader & header = GetHeader();
+        return memcmp(header.magic, "STSTREE", 8) == 0 &&
+            header.version == solve_cache_version &&
+            header.mob_slots <= MAX_MOBS_PER_NODE &&
+            header.file_size == file.size &&
+            header.node_count > 0 &&
+            sizeof(TreeFileHeader) + header.node_count * sizeof(TreeFileNode) <=
+                header.card_table_offset &&
+            header.card_table_offset <= header.mob_table_offset &&
+            header.mob_table_offset <= header.pile_table_offset &&
+            header.pile_table_offset + header.pile_count * sizeof(uint64_t) <=
+                header.mob_state_table_offset &&
+            header.mob_state_table_offset +
+                header.mob_state_count * header.mob_slots * tree_file_mob_size ==
+                header.buff_table_offset &&
+            header.buff_table_offset + header.buff_count * sizeof(BuffState) ==
+                file.size &&
+            header.deck_pile < header.pile_count;
+    }
+    // read the card and mob tables, return true if successful
+    bool ReadTables() {
+        const TreeFileHeader & header = GetHeader();
+        uint64_t offset = header.card_table_offset;
+        card_index.resize(Get<uint16_t>(offset));
+        offset += sizeof(uint16_t);
+        for (auto & index : card_index) {
+            std::string name;
+            if (!file.GetString(offset, name)) {
+                return false;
+            }
+            const Card * card = GetCardByName(name);
+            if (card == nullptr) {
+                return false;
+            }
+            index = card->GetIndex();
+        }
+        offset = header.mob_table_offset;
+        mob.resize(Get<uint8_t>(offset));
+        offset += sizeof(uint8_t);
+        for (auto & base : mob) {
+            std::string name;
+            if (!file.GetString(offset, name)) {
+                return false;
+            }
+            base = GetBaseMobByName(name);
+            if (base == nullptr) {
+                return false;
+            }
+        }
+        return true;
+    }
+    // open a tree file, return true if successful
+    bool Open(std::string filename) {
+        Close();
+        if (!file.Open(filename)) {
+            return false;
+        }
+        if (!IsValid() || !ReadTables()) {
+            Close();
+            return false;
+        }
+        return true;
+    }
+    // close the file
+    void Close() {
+        file.Close();
+        card_index.clear();
+        mob.clear();
+        pile.clear();
+    }
+    // return the pile with the given index
+    CardCollectionPtr GetPile(uint32_t index) {
+        auto it = pile.find(index);
+        if (it != pile.end()) {
+            return it->second;
+        }
+        CardCollectionPtr this_pile;
+        uint64_t offset = Get<uint64_t>(
+            GetHeader().pile_table_offset + index * sizeof(uint64_t));
+        const uint16_t count = Get<uint16_t>(offset);
+        offset += sizeof(uint16_t);
+        for (uint16_t i = 0; i < count; ++i) {
+            const deck_item_t item(
+                Get<card_index_t>(offset),
+                Get<card_count_t>(offset + sizeof(card_index_t)));
+            offset += sizeof(card_index_t) + sizeof(card_count_t);
+            this_pile.AddCard(card_index[item.first], item.second);
+        }
+        pile[index] = this_pile;
+        return this_pile;
+    }
+    // return the starting deck
+    CardCollectionPtr GetDeck() {
+        return GetPile(GetHeader().deck_pile);
+    }
+    // read the state of a node
+    // (the parent and children are not set)
+    void ReadState(uint64_t index, Node & node) {
+        const TreeFileHeader & header = GetHeader();
+        const TreeFileNode & record = GetNode(index);
+        node.objective = record.objective;
+        node.probability = record.probability;
+        node.hand = GetPile(record.pile[0]);
+        node.draw_pile = GetPile(record.pile[1]);
+        node.discard_pile = GetPile(record.pile[2]);
+        node.exhaust_pile = GetPile(record.pile[3]);
+        uint64_t offset = header.mob_state_table_offset +
+            record.mob_state * header.mob_slots * tree_file_mob_size;
+        for (unsigned int i = 0; i < MAX_MOBS_PER_NODE; ++i) {
+            node.monster[i] = Monster();
+            if (i >= header.mob_slots) {
+                continue;
+            }
+            Monster & this_mob = node.monster[i];
+            const uint8_t mob_index = Get<uint8_t>(offset);
+            this_mob.base = (mob_index == 0) ? nullptr : mob[mob_index - 1];
+            offset += sizeof(uint8_t);
+            this_mob.buff = Get<BuffState>(offset);
+            offset += sizeof(BuffState);
+            this_mob.hp = Get<uint16_t>(offset);
+            offset += sizeof(uint16_t);
+            this_mob.max_hp = Get<uint16_t>(offset);
+            offset += sizeof(uint16_t);
+            for (auto & intent : this_mob.last_intent) {
+                intent = Get<uint8_t>(offset);
+                offset += sizeof(uint8_t);
+            }
+            this_mob.block = Get<uint8_t>(offset);
+            offset += sizeof(uint8_t);
+        }
+        node.buff = Get<BuffState>(
+            header.buff_table_offset + record.buff * sizeof(BuffState));
+        node.relics = record.relics;
+        for (std::size_t a = 0; a < MAX_PENDING_ACTIONS; ++a) {
+            node.pending_action[a].type = record.action_type[a];
+            node.pending_action[a].arg[0] = record.action_arg[a][0];
+            if (IsCardAction(record.action_type[a])) {
+                node.pending_action[a].arg[0] = card_index[record.action_arg[a][0]];
+            }
+            node.pending_action[a].arg[1] = record.action_arg[a][1];
+        }
+        node.turn = record.turn;
+        node.energy = record.energy;
+        node.layer = record.layer;
+        node.max_hp = record.max_hp;
+        node.hp = record.hp;
+        node.block = record.block;
+        node.stance = record.stance;
+        node.flag.battle_done = (record.flags & 1) != 0;
+        node.flag.tree_solved = (record.flags & 2) != 0;
+        node.flag.last_card_attack = (record.flags & 4) != 0;
+        node.flag.last_card_skill = (record.flags & 8) != 0;
+        node.parent = nullptr;
+        node.child.clear();
+        node.parent_decision.type = record.decision_type;
+        node.parent_decision.argument[0] = 0;
+        node.parent_decision.argument[1] = 0;
+        if (record.decision_type == kDecisionPlayCard) {
+            node.parent_decision.argument[0] = card_index[record.decision_card];
+            node.parent_decision.argument[1] = record.decision_target;
+        }
+    }
+    // return true if the decision which led to a node is shown
+    // (as in Node::ToString, it's shown if the parent had no pending actions)
+    bool IsDecisionShown(uint64_t index) const {
+        const TreeFileNode & record = GetNode(index);
+        return record.parent != no_tree_file_parent &&
+            GetNode(record.parent).action_type[0] == kActionNone;
+    }
+    // return the node as Node::ToString would
+    std::string NodeToString(uint64_t index) {
+        Node node = Node();
+        ReadState(index, node);
+        // a stand-in parent tells ToString whether to show the decision
+        Node parent = Node();
+        parent.pending_action[0].type = kActionNone;
+        if (IsDecisionShown(index)) {
+            node.parent = &parent;
+        }
+        CardCollectionPtr old_deck = NodeShared::deck;
+        NodeShared::deck = GetDeck();
+        std::string text = node.ToString();
+        NodeShared::deck = old_deck;
+        return text;
+    }
+    // print the subtree below a node to the given depth, like Node::PrintTree
+    // (returns the number of lines left to print)
+    std::size_t PrintSubtree(
+            std::ostream & out,
+            uint64_t index,
+            unsigned int max_depth,
+            std::size_t max_lines,
+            std::string indent = "",
+            std::string hanging_indent = "") {
+        if (max_lines == 0) {
+            return 0;
+        }
+        out << indent << "#" << index << " " << NodeToString(index) << "\n";
+        --max_lines;
+        const TreeFileNode & record = GetNode(index);
+        if (record.child_count == 0) {
+            return max_lines;
+        }
+        if (max_depth == 0) {
+            out << hanging_indent << "+- (" << record.child_count <<
+                " children, " << record.subtree_size - 1 << " nodes below)\n";
+            return max_lines;
+        }
+        uint64_t child_index = index + 1;
+        for (uint32_t i = 0; i < record.child_count; ++i) {
+            if (max_lines == 0) {
+                out << hanging_indent << "+- ...\n";
+                return 0;
+            }
+            const bool last = (i == record.child_count - 1);
+            max_lines = PrintSubtree(
+                out,
+                child_index,
+                max_depth - 1,
+                max_lines,
+                hanging_indent + "+-",
+                hanging_indent + (last ? "  " : "| "));
+            child_index += GetNode(child_index).subtree_size;
+        }
+        return max_lines;
+    }
+    // print the path from the top node to the given node
+    void PrintPath(std::ostream & out, uint64_t index) {
+        std::vector<uint64_t> path;
+        for (uint64_t i = index; ; i = GetNode(i).parent) {
+            path.push_back(i);
+            if (GetNode(i).parent == no_tree_file_parent) {
+                break;
+            }
+        }
+        std::string indent;
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+            out << indent << "#" << *it << " " << NodeToString(*it) << "\n";
+            if (indent.empty()) {
+                indent = "+-";
+            } else {
+                indent = "  " + indent;
+            }
+        }
+    }
+    // print summary stats from the header
+    void PrintStats(std::ostream & out) {
+        const TreeFileHeader & header = GetHeader();
+        out << "Fight: " << fight_map[header.fight_type].name << "\n";
+        out << "Solve took " << header.solve_duration_s << " seconds\n";
+        out << "Nodes: " << header.node_count << "\n";
+        out << "Terminal nodes: " << header.terminal_count << "\n";
+        out << "Max depth: " << header.max_depth << "\n";
+        out << "Distinct piles: " << header.pile_count << "\n";
+        out << "Distinct mob states: " << header.mob_state_count << "\n";
+        out << "Distinct player buffs: " << header.buff_count << "\n";
+        out << "File size: " << header.file_size << " bytes\n";
+        out << "Top node: #0 " << NodeToString(0) << "\n";
+    }
+};
+
+// answer a query about a tree file
+// (query is "stats", "subtree" or "path")
+void RunTreeQuery(
+        std::string filename,
+        std::string query,
+        uint64_t index,
+        unsigned int max_depth) {
+    TreeFile tree_file;
+    if (!tree_file.Open(filename)) {
+        printf("ERROR: could not read tree file %s\n", filename.c_str());
+        exit(1);
+    }
+    if (index >= tree_file.GetNodeCount()) {
+        printf("ERROR: tree has no node %llu\n", (unsigned long long) index);
+        exit(1);
+    }
+    if (query == "stats") {
+        tree_file.PrintStats(std::cout);
+    } else if (query == "subtree") {
+        tree_file.PrintSubtree(std::cout, index, max_depth, max_nodes_to_print);
+    } else if (query == "path") {
+        tree_file.PrintPath(std::cout, index);
+    } else {
+        printf("ERROR: unknown query \"%s\"\n", query.c_str());
+        exit(1);
+    }
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "defines.h"
+
+// Tree shape stats show where the tree is wide and how much each kind of
+// pruning removes, so we can tell which optimization would pay off for a
+// given fight and deck.  They're gathered while expanding and written as a
+// JSON report after the solve.
+
+// kinds of nodes which are expanded
+enum TreeShapeNodeEnum : uint8_t {
+    // start of the battle, with one child per mob layout
+    kShapeBattle,
+    // cards drawn, with one child per possible draw
+    kShapeDraw,
+    // mob intents chosen, with one child per combination of intents
+    kShapeIntent,
+    // player decisions, with one child per ending kept after dominance
+    kShapeDecision,
+    kShapeFinal
+};
+
+// name of each kind of node
+const char * const tree_shape_node_name[kShapeFinal] = {
+    "battle",
+    "draw",
+    "intent",
+    "decision",
+};
+
+// ways nodes are discarded
+enum TreeShapePruneEnum : uint8_t {
+    // endings which die with a lower objective than another death
+    kPruneWorseDeath,
+    // endings worse than or equal to another ending
+    kPruneDominated,
+    // decisions skipped because one ends the battle at the best objective
+    kPruneBestEnding,
+    // UpdateTree: choices other than the best once all are solved
+    kPruneAllSolved,
+    // UpdateTree: choices no better than the best solved choice
+    kPruneBounded,
+    // UpdateTree: children of solved nodes when not keeping all nodes
+    kPruneSolvedSubtree,
+    kPruneFinal
+};
+
+// name of each way nodes are discarded
+const char * const tree_shape_prune_name[kPruneFinal] = {
+    "worse_death",
+    "dominated",
+    "best_ending",
+    "all_solved",
+    "bounded",
+    "solved_subtree",
+};
+
+// shape of a tree and how it was pruned
+struct TreeShapeStats {
+    // number of nodes expanded of each kind
+    uint64_t expanded[kShapeFinal] = {0};
+    // number of children made by expanding each kind
+    uint64_t children[kShapeFinal] = {0};
+    // most children made by expanding a single node of each kind
+    uint64_t max_children[kShapeFinal] = {0};
+    // number of calls to FindPlayerChoices
+    uint64_t choice_calls = 0;
+    // number of endings found by FindPlayerChoices
+    uint64_t choice_endings = 0;
+    // number of endings kept after dominance
+    uint64_t choice_survivors = 0;
+    // number of nodes discarded in each way
+    uint64_t pruned[kPruneFinal] = {0};
+    // number of nodes expanded by turn
+    std::vector<uint64_t> expanded_by_turn;
+    // number of nodes expanded by depth in the tree
+    // (depth is the layer of a node, which wraps at 256)
+    std::vector<uint64_t> expanded_by_depth;
+    // count one step of a histogram
+    static void AddToHistogram(std::vector<uint64_t> & histogram, std::size_t index) {
+        if (histogram.size() <= index) {
+            histogram.resize(index + 1, 0);
+        }
+        ++histogram[index];
+    }
+    // count an expanded node
+    void AddExpansion(
+            TreeShapeNodeEnum type,
+            std::size_t child_count,
+            uint8_t turn,
+            uint8_t depth) {
+        ++expanded[type];
+        children[type] += child_count;
+        if (child_count > max_children[type]) {
+            max_children[type] = child_count;
+        }
+        AddToHistogram(expanded_by_turn, turn);
+        AddToHistogram(expanded_by_depth, depth);
+    }
+    // return the average number of children made by expanding a kind of node
+    double GetBranchingFactor(TreeShapeNodeEnum type) const {
+        return expanded[type] == 0 ? 0.0 : (double) children[type] / expanded[type];
+    }
+    // print the branching factor of each kind of node and the nodes pruned
+    void Print() const {
+        printf("\nTree shape:\n");
+        for (int i = 0; i < kShapeFinal; ++i) {
+            printf("- %-8s %12llu expanded  %8.2f children each (max %llu)\n",
+                tree_shape_node_name[i],
+                (unsigned long long) expanded[i],
+                GetBranchingFactor((TreeShapeNodeEnum) i),
+                (unsigned long long) max_children[i]);
+        }
+        printf("- Player choices kept %llu of %llu endings\n",
+            (unsigned long long) choice_survivors,
+            (unsigned long long) choice_endings);
+        for (int i = 0; i < kPruneFinal; ++i) {
+            printf("- Pruned %llu nodes as %s\n",
+                (unsigned long long) pruned[i],
+                tree_shape_prune_name[i]);
+        }
+    }
+    // return a histogram as a JSON array
+    static std::string HistogramToJson(const std::vector<uint64_t> & histogram) {
+        std::string text = "[";
+        char buffer[32];
+        for (std::size_t i = 0; i < histogram.size(); ++i) {
+            snprintf(buffer, sizeof(buffer), "%s%llu",
+                i == 0 ? "" : ", ",
+                (unsigned long long) histogram[i]);
+            text += buffer;
+        }
+        return text + "]";
+    }
+    // return the stats as a JSON object
+    std::string ToJson() const {
+        std::string text = "{\n  \"nodes\": {";
+        char buffer[256];
+        for (int i = 0; i < kShapeFinal; ++i) {
+            snprintf(buffer, sizeof(buffer),
+                "%s\n    \"%s\": {\"expanded\": %llu, \"children\": %llu, "
+                "\"branching_factor\": %.6g, \"max_children\": %llu}",
+                i == 0 ? "" : ",",
+                tree_shape_node_name[i],
+                (unsigned long long) expanded[i],
+                (unsigned long long) children[i],
+                GetBranchingFactor((TreeShapeNodeEnum) i),
+                (unsigned long long) max_children[i]);
+            text += buffer;
+        }
+        snprintf(buffer, sizeof(buffer),
+            "\n  },\n  \"player_choices\": {\"calls\": %llu, \"endings\": %llu, "
+            "\"survivors\": %llu, \"endings_per_call\": %.6g, "
+            "\"survivors_per_call\": %.6g},\n  \"pruned\": {",
+            (unsigned long long) choice_calls,
+            (unsigned long long) choice_endings,
+            (unsigned long long) choice_survivors,
+            choice_calls == 0 ? 0.0 : (double) choice_endings / choice_calls,
+            choice_calls == 0 ? 0.0 : (double) choice_survivors / choice_calls);
+        text += buffer;
+        for (int i = 0; i < kPruneFinal; ++i) {
+            snprintf(buffer, sizeof(buffer), "%s\"%s\": %llu",
+                i == 0 ? "" : ", ",
+                tree_shape_prune_name[i],
+                (unsigned long long) pruned[i]);
+            text += buffer;
+        }
+        text += "},\n  \"expanded_by_turn\": " + HistogramToJson(expanded_by_turn);
+        text += ",\n  \"expanded_by_depth\": " + HistogramToJson(expanded_by_depth);
+        return text + "\n}\n";
+    }
+    // write the stats to a JSON file, return true if successful
+    bool WriteJson(const std::string & filename) const {
+        FILE * file = fopen(filename.c_str(), "w");
+        if (file == nullptr) {
+            return false;
+        }
+        const std::string text = ToJson();
+        const bool success = fwrite(text.data(), 1, text.size(), file) == text.size();
+        return fclose(file) == 0 && success;
+    }
+};
@@ -0,0 +1,398 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "defines.h"
+#include "card_collection_map.hpp"
+#include "monster.hpp"
+#include "node.hpp"
+#include "wire_format.hpp"
+#include "trace.hpp"
+
+// A tree stream holds a solved tree which was pruned while it was solved.
+// Once the tree stops keeping all nodes, the children of each solved node are
+// deleted.  Just before that happens, the subtree below the node is appended
+// to the stream, so the whole solved tree ends up on disk without ever being
+// in memory at once.
+//
+// Nodes are written in the order they're finished, children first.  Each
+// node is numbered by its position in the stream and refers to its children
+// by number.  A subtree written earlier is referred to rather than written
+// again, so each node is written once.  Subtrees which later turn out not to
+// be optimal are left in the stream but aren't reachable from the top node.
+//
+// Nodes are encoded on the solver thread, since they're deleted right after,
+// and written to the file by a background thread.
+//
+// File layout:
+// * "STSSTRM", solve_cache_version, mob slots, fight type
+// * each node: WriteNode state, objective, probability, parent decision,
+//   number of children and the number of each child
+// * footer: card table, mob table, starting deck, number of the top node and
+//   number of nodes
+// * file offset of the footer
+
+// writes cards and mobs as indices into tables written at the end, and piles
+// inline
+struct StreamNameWriter {
+    // write a card (cards are indexed by card_map)
+    void WriteCard(WireWriter & out, card_index_t index) {
+        out.Put(index);
+    }
+    // write a pile
+    void WritePile(WireWriter & out, const CardCollectionPtr & pile) {
+        uint16_t count = 0;
+        for (const auto & deck_item : pile) {
+            (void) deck_item;
+            ++count;
+        }
+        out.Put(count);
+        for (const auto & deck_item : pile) {
+            out.Put(deck_item.first);
+            out.Put(deck_item.second);
+        }
+    }
+    // write a mob (0 for none, else 1 + its index in all_base_mobs)
+    void WriteMob(WireWriter & out, const BaseMonster * base) {
+        uint8_t index = 0;
+        for (std::size_t i = 0; base != nullptr && i < all_base_mobs.size(); ++i) {
+            if (all_base_mobs[i] == base) {
+                index = (uint8_t) (i + 1);
+            }
+        }
+        out.Put(index);
+    }
+    // write the card and mob tables
+    void WriteTables(WireWriter & out) {
+        const std::size_t card_count = card_map_count.load();
+        out.Put((uint16_t) card_count);
+        for (std::size_t i = 0; i < card_count; ++i) {
+            out.PutString(card_map[i]->name);
+        }
+        out.Put((uint8_t) all_base_mobs.size());
+        for (const BaseMonster * base : all_base_mobs) {
+            out.PutString(base->name);
+        }
+    }
+};
+
+// reads cards, piles and mobs written by StreamNameWriter
+struct StreamNameReader {
+    // index in this process of each card in the card table
+    std::vector<card_index_t> card_index;
+    // each mob in the mob table
+    std::vector<const BaseMonster *> mob;
+    // read a card, return true if successful
+    bool ReadCard(WireReader & in, card_index_t & index) {
+        const card_index_t table_index = in.Get<card_index_t>();
+        if (!in.good || table_index >= card_index.size()) {
+            return false;
+        }
+        index = card_index[table_index];
+        return true;
+    }
+    // read a pile, return true if successful
+    bool ReadPile(WireReader & in, CardCollectionPtr & pile) {
+        pile.Clear();
+        const uint16_t count = in.Get<uint16_t>();
+        for (uint16_t i = 0; in.good && i < count; ++i) {
+            card_index_t index = 0;
+            if (!ReadCard(in, index)) {
+                return false;
+            }
+            pile.AddCard(index, in.Get<card_count_t>());
+        }
+        return in.good;
+    }
+    // read a mob, return true if successful
+    bool ReadMob(WireReader & in, const BaseMonster * & base) {
+        const uint8_t index = in.Get<uint8_t>();
+        if (!in.good || index > mob.size()) {
+            return false;
+        }
+        base = (index == 0) ? nullptr : mob[index - 1];
+        return true;
+    }
+    // read the card and mob tables, return true if successful
+    bool ReadTables(WireReader & in) {
+        card_index.resize(in.Get<uint16_t>());
+        for (auto & index : card_index) {
+            const Card * card = GetCardByName(in.GetString());
+            if (!in.good || card == nullptr) {
+                return false;
+            }
+            index = card->GetIndex();
+        }
+        mob.resize(in.Get<uint8_t>());
+        for (auto & base : mob) {
+            base = GetBaseMobByName(in.GetString());
+            if (!in.good || base == nullptr) {
+                return false;
+            }
+        }
+        return in.good;
+    }
+};
+
+// appends solved subtrees to a tree stream
+struct TreeStreamWriter {
+    // file being written
+    FILE * file = nullptr;
+    // encoded nodes not yet handed to the I/O thread
+    WireWriter out;
+    // names of cards and mobs
+    StreamNameWriter names;
+    // number of nodes written
+    uint64_t node_count = 0;
+    // number of each node which was written and still exists
+    // (these are solved nodes whose children were deleted)
+    std::unordered_map<const void *, uint64_t> node_number;
+    // thread which writes to the file
+    std::thread io_thread;
+    // guards the members below
+    std::mutex mutex;
+    // signals changes to the members below
+    std::condition_variable changed;
+    // encoded data waiting to be written
+    std::deque<std::string> queue;
+    // number of bytes waiting to be written
+    std::size_t queued_bytes = 0;
+    // number of bytes handed to the I/O thread so far
+    uint64_t queued_total = 0;
+    // true once all data is queued
+    bool done = false;
+    // true if writing to the file failed
+    bool failed = false;
+    // destructor
+    ~TreeStreamWriter() {
+        if (file != nullptr) {
+            Close();
+        }
+    }
+    // write queued data until done
+    void RunIO() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            changed.wait(lock, [this]() { return done || !queue.empty(); });
+            if (queue.empty()) {
+                return;
+            }
+            std::string data = std::move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+            bool good;
+            {
+                TraceScope trace_scope("tree_stream_io");
+                good = fwrite(data.data(), 1, data.size(), file) == data.size();
+            }
+            lock.lock();
+            queued_bytes -= data.size();
+            failed = failed || !good;
+            changed.notify_all();
+        }
+    }
+    // hand the encoded data to the I/O thread
+    // (waits while too much data is already waiting)
+    void Queue() {
+        if (out.data.empty()) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        {
+            TraceScope trace_scope("tree_stream_wait");
+            changed.wait(lock, [this]() {
+                return queued_bytes < max_tree_stream_queue_bytes;
+            });
+        }
+        queued_bytes += out.data.size();
+        queued_total += out.data.size();
+        queue.push_back(std::move(out.data));
+        out.data.clear();
+        changed.notify_all();
+    }
+    // open the stream, return true if successful
+    bool Open(std::string filename, unsigned int mob_slots, FightEnum fight_type) {
+        file = fopen(filename.c_str(), "wb");
+        if (file == nullptr) {
+            return false;
+        }
+        out.data.append("STSSTRM", 8);
+        out.Put((uint32_t) solve_cache_version);
+        out.Put((uint8_t) mob_slots);
+        out.Put(fight_type);
+        io_thread = std::thread(&TreeStreamWriter::RunIO, this);
+        return true;
+    }
+    // write the subtree below a node which hasn't been written yet,
+    // return the node's number
+    template <unsigned int mob_slots>
+    uint64_t WriteNodeAndChildren(const BasicNode<mob_slots> & node) {
+        auto it = node_number.find(&node);
+        if (it != node_number.end()) {
+            return it->second;
+        }
+        std::vector<uint64_t> child_number;
+        child_number.reserve(node.child.size());
+        for (const auto & child_ptr : node.child) {
+            child_number.push_back(WriteNodeAndChildren(*child_ptr));
+        }
+        WriteNode(out, node, names);
+        out.Put(node.objective);
+        out.Put(node.probability);
+        out.Put(node.parent_decision.type);
+        out.Put(node.parent_decision.argument[0]);
+        out.Put(node.parent_decision.argument[1]);
+        out.Put((uint32_t) child_number.size());
+        for (uint64_t number : child_number) {
+            out.Put(number);
+        }
+        if (out.data.size() >= (1 << 20)) {
+            Queue();
+        }
+        return node_count++;
+    }
+    // write the subtree below a solved node whose children are about to be
+    // deleted
+    template <unsigned int mob_slots>
+    void WriteSubtree(const BasicNode<mob_slots> & node) {
+        node_number[&node] = WriteNodeAndChildren(node);
+    }
+    // note that a node is being deleted
+    void ForgetNode(const void * node) {
+        if (!node_number.empty()) {
+            node_number.erase(node);
+        }
+    }
+    // write the rest of the tree below the top node and the footer, then close
+    // the file, return true if successful
+    template <unsigned int mob_slots>
+    bool Finish(const BasicNode<mob_slots> & top_node) {
+        const uint64_t top_number = WriteNodeAndChildren(top_node);
+        const uint64_t footer_offset = queued_total + out.data.size();
+        names.WriteTables(out);
+        names.WritePile(out, NodeShared::deck);
+        out.Put(top_number);
+        out.Put(node_count);
+        out.Put(footer_offset);
+        return Close();
+    }
+    // stop the I/O thread and close the file, return true if successful
+    bool Close() {
+        Queue();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+            changed.notify_all();
+        }
+        io_thread.join();
+        bool good = !failed;
+        if (fclose(file) != 0) {
+            good = false;
+        }
+        file = nullptr;
+        node_number.clear();
+        return good;
+    }
+};
+
+// a tree read back from a tree stream
+struct TreeStreamContents {
+    // every node in the stream, by number
+    // (only nodes reachable from the top node are part of the solved tree)
+    std::deque<Node> node;
+    // the top node (or nullptr)
+    Node * top_node_ptr = nullptr;
+    // fight which was solved
+    FightEnum fight_type = kFightNone;
+    // starting deck
+    CardCollectionPtr deck;
+};
+
+// read a tree stream, return true if successful
+// (the whole stream is read into memory, including unreachable subtrees)
+bool ReadTreeStream(std::string filename, TreeStreamContents & contents) {
+    FILE * file = fopen(filename.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    std::string data;
+    char buffer[1 << 16];
+    std::size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.append(buffer, count);
+    }
+    fclose(file);
+    if (data.size() < 8 + sizeof(uint64_t) || memcmp(data.data(), "STSSTRM", 8) != 0) {
+        return false;
+    }
+    uint64_t footer_offset = 0;
+    memcpy(&footer_offset, data.data() + data.size() - sizeof(uint64_t), sizeof(uint64_t));
+    if (footer_offset >= data.size()) {
+        return false;
+    }
+    StreamNameReader names;
+    WireReader footer(data);
+    footer.offset = (std::size_t) footer_offset;
+    if (!names.ReadTables(footer) || !names.ReadPile(footer, contents.deck)) {
+        return false;
+    }
+    const uint64_t top_number = footer.Get<uint64_t>();
+    const uint64_t node_count = footer.Get<uint64_t>();
+    if (!footer.good || top_number >= node_count) {
+        return false;
+    }
+    WireReader in(data);
+    in.offset = 8;
+    if (in.Get<uint32_t>() != solve_cache_version) {
+        return false;
+    }
+    const uint8_t mob_slots = in.Get<uint8_t>();
+    contents.fight_type = in.Get<FightEnum>();
+    if (!in.good || mob_slots > MAX_MOBS_PER_NODE) {
+        return false;
+    }
+    contents.node.clear();
+    for (uint64_t i = 0; i < node_count; ++i) {
+        contents.node.emplace_back();
+        Node & node = contents.node.back();
+        if (!ReadNode(in, node, names)) {
+            return false;
+        }
+        node.objective = in.Get<double>();
+        node.probability = in.Get<double>();
+        node.parent_decision.type = in.Get<DecisionTypeEnum>();
+        node.parent_decision.argument[0] = in.Get<uint16_t>();
+        node.parent_decision.argument[1] = in.Get<uint16_t>();
+        if (node.parent_decision.type == kDecisionPlayCard) {
+            if (node.parent_decision.argument[0] >= names.card_index.size()) {
+                return false;
+            }
+            node.parent_decision.argument[0] =
+                names.card_index[node.parent_decision.argument[0]];
+        }
+        const uint32_t child_count = in.Get<uint32_t>();
+        for (uint32_t c = 0; in.good && c < child_count; ++c) {
+            const uint64_t number = in.Get<uint64_t>();
+            if (number >= i) {
+                return false;
+            }
+            node.child.push_back(&contents.node[number]);
+            contents.node[number].parent = &node;
+        }
+        if (!in.good || in.offset > footer_offset) {
+            return false;
+        }
+    }
+    contents.top_node_ptr = &contents.node[top_number];
+    contents.top_node_ptr->parent = nullptr;
+    return true;
+}
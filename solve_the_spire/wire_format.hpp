@@ -0,0 +1,312 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+#include "defines.h"
+#include "presets.hpp"
+#include "card_collection_map.hpp"
+#include "monster.hpp"
+#include "node.hpp"
+
+// The wire format holds node states outside of the process which solved
+// them.  Card indices are assigned as cards are first used and mob pointers
+// change between runs, so cards and mobs are written through a name writer,
+// which either writes their names inline or indices into tables of names.
+// Other state is written as it is laid out in memory, so it can only be read
+// by the same build.
+
+// values written to a message or file
+struct WireWriter {
+    // data not yet written to the file
+    std::string data;
+    // if not nullptr, data is written to this file as it grows
+    FILE * file = nullptr;
+    // true if writing to the file failed
+    bool failed = false;
+    // number of bytes already written to the file
+    uint64_t written = 0;
+    // append a value
+    template <class T>
+    void Put(const T & value) {
+        data.append((const char *) &value, sizeof(value));
+        if (file != nullptr && data.size() >= (1 << 20)) {
+            Flush();
+        }
+    }
+    // append a string
+    void PutString(const std::string & text) {
+        Put((uint32_t) text.size());
+        data += text;
+    }
+    // return the number of bytes written so far, including unflushed data
+    uint64_t GetPosition() const {
+        return written + data.size();
+    }
+    // write data to the file
+    void Flush() {
+        if (file != nullptr && !data.empty()) {
+            if (fwrite(data.data(), 1, data.size(), file) != data.size()) {
+                failed = true;
+            }
+            written += data.size();
+            data.clear();
+        }
+    }
+};
+
+// values read from a message or file
+struct WireReader {
+    // data
+    const std::string & data;
+    // position of the next value
+    std::size_t offset;
+    // false if we tried to read past the end
+    bool good;
+    // constructor
+    WireReader(const std::string & data_) : data(data_), offset(0), good(true) {
+    }
+    // read a value
+    template <class T>
+    T Get() {
+        T value;
+        memset((void *) &value, 0, sizeof(value));
+        if (offset + sizeof(value) > data.size()) {
+            good = false;
+            return value;
+        }
+        memcpy((void *) &value, data.data() + offset, sizeof(value));
+        offset += sizeof(value);
+        return value;
+    }
+    // read a string
+    std::string GetString() {
+        const uint32_t size = Get<uint32_t>();
+        if (!good || offset + size > data.size()) {
+            good = false;
+            return std::string();
+        }
+        std::string text = data.substr(offset, size);
+        offset += size;
+        return text;
+    }
+};
+
+// return the card with exactly the given name, or nullptr if not found
+const Card * GetCardByName(const std::string & name) {
+    static const std::unordered_map<std::string, const Card *> card_by_name = []() {
+        std::unordered_map<std::string, const Card *> result;
+        for (const Card * card : all_cards) {
+            result[card->name] = card;
+        }
+        return result;
+    }();
+    auto it = card_by_name.find(name);
+    return it == card_by_name.end() ? nullptr : it->second;
+}
+
+// return the mob with exactly the given name, or nullptr if not found
+const BaseMonster * GetBaseMobByName(const std::string & name) {
+    for (const BaseMonster * base_mob : all_base_mobs) {
+        if (base_mob->name == name) {
+            return base_mob;
+        }
+    }
+    return nullptr;
+}
+
+// return true if the first argument of this action type is a card index
+bool IsCardAction(ActionType type) {
+    return type == kActionAddCardToDrawPile ||
+        type == kActionAddCardToDiscardPile ||
+        type == kActionAddCardToHand;
+}
+
+// writes cards, piles and mobs by name wherever they appear
+struct InlineNameWriter {
+    // write a card
+    void WriteCard(WireWriter & out, card_index_t index) {
+        out.PutString(card_map[index]->name);
+    }
+    // write a pile
+    void WritePile(WireWriter & out, const CardCollectionPtr & pile) {
+        uint16_t count = 0;
+        for (const auto & deck_item : pile) {
+            (void) deck_item;
+            ++count;
+        }
+        out.Put(count);
+        for (const auto & deck_item : pile) {
+            WriteCard(out, deck_item.first);
+            out.Put(deck_item.second);
+        }
+    }
+    // write a mob
+    void WriteMob(WireWriter & out, const BaseMonster * base) {
+        out.PutString(base == nullptr ? std::string() : base->name);
+    }
+};
+
+// reads cards, piles and mobs written by InlineNameWriter
+struct InlineNameReader {
+    // read a card, return true if successful
+    bool ReadCard(WireReader & in, card_index_t & index) {
+        const Card * card = GetCardByName(in.GetString());
+        if (!in.good || card == nullptr) {
+            return false;
+        }
+        index = card->GetIndex();
+        return true;
+    }
+    // read a pile, return true if successful
+    bool ReadPile(WireReader & in, CardCollectionPtr & pile) {
+        pile.Clear();
+        const uint16_t count = in.Get<uint16_t>();
+        for (uint16_t i = 0; in.good && i < count; ++i) {
+            card_index_t index = 0;
+            if (!ReadCard(in, index)) {
+                return false;
+            }
+            pile.AddCard(index, in.Get<card_count_t>());
+        }
+        return in.good;
+    }
+    // read a mob, return true if successful
+    bool ReadMob(WireReader & in, const BaseMonster * & base) {
+        const std::string name = in.GetString();
+        base = name.empty() ? nullptr : GetBaseMobByName(name);
+        return in.good && (name.empty() || base != nullptr);
+    }
+};
+
+// write the state of a node
+// (the parent, children, probability, objective and parent decision are not
+// written)
+template <unsigned int mob_slots, class NameWriter>
+void WriteNode(
+        WireWriter & out,
+        const BasicNode<mob_slots> & node,
+        NameWriter & names) {
+    out.Put(node.turn);
+    out.Put(node.energy);
+    out.Put(node.layer);
+    out.Put(node.max_hp);
+    out.Put(node.hp);
+    out.Put(node.block);
+    out.Put(node.stance);
+    out.Put((uint8_t) node.flag.battle_done);
+    out.Put((uint8_t) node.flag.tree_solved);
+    out.Put((uint8_t) node.flag.last_card_attack);
+    out.Put((uint8_t) node.flag.last_card_skill);
+#ifdef USE_ORBS
+    out.Put(node.focus);
+    out.Put(node.orb_slots);
+    out.Put((uint8_t) node.orbs.size());
+    for (const auto & orb : node.orbs) {
+        out.Put(orb);
+    }
+#endif
+    names.WritePile(out, node.hand);
+    names.WritePile(out, node.draw_pile);
+    names.WritePile(out, node.discard_pile);
+    names.WritePile(out, node.exhaust_pile);
+    out.Put((uint8_t) mob_slots);
+    for (const auto & mob : node.monster) {
+        names.WriteMob(out, mob.base);
+        out.Put(mob.buff);
+        out.Put(mob.hp);
+        out.Put(mob.max_hp);
+        out.Put(mob.last_intent);
+        out.Put(mob.block);
+    }
+    for (const auto & action : node.pending_action) {
+        out.Put(action.type);
+        if (IsCardAction(action.type)) {
+            names.WriteCard(out, (card_index_t) action.arg[0]);
+        } else {
+            out.Put(action.arg[0]);
+        }
+        out.Put(action.arg[1]);
+    }
+    out.Put(node.buff);
+    out.Put(node.relics);
+}
+
+// read the state of a node written by WriteNode, return true if successful
+// (the node may have fewer mob slots than the one written as long as the
+// extra slots are empty)
+template <unsigned int mob_slots, class NameReader>
+bool ReadNode(
+        WireReader & in,
+        BasicNode<mob_slots> & node,
+        NameReader & names) {
+    node.turn = in.Get<uint8_t>();
+    node.energy = in.Get<uint8_t>();
+    node.layer = in.Get<uint8_t>();
+    node.max_hp = in.Get<uint8_t>();
+    node.hp = in.Get<uint8_t>();
+    node.block = in.Get<uint8_t>();
+    node.stance = in.Get<StanceEnum>();
+    node.flag.battle_done = in.Get<uint8_t>() != 0;
+    node.flag.tree_solved = in.Get<uint8_t>() != 0;
+    node.flag.last_card_attack = in.Get<uint8_t>() != 0;
+    node.flag.last_card_skill = in.Get<uint8_t>() != 0;
+#ifdef USE_ORBS
+    node.focus = in.Get<uint8_t>();
+    node.orb_slots = in.Get<uint8_t>();
+    node.orbs.resize(in.Get<uint8_t>());
+    for (auto & orb : node.orbs) {
+        orb = in.Get<OrbStruct>();
+    }
+#endif
+    if (!names.ReadPile(in, node.hand) ||
+            !names.ReadPile(in, node.draw_pile) ||
+            !names.ReadPile(in, node.discard_pile) ||
+            !names.ReadPile(in, node.exhaust_pile)) {
+        return false;
+    }
+    const uint8_t mob_count = in.Get<uint8_t>();
+    for (unsigned int i = 0; i < mob_slots; ++i) {
+        node.monster[i] = Monster();
+    }
+    for (unsigned int i = 0; i < mob_count; ++i) {
+        Monster mob;
+        if (!names.ReadMob(in, mob.base)) {
+            return false;
+        }
+        mob.buff = in.Get<BuffState>();
+        mob.hp = in.Get<uint16_t>();
+        mob.max_hp = in.Get<uint16_t>();
+        for (auto & intent : mob.last_intent) {
+            intent = in.Get<uint8_t>();
+        }
+        mob.block = in.Get<uint8_t>();
+        if (i < mob_slots) {
+            node.monster[i] = mob;
+        } else if (mob.Exists()) {
+            return false;
+        }
+    }
+    for (auto & action : node.pending_action) {
+        action.type = in.Get<ActionType>();
+        if (IsCardAction(action.type)) {
+            card_index_t index = 0;
+            if (!names.ReadCard(in, index)) {
+                return false;
+            }
+            action.arg[0] = index;
+        } else {
+            action.arg[0] = in.Get<int16_t>();
+        }
+        action.arg[1] = in.Get<int16_t>();
+    }
+    node.buff = in.Get<BuffState>();
+    node.relics = in.Get<RelicStruct>();
+    node.parent = nullptr;
+    node.probability = 1.0;
+    node.child.clear();
+    return in.good;
+}
@@ -1,7 +1,18 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
 #include "gtest/gtest.h"
 
 #include "node.hpp"
 #include "tree.hpp"
+#include "hp_sweep.hpp"
+#include "tablebase.hpp"
+#include "compare.hpp"
+#include "jobs.hpp"
+#include "distributed.hpp"
+#include "tree_export.hpp"
+#include "server.hpp"
 
 Node GetDefaultAttackNode() {
     Node node;
@@ -68,6 +79,36 @@ TEST(TestDecks, TestUpgrades) {
     ASSERT_TRUE(upgraded_deck.IsWorseOrEqual(upgraded_deck));
 }
 
+// test decks built in several threads at once end up as the same collections
+TEST(TestDecks, TestConcurrentDecks) {
+    const std::vector<const Card *> card = {
+        &card_strike, &card_defend, &card_bash, &card_anger, &card_cleave};
+    auto build = [&](unsigned int seed, CardCollectionPtr & deck) {
+        for (unsigned int i = 0; i < 200; ++i) {
+            const Card & this_card = *card[(seed + i * 7) % card.size()];
+            deck.AddCard(this_card);
+            if (i % 3 == 2) {
+                deck.RemoveCard(this_card);
+            }
+            deck.Select(deck.Count() < 5 ? deck.Count() : 5);
+        }
+    };
+    std::vector<CardCollectionPtr> deck(4);
+    std::vector<std::thread> thread;
+    for (unsigned int i = 0; i < deck.size(); ++i) {
+        thread.push_back(std::thread(build, i, std::ref(deck[i])));
+    }
+    for (auto & this_thread : thread) {
+        this_thread.join();
+    }
+    for (unsigned int i = 0; i < deck.size(); ++i) {
+        CardCollectionPtr this_deck;
+        build(i, this_deck);
+        ASSERT_EQ(this_deck, deck[i]);
+        ASSERT_EQ(this_deck.Select(5), deck[i].Select(5));
+    }
+}
+
 // ensure that the solver selects the path that does the most damage
 // even if death is inevitable
 TEST(TestSolver, TestDoMaxDamageOnDeath) {
@@ -181,3 +222,1372 @@ TEST(TestCards, TestBane) {
     this_node.PlayCard(card_bane.GetIndex());
     ASSERT_EQ(mob.hp, 100 - 7 * 3);
 }
+
+// test Lagavulin sleeps until damaged and wakes up without its armor
+TEST(TestMonsters, TestLagavulinIntents) {
+    Monster mob(base_mob_lagavulin);
+    ASSERT_EQ(mob.GetIntents().size(), 1);
+    ASSERT_EQ(mob.GetIntents()[0].intent, 0);
+    mob.SelectIntent(mob.GetIntents()[0].intent);
+    ASSERT_EQ(mob.block, 8);
+    ASSERT_EQ(mob.buff[kBuffMetallicize], 8);
+    // once damaged, it wakes up and loses its block and metallicize
+    mob.hp -= 1;
+    ASSERT_EQ(mob.GetIntents()[0].intent, 1);
+    mob.SelectIntent(mob.GetIntents()[0].intent);
+    ASSERT_EQ(mob.block, 0);
+    ASSERT_EQ(mob.buff[kBuffMetallicize], 0);
+    // after attacking twice, it siphons
+    mob.SelectIntent(mob.GetIntents()[0].intent);
+    ASSERT_EQ(mob.GetIntents()[0].intent, 2);
+}
+
+// test identical mobs are sorted into a canonical order
+TEST(TestMonsters, TestSortIdenticalMobs) {
+    Node this_node = GetDefaultAttackNode();
+    this_node.monster[0] = base_mob_red_louse;
+    this_node.monster[0].hp = 12;
+    this_node.monster[1] = base_mob_red_louse;
+    this_node.monster[1].hp = 10;
+    AddAndPlayCard(card_strike, this_node, 1);
+    this_node.SortMobs();
+    // the damaged louse moves first, but the target stays the mob played on
+    // in the parent state
+    ASSERT_EQ(this_node.monster[0].hp, 4);
+    ASSERT_EQ(this_node.monster[1].hp, 12);
+    ASSERT_EQ(this_node.parent_decision.argument[1], 1);
+    // swapping the two lice results in the same node
+    Node other_node = this_node;
+    std::swap(other_node.monster[0], other_node.monster[1]);
+    other_node.SortMobs();
+    ASSERT_TRUE(std::equal(
+        this_node.monster,
+        this_node.monster + MAX_MOBS_PER_NODE,
+        other_node.monster));
+}
+
+// test an ending where a mob was killed dominates one where it's alive
+TEST(TestMonsters, TestDominanceAcrossKills) {
+    Node alive_node = GetDefaultAttackNode();
+    alive_node.monster[0] = base_mob_red_louse;
+    alive_node.monster[0].hp = 10;
+    alive_node.monster[1] = base_mob_red_louse;
+    alive_node.monster[1].hp = 10;
+    alive_node.SortMobs();
+    Node killed_node = alive_node;
+    killed_node.monster[0].hp = 0;
+    killed_node.SortMobs();
+    ASSERT_FALSE(killed_node.monster[1].Exists());
+    ASSERT_TRUE(alive_node.IsWorseOrEqual(killed_node));
+    ASSERT_FALSE(killed_node.IsWorseOrEqual(alive_node));
+}
+
+// test fights are solved with nodes sized to their mobs
+TEST(TestSolver, TestMobSlots) {
+    ASSERT_EQ(GetFightMobCount(kFightAct1EasyCultist), 1);
+    ASSERT_EQ(GetFightMobCount(kFightAct1EasyLouses), 2);
+    ASSERT_LT(sizeof(BasicNode<1>), sizeof(Node));
+    // copying to a smaller node keeps the mobs which fit
+    Node this_node = GetDefaultAttackNode();
+    BasicNode<1> small_node;
+    small_node.CopyStateFrom(this_node);
+    ASSERT_EQ(small_node.hp, this_node.hp);
+    ASSERT_EQ(small_node.monster[0], this_node.monster[0]);
+    ASSERT_EQ(small_node.hand, this_node.hand);
+}
+
+// test the tree a fight was solved in with fewer mob slots is kept
+TEST(TestSolver, TestSizedTreeKept) {
+    Node this_node;
+    this_node.hp = 20;
+    this_node.max_hp = 20;
+    this_node.relics = {0};
+    this_node.deck.Clear();
+    this_node.deck.AddCard(card_strike, 3);
+    this_node.deck.AddCard(card_defend, 2);
+    this_node.InitializeStartingNode();
+    TreeStruct tree(this_node);
+    tree.fight_type = kFightTestOneLouse;
+    tree.ExpandFight();
+    ASSERT_EQ(tree.sized_tree.index(), 1);
+    ASSERT_GT(this_node.objective, 0);
+    std::size_t node_count = 0;
+    tree.ForSolvedTree([&](auto & solved_tree) {
+        node_count = solved_tree.top_node_ptr->CountNodes();
+    });
+    ASSERT_GT(node_count, 1);
+    // expanding again goes to the solved tree, which has nothing left to do
+    const double objective = this_node.objective;
+    tree.Expand();
+    ASSERT_EQ(this_node.objective, objective);
+    this_node.deck.Clear();
+}
+
+// test solving all mob HP variations as lanes matches solving each one
+TEST(TestSolver, TestMobHPLanes) {
+    Node this_node;
+    this_node.hp = 60;
+    this_node.max_hp = 80;
+    this_node.relics = {0};
+    this_node.deck.AddCard(card_strike, 5);
+    this_node.deck.AddCard(card_defend, 4);
+    this_node.deck.AddCard(card_bash);
+    this_node.InitializeStartingNode();
+    Node lane_node = this_node;
+    TreeStruct tree(this_node);
+    tree.fight_type = kFightTestOneLouse;
+    tree.generate_all_mob_hp = true;
+    tree.ExpandFight();
+    TreeStruct lane_tree(lane_node);
+    lane_tree.fight_type = kFightTestOneLouse;
+    lane_tree.generate_all_mob_hp = true;
+    lane_tree.use_mob_hp_lanes = true;
+    lane_tree.ExpandFight();
+    this_node.deck.Clear();
+    ASSERT_NEAR(lane_node.objective, this_node.objective, 1e-9);
+    ASSERT_NEAR(lane_tree.final_hp, tree.final_hp, 1e-9);
+    // the lanes fill in the distributions
+    double total = 0.0;
+    double hp_total = 0.0;
+    for (const auto & item : lane_tree.final_hp_distribution) {
+        total += item.second;
+        hp_total += item.first * item.second;
+    }
+    ASSERT_NEAR(total, 1.0, 1e-9);
+    ASSERT_NEAR(hp_total, lane_tree.final_hp, 1e-9);
+    total = 0.0;
+    for (const auto & item : lane_tree.turn_distribution) {
+        total += item.second;
+    }
+    ASSERT_NEAR(total, 1.0, 1e-9);
+}
+
+// test sweeping starting HP in several threads matches solving one at a time
+TEST(TestSolver, TestHPSweep) {
+    Node this_node;
+    this_node.hp = 20;
+    this_node.max_hp = 20;
+    this_node.relics = {0};
+    this_node.deck.AddCard(card_strike, 5);
+    this_node.deck.AddCard(card_defend, 4);
+    this_node.deck.AddCard(card_bash);
+    this_node.InitializeStartingNode();
+    auto result = SweepStartingHP(this_node, kFightTestOneLouse, 4);
+    TreeStruct tree(this_node);
+    tree.fight_type = kFightTestOneLouse;
+    tree.ExpandFight();
+    this_node.deck.Clear();
+    ASSERT_EQ(result.size(), 20);
+    for (unsigned int i = 0; i < result.size(); ++i) {
+        ASSERT_EQ(result[i].hp, i + 1);
+        double total = 0.0;
+        for (auto & item : result[i].final_hp_distribution) {
+            total += item.second;
+        }
+        ASSERT_NEAR(total, 1.0, 1e-9);
+    }
+    ASSERT_NEAR(result[19].final_hp, tree.final_hp, 1e-9);
+    ASSERT_EQ(result[19].final_hp_distribution.size(),
+        tree.final_hp_distribution.size());
+    for (auto & item : tree.final_hp_distribution) {
+        ASSERT_NEAR(result[19].final_hp_distribution[item.first], item.second, 1e-9);
+    }
+}
+
+// test solving comparison variants in several threads matches solving each
+// one at a time
+TEST(TestSolver, TestComparison) {
+    Node this_node;
+    this_node.hp = 20;
+    this_node.max_hp = 20;
+    this_node.relics = {0};
+    this_node.deck.AddCard(card_strike, 5);
+    this_node.deck.AddCard(card_defend, 4);
+    std::vector<CompareVariant> variant;
+    variant.push_back({"base", GetVariantStartingNode(this_node, this_node.deck)});
+    for (const Card * card : {&card_bash, &card_anger, &card_strike_plus}) {
+        CardCollectionPtr deck = this_node.deck;
+        deck.AddCard(*card);
+        variant.push_back({card->name, GetVariantStartingNode(this_node, deck)});
+    }
+    auto objective = RunComparison(
+        variant, kFightTestOneLouse, "test_comparison.txt", 4);
+    std::remove("test_comparison.txt");
+    ASSERT_EQ(objective.size(), variant.size());
+    for (std::size_t i = 0; i < variant.size(); ++i) {
+        Node top_node = variant[i].top_node;
+        TreeStruct tree(top_node);
+        tree.fight_type = kFightTestOneLouse;
+        tree.quiet = true;
+        tree.ExpandFight();
+        ASSERT_EQ(objective[i], top_node.objective);
+    }
+    this_node.deck.Clear();
+}
+
+// test a deck from the default context can be solved in a new context more
+// than once
+TEST(TestSolver, TestSolverContextReuseDeck) {
+    CardCollectionPtr deck;
+    deck.AddCard(card_strike, 5);
+    deck.AddCard(card_defend, 4);
+    deck.AddCard(card_bash);
+    double objective[2] = {0.0, 0.0};
+    for (unsigned int i = 0; i < 2; ++i) {
+        {
+            SolverContext context;
+            SolverContextScope scope(context);
+            NodeShared::deck.Clear();
+            NodeShared::deck.AddDeck(deck);
+            Node this_node;
+            this_node.hp = 20;
+            this_node.max_hp = 20;
+            this_node.relics = {0};
+            this_node.InitializeStartingNode();
+            TreeStruct tree(this_node);
+            tree.fight_type = kFightTestOneLouse;
+            tree.quiet = true;
+            tree.ExpandFight();
+            objective[i] = this_node.objective;
+        }
+        NodeShared::deck.Clear();
+    }
+    ASSERT_GT(objective[0], 0.0);
+    ASSERT_EQ(objective[0], objective[1]);
+}
+
+// test solves in their own contexts match and leave the default context alone
+TEST(TestSolver, TestSolverContext) {
+    const std::size_t default_count = default_solver_context.CountCollections();
+    double objective[2] = {0.0, 0.0};
+    auto solve = [&](unsigned int i) {
+        {
+            SolverContext context;
+            SolverContextScope scope(context);
+            Node this_node;
+            this_node.hp = 20;
+            this_node.max_hp = 20;
+            this_node.relics = {0};
+            this_node.deck.Clear();
+            this_node.deck.AddCard(card_strike, 5);
+            this_node.deck.AddCard(card_defend, 4);
+            this_node.deck.AddCard(card_bash);
+            this_node.InitializeStartingNode();
+            TreeStruct tree(this_node);
+            tree.fight_type = kFightTestOneLouse;
+            tree.quiet = true;
+            tree.ExpandFight();
+            objective[i] = this_node.objective;
+            EXPECT_GT(context.CountCollections(), 10);
+        }
+        NodeShared::deck.Clear();
+    };
+    std::thread thread(solve, 0);
+    solve(1);
+    thread.join();
+    ASSERT_GT(objective[0], 0.0);
+    ASSERT_EQ(objective[0], objective[1]);
+    ASSERT_EQ(default_solver_context.CountCollections(), default_count);
+}
+
+// test parsing job lines
+TEST(TestSolver, TestParseJsonObject) {
+    JsonObject object;
+    ASSERT_TRUE(ParseJsonObject(
+        "{\"id\": \"a\\\"b\", \"hp\": 72, \"turns\": {\"3\": 0.5}}", object));
+    ASSERT_EQ(object.size(), 3);
+    ASSERT_EQ(object["id"], "a\"b");
+    ASSERT_EQ(object["hp"], "72");
+    ASSERT_EQ(object["turns"], "{\"3\": 0.5}");
+    ASSERT_TRUE(ParseJsonObject("{}", object));
+    ASSERT_TRUE(object.empty());
+    ASSERT_FALSE(ParseJsonObject("{\"id\": \"a\"", object));
+    ASSERT_FALSE(ParseJsonObject("[1, 2]", object));
+    ASSERT_EQ(ToJsonString("a\"b"), "\"a\\\"b\"");
+}
+
+// test batch jobs match direct solves and finished jobs are skipped
+TEST(TestSolver, TestJobs) {
+    const std::string filename = "test_job_results.jsonl";
+    std::remove(filename.c_str());
+    std::vector<Job> job(2);
+    for (std::size_t i = 0; i < job.size(); ++i) {
+        job[i].id = "job" + std::to_string(i);
+        job[i].deck.Clear();
+        job[i].deck.AddCard(card_strike.GetIndex(), 5);
+        job[i].deck.AddCard(card_defend.GetIndex(), 4);
+        job[i].relics = {0};
+        job[i].hp = (uint8_t) (15 + i * 5);
+        job[i].max_hp = 20;
+        job[i].fight_type = kFightTestOneLouse;
+    }
+    RunJobs(job, filename, 2);
+    RunJobs(job, filename, 2);
+    std::ifstream file(filename);
+    std::string line;
+    std::vector<JsonObject> result;
+    while (std::getline(file, line)) {
+        JsonObject object;
+        ASSERT_TRUE(ParseJsonObject(line, object));
+        result.push_back(object);
+    }
+    file.close();
+    std::remove(filename.c_str());
+    ASSERT_EQ(result.size(), job.size());
+    for (const auto & object : result) {
+        const std::size_t i = object.at("id") == "job0" ? 0 : 1;
+        Node this_node;
+        this_node.hp = job[i].hp;
+        this_node.max_hp = job[i].max_hp;
+        this_node.relics = {0};
+        this_node.deck.Clear();
+        this_node.deck.AddDeck(job[i].deck);
+        this_node.InitializeStartingNode();
+        TreeStruct tree(this_node);
+        tree.fight_type = kFightTestOneLouse;
+        tree.quiet = true;
+        tree.ExpandFight();
+        this_node.deck.Clear();
+        ASSERT_NEAR(atof(object.at("objective").c_str()), this_node.objective, 1e-6);
+        ASSERT_NE(object.at("turns"), "{}");
+    }
+}
+
+// test cutting the tree after the first turn and solving the cut off states
+// separately, as a distributed solve does, matches a normal solve
+TEST(TestSolver, TestDistributedRounds) {
+    Node this_node;
+    this_node.hp = 20;
+    this_node.max_hp = 20;
+    this_node.relics = {0};
+    this_node.deck.Clear();
+    this_node.deck.AddCard(card_strike, 5);
+    this_node.deck.AddCard(card_defend, 4);
+    this_node.deck.AddCard(card_bash);
+    this_node.InitializeStartingNode();
+    Node top_node = this_node;
+    TreeStruct tree(this_node);
+    tree.fight_type = kFightTestOneLouse;
+    tree.quiet = true;
+    tree.ExpandFight();
+    std::unordered_map<uint64_t, SubgameMemo::Slot> cut_values;
+    unsigned int round_count = 0;
+    while (true) {
+        Node round_node = top_node;
+        TreeStruct round_tree(round_node);
+        round_tree.fight_type = kFightTestOneLouse;
+        round_tree.quiet = true;
+        round_tree.cut_values = &cut_values;
+        round_tree.ExpandFight();
+        if (round_tree.cut_nodes.empty()) {
+            ASSERT_NEAR(round_node.objective, this_node.objective, 1e-9);
+            ASSERT_NEAR(round_tree.final_hp, tree.final_hp, 1e-9);
+            break;
+        }
+        ++round_count;
+        for (const auto & item : round_tree.cut_nodes) {
+            // states must come through the wire format unchanged
+            WireWriter out;
+            InlineNameWriter name_writer;
+            WriteNode(out, item.second, name_writer);
+            WireReader in(out.data);
+            Node read_node;
+            InlineNameReader name_reader;
+            ASSERT_TRUE(ReadNode(in, read_node, name_reader));
+            ASSERT_EQ(
+                read_node.GetCanonicalStateHash(),
+                item.second.GetCanonicalStateHash());
+            std::string reply = SolveWorkerRequest(GetWorkerRequest<1>(item.second));
+            ASSERT_EQ(reply.size(), sizeof(WorkerResult));
+            WorkerResult result;
+            memcpy(&result, reply.data(), sizeof(result));
+            ASSERT_EQ(result.check, item.second.GetCanonicalStateCheckHash());
+            cut_values[item.first] = {item.first, result.check, result.value};
+        }
+    }
+    ASSERT_GT(round_count, 0);
+    // values of states with another check hash must not be recalled
+    for (auto & item : cut_values) {
+        item.second.check ^= 1;
+        item.second.value = {-1.0, 0.0, 1.0};
+    }
+    Node round_node = top_node;
+    TreeStruct round_tree(round_node);
+    round_tree.fight_type = kFightTestOneLouse;
+    round_tree.quiet = true;
+    round_tree.cut_values = &cut_values;
+    round_tree.ExpandFight();
+    ASSERT_NEAR(round_node.objective, this_node.objective, 1e-9);
+    this_node.deck.Clear();
+}
+
+// test a solve resumed from a checkpoint finishes with the same result
+TEST(TestSolver, TestCheckpoint) {
+    const std::string filename = "test_checkpoint.bin";
+    std::remove(filename.c_str());
+    Node this_node;
+    this_node.hp = 40;
+    this_node.max_hp = 40;
+    this_node.relics = {0};
+    this_node.deck.Clear();
+    this_node.deck.AddCard(card_strike, 5);
+    this_node.deck.AddCard(card_defend, 4);
+    this_node.deck.AddCard(card_bash);
+    this_node.InitializeStartingNode();
+    TreeStruct tree(this_node);
+    tree.fight_type = kFightAct1EasyCultist;
+    tree.quiet = true;
+    // (write a checkpoint as often as possible)
+    tree.checkpoint_filename = filename;
+    tree.checkpoint_interval_s = 0.0;
+    tree.ExpandFight();
+    ASSERT_GT(tree.expanded_node_count, 1024);
+    Node resumed_node;
+    TreeStruct resumed_tree(resumed_node);
+    resumed_tree.quiet = true;
+    resumed_tree.checkpoint_filename = "test_checkpoint_2.bin";
+    // (settings not in the checkpoint should reach the one mob slot tree)
+    resumed_tree.policy_filename = "test_checkpoint_policy.bin";
+    resumed_tree.ResumeFromCheckpoint(filename);
+    ASSERT_EQ(resumed_tree.fight_type, kFightAct1EasyCultist);
+    ASSERT_EQ(resumed_node.objective, this_node.objective);
+    ASSERT_NEAR(resumed_tree.final_hp, tree.final_hp, 1e-9);
+    ASSERT_EQ(resumed_tree.expanded_node_count, tree.expanded_node_count);
+    PolicyTable table;
+    ASSERT_TRUE(table.Open("test_checkpoint_policy.bin"));
+    ASSERT_GT(table.GetStateCount(), 0);
+    this_node.deck.Clear();
+    std::remove(filename.c_str());
+    std::remove("test_checkpoint_2.bin");
+    std::remove("test_checkpoint_policy.bin");
+}
+
+// test writing a solved tree to a tree file and querying it
+TEST(TestSolver, TestTreeFile) {
+    const std::string filename = "test_tree.bin";
+    Node this_node = GetDefaultAttackNode();
+    this_node.hp = 10;
+    TreeStruct tree(this_node);
+    tree.quiet = true;
+    tree.Expand();
+    ASSERT_GT(this_node.child.size(), 0);
+    ASSERT_TRUE(WriteTreeFile(this_node, tree.fight_type, 1.5, filename));
+    TreeFile tree_file;
+    ASSERT_TRUE(tree_file.Open(filename));
+    ASSERT_EQ(tree_file.GetNodeCount(), this_node.CountNodes());
+    ASSERT_EQ(tree_file.GetHeader().solve_duration_s, 1.5);
+    // nodes should be in depth first order and read back the same
+    std::vector<const Node *> stack(1, &this_node);
+    uint64_t index = 0;
+    while (!stack.empty()) {
+        const Node * node_ptr = stack.back();
+        stack.pop_back();
+        ASSERT_EQ(tree_file.NodeToString(index), node_ptr->ToString());
+        ASSERT_EQ(tree_file.GetNode(index).child_count, node_ptr->child.size());
+        for (auto it = node_ptr->child.rbegin(); it != node_ptr->child.rend(); ++it) {
+            stack.push_back(*it);
+        }
+        ++index;
+    }
+    ASSERT_EQ(tree_file.GetNode(0).subtree_size, index);
+    // the path to the last node should have a line for each ancestor
+    const uint64_t last_index = index - 1;
+    std::ostringstream path_stream;
+    tree_file.PrintPath(path_stream, last_index);
+    const std::string path = path_stream.str();
+    std::size_t path_length = 0;
+    for (uint64_t i = last_index; i != no_tree_file_parent;
+            i = tree_file.GetNode(i).parent) {
+        ++path_length;
+    }
+    ASSERT_EQ(std::count(path.begin(), path.end(), '\n'), path_length);
+    ASSERT_EQ(path.find("#0 " + this_node.ToString() + "\n"), 0);
+    ASSERT_NE(path.find("#" + std::to_string(last_index) + " " +
+        tree_file.NodeToString(last_index)), std::string::npos);
+    // a subtree to depth 1 has the top node and a line for each child
+    std::ostringstream subtree_stream;
+    tree_file.PrintSubtree(subtree_stream, 0, 1, 1000);
+    const std::string subtree = subtree_stream.str();
+    ASSERT_EQ(subtree.find("#0 " + this_node.ToString() + "\n"), 0);
+    ASSERT_GE(std::count(subtree.begin(), subtree.end(), '\n'),
+        1 + this_node.child.size());
+    tree_file.Close();
+    std::remove(filename.c_str());
+}
+
+// test streaming solved subtrees to a file as they're pruned
+TEST(TestSolver, TestTreeStream) {
+    const std::string filename = "test_tree.stream";
+    Node this_node;
+    this_node.hp = 40;
+    this_node.max_hp = 40;
+    this_node.relics = {0};
+    this_node.deck.Clear();
+    this_node.deck.AddCard(card_strike, 5);
+    this_node.deck.AddCard(card_defend, 4);
+    this_node.deck.AddCard(card_bash);
+    this_node.InitializeStartingNode();
+    TreeStruct tree(this_node);
+    tree.fight_type = kFightAct1EasyCultist;
+    tree.quiet = true;
+    // (prune from the start)
+    tree.keep_all_nodes = false;
+    tree.tree_stream_filename = filename;
+    tree.ExpandFight();
+    TreeStreamContents contents;
+    ASSERT_TRUE(ReadTreeStream(filename, contents));
+    ASSERT_EQ(contents.fight_type, kFightAct1EasyCultist);
+    ASSERT_EQ(contents.top_node_ptr->objective, this_node.objective);
+    // the streamed tree should be whole: each solved choice has one child,
+    // and the chances of its outcomes add up to the expected final hp
+    double total_probability = 0.0;
+    double total_hp = 0.0;
+    std::size_t node_count = 0;
+    std::vector<const Node *> stack(1, contents.top_node_ptr);
+    while (!stack.empty()) {
+        const Node & node = *stack.back();
+        stack.pop_back();
+        ++node_count;
+        ASSERT_TRUE(node.flag.tree_solved);
+        if (node.child.empty()) {
+            ASSERT_TRUE(node.IsBattleDone());
+            total_probability += node.probability;
+            total_hp += node.probability * node.hp;
+            continue;
+        }
+        if (!node.HasPendingActions() && !node.IsBattleDone()) {
+            ASSERT_EQ(node.child.size(), 1);
+        }
+        for (const Node * child_ptr : node.child) {
+            ASSERT_EQ(child_ptr->parent, &node);
+            stack.push_back(child_ptr);
+        }
+    }
+    ASSERT_GT(node_count, 1000);
+    ASSERT_NEAR(total_probability, 1.0, 1e-9);
+    // (the pruned tree can't give its expected final hp, so solve it again)
+    Node kept_node = this_node;
+    TreeStruct kept_tree(kept_node);
+    kept_tree.fight_type = kFightAct1EasyCultist;
+    kept_tree.quiet = true;
+    kept_tree.ExpandFight();
+    ASSERT_EQ(kept_node.objective, this_node.objective);
+    ASSERT_NEAR(total_hp, kept_tree.final_hp, 1e-9);
+    this_node.deck.Clear();
+    std::remove(filename.c_str());
+}
+
+// return the tree as printed by Node::PrintTree
+std::string GetPrintedTree(const Node & node, bool collapse) {
+    std::ostringstream printed;
+    std::streambuf * old_buffer = std::cout.rdbuf(printed.rdbuf());
+    node.PrintTree(collapse);
+    std::cout.rdbuf(old_buffer);
+    return printed.str();
+}
+
+// test exporting trees as text, DOT and JSON
+TEST(TestSolver, TestTreeExport) {
+    const std::string filename = "test_export_tree.bin";
+    Node this_node = GetDefaultAttackNode();
+    this_node.hp = 30;
+    this_node.monster[0].hp = 60;
+    this_node.hand.AddCard(card_defend);
+    this_node.draw_pile.AddCard(card_strike, 2);
+    this_node.draw_pile.AddCard(card_defend, 2);
+    TreeStruct tree(this_node);
+    tree.quiet = true;
+    tree.Expand();
+    ASSERT_GT(this_node.CountNodes(), 1000);
+    // text should match PrintTree, with or without collapsing
+    MemoryTreeView<MAX_MOBS_PER_NODE> memory_view(this_node);
+    TreeExportSettings settings;
+    ExportBuffer text;
+    ASSERT_EQ(ExportTree(memory_view, settings, text), this_node.CountNodes());
+    ASSERT_EQ(text.data, GetPrintedTree(this_node, false));
+    settings.collapse = true;
+    ExportBuffer collapsed_text;
+    ExportTree(memory_view, settings, collapsed_text);
+    ASSERT_EQ(collapsed_text.data, GetPrintedTree(this_node, true));
+    // a tree file should export the same way
+    ASSERT_TRUE(WriteTreeFile(this_node, tree.fight_type, 0.0, filename));
+    TreeFile tree_file;
+    ASSERT_TRUE(tree_file.Open(filename));
+    FileTreeView file_view(tree_file);
+    settings.collapse = false;
+    ExportBuffer file_text;
+    ExportTree(file_view, settings, file_text);
+    ASSERT_EQ(file_text.data, text.data);
+    // filters leave out deep and unlikely nodes
+    settings.max_depth = 1;
+    ExportBuffer shallow_text;
+    ASSERT_EQ(ExportTree(file_view, settings, shallow_text), 1 + this_node.child.size());
+    settings.max_depth = 0xFFFFFFFF;
+    settings.min_probability = 2.0;
+    ExportBuffer no_text;
+    ASSERT_EQ(ExportTree(file_view, settings, no_text), 0);
+    // DOT has an edge for each node but the top one
+    settings.min_probability = 0.0;
+    settings.format = kTreeExportDot;
+    ExportBuffer dot;
+    ExportTree(file_view, settings, dot);
+    std::size_t edge_count = 0;
+    for (std::size_t i = dot.data.find(" -> "); i != std::string::npos;
+            i = dot.data.find(" -> ", i + 1)) {
+        ++edge_count;
+    }
+    ASSERT_EQ(edge_count, this_node.CountNodes() - 1);
+    // JSON has an object for each node and balanced brackets
+    settings.format = kTreeExportJson;
+    ExportBuffer json;
+    ExportTree(file_view, settings, json);
+    std::size_t object_count = 0;
+    for (std::size_t i = json.data.find("{\"objective\""); i != std::string::npos;
+            i = json.data.find("{\"objective\"", i + 1)) {
+        ++object_count;
+    }
+    ASSERT_EQ(object_count, this_node.CountNodes());
+    ASSERT_EQ(std::count(json.data.begin(), json.data.end(), '{'),
+        std::count(json.data.begin(), json.data.end(), '}'));
+    ASSERT_EQ(std::count(json.data.begin(), json.data.end(), '['),
+        std::count(json.data.begin(), json.data.end(), ']'));
+    tree_file.Close();
+    std::remove(filename.c_str());
+}
+
+// test writing a policy table and looking up the decision of each state
+TEST(TestSolver, TestPolicyTable) {
+    const std::string filename = "test_policy.bin";
+    Node this_node = GetDefaultAttackNode();
+    this_node.hp = 30;
+    this_node.monster[0].hp = 60;
+    this_node.hand.AddCard(card_defend);
+    this_node.draw_pile.AddCard(card_strike, 2);
+    this_node.draw_pile.AddCard(card_defend, 2);
+    TreeStruct tree(this_node);
+    tree.quiet = true;
+    tree.policy_filename = filename;
+    tree.Expand();
+    PolicyTable table;
+    ASSERT_TRUE(table.Open(filename));
+    ASSERT_GT(table.GetStateCount(), 10);
+    // each solved decision state should give the decision made there
+    std::vector<const Node *> stack(1, &this_node);
+    std::size_t decision_count = 0;
+    while (!stack.empty()) {
+        const Node & node = *stack.back();
+        stack.pop_back();
+        if (!node.HasPendingActions() && !node.IsBattleDone() &&
+                node.child.size() == 1) {
+            Decision decision;
+            ASSERT_TRUE(table.LookupNode(node, decision));
+            const Decision & expected = node.child[0]->parent_decision;
+            ASSERT_EQ(decision.type, expected.type);
+            if (expected.type == kDecisionPlayCard) {
+                ASSERT_EQ(decision.argument[0], expected.argument[0]);
+                ASSERT_EQ(decision.argument[1], expected.argument[1]);
+            }
+            ++decision_count;
+        }
+        for (const auto & child_ptr : node.child) {
+            stack.push_back(child_ptr);
+        }
+    }
+    ASSERT_GE(decision_count, table.GetStateCount());
+    // each slot holds a different state
+    std::set<uint64_t> keys;
+    for (uint64_t i = 0; i < table.GetStateCount(); ++i) {
+        keys.insert(table.GetSlot(i).key);
+    }
+    ASSERT_EQ(keys.size(), table.GetStateCount());
+    // a state which was never reached isn't found
+    Node other_node = GetDefaultAttackNode();
+    other_node.hp = 1;
+    other_node.monster[0].hp = 1;
+    Decision decision;
+    ASSERT_FALSE(table.LookupNode(other_node, decision));
+    // nor is a state with the same hash but another check hash
+    const PolicyTableSlot & slot = table.GetSlot(0);
+    ASSERT_TRUE(table.Lookup(slot.key, slot.check, decision));
+    ASSERT_FALSE(table.Lookup(slot.key, slot.check + 1, decision));
+    table.Close();
+    std::remove(filename.c_str());
+}
+
+// test a policy table gives targets in the order of the mobs looked up
+TEST(TestSolver, TestPolicyTableMobOrder) {
+    const std::string filename = "test_policy_order.bin";
+    Node this_node = GetDefaultAttackNode();
+    this_node.hp = 30;
+    this_node.energy = 1;
+    this_node.monster[0] = Monster(base_mob_red_louse);
+    this_node.monster[0].hp = 12;
+    this_node.monster[0].last_intent[0] = 0;
+    this_node.monster[1] = Monster(base_mob_red_louse);
+    this_node.monster[1].hp = 3;
+    this_node.monster[1].last_intent[0] = 0;
+    this_node.draw_pile.AddCard(card_defend, 5);
+    Node state = this_node;
+    TreeStruct tree(this_node);
+    tree.quiet = true;
+    tree.policy_filename = filename;
+    tree.Expand();
+    PolicyTable table;
+    ASSERT_TRUE(table.Open(filename));
+    // the weaker louse is struck in either order
+    for (int i = 0; i < 2; ++i) {
+        Decision decision;
+        ASSERT_TRUE(table.LookupNode(state, decision));
+        ASSERT_EQ(decision.type, kDecisionPlayCard);
+        ASSERT_EQ(state.monster[decision.argument[1]].hp, 3);
+        std::swap(state.monster[0], state.monster[1]);
+    }
+    table.Close();
+    std::remove(filename.c_str());
+}
+
+// test re-rooting a solved tree at a later state gives the same result as
+// solving that state from scratch
+TEST(TestSolver, TestReroot) {
+    auto get_node = []() {
+        Node node = GetDefaultAttackNode();
+        node.hp = 30;
+        node.monster[0].hp = 60;
+        node.hand.AddCard(card_defend);
+        node.draw_pile.AddCard(card_strike, 2);
+        node.draw_pile.AddCard(card_defend, 2);
+        return node;
+    };
+    Node this_node = get_node();
+    TreeStruct tree(this_node);
+    tree.quiet = true;
+    tree.Expand();
+    // find a decision after a draw, and the decisions on the way there
+    std::deque<Node *> queue(1, &this_node);
+    Node state;
+    std::vector<Node> path;
+    while (!queue.empty()) {
+        const Node & node = *queue.front();
+        queue.pop_front();
+        if (node.probability < 1.0 && !node.HasPendingActions() &&
+                !node.IsBattleDone()) {
+            state.CopyStateFrom(node);
+            for (const Node * node_ptr = node.parent; node_ptr != &this_node;
+                    node_ptr = node_ptr->parent) {
+                if (!node_ptr->HasPendingActions()) {
+                    path.insert(path.begin(), Node());
+                    path.front().CopyStateFrom(*node_ptr);
+                }
+            }
+            break;
+        }
+        queue.insert(queue.end(), node.child.begin(), node.child.end());
+    }
+    ASSERT_FALSE(queue.empty());
+    Node fresh_node;
+    fresh_node.CopyStateFrom(state);
+    fresh_node.objective = fresh_node.GetMaxFinalObjective();
+    fresh_node.flag.tree_solved = false;
+    fresh_node.probability = 1.0;
+    TreeStruct fresh_tree(fresh_node);
+    fresh_tree.quiet = true;
+    fresh_tree.Expand();
+    // a state more than one decision later isn't searched for
+    ASSERT_FALSE(path.empty());
+    ASSERT_FALSE(tree.Reroot(state));
+    // (each decision is played in turn)
+    for (const Node & decision_state : path) {
+        ASSERT_TRUE(tree.Reroot(decision_state));
+    }
+    // the whole subtree was kept, so nothing is left to expand
+    ASSERT_TRUE(tree.Reroot(state));
+    ASSERT_DOUBLE_EQ(this_node.probability, 1.0);
+    tree.Expand();
+    ASSERT_EQ(tree.expanded_node_count, 0);
+    ASSERT_NEAR(this_node.objective, fresh_node.objective, 1e-9);
+    ASSERT_NEAR(tree.final_hp, fresh_tree.final_hp, 1e-9);
+    ASSERT_NEAR(tree.death_chance, fresh_tree.death_chance, 1e-9);
+    ASSERT_EQ(tree.created_node_count + 1, this_node.CountNodes());
+    ASSERT_FALSE(tree.Reroot(get_node()));
+    // in a pruned tree, the pruned subtrees are solved again
+    Node pruned_node = get_node();
+    TreeStruct pruned_tree(pruned_node);
+    pruned_tree.quiet = true;
+    pruned_tree.keep_all_nodes = false;
+    pruned_tree.Expand();
+    ASSERT_EQ(pruned_node.child.size(), 1);
+    Node next_state;
+    next_state.CopyStateFrom(*pruned_node.child[0]);
+    ASSERT_TRUE(pruned_tree.Reroot(next_state));
+    pruned_tree.Expand();
+    ASSERT_GT(pruned_tree.expanded_node_count, 0);
+    ASSERT_GT(pruned_node.CountNodes(), 1);
+    Node next_node;
+    next_node.CopyStateFrom(next_state);
+    next_node.objective = next_node.GetMaxFinalObjective();
+    next_node.flag.tree_solved = false;
+    next_node.probability = 1.0;
+    TreeStruct next_tree(next_node);
+    next_tree.quiet = true;
+    next_tree.Expand();
+    ASSERT_NEAR(pruned_node.objective, next_node.objective, 1e-9);
+    ASSERT_NEAR(pruned_tree.final_hp, next_tree.final_hp, 1e-9);
+}
+
+// test re-rooting a fight solved in a tree with fewer mob slots
+TEST(TestSolver, TestRerootSizedTree) {
+    Node this_node;
+    this_node.hp = 20;
+    this_node.max_hp = 20;
+    this_node.relics = {0};
+    this_node.deck.Clear();
+    this_node.deck.AddCard(card_strike, 3);
+    this_node.deck.AddCard(card_defend, 2);
+    this_node.InitializeStartingNode();
+    TreeStruct tree(this_node);
+    tree.fight_type = kFightTestOneLouse;
+    tree.quiet = true;
+    tree.ExpandFight();
+    Node state;
+    tree.ForSolvedTree([&](auto & solved_tree) {
+        // find a decision after the first draw
+        std::deque<const typename std::remove_reference_t<decltype(solved_tree)>::Node *>
+            queue(1, solved_tree.top_node_ptr);
+        while (!queue.empty()) {
+            const auto & node = *queue.front();
+            queue.pop_front();
+            if (node.turn == 1 && !node.HasPendingActions() && !node.IsBattleDone()) {
+                state.CopyStateFrom(node);
+                break;
+            }
+            queue.insert(queue.end(), node.child.begin(), node.child.end());
+        }
+    });
+    ASSERT_EQ(state.turn, 1);
+    // re-rooting goes to the solved tree, which has nothing left to expand
+    ASSERT_TRUE(tree.Reroot(state));
+    tree.Expand();
+    ASSERT_EQ(tree.expanded_node_count, 0);
+    ASSERT_TRUE(this_node.flag.tree_solved);
+    ASSERT_EQ(this_node.turn, 1);
+    this_node.deck.Clear();
+}
+
+// fill in a solve server request for a default attack node with the given
+// "mob_hp"
+bool ParseTestServerRequest(
+        const JsonObject & object,
+        ServerRequest & request,
+        std::string & error) {
+    if (!object.count("mob_hp")) {
+        error = "missing mob_hp";
+        return false;
+    }
+    request.node = GetDefaultAttackNode();
+    request.node.hp = 30;
+    request.node.monster[0].hp = (uint16_t) atoi(object.at("mob_hp").c_str());
+    request.node.hand.AddCard(card_defend);
+    request.node.draw_pile.AddCard(card_strike, 2);
+    request.node.draw_pile.AddCard(card_defend, 2);
+    return true;
+}
+
+// test the solve server answers requests and recalls solved states
+TEST(TestSolver, TestSolveServer) {
+    SolveServer server(ParseTestServerRequest);
+    JsonObject first;
+    ASSERT_TRUE(ParseJsonObject(server.HandleLine("{\"id\": \"a\", \"mob_hp\": 60}"), first));
+    ASSERT_EQ(first["id"], "a");
+    ASSERT_EQ(first["cached"], "false");
+    ASSERT_FALSE(first["decision"].empty());
+    ASSERT_GT(server.solved_state.size(), 10);
+    // the same state is answered from the solved states with the same value
+    JsonObject second;
+    ASSERT_TRUE(ParseJsonObject(server.HandleLine("{\"id\": \"b\", \"mob_hp\": 60}"), second));
+    ASSERT_EQ(second["cached"], "true");
+    ASSERT_EQ(second["decision"], first["decision"]);
+    ASSERT_NEAR(atof(second["final_hp"].c_str()), atof(first["final_hp"].c_str()), 1e-9);
+    ASSERT_NEAR(atof(second["death_chance"].c_str()),
+        atof(first["death_chance"].c_str()), 1e-9);
+    ASSERT_EQ(server.hit_count, 1);
+    // a state whose check hash doesn't match isn't answered from the solved
+    // states
+    for (auto & item : server.solved_state) {
+        item.second.check ^= 1;
+    }
+    JsonObject third;
+    ASSERT_TRUE(ParseJsonObject(server.HandleLine("{\"id\": \"c\", \"mob_hp\": 60}"), third));
+    ASSERT_EQ(third["cached"], "false");
+    ASSERT_EQ(third["decision"], first["decision"]);
+    ASSERT_EQ(server.hit_count, 1);
+    // requests in several threads get the same answers as one at a time
+    std::vector<std::string> reply(4);
+    std::vector<std::thread> thread;
+    for (unsigned int i = 0; i < reply.size(); ++i) {
+        thread.push_back(std::thread([&server, &reply, i]() {
+            reply[i] = server.HandleLine(
+                "{\"mob_hp\": " + std::to_string(40 + i) + "}");
+        }));
+    }
+    for (auto & this_thread : thread) {
+        this_thread.join();
+    }
+    for (unsigned int i = 0; i < reply.size(); ++i) {
+        SolveServer this_server(ParseTestServerRequest);
+        JsonObject expected;
+        JsonObject actual;
+        ASSERT_TRUE(ParseJsonObject(this_server.HandleLine(
+            "{\"mob_hp\": " + std::to_string(40 + i) + "}"), expected));
+        ASSERT_TRUE(ParseJsonObject(reply[i], actual));
+        ASSERT_EQ(actual["decision"], expected["decision"]);
+        ASSERT_EQ(actual["final_hp"], expected["final_hp"]);
+    }
+    // bad requests get errors
+    JsonObject error;
+    ASSERT_TRUE(ParseJsonObject(server.HandleLine("not json"), error));
+    ASSERT_FALSE(error["error"].empty());
+    ASSERT_TRUE(ParseJsonObject(server.HandleLine("{\"id\": \"c\"}"), error));
+    ASSERT_EQ(error["id"], "c");
+    ASSERT_EQ(error["error"], "missing mob_hp");
+}
+
+// test the solve server gives targets in the order of the request's mobs
+TEST(TestSolver, TestSolveServerTarget) {
+    SolveServer server([](const JsonObject &, ServerRequest & request, std::string &) {
+        request.node = GetDefaultAttackNode();
+        request.node.hp = 30;
+        request.node.energy = 1;
+        request.node.monster[0] = Monster(base_mob_red_louse);
+        request.node.monster[0].hp = 12;
+        request.node.monster[0].last_intent[0] = 0;
+        request.node.monster[1] = Monster(base_mob_red_louse);
+        request.node.monster[1].hp = 3;
+        request.node.monster[1].last_intent[0] = 0;
+        request.node.draw_pile.AddCard(card_defend, 5);
+        return true;
+    });
+    // (the lice are sorted with the weaker one first, but the reply uses
+    // the request's order)
+    for (int i = 0; i < 2; ++i) {
+        JsonObject reply;
+        ASSERT_TRUE(ParseJsonObject(server.HandleLine("{}"), reply));
+        ASSERT_EQ(reply["card"], card_strike.name);
+        ASSERT_EQ(reply["target"], "1");
+        ASSERT_EQ(reply["cached"], i == 0 ? "false" : "true");
+    }
+}
+
+// test fight requests to the solve server store their solved states
+TEST(TestSolver, TestSolveServerFight) {
+    SolveServer server([](const JsonObject &, ServerRequest & request, std::string &) {
+        request.node.hp = 20;
+        request.node.max_hp = 20;
+        request.node.relics = {0};
+        request.node.deck.Clear();
+        request.node.deck.AddCard(card_strike, 3);
+        request.node.deck.AddCard(card_defend, 2);
+        request.fight_type = kFightTestOneLouse;
+        return true;
+    });
+    JsonObject reply;
+    ASSERT_TRUE(ParseJsonObject(server.HandleLine("{}"), reply));
+    ASSERT_GT(atof(reply["final_hp"].c_str()), 0.0);
+    // (the fight is solved in a tree with one mob slot)
+    ASSERT_GT(server.solved_state.size(), 0);
+}
+
+// test storing results in the solve cache and recalling them
+TEST(TestSolver, TestSolveCache) {
+    std::remove("test_solve_cache.log");
+    std::remove("test_solve_cache.idx");
+    CardCollectionPtr deck;
+    deck.AddCard(card_strike, 5);
+    deck.AddCard(card_bash);
+    RelicStruct relics = {0};
+    std::string key = SolveCache::GetKey(
+        deck, relics, 60, 80, kFightTestOneLouse, false, false);
+    ASSERT_NE(key, SolveCache::GetKey(
+        deck, relics, 61, 80, kFightTestOneLouse, false, false));
+    ASSERT_NE(key, SolveCache::GetKey(
+        deck, relics, 60, 80, kFightTestOneLouse, true, false));
+    SolveCacheResult result = {
+        59.5, 59.25, 0.125, {{0, 0.125}, {60, 0.875}}, {{2, 0.5}, {3, 0.5}}};
+    // (a second cache on the same files stands in for another process)
+    const std::string other_key = SolveCache::GetKey(
+        deck, relics, 62, 80, kFightTestOneLouse, false, false);
+    SolveCacheResult other_result = {61.5, 61.5, 0.0, {{62, 1.0}}, {{1, 1.0}}};
+    {
+        SolveCache cache("test_solve_cache.log", "test_solve_cache.idx");
+        SolveCache other_cache("test_solve_cache.log", "test_solve_cache.idx");
+        SolveCacheResult recalled;
+        ASSERT_FALSE(cache.Lookup(key, recalled));
+        ASSERT_FALSE(other_cache.Lookup(other_key, recalled));
+        cache.Store(key, result);
+        other_cache.Store(other_key, other_result);
+    }
+    // recall from the index, then again after the index is lost
+    for (int i = 0; i < 2; ++i) {
+        SolveCache cache("test_solve_cache.log", "test_solve_cache.idx");
+        SolveCacheResult recalled;
+        ASSERT_TRUE(cache.Lookup(key, recalled));
+        ASSERT_EQ(recalled.objective, result.objective);
+        ASSERT_EQ(recalled.final_hp, result.final_hp);
+        ASSERT_EQ(recalled.death_chance, result.death_chance);
+        ASSERT_EQ(recalled.final_hp_distribution, result.final_hp_distribution);
+        ASSERT_EQ(recalled.turn_distribution, result.turn_distribution);
+        ASSERT_TRUE(cache.Lookup(other_key, recalled));
+        ASSERT_EQ(recalled.objective, other_result.objective);
+        std::remove("test_solve_cache.idx");
+    }
+    std::remove("test_solve_cache.log");
+    std::remove("test_solve_cache.log.lock");
+}
+
+// test the subgame memo keeps values through compaction
+TEST(TestSolver, TestSubgameMemoCompaction) {
+    const std::string filename = "test_subgame_memo.bin";
+    std::remove(filename.c_str());
+    std::remove((filename + ".journal").c_str());
+    const uint64_t count = min_subgame_memo_journal_size + 100;
+    {
+        SubgameMemo memo(filename);
+        std::vector<SubgameMemo::Slot> item;
+        for (uint64_t i = 1; i <= count; ++i) {
+            item.push_back(SubgameMemo::Slot{
+                i * 7919, i, SubgameValue{(double) i, 0, 0}});
+        }
+        ASSERT_EQ(memo.Store(item), count);
+        // stored values were merged into the table
+        ASSERT_TRUE(memo.journal.empty());
+        ASSERT_EQ(memo.Store(item), 0);
+        memo.Store({SubgameMemo::Slot{3, 7, SubgameValue{-1.0, 0, 0}}});
+    }
+    SubgameMemo memo(filename);
+    ASSERT_EQ(memo.Count(), count + 1);
+    SubgameValue value;
+    ASSERT_TRUE(memo.Lookup(5 * 7919, 5, value));
+    ASSERT_EQ(value.objective, 5.0);
+    ASSERT_TRUE(memo.Lookup(3, 7, value));
+    ASSERT_EQ(value.objective, -1.0);
+    ASSERT_FALSE(memo.Lookup(4, 7, value));
+    // a state with the same hash but another check hash isn't found
+    ASSERT_FALSE(memo.Lookup(5 * 7919, 6, value));
+    ASSERT_FALSE(memo.Lookup(3, 8, value));
+    memo.Unload();
+    std::remove(filename.c_str());
+    std::remove((filename + ".journal").c_str());
+    std::remove((filename + ".lock").c_str());
+}
+
+// test a fight recalled from the subgame memo has the same result
+TEST(TestSolver, TestSubgameMemoRecall) {
+    const std::string filename = subgame_memo.filename;
+    subgame_memo.filename = "test_subgame_memo.bin";
+    std::remove(subgame_memo.filename.c_str());
+    std::remove(subgame_memo.GetJournalFilename().c_str());
+    use_subgame_memo = true;
+    Node this_node;
+    this_node.hp = 60;
+    this_node.max_hp = 80;
+    this_node.relics = {0};
+    this_node.deck.AddCard(card_strike, 5);
+    this_node.deck.AddCard(card_defend, 4);
+    this_node.deck.AddCard(card_bash);
+    this_node.InitializeStartingNode();
+    Node recalled_node = this_node;
+    TreeStruct tree(this_node);
+    tree.fight_type = kFightTestOneLouse;
+    tree.ExpandFight();
+    // (a result with recalled subgames isn't stored in the solve cache)
+    const std::string cache_key = SolveCache::GetKey(
+        recalled_node.draw_pile, recalled_node.relics, 60, 80,
+        kFightTestOneLouse, false, false);
+    const std::string log_filename = solve_cache.log_filename;
+    const std::string index_filename = solve_cache.index_filename;
+    solve_cache.log_filename = "test_solve_cache.log";
+    solve_cache.index_filename = "test_solve_cache.idx";
+    std::remove(solve_cache.log_filename.c_str());
+    std::remove(solve_cache.index_filename.c_str());
+    use_solve_cache = true;
+    TreeStruct recalled_tree(recalled_node);
+    recalled_tree.fight_type = kFightTestOneLouse;
+    recalled_tree.ExpandFight();
+    use_solve_cache = false;
+    use_subgame_memo = false;
+    SolveCacheResult cache_result;
+    ASSERT_FALSE(solve_cache.Lookup(cache_key, cache_result));
+    std::remove(solve_cache.log_filename.c_str());
+    std::remove(solve_cache.index_filename.c_str());
+    std::remove((solve_cache.log_filename + ".lock").c_str());
+    solve_cache.log_filename = log_filename;
+    solve_cache.index_filename = index_filename;
+    solve_cache.index.clear();
+    solve_cache.loaded = false;
+    this_node.deck.Clear();
+    ASSERT_GT(subgame_memo.hit_count, 0);
+    ASSERT_NEAR(recalled_node.objective, this_node.objective, 1e-9);
+    ASSERT_NEAR(recalled_tree.final_hp, tree.final_hp, 1e-9);
+    ASSERT_NEAR(recalled_tree.death_chance, tree.death_chance, 1e-9);
+    subgame_memo.Unload();
+    std::remove(subgame_memo.filename.c_str());
+    std::remove(subgame_memo.GetJournalFilename().c_str());
+    std::remove((subgame_memo.filename + ".lock").c_str());
+    subgame_memo.filename = filename;
+}
+
+// test states recalled from a tablebase solve the same as without it
+TEST(TestSolver, TestTablebase) {
+    const std::string filename = "test_tablebase.bin";
+    std::remove(filename.c_str());
+    std::remove((filename + ".journal").c_str());
+    Node template_node;
+    template_node.max_hp = 12;
+    template_node.relics = {0};
+    template_node.deck.Clear();
+    template_node.deck.AddCard(card_strike);
+    template_node.deck.AddCard(card_defend);
+    TablebaseSettings settings;
+    settings.base_mob = &base_mob_red_louse;
+    settings.last_intent = {0};
+    settings.max_mob_hp = 3;
+    settings.max_cards = 2;
+    // 3 mob hps, 12 player hps and 15 ways to split the piles
+    ASSERT_EQ(GenerateTablebase(template_node, settings, filename), 540);
+    template_node.deck.Clear();
+    // the player can only end the turn here, which leads to a state in the
+    // tablebase
+    BasicNode<1> node;
+    node.CopyStateFrom(GetDefaultAttackNode());
+    node.hp = 12;
+    node.max_hp = 12;
+    node.hand.Clear();
+    node.draw_pile.AddCard(card_strike);
+    node.discard_pile.AddCard(card_defend);
+    node.monster[0] = Monster(base_mob_red_louse);
+    node.monster[0].hp = 3;
+    node.monster[0].last_intent[0] = 0;
+    node.objective = node.GetMaxFinalObjective();
+    BasicNode<1> recalled_node;
+    recalled_node.CopyStateFrom(node);
+    BasicTreeStruct<1> tree(node);
+    tree.quiet = true;
+    tree.Expand();
+    const std::string old_filename = tablebase.filename;
+    tablebase.filename = filename;
+    use_tablebase = true;
+    BasicTreeStruct<1> recalled_tree(recalled_node);
+    recalled_tree.quiet = true;
+    recalled_tree.Expand();
+    use_tablebase = false;
+    ASSERT_EQ(recalled_tree.recalled_nodes.size(), 1);
+    ASSERT_NEAR(recalled_node.objective, node.objective, 1e-9);
+    ASSERT_NEAR(recalled_tree.final_hp, tree.final_hp, 1e-9);
+    // a state with the same hash but another check hash isn't recalled
+    const auto & tablebase_node = *recalled_tree.recalled_nodes.begin()->first;
+    const uint64_t hash = tablebase_node.GetCanonicalStateHash();
+    const uint64_t check = tablebase_node.GetCanonicalStateCheckHash();
+    SubgameValue value;
+    ASSERT_TRUE(tablebase.Lookup(hash, check, value));
+    ASSERT_FALSE(tablebase.Lookup(hash, check + 1, value));
+    tablebase.Unload();
+    tablebase.filename = old_filename;
+    std::remove(filename.c_str());
+    std::remove((filename + ".journal").c_str());
+    std::remove((filename + ".lock").c_str());
+}
+
+// test the profiler counts each phase of a solve, or nothing if disabled
+TEST(TestSolver, TestProfiler) {
+    Node this_node;
+    this_node.hp = 20;
+    this_node.max_hp = 20;
+    this_node.relics = {0};
+    this_node.deck.Clear();
+    this_node.deck.AddCard(card_strike, 3);
+    this_node.deck.AddCard(card_defend, 2);
+    this_node.InitializeStartingNode();
+    TreeStruct tree(this_node);
+    tree.fight_type = kFightTestOneLouse;
+    tree.quiet = true;
+    tree.ExpandFight();
+    this_node.deck.Clear();
+    if (!profiler_enabled) {
+        ASSERT_TRUE(tree.profile.IsEmpty());
+        return;
+    }
+    ASSERT_FALSE(tree.profile.IsEmpty());
+    ASSERT_EQ(tree.profile.calls[kProfileOther], 1);
+    ASSERT_EQ(tree.profile.calls[kProfileCreateChild],
+        tree.created_node_count + tree.reused_node_count);
+    ASSERT_GT(tree.profile.calls[kProfileMoveGeneration], 0);
+    // (move generation stops early if it finds a best possible ending)
+    ASSERT_GT(tree.profile.calls[kProfileDominance], 0);
+    ASSERT_LE(tree.profile.calls[kProfileDominance],
+        tree.profile.calls[kProfileMoveGeneration]);
+    ASSERT_GT(tree.profile.calls[kProfilePlayCard], 0);
+    ASSERT_GT(tree.profile.calls[kProfileEndTurn], 0);
+    double total = 0.0;
+    for (int i = 0; i < kProfileFinal; ++i) {
+        total += tree.profile.GetFraction((ProfilePhaseEnum) i);
+    }
+    ASSERT_NEAR(total, 1.0, 1e-9);
+    // the phase is back to none after the solve
+    ASSERT_EQ(profile_phase, kProfileFinal);
+}
+
+TEST(TestSolver, TestMemoryAccounting) {
+    // containers count exactly what they allocate
+    const int64_t frontier_bytes = GetTrackedMemory(kMemoryFrontier);
+    {
+        std::vector<int, TrackedAllocator<int, kMemoryFrontier>> item;
+        item.reserve(100);
+        ASSERT_EQ(GetTrackedMemory(kMemoryFrontier), frontier_bytes + 400);
+    }
+    ASSERT_EQ(GetTrackedMemory(kMemoryFrontier), frontier_bytes);
+    // a tree gives back all of its memory when destroyed
+    const int64_t node_bytes = GetTrackedMemory(kMemoryNodes);
+    const int64_t child_bytes = GetTrackedMemory(kMemoryChildArrays);
+    const int64_t terminal_bytes = GetTrackedMemory(kMemoryTerminalSet);
+    {
+        Node this_node;
+        this_node.hp = 20;
+        this_node.max_hp = 20;
+        this_node.relics = {0};
+        this_node.deck.Clear();
+        this_node.deck.AddCard(card_strike, 3);
+        this_node.deck.AddCard(card_defend, 2);
+        this_node.InitializeStartingNode();
+        TreeStruct tree(this_node);
+        tree.fight_type = kFightTestOneLouse;
+        tree.quiet = true;
+        tree.Expand();
+        ASSERT_GE(GetTrackedMemory(kMemoryNodes),
+            node_bytes + (int64_t) (tree.top_node_ptr->CountNodes() - 1) *
+                (int64_t) sizeof(Node));
+        // the tree's own estimate covers its nodes but not other trees
+        const int64_t tree_bytes = tree.GetTreeMemory();
+        ASSERT_GE(tree_bytes, (int64_t) (tree.top_node_ptr->CountNodes() - 1) *
+            (int64_t) sizeof(Node));
+        {
+            Node other_node;
+            other_node.hp = 20;
+            other_node.max_hp = 20;
+            other_node.relics = {0};
+            other_node.InitializeStartingNode();
+            TreeStruct other_tree(other_node);
+            other_tree.fight_type = kFightTestOneLouse;
+            other_tree.quiet = true;
+            other_tree.Expand();
+            ASSERT_EQ(tree.GetTreeMemory(), tree_bytes);
+        }
+        ASSERT_GT(GetTrackedMemory(kMemoryChildArrays), child_bytes);
+        ASSERT_GT(GetTrackedMemory(kMemoryTerminalSet), terminal_bytes);
+        ASSERT_GT(GetTrackedMemory(kMemoryCardCollections), 0);
+        ASSERT_GT(GetTrackedMemory(kMemoryDrawCache), 0);
+        this_node.deck.Clear();
+    }
+    ASSERT_EQ(GetTrackedMemory(kMemoryNodes), node_bytes);
+    ASSERT_EQ(GetTrackedMemory(kMemoryChildArrays), child_bytes);
+    ASSERT_EQ(GetTrackedMemory(kMemoryTerminalSet), terminal_bytes);
+    ASSERT_GE(GetTrackedMemoryPeak(), GetTrackedMemory());
+}
+
+// test the tree shape stats count every expanded node and are written out
+TEST(TestSolver, TestTreeShape) {
+    const std::string filename =
+        (std::filesystem::temp_directory_path() / "test_tree_shape.json").string();
+    std::remove(filename.c_str());
+    Node this_node;
+    this_node.hp = 20;
+    this_node.max_hp = 20;
+    this_node.relics = {0};
+    this_node.deck.Clear();
+    this_node.deck.AddCard(card_strike, 3);
+    this_node.deck.AddCard(card_defend, 2);
+    this_node.InitializeStartingNode();
+    TreeStruct tree(this_node);
+    tree.fight_type = kFightTestOneLouse;
+    tree.quiet = true;
+    tree.tree_shape_filename = filename;
+    tree.ExpandFight();
+    this_node.deck.Clear();
+    const TreeShapeStats & shape = tree.shape;
+    // every expanded node is counted once, by kind, turn and depth
+    uint64_t expanded = 0;
+    for (auto count : shape.expanded) {
+        expanded += count;
+    }
+    ASSERT_EQ(expanded, tree.expanded_node_count);
+    uint64_t by_turn = 0;
+    for (auto count : shape.expanded_by_turn) {
+        by_turn += count;
+    }
+    ASSERT_EQ(by_turn, expanded);
+    uint64_t by_depth = 0;
+    for (auto count : shape.expanded_by_depth) {
+        by_depth += count;
+    }
+    ASSERT_EQ(by_depth, expanded);
+    ASSERT_EQ(shape.expanded[kShapeBattle], 1);
+    ASSERT_GT(shape.expanded[kShapeDraw], 0);
+    ASSERT_GT(shape.expanded[kShapeIntent], 0);
+    // each decision keeps its surviving endings as children
+    ASSERT_EQ(shape.expanded[kShapeDecision], shape.choice_calls);
+    ASSERT_EQ(shape.children[kShapeDecision], shape.choice_survivors);
+    ASSERT_LE(shape.choice_survivors, shape.choice_endings);
+    ASSERT_GT(shape.pruned[kPruneDominated], 0);
+    ASSERT_GE(shape.GetBranchingFactor(kShapeDraw), 1.0);
+    const std::string json = shape.ToJson();
+    ASSERT_NE(json.find("\"decision\": {\"expanded\": "), std::string::npos);
+    ASSERT_NE(json.find("\"expanded_by_depth\": ["), std::string::npos);
+    std::ifstream file(filename);
+    std::stringstream written;
+    written << file.rdbuf();
+    ASSERT_EQ(written.str(), json);
+    file.close();
+    std::remove(filename.c_str());
+}
+
+TEST(TestSolver, TestTrace) {
+    const std::string filename = "test_trace.json";
+    trace_min_duration_ns = 0;
+    EnableTrace();
+    {
+        Node this_node;
+        this_node.hp = 20;
+        this_node.max_hp = 20;
+        this_node.relics = {0};
+        this_node.deck.Clear();
+        this_node.deck.AddCard(card_strike, 3);
+        this_node.deck.AddCard(card_defend, 2);
+        this_node.InitializeStartingNode();
+        TreeStruct tree(this_node);
+        tree.fight_type = kFightTestOneLouse;
+        tree.quiet = true;
+        tree.Expand();
+        this_node.deck.Clear();
+    }
+    // events of another thread
+    std::thread([]() {
+        TraceScope trace_scope("other_thread");
+    }).join();
+    trace_enabled = false;
+    trace_min_duration_ns = default_trace_min_duration_ns;
+    ASSERT_NE(trace_buffer, nullptr);
+    ASSERT_GT(trace_buffer->event_count.load(), 0);
+    ASSERT_TRUE(WriteTrace(filename));
+    std::ifstream file(filename);
+    const std::string text(
+        (std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+    file.close();
+    std::remove(filename.c_str());
+    ASSERT_EQ(text.find("{\"traceEvents\": ["), 0);
+    ASSERT_NE(text.find("{\"name\": \"expand\", \"ph\": \"X\""), std::string::npos);
+    ASSERT_NE(text.find("\"find_player_choices\""), std::string::npos);
+    ASSERT_NE(text.find("\"update_tree\""), std::string::npos);
+    ASSERT_NE(text.find("\"delete_nodes\""), std::string::npos);
+    // (this thread recorded first, so the other one is thread 2)
+    ASSERT_NE(text.find("\"other_thread\", \"ph\": \"X\", \"pid\": 1, \"tid\": 2"),
+        std::string::npos);
+}